@@ -12,7 +12,16 @@
 #include "util/Params.h"
 #include "util/StringUtils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <limits>
 #include <map>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 
 using namespace std;
@@ -26,7 +35,7 @@ static const double EPSILON = 0.00000000000001;
 * \returns a blank ComputeQValues object
 */
 AssignConfidenceApplication::AssignConfidenceApplication():
-  spectrum_flag_(NULL), iteration_cnt_(0) {
+  spectrum_flag_(NULL), iteration_cnt_(0), target_stream_(NULL), decoy_stream_(NULL) {
 }
 
 /**
@@ -35,6 +44,29 @@ AssignConfidenceApplication::AssignConfidenceApplication():
 AssignConfidenceApplication::~AssignConfidenceApplication() {
 }
 
+/**
+ * Logs how many targets pass the usual FDR thresholds.
+ */
+static void log_fdr_counts(const vector<FLOAT_T>& qvalues, bool peptide_level) {
+  unsigned int fdr1 = 0;
+  unsigned int fdr5 = 0;
+  unsigned int fdr10 = 0;
+  for (vector<FLOAT_T>::const_iterator i = qvalues.begin(); i != qvalues.end(); i++) {
+    if (*i < 0.01) ++fdr1;
+    if (*i < 0.05) ++fdr5;
+    if (*i < 0.10) ++fdr10;
+  }
+  if (peptide_level) {
+    carp(CARP_INFO, "Number of peptides at 1%% FDR = %d.", fdr1);
+    carp(CARP_INFO, "Number of peptides at 5%% FDR = %d.", fdr5);
+    carp(CARP_INFO, "Number of peptides at 10%% FDR = %d.", fdr10);
+  } else {
+    carp(CARP_INFO, "Number of PSMs at 1%% FDR = %d.", fdr1);
+    carp(CARP_INFO, "Number of PSMs at 5%% FDR = %d.", fdr5);
+    carp(CARP_INFO, "Number of PSMs at 10%% FDR = %d.", fdr10);
+  }
+}
+
 /**
  * Generate keys when building a hash on PSMs.
  * http://stackoverflow.com/questions/98153/whats-the-best-hashing-algorithm-to-use-on-a-stl-string-when-using-hash-map/
@@ -56,11 +88,6 @@ int AssignConfidenceApplication::main(int argc, char** argv) {
 }
 
 int AssignConfidenceApplication::main(const vector<string>& input_files) {
-  // Prepare the output files if not in Cascade Search
-  if (spectrum_flag_ == NULL) {
-    output_ = new OutputFiles(this);
-  }
-  
   ESTIMATION_METHOD_T estimation_method;
   string method_param = Params::GetString("estimation-method");
   carp(CARP_INFO, "Estimation method = %s.", method_param.c_str());
@@ -145,6 +172,30 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
     carp(CARP_WARNING, "Sidak adjustment may not be compatible with score: %s", score_param.c_str());
   }
 
+  if (Params::GetBool("columnar")) {
+    bool tab_delimited = true;
+    for (vector<string>::const_iterator i = input_files.begin(); i != input_files.end(); i++) {
+      if (StringUtils::IEndsWith(*i, ".xml") || StringUtils::IEndsWith(*i, ".sqt") ||
+          StringUtils::IEndsWith(*i, ".mzid")) {
+        tab_delimited = false;
+      }
+    }
+    if (spectrum_flag_ != NULL || target_stream_ != NULL) {
+      carp(CARP_DEBUG, "The columnar path is not used in cascade search.");
+    } else if (sidak) {
+      carp(CARP_WARNING, "The \"columnar\" option is ignored when \"sidak\" is set.");
+    } else if (!tab_delimited) {
+      carp(CARP_WARNING, "The \"columnar\" option requires tab-delimited input; ignoring it.");
+    } else {
+      return columnarMain(input_files, estimation_method, score_type, top_match);
+    }
+  }
+
+  // Prepare the output files if not in Cascade Search
+  if (spectrum_flag_ == NULL) {
+    output_ = new OutputFiles(this);
+  }
+
   // Create two match collections, for targets and decoys.
   MatchCollection* target_matches = new MatchCollection();
   map<int, MatchCollection*> decoy_matches; // key is decoy index
@@ -164,20 +215,27 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
                        "corresponding decoy files.", target_path.c_str());
     }
 
-    check_target_decoy_files(target_path, decoy_path);
-
-    if (!FileUtils::Exists(target_path)) {
-      carp(CARP_FATAL, "Target file %s not found", target_path.c_str());
-    } else if (!FileUtils::Exists(decoy_path)) {
-      if (estimation_method == MIXMAX_METHOD) {
-        carp(CARP_FATAL, "Cannot find file %s. Decoy file from separate target-decoy search is "
-                         "required for mix-max q-value calculation", decoy_path.c_str());
+    if (target_stream_ != NULL) {
+      // Matches are read from memory, the file names only label the input.
+      decoy_path = decoy_stream_ != NULL ? target_path + " (decoys)" : "";
+    } else {
+      check_target_decoy_files(target_path, decoy_path);
+
+      if (!FileUtils::Exists(target_path)) {
+        carp(CARP_FATAL, "Target file %s not found", target_path.c_str());
+      } else if (!FileUtils::Exists(decoy_path)) {
+        if (estimation_method == MIXMAX_METHOD) {
+          carp(CARP_FATAL, "Cannot find file %s. Decoy file from separate target-decoy search is "
+                           "required for mix-max q-value calculation", decoy_path.c_str());
+        }
+        carp(CARP_DEBUG, "Decoy file %s not found", decoy_path.c_str());
+        decoy_path = "";
       }
-      carp(CARP_DEBUG, "Decoy file %s not found", decoy_path.c_str());
-      decoy_path = "";
     }
 
-    MatchCollection* match_collection = parser.create(target_path, Params::GetString("protein-database"));
+    MatchCollection* match_collection = target_stream_ != NULL ?
+      parser.create(target_stream_, target_path, Params::GetString("protein-database")) :
+      parser.create(target_path, Params::GetString("protein-database"));
     distinct_matches = match_collection->getHasDistinctMatches();
     if (!match_collection->hasMulitpleDecoys()) {
       avgTdc = false;
@@ -256,7 +314,9 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
     int num_decoy_peptide_skipped = 0;
     
     if (decoy_path != "") {
-      MatchCollection* temp_collection = parser.create(decoy_path, Params::GetString("protein-database"));
+      MatchCollection* temp_collection = decoy_stream_ != NULL ?
+        parser.create(decoy_stream_, decoy_path, Params::GetString("protein-database")) :
+        parser.create(decoy_path, Params::GetString("protein-database"));
       carp(CARP_INFO, "Found %d PSMs in %s.", temp_collection->getMatchTotal(), decoy_path.c_str());
 
       if (temp_collection->hasMulitpleDecoys()) {
@@ -648,29 +708,9 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
       carp(CARP_FATAL, "No estimation method specified.");
   }
 
-  unsigned int fdr1 = 0;
-  unsigned int fdr5 = 0;
-  unsigned int fdr10 = 0;
-  for (vector<FLOAT_T>::const_iterator i = qvalues.begin(); i != qvalues.end(); i++) {
-    if (*i < 0.01) ++fdr1;
-    if (*i < 0.05) ++fdr5;
-    if (*i < 0.10) ++fdr10;
-  }
-  if (estimation_method == PEPTIDE_LEVEL_METHOD) {
-    carp(CARP_INFO, "Number of peptides at 1%% FDR = %d.", fdr1);
-    carp(CARP_INFO, "Number of peptides at 5%% FDR = %d.", fdr5);
-    carp(CARP_INFO, "Number of peptides at 10%% FDR = %d.", fdr10);
-  } else {
-    carp(CARP_INFO, "Number of PSMs at 1%% FDR = %d.", fdr1);
-    carp(CARP_INFO, "Number of PSMs at 5%% FDR = %d.", fdr5);
-    carp(CARP_INFO, "Number of PSMs at 10%% FDR = %d.", fdr10);
-
-  }
-
-  // Store p-values to q-values as a hash, and then assign them.
-  map<FLOAT_T, FLOAT_T> qvalue_hash = store_arrays_as_hash(target_scores, qvalues);
+  log_fdr_counts(qvalues, estimation_method == PEPTIDE_LEVEL_METHOD);
 
-  target_matches->assignQValues(&qvalue_hash, score_type, derived_score_type);
+  target_matches->assignQValues(target_scores, qvalues, score_type, derived_score_type);
 
   // Store targets by score.
   target_matches->sort(score_type);
@@ -714,6 +754,547 @@ int AssignConfidenceApplication::main(const vector<string>& input_files) {
 } // Main
 
 
+/**
+ * A PSM reduced to the columns that q-value estimation needs. The row
+ * itself stays in its input file and is copied to the output by offset.
+ */
+struct ColumnarPsm {
+  FLOAT_T score;
+  uint64_t offset;   ///< byte offset of the row in its input file
+  int source;        ///< index of the input file holding the row
+  int spectrumFile;  ///< interned spectrum file name
+  int scan;
+  int charge;
+  int rank;          ///< xcorr rank, used to pair targets with decoys, or -1
+  int scoreRank;     ///< rank under the score type, used for top-match, or -1
+  int peptide;       ///< interned peptide key, or -1 if not needed
+  int decoyIndex;
+  bool decoy;
+};
+
+/**
+ * Gives each distinct string a small integer id.
+ */
+class StringIds {
+ public:
+  int get(const string& value) {
+    return ids_.insert(make_pair(value, (int)ids_.size())).first->second;
+  }
+ private:
+  unordered_map<string, int> ids_;
+};
+
+/**
+ * Reads a tab-delimited PSM file row by row, splitting only on demand
+ * and recording the offset of each row so it can be read again later.
+ */
+class ColumnarPsmReader {
+ public:
+  explicit ColumnarPsmReader(const string& path)
+    : file_(path.c_str(), ios::in | ios::binary), offset_(0), nextOffset_(0) {
+    if (!file_.good()) {
+      carp(CARP_FATAL, "Could not open %s", path.c_str());
+    }
+    if (!next()) {
+      carp(CARP_FATAL, "%s is empty", path.c_str());
+    }
+    for (size_t i = 0; i < fields_.size(); i++) {
+      header_.push_back(field(i));
+    }
+  }
+
+  const vector<string>& header() const { return header_; }
+
+  /**
+   * \returns the index of the given column, or -1 if the file lacks it.
+   */
+  int column(MATCH_COLUMNS_T col) const {
+    vector<string>::const_iterator i = find(header_.begin(), header_.end(), get_column_header(col));
+    return i != header_.end() ? (int)(i - header_.begin()) : -1;
+  }
+
+  bool next() {
+    offset_ = nextOffset_;
+    if (!getline(file_, line_)) {
+      return false;
+    }
+    nextOffset_ += line_.size() + 1;
+    if (!line_.empty() && line_[line_.size() - 1] == '\r') {
+      line_.erase(line_.size() - 1);
+    }
+    fields_.clear();
+    fields_.push_back(0);
+    for (size_t i = line_.find('\t'); i != string::npos; i = line_.find('\t', i + 1)) {
+      fields_.push_back(i + 1);
+    }
+    return true;
+  }
+
+  uint64_t offset() const { return offset_; }
+
+  bool empty(int col) const {
+    return col < 0 || col >= (int)fields_.size() || fieldEnd(col) == fields_[col];
+  }
+  string field(int col) const {
+    return empty(col) ? string() : line_.substr(fields_[col], fieldEnd(col) - fields_[col]);
+  }
+  FLOAT_T getFloat(int col) const {
+    return empty(col) ? numeric_limits<FLOAT_T>::quiet_NaN() : (FLOAT_T)atof(line_.c_str() + fields_[col]);
+  }
+  int getInteger(int col, int missing) const {
+    return empty(col) ? missing : atoi(line_.c_str() + fields_[col]);
+  }
+
+ private:
+  size_t fieldEnd(int col) const {
+    return col + 1 < (int)fields_.size() ? fields_[col + 1] - 1 : line_.size();
+  }
+
+  ifstream file_;
+  string line_;
+  vector<size_t> fields_;  ///< start of each field in line_
+  vector<string> header_;
+  uint64_t offset_;
+  uint64_t nextOffset_;
+};
+
+/**
+ * \returns the column holding the given score, or INVALID_COL.
+ */
+static MATCH_COLUMNS_T columnar_score_column(SCORER_TYPE_T score_type) {
+  switch (score_type) {
+  case SP: return SP_SCORE_COL;
+  case XCORR: return XCORR_SCORE_COL;
+  case EVALUE: return EVALUE_COL;
+  case PERCOLATOR_SCORE: return PERCOLATOR_SCORE_COL;
+  case TIDE_SEARCH_EXACT_PVAL: return EXACT_PVALUE_COL;
+  case TIDE_SEARCH_REFACTORED_XCORR: return REFACTORED_SCORE_COL;
+  case TIDE_SEARCH_EXACT_SMOOTHED: return ELUTION_WINDOW_COL;
+  case RESIDUE_EVIDENCE_PVAL: return RESIDUE_PVALUE_COL;
+  case RESIDUE_EVIDENCE_SCORE: return RESIDUE_EVIDENCE_COL;
+  case BOTH_PVALUE: return BOTH_PVALUE_COL;
+  case TAILOR_SCORE: return TAILOR_COL;
+  default: return INVALID_COL;
+  }
+}
+
+/**
+ * Reads the PSMs of one tab-delimited file into flat records, detecting
+ * the score type from the first row if it is not yet known.
+ * \returns true if any PSM carries a decoy index above zero.
+ */
+static bool read_columnar_psms(
+  const string& path,
+  int source,
+  bool all_decoys,      ///< label every PSM a decoy, as for a decoy file
+  bool peptide_keys,    ///< fill in ColumnarPsm::peptide
+  SCORER_TYPE_T& score_type,
+  StringIds& spectrum_files,
+  StringIds& peptides,
+  vector<ColumnarPsm>& out
+) {
+  const string decoy_prefix = Params::GetString("decoy-prefix");
+  const bool combine_modified = Params::GetBool("combine-modified-peptides");
+  const bool combine_charges = Params::GetBool("combine-charge-states");
+
+  ColumnarPsmReader reader(path);
+  bool has_row = reader.next();
+
+  if (score_type == INVALID_SCORER_TYPE) {
+    SCORER_TYPE_T score_types[] = {
+      TAILOR_SCORE, XCORR, EVALUE, BOTH_PVALUE, RESIDUE_EVIDENCE_PVAL, RESIDUE_EVIDENCE_SCORE,
+      TIDE_SEARCH_EXACT_PVAL, TIDE_SEARCH_EXACT_SMOOTHED, PERCOLATOR_SCORE
+    };
+    for (size_t i = 0; has_row && i < sizeof(score_types) / sizeof(score_types[0]); i++) {
+      if (!reader.empty(reader.column(columnar_score_column(score_types[i])))) {
+        score_type = score_types[i];
+        carp(CARP_INFO, "Automatically detected score type: %s", scorer_type_to_string(score_type));
+        break;
+      }
+    }
+    if (score_type == INVALID_SCORER_TYPE) {
+      carp(CARP_FATAL, "Could not detect score type. Specify the score type using the \"score\" parameter.");
+    }
+  }
+  MATCH_COLUMNS_T score_col_type = columnar_score_column(score_type);
+  int score_col = score_col_type == INVALID_COL ? -1 : reader.column(score_col_type);
+  if (score_col < 0) {
+    carp(CARP_FATAL, "The PSM feature \"%s\" was not found in file \"%s\".",
+         scorer_type_to_string(score_type), path.c_str());
+  }
+  // main() pairs on Match::getRank(XCORR) but applies top-match to the
+  // rank under the score type.
+  int rank_col = reader.column(XCORR_RANK_COL);
+  int score_rank_col = reader.column(
+    score_type == BOTH_PVALUE ? BOTH_PVALUE_RANK :
+    score_type == RESIDUE_EVIDENCE_PVAL ? RESIDUE_RANK_COL : XCORR_RANK_COL);
+  // MatchFileReader::parse applies top-match-in to the first of these
+  // columns that is empty in the row, so it keeps every row, and it fails
+  // if none is empty.  Do the same, so that both paths see the same PSMs.
+  const int read_rank_cols[] = {
+    reader.column(PERCOLATOR_RANK_COL), reader.column(BOTH_PVALUE_RANK),
+    reader.column(RESIDUE_RANK_COL), reader.column(XCORR_RANK_COL), reader.column(SP_RANK_COL)
+  };
+  int file_col = reader.column(FILE_COL);
+  int scan_col = reader.column(SCAN_COL);
+  int charge_col = reader.column(CHARGE_COL);
+  int protein_col = reader.column(PROTEIN_ID_COL);
+  int decoy_index_col = reader.column(DECOY_INDEX_COL);
+  int sequence_col = reader.column(combine_modified && reader.column(UNMOD_SEQUENCE_COL) >= 0 ?
+                                   UNMOD_SEQUENCE_COL : SEQUENCE_COL);
+
+  bool multiple_decoys = false;
+  for (; has_row; has_row = reader.next()) {
+    bool has_empty_rank = false;
+    for (size_t i = 0; !has_empty_rank && i < sizeof(read_rank_cols) / sizeof(read_rank_cols[0]); i++) {
+      has_empty_rank = reader.empty(read_rank_cols[i]);
+    }
+    if (!has_empty_rank) {
+      carp(CARP_FATAL, "Input file does not contain any reconized rank column.");
+    }
+    ColumnarPsm psm;
+    psm.rank = reader.getInteger(rank_col, -1);
+    psm.scoreRank = reader.getInteger(score_rank_col, -1);
+    psm.score = reader.getFloat(score_col);
+    psm.offset = reader.offset();
+    psm.source = source;
+    psm.spectrumFile = spectrum_files.get(reader.field(file_col));
+    psm.scan = reader.getInteger(scan_col, -1);
+    psm.charge = reader.getInteger(charge_col, -1);
+    psm.decoyIndex = reader.getInteger(decoy_index_col, -1);
+    psm.decoy = all_decoys || StringUtils::StartsWith(reader.field(protein_col), decoy_prefix);
+    multiple_decoys = multiple_decoys || psm.decoyIndex > 0;
+    psm.peptide = -1;
+    if (peptide_keys) {
+      string seq = reader.field(sequence_col);
+      // In cases where the sequence is in X.seq.X format, parse out the seq part
+      if (seq.length() > 4 && seq[1] == '.' && seq[seq.length() - 2] == '.') {
+        seq = seq.substr(2, seq.length() - 4);
+      }
+      if (combine_modified && sequence_col == reader.column(SEQUENCE_COL)) {
+        seq.erase(remove_if(seq.begin(), seq.end(), [](char c) { return !isupper(c); }), seq.end());
+      }
+      if (combine_charges) {
+        seq += StringUtils::ToString(psm.charge);
+      }
+      psm.peptide = peptides.get(seq);
+    }
+    out.push_back(psm);
+  }
+  return multiple_decoys;
+}
+
+/**
+ * Records the best score of each peptide among the given PSMs.
+ */
+static void columnar_peptide_level_filtering(
+  const vector<ColumnarPsm>& psms,
+  vector<FLOAT_T>& best_peptide_score,  ///< NaN where no score is known
+  bool ascending
+) {
+  for (vector<ColumnarPsm>::const_iterator i = psms.begin(); i != psms.end(); i++) {
+    if ((size_t)i->peptide >= best_peptide_score.size()) {
+      best_peptide_score.resize(i->peptide + 1, numeric_limits<FLOAT_T>::quiet_NaN());
+    }
+    FLOAT_T& best = best_peptide_score[i->peptide];
+    if (isnan(best) || (ascending && best > i->score) || (!ascending && i->score > best)) {
+      best = i->score;
+    }
+  }
+}
+
+/**
+ * Estimates q-values from flat records holding only the score, label,
+ * spectrum and peptide of each PSM, and writes the targets by copying
+ * their rows from the input files with the q-value appended.
+ */
+int AssignConfidenceApplication::columnarMain(
+  const vector<string>& input_files,
+  ESTIMATION_METHOD_T estimation_method,
+  SCORER_TYPE_T score_type,
+  int top_match
+) {
+  bool peptide_level = estimation_method == PEPTIDE_LEVEL_METHOD;
+  bool ascending = false;
+  bool avgTdc = estimation_method == TDC_METHOD;
+
+  vector<string> sources;  // files the kept rows are read back from
+  StringIds spectrum_files;
+  StringIds peptides;
+  vector<FLOAT_T> best_peptide_score;
+  vector<ColumnarPsm> targets;
+  map<int, vector<ColumnarPsm> > decoys;  // key is decoy index
+
+  for (vector<string>::const_iterator iter = input_files.begin(); iter != input_files.end(); ++iter) {
+    string target_path = *iter;
+    string decoy_path = *iter;
+
+    if (target_path.find("decoy") != string::npos) {
+      carp(CARP_FATAL, "%s appears to be a decoy file. Only target or concatenated files "
+                       "should be given to assign-confidence because it automatically searches for "
+                       "corresponding decoy files.", target_path.c_str());
+    }
+    check_target_decoy_files(target_path, decoy_path);
+    if (!FileUtils::Exists(target_path)) {
+      carp(CARP_FATAL, "Target file %s not found", target_path.c_str());
+    } else if (!FileUtils::Exists(decoy_path)) {
+      if (estimation_method == MIXMAX_METHOD) {
+        carp(CARP_FATAL, "Cannot find file %s. Decoy file from separate target-decoy search is "
+                         "required for mix-max q-value calculation", decoy_path.c_str());
+      }
+      carp(CARP_DEBUG, "Decoy file %s not found", decoy_path.c_str());
+      decoy_path = "";
+    }
+
+    vector<ColumnarPsm> psms;
+    sources.push_back(target_path);
+    if (!read_columnar_psms(target_path, sources.size() - 1, false, peptide_level,
+                            score_type, spectrum_files, peptides, psms)) {
+      avgTdc = false;
+    }
+    carp(CARP_INFO, "Found %d PSMs in %s.", psms.size(), target_path.c_str());
+
+    switch (getDirection(score_type)) {
+      case -1:
+        ascending = false;
+        break;
+      case 1:
+        ascending = true;
+        break;
+      default:
+        carp(CARP_FATAL, "Cannot infer sort order for score %s.", scorer_type_to_string(score_type));
+    }
+
+    // Find and keep the best score for each peptide.
+    if (peptide_level) {
+      columnar_peptide_level_filtering(psms, best_peptide_score, ascending);
+    }
+
+    int num_target_rank_skipped = 0;
+    int num_decoy_rank_skipped = 0;
+    int num_target_peptide_skipped = 0;
+    int num_decoy_peptide_skipped = 0;
+
+    if (!decoy_path.empty()) {
+      vector<ColumnarPsm> decoy_psms;
+      sources.push_back(decoy_path);
+      bool multiple_decoys = read_columnar_psms(decoy_path, sources.size() - 1, true, peptide_level,
+                                                score_type, spectrum_files, peptides, decoy_psms);
+      carp(CARP_INFO, "Found %d PSMs in %s.", decoy_psms.size(), decoy_path.c_str());
+
+      if (multiple_decoys) {
+        avgTdc = true;
+        psms.insert(psms.end(), decoy_psms.begin(), decoy_psms.end());
+      } else {
+        // key = (file, scan, charge, rank); value = index of the first such decoy
+        map<boost::tuple<int, int, int, int>, size_t> pairidx;
+        for (size_t i = 0; i < decoy_psms.size(); i++) {
+          const ColumnarPsm& decoy = decoy_psms[i];
+          if (decoy.rank > top_match) {
+            num_decoy_rank_skipped++;
+            continue;
+          }
+          if (estimation_method == MIXMAX_METHOD) {
+            // Put the decoy directly in the final set, because no TDC.
+            decoys[decoy.decoyIndex].push_back(decoy);
+          } else {
+            pairidx.insert(make_pair(
+              boost::make_tuple(decoy.spectrumFile, decoy.scan, decoy.charge, decoy.rank), i));
+          }
+        }
+
+        // Find and keep the best score for each decoy peptide.
+        if (peptide_level) {
+          columnar_peptide_level_filtering(decoy_psms, best_peptide_score, ascending);
+        }
+
+        if (estimation_method != MIXMAX_METHOD) {
+          int numCompetitions = 0;
+          int numLostDecoys = 0;
+          int numTies = 0;
+          vector<ColumnarPsm> tdc_psms;
+          for (vector<ColumnarPsm>::const_iterator i = psms.begin(); i != psms.end(); i++) {
+            if (i->rank > top_match) {
+              num_target_rank_skipped++;
+              continue;
+            }
+            map<boost::tuple<int, int, int, int>, size_t>::const_iterator decoy_idx =
+              pairidx.find(boost::make_tuple(i->spectrumFile, i->scan, i->charge, i->rank));
+            if (decoy_idx == pairidx.end()) {
+              numLostDecoys++;
+              tdc_psms.push_back(*i);
+              continue;
+            }
+            const ColumnarPsm& decoy = decoy_psms[decoy_idx->second];
+            if (peptide_level) {
+              tdc_psms.push_back(*i);
+              tdc_psms.push_back(decoy);
+              continue;
+            }
+            // This is where the target-decoy competition happens.
+            FLOAT_T score_difference = i->score - decoy.score;
+            numCompetitions++;
+            // Randomly break ties.
+            if (fabs(score_difference) < 1e-10) {
+              numTies++;
+              score_difference += 0.5 - ((double)myrandom() / UNIFORM_INT_DISTRIBUTION_MAX);
+            }
+            if (ascending) { // smaller scores are better
+              score_difference *= -1.0;
+            }
+            tdc_psms.push_back(score_difference >= 0.0 ? *i : decoy);
+          }
+          psms.swap(tdc_psms);
+          if (numCompetitions > 0) {
+            carp(CARP_INFO, "Randomly broke %d ties in %d target-decoy competitions.", numTies, numCompetitions);
+          }
+          if (numLostDecoys > 0) {
+            carp(CARP_INFO, "Failed to find %d decoys.", numLostDecoys);
+          }
+        }
+      }
+    }
+
+    // Gather the PSMs into targets and decoys.
+    for (vector<ColumnarPsm>::const_iterator i = psms.begin(); i != psms.end(); i++) {
+      if (i->scoreRank > top_match) {
+        (i->decoy ? num_decoy_rank_skipped : num_target_rank_skipped)++;
+        continue;
+      }
+      if (peptide_level && (size_t)i->peptide < best_peptide_score.size() &&
+          !isnan(best_peptide_score[i->peptide])) {
+        FLOAT_T& best = best_peptide_score[i->peptide];
+        if (best != i->score) {  // not the best scoring peptide
+          (i->decoy ? num_decoy_peptide_skipped : num_target_peptide_skipped)++;
+          continue;
+        }
+        best += ascending ? -1.0 : 1.0;  // make sure only one best scoring peptide reported.
+      }
+      if (i->decoy) {
+        decoys[i->decoyIndex].push_back(*i);
+      } else {
+        targets.push_back(*i);
+      }
+    }
+    if (num_decoy_rank_skipped + num_target_rank_skipped > 0) {
+      carp(CARP_INFO, "Skipped %d target and %d decoy PSMs with rank > %d.",
+           num_target_rank_skipped, num_decoy_rank_skipped, top_match);
+    }
+    if (num_target_peptide_skipped + num_decoy_peptide_skipped > 0) {
+      carp(CARP_INFO, "Skipped %d target and %d decoy PSMs due to peptide-level filtering.",
+           num_target_peptide_skipped, num_decoy_peptide_skipped);
+    }
+  }
+
+  // Compute q-values.
+  vector<FLOAT_T> target_scores;
+  vector<FLOAT_T> qvalues;
+  if (avgTdc) {
+    carp(CARP_INFO, "Using a-TDC (%d decoy sets).", decoys.size());
+    vector<AtdcScoreSet::PsmScore> target_keys;
+    for (vector<ColumnarPsm>::const_iterator i = targets.begin(); i != targets.end(); i++) {
+      target_keys.push_back(boost::make_tuple(i->score, i->spectrumFile, i->scan, i->charge));
+    }
+    vector< vector<AtdcScoreSet::PsmScore> > decoy_keys;
+    for (map<int, vector<ColumnarPsm> >::const_iterator i = decoys.begin(); i != decoys.end(); i++) {
+      decoy_keys.push_back(vector<AtdcScoreSet::PsmScore>());
+      for (vector<ColumnarPsm>::const_iterator j = i->second.begin(); j != i->second.end(); j++) {
+        decoy_keys.back().push_back(boost::make_tuple(j->score, j->spectrumFile, j->scan, j->charge));
+      }
+    }
+    vector< vector<FLOAT_T> > decoy_scores;
+    AtdcScoreSet::getScores(target_keys, decoy_keys, ascending, target_scores, decoy_scores);
+    qvalues = AtdcScoreSet(target_scores, decoy_scores, ascending).fdps();
+    convert_fdr_to_qvalue(qvalues, true);
+  } else {
+    vector<FLOAT_T> decoy_scores;
+    for (vector<ColumnarPsm>::const_iterator i = targets.begin(); i != targets.end(); i++) {
+      target_scores.push_back(i->score);
+    }
+    for (map<int, vector<ColumnarPsm> >::const_iterator i = decoys.begin(); i != decoys.end(); i++) {
+      for (vector<ColumnarPsm>::const_iterator j = i->second.begin(); j != i->second.end(); j++) {
+        decoy_scores.push_back(j->score);
+      }
+    }
+    carp(CARP_INFO, "There are %d target and %d decoy PSMs for q-value computation.",
+         target_scores.size(), decoy_scores.size());
+    qvalues = estimation_method == MIXMAX_METHOD ?
+      compute_decoy_qvalues_mixmax(target_scores, decoy_scores, ascending, Params::GetDouble("pi-zero")) :
+      compute_decoy_qvalues_tdc(target_scores, decoy_scores, ascending, 1.0);
+  }
+  decoys.clear();
+  log_fdr_counts(qvalues, peptide_level);
+
+  // Store targets by score, best first.
+  stable_sort(targets.begin(), targets.end(), [ascending](const ColumnarPsm& x, const ColumnarPsm& y) {
+    return ascending ? Match::ScoreLess(x.score, y.score) : Match::ScoreGreater(x.score, y.score);
+  });
+  vector<FLOAT_T> row_scores;
+  row_scores.reserve(targets.size());
+  for (vector<ColumnarPsm>::const_iterator i = targets.begin(); i != targets.end(); i++) {
+    row_scores.push_back(i->score);
+  }
+  vector<FLOAT_T> row_qvalues = MatchCollection::lookupQValues(target_scores, qvalues, row_scores);
+  row_scores.clear();
+
+  // The output keeps the columns of the first file; rows from files with
+  // another layout are rearranged to match.
+  MATCH_COLUMNS_T qvalue_col = estimation_method == MIXMAX_METHOD ? QVALUE_MIXMAX_COL : QVALUE_TDC_COL;
+  vector<string> out_header = ColumnarPsmReader(sources.front()).header();
+  out_header.erase(remove(out_header.begin(), out_header.end(),
+                          string(get_column_header(qvalue_col))), out_header.end());
+  vector<ifstream*> source_files(sources.size(), NULL);
+  vector< vector<int> > source_columns(sources.size());
+
+  string out_path = make_file_path(getFileStem() + ".target.txt");
+  ofstream* out_file = create_stream_in_path(out_path.c_str(), NULL, Params::GetBool("overwrite"));
+  if (!out_file->good()) {
+    carp(CARP_FATAL, "Could not open %s for writing", out_path.c_str());
+  }
+  ofstream& out = *out_file;
+  for (vector<string>::const_iterator i = out_header.begin(); i != out_header.end(); i++) {
+    out << *i << '\t';
+  }
+  out << get_column_header(qvalue_col) << '\n';
+
+  int precision = Params::GetInt("precision");
+  string line;
+  for (size_t i = 0; i < targets.size(); i++) {
+    int source = targets[i].source;
+    if (source_files[source] == NULL) {
+      ColumnarPsmReader layout(sources[source]);
+      for (vector<string>::const_iterator j = out_header.begin(); j != out_header.end(); j++) {
+        vector<string>::const_iterator k = find(layout.header().begin(), layout.header().end(), *j);
+        source_columns[source].push_back(
+          k != layout.header().end() ? (int)(k - layout.header().begin()) : -1);
+      }
+      source_files[source] = new ifstream(sources[source].c_str(), ios::in | ios::binary);
+    }
+    ifstream& in = *source_files[source];
+    in.clear();
+    in.seekg(targets[i].offset);
+    getline(in, line);
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+    vector<string> fields = StringUtils::Split(line, '\t');
+    const vector<int>& columns = source_columns[source];
+    for (vector<int>::const_iterator j = columns.begin(); j != columns.end(); j++) {
+      if (*j >= 0 && *j < (int)fields.size()) {
+        out << fields[*j];
+      }
+      out << '\t';
+    }
+    out << StringUtils::ToString(row_qvalues[i], precision, false) << '\n';
+  }
+  for (vector<ifstream*>::const_iterator i = source_files.begin(); i != source_files.end(); i++) {
+    delete *i;
+  }
+  delete out_file;
+  carp(CARP_INFO, "Wrote %d target PSMs to %s.", targets.size(), out_path.c_str());
+  return 0;
+}
+
 /**
 * Find the best-scoring match for each peptide in a given collection.
 * Only consider the top-ranked PSM per spectrum.
@@ -817,19 +1398,52 @@ void AssignConfidenceApplication::convert_fdr_to_qvalue(
   }
 }
 
+// <file, scan, charge> of a PSM, packed so that the keys sort like
+// the tuple does, and the index of the PSM
+struct AtdcKey {
+  AtdcKey(int file, int scan, int charge, size_t psm):
+    spectrum(((uint64_t)((uint32_t)file ^ 0x80000000u) << 32) | ((uint32_t)scan ^ 0x80000000u)),
+    charge(charge), idx(psm) {}
+  bool sameKey(const AtdcKey& other) const {
+    return spectrum == other.spectrum && charge == other.charge;
+  }
+  bool keyBefore(const AtdcKey& other) const {
+    return spectrum != other.spectrum ? spectrum < other.spectrum : charge < other.charge;
+  }
+  bool operator <(const AtdcKey& other) const {
+    return sameKey(other) ? idx < other.idx : keyBefore(other);
+  }
+
+  uint64_t spectrum;
+  int charge;
+  size_t idx;
+};
+
 /**
- * Store two parallel arrays of floats in a hash table.
+ * \returns The number of threads for ATDC, from num-threads.
  */
-map<FLOAT_T, FLOAT_T> AssignConfidenceApplication::store_arrays_as_hash(
-  const vector<FLOAT_T>& keys,
-  const vector<FLOAT_T>& values
-) {
-  map<FLOAT_T, FLOAT_T> return_value;
-  for (size_t i = 0; i < keys.size(); i++) {
-    carp(CARP_DETAILED_DEBUG, "%g maps to %g", keys[i], values[i]);
-    return_value[keys[i]] = values[i];
+static int atdc_threads() {
+  int numThreads = Params::GetInt("num-threads");
+  if (numThreads < 1) {
+    numThreads = max(1, (int)thread::hardware_concurrency());
+  }
+  return numThreads;
+}
+
+/**
+ * Runs worker on up to num-threads threads, this one included, with no
+ * more threads than tasks.
+ */
+static void run_atdc_workers(const function<void()>& worker, size_t tasks) {
+  int numThreads = (int)min((size_t)atdc_threads(), tasks);
+  vector<thread> threads;
+  for (int i = 1; i < numThreads; i++) {
+    threads.push_back(thread(worker));
+  }
+  worker();
+  for (vector<thread>::iterator i = threads.begin(); i != threads.end(); i++) {
+    i->join();
   }
-  return return_value;
 }
 
 AssignConfidenceApplication::AtdcScoreSet::AtdcScoreSet(
@@ -863,10 +1477,7 @@ void AssignConfidenceApplication::AtdcScoreSet::getScores(
   vector<FLOAT_T>& outTargetScores,
   vector< vector<FLOAT_T> >& outDecoyScores
 ) {
-  outTargetScores.clear();
-  outDecoyScores.clear();
-
-  vector< boost::tuple<FLOAT_T, int, int, int> > targetScores; // score, file, scan, charge
+  vector<PsmScore> targetScores;
   for (MatchIterator i(targets, scoreType, false); i.hasNext(); ) {
     Match* match = i.next();
     targetScores.push_back(boost::make_tuple(
@@ -876,51 +1487,101 @@ void AssignConfidenceApplication::AtdcScoreSet::getScores(
       match->getCharge()));
   }
 
+  vector< vector<PsmScore> > decoyScores;
+  for (map<int, MatchCollection*>::const_iterator i = decoys.begin(); i != decoys.end(); i++) {
+    decoyScores.push_back(vector<PsmScore>());
+    for (MatchIterator j(i->second, scoreType, false); j.hasNext(); ) {
+      Match* match = j.next();
+      decoyScores.back().push_back(boost::make_tuple(
+        match->getScore(scoreType),
+        match->getFileIndex(),
+        match->getSpectrum()->getFirstScan(),
+        match->getCharge()));
+    }
+  }
+
+  getScores(targetScores, decoyScores, ascending, outTargetScores, outDecoyScores);
+}
+
+void AssignConfidenceApplication::AtdcScoreSet::getScores(
+  vector<PsmScore>& targetScores,
+  const vector< vector<PsmScore> >& decoys,
+  bool ascending,
+  vector<FLOAT_T>& outTargetScores,
+  vector< vector<FLOAT_T> >& outDecoyScores
+) {
+  outTargetScores.clear();
+  outDecoyScores.clear();
+
   if (ascending) {
     sort(targetScores.begin(), targetScores.end(), sortScoresAsc);
   } else {
     sort(targetScores.begin(), targetScores.end(), sortScoresDesc);
   }
 
-  map< boost::tuple<int, int, int>, pair<size_t, size_t> > idxMap; // <file, scan, charge> -> <idx, decoys found>
+  // Targets and decoys are paired by joining their keys sorted on
+  // <file, scan, charge>, each decoy set on its own thread.
+  vector<AtdcKey> targetKeys;
+  targetKeys.reserve(targetScores.size());
   for (size_t i = 0; i < targetScores.size(); i++) {
     const boost::tuple<FLOAT_T, int, int, int>& score = targetScores[i];
     outTargetScores.push_back(score.get<0>());
-    int file = score.get<1>();
-    int scan = score.get<2>();
-    int charge = score.get<3>();
-    boost::tuple<int, int, int> idxKey = boost::make_tuple(file, scan, charge);
-    if (!idxMap.insert(make_pair(idxKey, make_pair(i, 0))).second) {
-      carp(CARP_FATAL, "Multiple target scores found for file %d, scan %d, charge %d", file, scan, charge);
+    targetKeys.push_back(AtdcKey(score.get<1>(), score.get<2>(), score.get<3>(), i));
+  }
+  sort(targetKeys.begin(), targetKeys.end());
+  for (size_t i = 1; i < targetKeys.size(); i++) {
+    if (targetKeys[i].sameKey(targetKeys[i - 1])) {
+      const PsmScore& score = targetScores[targetKeys[i].idx];
+      carp(CARP_FATAL, "Multiple target scores found for file %d, scan %d, charge %d",
+           score.get<1>(), score.get<2>(), score.get<3>());
     }
   }
 
-  for (map<int, MatchCollection*>::const_iterator i = decoys.begin(); i != decoys.end(); i++) {
-    outDecoyScores.push_back(vector<FLOAT_T>(outTargetScores.size(), numeric_limits<FLOAT_T>::quiet_NaN()));
-    for (MatchIterator j(i->second, scoreType, false); j.hasNext(); ) {
-      Match* match = j.next();
-      boost::tuple<int, int, int> idxKey = boost::make_tuple(
-        match->getFileIndex(), match->getSpectrum()->getFirstScan(), match->getCharge());
-      map< boost::tuple<int, int, int>, pair<size_t, size_t> >::iterator k = idxMap.find(idxKey);
-      if (k != idxMap.end()) {
-        k->second.second++;
-        outDecoyScores.back()[k->second.first] = match->getScore(scoreType);
+  outDecoyScores.resize(decoys.size(),
+    vector<FLOAT_T>(outTargetScores.size(), numeric_limits<FLOAT_T>::quiet_NaN()));
+  vector< atomic<int> > decoysFound(targetKeys.size()); // by position in targetKeys
+  atomic<size_t> nextSet(0);
+  auto worker = [&]() {
+    size_t set;
+    while ((set = nextSet++) < decoys.size()) {
+      const vector<PsmScore>& decoyScores = decoys[set];
+      vector<AtdcKey> decoyKeys;
+      decoyKeys.reserve(decoyScores.size());
+      for (size_t i = 0; i < decoyScores.size(); i++) {
+        const PsmScore& score = decoyScores[i];
+        decoyKeys.push_back(AtdcKey(score.get<1>(), score.get<2>(), score.get<3>(), i));
+      }
+      // a repeated decoy key sorts in input order, so the last score is kept
+      sort(decoyKeys.begin(), decoyKeys.end());
+      vector<FLOAT_T>& out = outDecoyScores[set];
+      vector<AtdcKey>::const_iterator target = targetKeys.begin();
+      for (vector<AtdcKey>::const_iterator i = decoyKeys.begin(); i != decoyKeys.end(); i++) {
+        while (target != targetKeys.end() && target->keyBefore(*i)) {
+          ++target;
+        }
+        if (target == targetKeys.end()) {
+          break;
+        }
+        if (target->sameKey(*i)) {
+          decoysFound[target - targetKeys.begin()]++;
+          out[target->idx] = decoyScores[i->idx].get<0>();
+        }
       }
     }
-  }
+  };
+  run_atdc_workers(worker, decoys.size());
 
-  for (map< boost::tuple<int, int, int>, pair<size_t, size_t> >::const_iterator i = idxMap.begin();
-       i != idxMap.end();
-       i++) {
-    size_t decoysFound = i->second.second;
-    if (decoys.size() > decoysFound) {
+  for (size_t i = 0; i < targetKeys.size(); i++) {
+    const PsmScore& score = targetScores[targetKeys[i].idx];
+    size_t found = decoysFound[i];
+    if (decoys.size() > found) {
       carp(CARP_FATAL, "Missing %d decoy scores for file %d, scan %d, charge %d (expected %d, found %d)",
-           decoys.size() - decoysFound, i->first.get<0>(), i->first.get<1>(), i->first.get<2>(),
-           decoys.size(), decoysFound);
-    } else if (decoysFound > decoys.size()) {
+           decoys.size() - found, score.get<1>(), score.get<2>(), score.get<3>(),
+           decoys.size(), found);
+    } else if (found > decoys.size()) {
       carp(CARP_FATAL, "Found %d extra decoy scores for file %d, scan %d, charge %d (expectede %d, found %d)",
-           decoysFound - decoys.size(), i->first.get<0>(), i->first.get<1>(), i->first.get<2>(),
-           decoys.size(), decoysFound);
+           found - decoys.size(), score.get<1>(), score.get<2>(), score.get<3>(),
+           decoys.size(), found);
     }
   }
 }
@@ -930,28 +1591,60 @@ vector<FLOAT_T> AssignConfidenceApplication::AtdcScoreSet::fdps() const {
   const size_t numDecoySets = scores_.front().second.size();
   const FLOAT_T bc1 = -1/(FLOAT_T)numDecoySets;
 
+  // Ties are broken at random in the order of a serial pass over the
+  // decoy sets, so the result does not depend on the number of threads.
   vector<size_t> optIdxCnt(numScores, 0);
-  vector<FLOAT_T> sumNtds(numScores, 0);
-  vector<FLOAT_T> sumNdds(numScores, 0);
+  vector< vector<bool> > targetBetter(numDecoySets, vector<bool>(numScores));
   for (size_t i = 0; i < numDecoySets; i++) {
-    vector<int> ntds(numScores, 0);
-    vector<int> ndds(numScores, 0);
     for (size_t j = 0; j < numScores; j++) {
       FLOAT_T scoreTarget = scores_[j].first;
       FLOAT_T scoreDecoy = scores_[j].second[i];
-      bool targetBetter = scoreTarget != scoreDecoy ? scoreTarget < scoreDecoy : myrandom_limit(2) == 0;
-      if (targetBetter) {
+      if (scoreTarget != scoreDecoy ? scoreTarget < scoreDecoy : myrandom_limit(2) == 0) {
+        targetBetter[i][j] = true;
         optIdxCnt[j]++;
-        histBin(ntds, scoreTarget);
-      } else {
-        histBin(ndds, scoreDecoy);
       }
     }
+  }
 
-    int ntdsTotal = 0, nddsTotal = 0;
-    for (size_t j = 0; j < numScores; j++) {
-      sumNtds[j] += (ntdsTotal += ntds[j]);
-      sumNdds[j] += (nddsTotal += ndds[j]);
+  // Each decoy set is binned on its own thread; the cumulative counts
+  // are then added in set order, as the serial loop did.
+  const size_t batchSize = min((size_t)atdc_threads(), numDecoySets);
+  vector< vector<int> > ntds(batchSize, vector<int>(numScores));
+  vector< vector<int> > ndds(batchSize, vector<int>(numScores));
+  vector<FLOAT_T> sumNtds(numScores, 0);
+  vector<FLOAT_T> sumNdds(numScores, 0);
+  for (size_t first = 0; first < numDecoySets; first += batchSize) {
+    const size_t batch = min(batchSize, numDecoySets - first);
+    atomic<size_t> next(0);
+    auto worker = [&]() {
+      size_t b;
+      while ((b = next++) < batch) {
+        size_t i = first + b;
+        vector<int>& setNtds = ntds[b];
+        vector<int>& setNdds = ndds[b];
+        fill(setNtds.begin(), setNtds.end(), 0);
+        fill(setNdds.begin(), setNdds.end(), 0);
+        for (size_t j = 0; j < numScores; j++) {
+          if (targetBetter[i][j]) {
+            histBin(setNtds, scores_[j].first);
+          } else {
+            histBin(setNdds, scores_[j].second[i]);
+          }
+        }
+        int ntdsTotal = 0, nddsTotal = 0;
+        for (size_t j = 0; j < numScores; j++) {
+          setNtds[j] = (ntdsTotal += setNtds[j]);
+          setNdds[j] = (nddsTotal += setNdds[j]);
+        }
+      }
+    };
+    run_atdc_workers(worker, batch);
+
+    for (size_t b = 0; b < batch; b++) {
+      for (size_t j = 0; j < numScores; j++) {
+        sumNtds[j] += ntds[b][j];
+        sumNdds[j] += ndds[b][j];
+      }
     }
   }
 
@@ -1042,12 +1735,15 @@ vector<FLOAT_T> AssignConfidenceApplication::AtdcScoreSet::fdps() const {
 
 void AssignConfidenceApplication::AtdcScoreSet::histBin(vector<int>& hist, FLOAT_T x) const {
   // the value x is in the nth bin if edges[n] < x <= edges[n+1]
-  // edges are [-inf, <target scores...>]
-  for (size_t i = 0; i < scores_.size(); i++) {
-    if (x <= scores_[i].first) {
-      hist[i]++;
-      return;
-    }
+  // edges are [-inf, <target scores...>], which are sorted
+  if (std::isnan(x)) {
+    return;
+  }
+  vector< pair<FLOAT_T, vector<FLOAT_T> > >::const_iterator i = lower_bound(
+    scores_.begin(), scores_.end(), x,
+    [](const pair<FLOAT_T, vector<FLOAT_T> >& edge, FLOAT_T value) { return edge.first < value; });
+  if (i != scores_.end()) {
+    hist[i - scores_.begin()]++;
   }
 }
 
@@ -1324,6 +2020,11 @@ void AssignConfidenceApplication::setFinalIteration(bool is_final) {
   is_final_ = is_final;
 }
 
+void AssignConfidenceApplication::setInputStreams(istream* target_stream, istream* decoy_stream) {
+  target_stream_ = target_stream;
+  decoy_stream_ = decoy_stream;
+}
+
 unsigned int AssignConfidenceApplication::getAcceptedPSMs() {
   return accepted_psms_;
 }
@@ -1464,6 +2165,8 @@ vector<string> AssignConfidenceApplication::getOptions() const {
     "list-of-files",
     "combine-charge-states",
     "combine-modified-peptides",
+    "columnar",
+    "num-threads",
     "fileroot"
   };
   return vector<string>(arr, arr + sizeof(arr) / sizeof(string));
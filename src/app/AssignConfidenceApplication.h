@@ -46,9 +46,13 @@ class AssignConfidenceApplication : public CruxApplication {
   unsigned int accepted_psms_;
   string index_name_;
   bool is_final_;
+  std::istream* target_stream_;  // in-memory search results passed by Cascade Search
+  std::istream* decoy_stream_;
 
   class AtdcScoreSet {
    public:
+    typedef boost::tuple<FLOAT_T, int, int, int> PsmScore; // score, file, scan, charge
+
     AtdcScoreSet(
       const std::vector<FLOAT_T>& targetScores,
       const std::vector< std::vector<FLOAT_T> >& decoyScores,
@@ -60,6 +64,12 @@ class AssignConfidenceApplication : public CruxApplication {
       bool ascending,
       std::vector<FLOAT_T>& outTargetScores,
       std::vector< std::vector<FLOAT_T> >& outDecoyScores);
+    static void getScores(
+      std::vector<PsmScore>& targets,
+      const std::vector< std::vector<PsmScore> >& decoys,
+      bool ascending,
+      std::vector<FLOAT_T>& outTargetScores,
+      std::vector< std::vector<FLOAT_T> >& outDecoyScores);
     std::vector<FLOAT_T> fdps() const;
    private:
     void histBin(std::vector<int>& hist, FLOAT_T x) const;
@@ -76,6 +86,16 @@ class AssignConfidenceApplication : public CruxApplication {
     std::vector< std::pair<FLOAT_T, std::vector<FLOAT_T> > > scores_; // <target score, [decoy scores]>
   };
 
+  /**
+  * Estimates q-values from flat arrays of the few columns needed, and
+  * writes targets by copying their input rows.
+  */
+  int columnarMain(
+    const std::vector<std::string>& input_files,
+    ESTIMATION_METHOD_T estimation_method,
+    SCORER_TYPE_T score_type,
+    int top_match);
+
  public:
   map<pair<string, unsigned int>, bool>* getSpectrumFlag();
   void setSpectrumFlag(map<pair<string, unsigned int>, bool>* spectrum_flag);
@@ -94,6 +114,12 @@ class AssignConfidenceApplication : public CruxApplication {
   */
   void setFinalIteration(bool is_final);
 
+  /**
+  * Reads the tab-delimited target and decoy PSMs from the given streams
+  * instead of from files. The decoy stream may be NULL.
+  */
+  void setInputStreams(std::istream* target_stream, std::istream* decoy_stream);
+
   /**
   * \returns a blank ComputeQValues object
   */
@@ -177,9 +203,6 @@ class AssignConfidenceApplication : public CruxApplication {
     std::vector<FLOAT_T>& qvalues, 
     bool ascending); ///< Come in as FDRs, go out as q-values.
 
-  map<FLOAT_T, FLOAT_T> store_arrays_as_hash(
-    const std::vector<FLOAT_T>& keys,
-    const std::vector<FLOAT_T>& values);
   std::vector<FLOAT_T> compute_decoy_qvalues_tdc(
     std::vector<FLOAT_T>& target_scores,
     std::vector<FLOAT_T>& decoy_scores,
@@ -190,6 +213,8 @@ class AssignConfidenceApplication : public CruxApplication {
     std::vector<FLOAT_T>& decoy_scores,
     bool ascending,
     FLOAT_T pi_zero);
+
+  friend class AssignConfidenceTest;
 };
 
 #endif //ASSIGNCONFIDENCE_H
@@ -40,20 +40,33 @@ int CascadeSearchApplication::main(int argc, char** argv) {
   vector<string> database_indices = StringUtils::Split(database_string, ',');
   OutputFiles* output = new OutputFiles(this);
 
-  int return_code;
+  // The spectra are converted to spectrumrecords only once, by the first
+  // search, and reused by all later rounds of the cascade.
+  vector<TideSearchApplication::InputFile> spectrum_files;
+
+  int return_code = 0;
   for (unsigned int cascade_cnt = 0; cascade_cnt < database_indices.size(); ++cascade_cnt) {
 
-    //carry out tide-search
+    //carry out tide-search, spectra accepted in earlier rounds are skipped
     TideSearchApplication TideSearchProgram;
     TideSearchProgram.setSpectrumFlag(spectrum_flag);
+    TideSearchProgram.setResultsToMemory(true);
+    TideSearchProgram.setDeleteSpectrumRecords(false);
+    if (!spectrum_files.empty()) {
+      TideSearchProgram.setSpectrumFiles(spectrum_files);
+    }
     return_code = TideSearchProgram.main(Params::GetStrings("tide spectra file"), database_indices[cascade_cnt]);
     if (return_code != 0) {
-      return return_code;
+      break;
     }
+    spectrum_files = TideSearchProgram.getSpectrumFiles();
 
-    //pass the output from Tide-Search to Assign-Confidence
+    //pass the output from Tide-Search to Assign-Confidence in memory
     vector<string> bridge_file_name;
     bridge_file_name.push_back(TideSearchProgram.getOutputFileName());
+    istream* target_results;
+    istream* decoy_results;
+    TideSearchProgram.releaseResultStreams(target_results, decoy_results);
 
     //carry out assign confidence
     AssignConfidenceApplication AssignConfidenceProgram;
@@ -62,10 +75,13 @@ int CascadeSearchApplication::main(int argc, char** argv) {
     AssignConfidenceProgram.setOutput(output);
     AssignConfidenceProgram.setIndexName(database_indices[cascade_cnt]);
     AssignConfidenceProgram.setFinalIteration(cascade_cnt + 1 == database_indices.size());
+    AssignConfidenceProgram.setInputStreams(target_results, decoy_results);
 
     return_code = AssignConfidenceProgram.main(bridge_file_name);
+    delete target_results;
+    delete decoy_results;
     if (return_code != 0) {
-      return return_code;
+      break;
     }
     spectrum_flag = AssignConfidenceProgram.getSpectrumFlag();
 
@@ -84,6 +100,18 @@ int CascadeSearchApplication::main(int argc, char** argv) {
     carp(CARP_INFO, "Finished cascade-search of database %d.\n", cascade_cnt + 1);
 
   }
+
+  // Delete the temporary spectrumrecords files shared by the searches
+  for (vector<TideSearchApplication::InputFile>::const_iterator i = spectrum_files.begin();
+       i != spectrum_files.end(); ++i) {
+    if (!i->Keep) {
+      carp(CARP_DEBUG, "Deleting %s", i->SpectrumRecords.c_str());
+      remove(i->SpectrumRecords.c_str());
+    }
+  }
+  if (return_code != 0) {
+    return return_code;
+  }
   delete output;
 
   return 0;
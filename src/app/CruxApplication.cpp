@@ -74,9 +74,17 @@ bool CruxApplication::needsOutputDirectory() const {
   return false;
 }
 
+bool CruxApplication::resumesOutputs() const {
+  return false;
+}
+
 void CruxApplication::initialize(int argc, char** argv) {
   initializeParams(getName(), getArgs(), getOptions(), argc, argv);
 
+  // A resumed run replaces the log and parameter files of the interrupted one.
+  bool overwrite = Params::GetBool("overwrite") ||
+    (resumesOutputs() && Params::GetBool("resume"));
+
   set_verbosity_level(Params::GetInt("verbosity"));
 
   // Set seed for random number generation 
@@ -92,12 +100,12 @@ void CruxApplication::initialize(int argc, char** argv) {
   if (needsOutputDirectory()) {
     // Create output directory 
     string output_folder = Params::GetString("output-dir");
-    if (create_output_directory(output_folder, Params::GetBool("overwrite")) == -1) {
+    if (create_output_directory(output_folder, overwrite) == -1) {
       carp(CARP_FATAL, "Unable to create output directory %s.", output_folder.c_str());
     }
 
     // Open the log file to record carp messages 
-    open_log_file(getFileStem() + ".log.txt");
+    open_log_file(getFileStem() + ".log.txt", overwrite);
   
     // Store the host name, start date and time, version number, and command line.
     carp(CARP_INFO, "CPU: %s", hostname());
@@ -121,7 +129,7 @@ void CruxApplication::initialize(int argc, char** argv) {
   if (needsOutputDirectory()) {
     // Write the parameter file
     string paramFile = make_file_path(getFileStem() + ".params.txt");
-    ofstream* file = FileUtils::GetWriteStream(paramFile, Params::GetBool("overwrite"));
+    ofstream* file = FileUtils::GetWriteStream(paramFile, overwrite);
     if (file == NULL) {
       throw runtime_error("Could not open " + paramFile + " for writing");
     }
@@ -114,6 +114,12 @@ class CruxApplication{
    */
   virtual bool needsOutputDirectory() const;
 
+  /**
+   * \returns whether --resume continues the outputs of an interrupted
+   * run from its checkpoint (default false).
+   */
+  virtual bool resumesOutputs() const;
+
   virtual void initialize(int argc, char** argv);
 
   /**
@@ -6,6 +6,7 @@
 #include <list>
 #include <memory>
 #include <sstream>
+#include <thread>
 
 #include "IndexedMassSpectralPeak.h"
 #include "LFQMetaData.h"
@@ -48,6 +49,7 @@ bool CruxLFQ::QUANTIFY_AMBIGUOUS_PEPTIDES = false;            // Default value i
 bool CruxLFQ::USE_SHARED_PEPTIDES_FOR_PROTEIN_QUANT = false;  // Default value is false
 bool CruxLFQ::NORMALIZE = false;                              // Default value is false
 int CruxLFQ::MaxThreads = 1;                                  // Default value is 1
+bool CruxLFQ::XIC_SWEEP = true;                               // Default value is true
 
 CruxLFQApplication::CruxLFQApplication() {}
 
@@ -75,6 +77,7 @@ int CruxLFQApplication::main(const string& psm_file, const vector<string>& spec_
     CruxLFQ::USE_SHARED_PEPTIDES_FOR_PROTEIN_QUANT = Params::GetBool("use-shared-peptides-for-protein-quant");  // Default value is false
     CruxLFQ::NORMALIZE = Params::GetBool("normalize");                                                          // Default value is false
     CruxLFQ::MaxThreads = Params::GetInt("num-threads");                                                        // Default value is 1
+    CruxLFQ::XIC_SWEEP = Params::GetBool("lfq-xic-sweep");                                                      // Default value is true
 
     string output_dir = Params::GetString("output-dir");
 
@@ -137,49 +140,55 @@ int CruxLFQApplication::main(const string& psm_file, const vector<string>& spec_
     //     return 0;
     // }
 
+    // Every file gets its Peaks entry up front; the workers below only look
+    // up their own entry, so the map is never modified concurrently.
     for (const string& spectra_file : spec_files) {
-        Crux::SpectrumCollection* spectra_ms1 = loadSpectra(spectra_file, 1);
-        carp(CARP_INFO, "Read %d spectra. for MS1. from %s", spectra_ms1->getNumSpectra(), spectra_file.c_str());
+        lfqResults.Peaks[spectra_file];
+    }
 
-        CruxLFQ::IndexedSpectralResults indexResults = indexedMassSpectralPeaks(spectra_ms1, spectra_file);
+    int concurrentFiles = std::max(1, std::min(Params::GetInt("lfq-concurrent-files"),
+                                               static_cast<int>(spec_files.size())));
+    int quantThreads = CruxLFQ::MaxThreads > 0
+        ? CruxLFQ::MaxThreads
+        : static_cast<int>(std::thread::hardware_concurrency());
+    quantThreads = std::max(1, (quantThreads + concurrentFiles - 1) / concurrentFiles);
+    FileMemoryBudget budget(static_cast<size_t>(Params::GetInt("lfq-memory-budget")) << 20);
+    if (concurrentFiles > 1) {
+        carp(CARP_INFO, "Processing up to %d spectrum files at once, %d quantification threads each",
+             concurrentFiles, quantThreads);
+    }
 
-        carp(CARP_INFO, "Finished indexing peaks for %s", spectra_file.c_str());
+    std::mutex fileMutex;
+    size_t nextFile = 0;
+    auto fileWorker = [&]() {
+        while (true) {
+            size_t fileIdx;
+            {
+                std::lock_guard<std::mutex> lock(fileMutex);
+                if (nextFile >= spec_files.size()) {
+                    return;
+                }
+                fileIdx = nextFile++;
+            }
+            const string& spectra_file = spec_files[fileIdx];
+            size_t reserved = budget.acquire(FileUtils::Size(spectra_file));
+            processSpectraFile(spectra_file, allIdentifications, chargeStates,
+                               modifiedSequenceToIsotopicDistribution, quantThreads,
+                               &budget, &reserved, &lfqResults);
+            budget.release(reserved);
+        }
+    };
 
-        vector<CruxLFQ::Identification> filteredIdentifications;
-
-        std::copy_if(
-            allIdentifications.begin(),
-            allIdentifications.end(),
-            std::back_inserter(filteredIdentifications),
-            [&spectra_file](const Identification& identification) {
-                return identification.spectralFile == spectra_file;
-            });
-        carp(CARP_INFO, "Filtered %zu identifications out of %zu total for '%s'",
-             filteredIdentifications.size(), allIdentifications.size(), spectra_file.c_str());
-
-        vector<vector<CruxLFQ::IndexedMassSpectralPeak>*> convertedPeaks;
-
-        auto metadata = &CruxLFQ::LFQMetaData::getInstance();
-        std::transform(
-            indexResults._indexedPeaks.begin(),
-            indexResults._indexedPeaks.end(),
-            std::back_inserter(convertedPeaks),
-            [](vector<CruxLFQ::IndexedMassSpectralPeak>& innerVec) {
-                return &innerVec;
-            });
-        metadata->setIndexedPeaks(&convertedPeaks);
-        metadata->setMs1Scans(&indexResults._ms1Scans);
-
-        CruxLFQ::quantifyMs2IdentifiedPeptides(
-            spectra_file,
-            filteredIdentifications,
-            chargeStates,
-            modifiedSequenceToIsotopicDistribution,
-            &lfqResults);
-        CruxLFQ::runErrorChecking(spectra_file, lfqResults);
-
-        carp(CARP_INFO, "Finished processing %s", spectra_file.c_str());
-        delete spectra_ms1;
+    if (concurrentFiles == 1) {
+        fileWorker();
+    } else {
+        vector<std::thread> fileThreads;
+        for (int i = 0; i < concurrentFiles; i++) {
+            fileThreads.emplace_back(fileWorker);
+        }
+        for (auto& thread : fileThreads) {
+            thread.join();
+        }
     }
 
     if (CruxLFQ::NORMALIZE) {
@@ -200,6 +209,96 @@ int CruxLFQApplication::main(const string& psm_file, const vector<string>& spec_
     return 0;
 }
 
+void CruxLFQApplication::processSpectraFile(
+    const string& spectra_file,
+    const vector<Identification>& allIdentifications,
+    const vector<int>& chargeStates,
+    unordered_map<string, vector<pair<double, double>>>& modifiedSequenceToIsotopicDistribution,
+    int numThreads,
+    FileMemoryBudget* budget,
+    size_t* reserved,
+    CruxLFQ::CruxLFQResults* lfqResults) {
+    CruxLFQ::IndexedSpectralResults indexResults;
+    bool useCache = Params::GetBool("lfq-index-cache");
+    string cacheFile = spectra_file + ".lfqidx";
+    unsigned long long sourceSize = FileUtils::Size(spectra_file);
+    long long sourceTime = FileUtils::ModificationTime(spectra_file);
+
+    if (useCache && indexResults._indexedPeaks.read(cacheFile, sourceSize, sourceTime)) {
+        indexResults._ms1Scans[spectra_file] = indexResults._indexedPeaks.scans();
+        carp(CARP_INFO, "Read MS1 peak index for %s from %s", spectra_file.c_str(), cacheFile.c_str());
+    } else {
+        Crux::SpectrumCollection* spectra_ms1 = loadSpectra(spectra_file, 1);
+        carp(CARP_INFO, "Read %d spectra. for MS1. from %s", spectra_ms1->getNumSpectra(), spectra_file.c_str());
+
+        indexResults = indexedMassSpectralPeaks(spectra_ms1, spectra_file);
+        // The index holds copies of the peaks, so the parsed spectra can go
+        // before quantification starts.
+        delete spectra_ms1;
+
+        carp(CARP_INFO, "Finished indexing peaks for %s", spectra_file.c_str());
+
+        if (useCache && !indexResults._indexedPeaks.write(cacheFile, sourceSize, sourceTime)) {
+            carp(CARP_WARNING, "Could not write MS1 peak index cache %s", cacheFile.c_str());
+        }
+    }
+
+    // Replace the on-disk estimate with the size of the index itself.
+    *reserved = budget->adjust(*reserved, indexResults._indexedPeaks.memoryBytes());
+
+    vector<CruxLFQ::Identification> filteredIdentifications;
+
+    std::copy_if(
+        allIdentifications.begin(),
+        allIdentifications.end(),
+        std::back_inserter(filteredIdentifications),
+        [&spectra_file](const Identification& identification) {
+            return identification.spectralFile == spectra_file;
+        });
+    carp(CARP_INFO, "Filtered %zu identifications out of %zu total for '%s'",
+         filteredIdentifications.size(), allIdentifications.size(), spectra_file.c_str());
+
+    CruxLFQ::LFQMetaData metaData(&indexResults._indexedPeaks, &indexResults._ms1Scans);
+
+    CruxLFQ::quantifyMs2IdentifiedPeptides(
+        spectra_file,
+        filteredIdentifications,
+        chargeStates,
+        modifiedSequenceToIsotopicDistribution,
+        metaData,
+        lfqResults,
+        numThreads);
+    CruxLFQ::runErrorChecking(spectra_file, *lfqResults);
+
+    carp(CARP_INFO, "Finished processing %s", spectra_file.c_str());
+}
+
+size_t CruxLFQApplication::FileMemoryBudget::acquire(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // A file is always admitted when nothing else is in flight, so a file
+    // larger than the whole budget can still be processed on its own.
+    cond_.wait(lock, [this, bytes]() {
+        return limit_ == 0 || inFlight_ == 0 || used_ + bytes <= limit_;
+    });
+    used_ += bytes;
+    inFlight_++;
+    return bytes;
+}
+
+size_t CruxLFQApplication::FileMemoryBudget::adjust(size_t oldBytes, size_t newBytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    used_ = used_ - oldBytes + newBytes;
+    cond_.notify_all();
+    return newBytes;
+}
+
+void CruxLFQApplication::FileMemoryBudget::release(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    used_ -= bytes;
+    inFlight_--;
+    cond_.notify_all();
+}
+
 string CruxLFQApplication::getName() const {
     return "lfq";
 }
@@ -251,7 +350,12 @@ vector<string> CruxLFQApplication::getOptions() const {
         "cterm-peptide-mods-spec",
         // "cterm-protein-mods-spec",
         "lfq-q-value-threshold",
-        "is-psm-filtered"};
+        "is-psm-filtered",
+        "lfq-concurrent-files",
+        "lfq-memory-budget",
+        "lfq-index-cache",
+        "lfq-xic-sweep",
+        "lfq-isotope-cache"};
     return vector<string>(arr, arr + sizeof(arr) / sizeof(string));
 }
 
@@ -295,48 +399,31 @@ Crux::SpectrumCollection* CruxLFQApplication::loadSpectra(const string& file, in
 }
 
 IndexedSpectralResults CruxLFQApplication::indexedMassSpectralPeaks(Crux::SpectrumCollection* spectrum_collection, const string& spectra_file) {
-    // string _spectra_file(spectra_file);
-
-    vector<vector<IndexedMassSpectralPeak>> _indexedPeaks;
-    unordered_map<string, vector<Ms1ScanInfo>> _ms1Scans;
-
-    _ms1Scans[spectra_file] = vector<Ms1ScanInfo>();
+    IndexedSpectralResults index_results;
+    Ms1PeakIndex& index = index_results._indexedPeaks;
 
-    IndexedSpectralResults index_results{_indexedPeaks, _ms1Scans};
-
-    if (spectrum_collection->getNumSpectra() <= 0) {
-        return index_results;
+    // First pass sizes the bins, second pass fills them in scan order.
+    for (auto spectrum = spectrum_collection->begin(); spectrum != spectrum_collection->end(); ++spectrum) {
+        if (*spectrum != nullptr) {
+            index.addScan((*spectrum)->getFirstScan(), (*spectrum)->getRTime());  // Native scan number from mzML
+            for (auto peak = (*spectrum)->begin(); peak != (*spectrum)->end(); ++peak) {
+                index.countPeak(peak->getLocation());
+            }
+        }
     }
+    index.reserve();
 
     int scanIndex = 0;
     for (auto spectrum = spectrum_collection->begin(); spectrum != spectrum_collection->end(); ++spectrum) {
         if (*spectrum != nullptr) {
-            double retentionTime = (*spectrum)->getRTime();
-            int nativeScanNumber = (*spectrum)->getFirstScan();  // Native scan number from mzML
             for (auto peak = (*spectrum)->begin(); peak != (*spectrum)->end(); ++peak) {
-                if (*peak != nullptr) {
-                    double mz = (*peak)->getLocation();
-                    int roundedMz = static_cast<int>(std::round(mz * BINS_PER_DALTON));
-
-                    if (index_results._indexedPeaks.size() <= roundedMz) {
-                        int size = roundedMz + 1;
-                        index_results._indexedPeaks.resize(size);
-                    }
-
-                    index_results._indexedPeaks[roundedMz].emplace_back(
-                        mz,                       // mz value
-                        (*peak)->getIntensity(),  // intensity
-                        scanIndex,                // zeroBasedMs1ScanIndex
-                        nativeScanNumber,         // nativeScanNumber from mzML
-                        retentionTime             // retentionTime
-                    );
-                }
+                index.addPeak(peak->getLocation(), peak->getIntensity(), scanIndex);
             }
-            index_results._ms1Scans[spectra_file].emplace_back(nativeScanNumber, scanIndex, retentionTime);
             scanIndex++;
         }
     }
 
+    index_results._ms1Scans[spectra_file] = index.scans();
     return index_results;
 }
 
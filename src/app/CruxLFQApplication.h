@@ -1,5 +1,7 @@
 #pragma once
 
+#include <condition_variable>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 
@@ -14,6 +16,7 @@ using CruxLFQ::BINS_PER_DALTON;
 using CruxLFQ::Identification;
 using CruxLFQ::IndexedMassSpectralPeak;
 using CruxLFQ::IndexedSpectralResults;
+using CruxLFQ::Ms1PeakIndex;
 using CruxLFQ::Ms1ScanInfo;
 using CruxLFQ::PSM;
 using std::pair;
@@ -78,6 +81,40 @@ class CruxLFQApplication : public CruxApplication {
     static vector<Identification> createIdentifications(const vector<PSM>& psm_data, const vector<string>& spec_files);
 
     static vector<PSM> create_percolator_psm(const string& psm_file);
+    /**
+     * Bounds the memory held by spectrum files in flight. Reservations start
+     * from the file size on disk and are replaced by the index size once a
+     * file has been indexed. A limit of 0 disables the bound.
+     */
+    class FileMemoryBudget {
+       public:
+        explicit FileMemoryBudget(size_t limit) : limit_(limit), used_(0), inFlight_(0) {}
+        size_t acquire(size_t bytes);
+        size_t adjust(size_t oldBytes, size_t newBytes);
+        void release(size_t bytes);
+
+       private:
+        size_t limit_;
+        size_t used_;
+        int inFlight_;
+        std::mutex mutex_;
+        std::condition_variable cond_;
+    };
+
+    /**
+     * Parses, indexes and quantifies one spectrum file with its own
+     * LFQMetaData context. Safe to run for several files at once.
+     */
+    static void processSpectraFile(
+        const string& spectra_file,
+        const vector<Identification>& allIdentifications,
+        const vector<int>& chargeStates,
+        unordered_map<string, vector<pair<double, double>>>& modifiedSequenceToIsotopicDistribution,
+        int numThreads,
+        FileMemoryBudget* budget,
+        size_t* reserved,
+        CruxLFQ::CruxLFQResults* lfqResults);
+
     static void gen_mods(
         string sequence_col,
         ModPosition mod_psn_type,
@@ -108,9 +108,23 @@ int DIAmeterApplication::main(const vector<string>& input_files, const string in
 
   vector<int> negative_isotope_errors = TideSearchApplication::getNegativeIsotopeErrors();
 
-  ofstream* output_file = create_stream_in_path(output_file_name_unsorted_.c_str(), NULL, Params::GetBool("overwrite"));
-  string output_header = TideMatchSet::getHeader(DIAMETER_TSV, "");
-  *output_file << output_header;
+  // An interrupted search continues with the first spectrum file not finished at the last checkpoint
+  string checkpoint_file = make_file_path("diameter.checkpoint.txt");
+  bool checkpoints = Params::GetInt("checkpoint-interval") > 0;
+  int files_done = 0;
+  ofstream* output_file;
+  if (Params::GetBool("resume")) {
+    streamoff output_size;
+    files_done = readCheckpoint(checkpoint_file, input_files, &output_size);
+    output_file = FileUtils::GetResumeStream(output_file_name_unsorted_, output_size);
+    if (output_file == NULL) {
+      carp(CARP_FATAL, "Cannot resume writing %s", output_file_name_unsorted_.c_str());
+    }
+  } else {
+    output_file = create_stream_in_path(output_file_name_unsorted_.c_str(), NULL, Params::GetBool("overwrite"));
+    string output_header = TideMatchSet::getHeader(DIAMETER_TSV, "");
+    *output_file << output_header;
+  }
 
   map<string, double> peptide_predrt_map;
   getPeptidePredRTMapping(&peptide_predrt_map);
@@ -127,6 +141,10 @@ int DIAmeterApplication::main(const vector<string>& input_files, const string in
  
   // Loop through spectrum files
   for (int file_idx=0; file_idx < input_files.size(); ++file_idx) {
+    if (file_idx < files_done) {
+      carp(CARP_INFO, "Skipping %s, which was searched before the checkpoint", input_files[file_idx].c_str());
+      continue;
+    }
     string ms1_spectra_file = ms1_spectra_files.at(file_idx).SpectrumRecords;
     string ms2_spectra_file = ms2_spectra_files.at(file_idx).SpectrumRecords;
     string origin_file = ms2_spectra_files.at(file_idx).OriginalName;
@@ -313,11 +331,16 @@ int DIAmeterApplication::main(const vector<string>& input_files, const string in
     ms1scan_mz_intensity_rank_map.clear();
     ms1scan_slope_intercept_map.clear();    
     delete active_peptide_queue;
+
+    if (checkpoints) {
+      writeCheckpoint(checkpoint_file, input_files, file_idx + 1, output_file);
+    }
   }
   if (output_file) {
     output_file->close();
     delete output_file;  
   }
+  FileUtils::Remove(checkpoint_file);
 
   // standardize the features
   DIAmeterFeatureScaler diameterScaler(output_file_name_unsorted_.c_str());
@@ -722,6 +745,51 @@ vector<InputFile> DIAmeterApplication::getInputFiles(const vector<string>& filep
   return input_sr;
 }
 
+void DIAmeterApplication::writeCheckpoint(const string& checkpoint_file, const vector<string>& input_files, int files_done, ofstream* output_file) const {
+  output_file->flush();
+  // Write to a temporary file first, so that a crash leaves the previous checkpoint intact
+  string temp_file = checkpoint_file + ".tmp";
+  ofstream checkpoint(temp_file.c_str());
+  checkpoint << "output\t" << (long long)output_file->tellp() << '\n';
+  for (int file_idx = 0; file_idx < files_done; ++file_idx) {
+    checkpoint << "input\t" << input_files[file_idx] << '\n';
+  }
+  checkpoint.close();
+  if (!checkpoint) {
+    carp(CARP_WARNING, "Could not write checkpoint %s", temp_file.c_str());
+    return;
+  }
+  FileUtils::Rename(temp_file, checkpoint_file);
+}
+
+int DIAmeterApplication::readCheckpoint(const string& checkpoint_file, const vector<string>& input_files, streamoff* output_size) const {
+  if (!FileUtils::Exists(checkpoint_file)) {
+    carp(CARP_FATAL, "Cannot resume the search: checkpoint %s does not exist.", checkpoint_file.c_str());
+  }
+  carp(CARP_INFO, "Resuming search from checkpoint %s", checkpoint_file.c_str());
+  ifstream checkpoint(checkpoint_file.c_str());
+  string line;
+  size_t files_done = 0;
+  *output_size = -1;
+  while (getline(checkpoint, line)) {
+    vector<string> fields = StringUtils::Split(line, '\t');
+    if (fields[0] == "output" && fields.size() == 2) {
+      *output_size = StringUtils::FromString<long long>(fields[1]);
+    } else if (fields[0] == "input" && fields.size() == 2) {
+      if (files_done >= input_files.size() || input_files[files_done] != fields[1]) {
+        carp(CARP_FATAL, "The checkpoint was written for different spectrum files (%s).", fields[1].c_str());
+      }
+      ++files_done;
+    } else {
+      carp(CARP_FATAL, "Invalid line in checkpoint %s: %s", checkpoint_file.c_str(), line.c_str());
+    }
+  }
+  if (*output_size < 0) {
+    carp(CARP_FATAL, "Invalid checkpoint %s", checkpoint_file.c_str());
+  }
+  return (int)files_done;
+}
+
 void DIAmeterApplication::getPeptidePredRTMapping(map<string, double>* peptide_predrt_map, int percent_bins) {
   carp(CARP_INFO, "predrt-files: %s ", Params::GetString("predrt-files").c_str());
 
@@ -1013,8 +1081,10 @@ vector<string> DIAmeterApplication::getOptions() const {
   "max-precursor-charge",
   "mz-bin-offset",
   "mz-bin-width",
+  "checkpoint-interval",
   "output-dir",
   "overwrite",
+  "resume",
   // "parameter-file",  
   // "precursor-window",
   "predrt-files",
@@ -1060,6 +1130,10 @@ bool DIAmeterApplication::needsOutputDirectory() const {
   return true;
 }
 
+bool DIAmeterApplication::resumesOutputs() const {
+  return true;
+}
+
 COMMAND_T DIAmeterApplication::getCommand() const {
   return DIAMETER_COMMAND;
 }
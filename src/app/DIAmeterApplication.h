@@ -66,6 +66,10 @@ class DIAmeterApplication : public CruxApplication {
 
   vector<InputFile> getInputFiles(const vector<string>& filepaths, int ms_level) const;
 
+  // Checkpoints written after each spectrum file, for --resume
+  void writeCheckpoint(const string& checkpoint_file, const vector<string>& input_files, int files_done, ofstream* output_file) const;
+  int readCheckpoint(const string& checkpoint_file, const vector<string>& input_files, streamoff* output_size) const;
+
   SpectrumCollection* loadSpectra(const std::string& file);
 
   void loadMS1Spectra(const std::string& file,
@@ -193,6 +197,11 @@ class DIAmeterApplication : public CruxApplication {
    */
   virtual bool needsOutputDirectory() const;
 
+  /**
+   * Returns true: --resume continues the outputs from the checkpoint
+   */
+  virtual bool resumesOutputs() const;
+
   virtual COMMAND_T getCommand() const;
 
   virtual void processParams();
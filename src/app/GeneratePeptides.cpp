@@ -5,12 +5,117 @@
 #include "util/FileUtils.h"
 #include "util/Params.h"
 #include "util/StringUtils.h"
+#include <atomic>
 #include <iostream>
+#include <iterator>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#ifndef _MSC_VER
+#include <unistd.h>
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
 
 using namespace std;
 
 MASS_TYPE_T GeneratePeptides::massType_ = AVERAGE;
 
+// proteins given to each digestion thread per batch
+static const size_t PROTEINS_PER_THREAD = 256;
+// peptides held in memory before a sorted run is written to disk
+static const size_t MAX_RUN_PEPTIDES = 10000000;
+
+// a peptide cleaved from a protein, which is identified by its index in the FASTA
+struct PeptideOccurrence {
+  PeptideOccurrence(): protein(-1) {}
+  PeptideOccurrence(const string& seq, int proteinIdx): sequence(seq), protein(proteinIdx) {}
+  bool operator <(const PeptideOccurrence& rhs) const {
+    int cmp = sequence.compare(rhs.sequence);
+    return cmp != 0 ? cmp < 0 : protein < rhs.protein;
+  }
+
+  string sequence;
+  int protein;
+};
+
+// temporary run files not yet removed; also removed at exit, so that a fatal
+// error partway through does not leave them behind
+static vector<string> runFiles_;
+
+static void removeRunFiles() {
+  for (vector<string>::const_iterator i = runFiles_.begin(); i != runFiles_.end(); i++) {
+    remove(i->c_str());
+  }
+  runFiles_.clear();
+}
+
+// returns the path for a new temporary run file, named with the process id so
+// that concurrent runs into the same output directory do not collide
+static string newRunFile() {
+  static bool registered = false;
+  if (!registered) {
+    atexit(removeRunFiles);
+    registered = true;
+  }
+  runFiles_.push_back(make_file_path("generate-peptides." +
+    StringUtils::ToString((int)getpid()) + ".run" +
+    StringUtils::ToString(runFiles_.size()) + ".tmp"));
+  return runFiles_.back();
+}
+
+// reads back a sorted run of peptides, from memory or from a temporary file
+class PeptideRun {
+ public:
+  explicit PeptideRun(const vector<PeptideOccurrence>* occurrences):
+    occurrences_(occurrences), next_(0), file_(NULL) {}
+  explicit PeptideRun(const string& path):
+    occurrences_(NULL), next_(0), file_(new ifstream(path.c_str(), ifstream::in)) {
+    if (!file_->good()) {
+      carp(CARP_FATAL, "Error reading temporary file %s", path.c_str());
+    }
+  }
+  ~PeptideRun() { delete file_; }
+
+  bool Next(PeptideOccurrence* out) {
+    if (occurrences_) {
+      if (next_ >= occurrences_->size()) {
+        return false;
+      }
+      *out = (*occurrences_)[next_++];
+      return true;
+    }
+    return (bool)(*file_ >> out->sequence >> out->protein);
+  }
+ private:
+  const vector<PeptideOccurrence>* occurrences_;
+  size_t next_;
+  ifstream* file_;
+};
+
+// sorts a run, adding the hash of each distinct sequence in it to hashes if given
+static void sortRun(vector<PeptideOccurrence>& run, vector<size_t>* hashes) {
+  sort(run.begin(), run.end());
+  if (hashes) {
+    for (size_t i = 0; i < run.size(); i++) {
+      if (i == 0 || run[i].sequence != run[i - 1].sequence) {
+        hashes->push_back(hash<string>()(run[i].sequence));
+      }
+    }
+  }
+}
+
+static void writeRun(const vector<PeptideOccurrence>& run, const string& path) {
+  ofstream file(path.c_str(), ofstream::out);
+  for (vector<PeptideOccurrence>::const_iterator i = run.begin(); i != run.end(); i++) {
+    file << i->sequence << '\t' << i->protein << '\n';
+  }
+  if (!file.good()) {
+    carp(CARP_FATAL, "Error writing temporary file %s", path.c_str());
+  }
+}
+
 GeneratePeptides::GeneratePeptides() {
 }
 
@@ -70,65 +175,182 @@ void GeneratePeptides::processFasta(
   string decoyPrefix = Params::GetString("decoy-prefix");
   bool peptideShuffle = decoyType == PEPTIDE_SHUFFLE_DECOYS;
   bool peptideReverse = decoyType == PEPTIDE_REVERSE_DECOYS;
-
-  set<string> targets, decoys;
-  map<const string*, const string*> targetToDecoy;
-  map< OrderedPeptide, vector<string> > peptideToProtein;
+  bool makeDecoys = peptideShuffle || peptideReverse;
+  int numThreads = Params::GetInt("num-threads");
+  if (numThreads < 1) {
+    numThreads = max(1, (int)thread::hardware_concurrency());
+  }
+  // the amino acid masses are initialized on first use, do it before the threads start
+  Crux::Peptide::calcSequenceMass("A", massType_);
+
+  // Proteins are referred to by their index in the FASTA. Peptides are
+  // collected into runs sorted by sequence; full runs go to temporary files
+  // and are merged afterwards, so only one run is held in memory at a time.
+  vector<string> proteinIds;
+  vector<PeptideOccurrence> run;
+  vector<string> runFiles;
+  vector<size_t> targetHashes;
   int proteinTotal = 0, peptideTotal = 0;
 
-  // Iterate over all proteins from this FASTA
-  while (true) {
+  // Iterate over all proteins from this FASTA, digesting them in batches
+  vector<string> batch;
+  vector< vector<PeptideOccurrence> > batchPeptides;
+  vector<int> batchCounts;
+  bool more = true;
+  while (more) {
+    batch.clear();
     string id, proteinSequence;
-    if (!getNextProtein(*fasta, &id, &proteinSequence)) {
-      break;
-    }
-    ++proteinTotal;
-    carp(CARP_DEBUG, "Read %s", id.c_str());
-
-    // Get peptides
-    vector<CleavedPeptide> peptides =
-      cleaveProtein(proteinSequence, enzyme, digest, missed, minLen, maxLen);
-    peptideTotal += peptides.size();
-
-    // Iterate over all peptides from this protein
-    for (vector<CleavedPeptide>::const_iterator i = peptides.begin();
-         i != peptides.end();
-         i++) {
-      FLOAT_T mass = i->Mass();
-      if (mass < minMass || mass > maxMass) {
-        carp(CARP_DETAILED_DEBUG, "Skipping peptide with mass %f", mass);
-        continue;
+    while (batch.size() < PROTEINS_PER_THREAD * numThreads &&
+           (more = getNextProtein(*fasta, &id, &proteinSequence))) {
+      carp(CARP_DEBUG, "Read %s", id.c_str());
+      proteinIds.push_back(id);
+      batch.push_back(string());
+      batch.back().swap(proteinSequence);
+    }
+    int firstProtein = proteinIds.size() - batch.size();
+    proteinTotal += batch.size();
+
+    batchPeptides.resize(batch.size());
+    batchCounts.assign(batch.size(), 0);
+    atomic<size_t> nextProtein(0);
+    auto worker = [&]() {
+      size_t i;
+      while ((i = nextProtein++) < batch.size()) {
+        // Get peptides
+        vector<CleavedPeptide> peptides =
+          cleaveProtein(batch[i], enzyme, digest, missed, minLen, maxLen);
+        batchCounts[i] = peptides.size();
+        vector<PeptideOccurrence>& out = batchPeptides[i];
+        out.clear();
+        for (vector<CleavedPeptide>::const_iterator j = peptides.begin();
+             j != peptides.end();
+             j++) {
+          FLOAT_T mass = j->Mass();
+          if (mass < minMass || mass > maxMass) {
+            carp(CARP_DETAILED_DEBUG, "Skipping peptide with mass %f", mass);
+            continue;
+          }
+          out.push_back(PeptideOccurrence(j->Sequence(), firstProtein + i));
+        }
       }
-      const string& sequence = i->Sequence();
-      pair<set<string>::iterator, bool> insert = targets.insert(sequence);
-      if (insert.second) {
-        peptideToProtein[*i] = vector<string>(1, id);
-      } else {
-        peptideToProtein[*i].push_back(id);
+    };
+    vector<thread> threads;
+    for (int i = 1; i < numThreads && i < (int)batch.size(); i++) {
+      threads.push_back(thread(worker));
+    }
+    worker();
+    for (vector<thread>::iterator i = threads.begin(); i != threads.end(); i++) {
+      i->join();
+    }
+
+    for (size_t i = 0; i < batch.size(); i++) {
+      peptideTotal += batchCounts[i];
+      run.insert(run.end(), make_move_iterator(batchPeptides[i].begin()),
+                 make_move_iterator(batchPeptides[i].end()));
+      if (run.size() >= MAX_RUN_PEPTIDES) {
+        runFiles.push_back(newRunFile());
+        sortRun(run, makeDecoys ? &targetHashes : NULL);
+        writeRun(run, runFiles.back());
+        run.clear();
       }
     }
   }
   delete fasta;
   carp(CARP_DEBUG, "Read %d proteins and %d peptides", proteinTotal, peptideTotal);
 
-  // Once we have all targets, try to generate a decoy for each one
-  if (peptideShuffle || peptideReverse) {
-    int decoyFailures = 0;
-    for (set<string>::const_iterator i = targets.begin(); i != targets.end(); i++) {
-      string decoy;
-      if (makeDecoy(*i, targets, decoys, peptideShuffle, decoy)) {
-        targetToDecoy[&*i] = &*(decoys.insert(decoy).first);
-      } else {
-        ++decoyFailures;
+  vector<PeptideRun*> runs;
+  sortRun(run, makeDecoys ? &targetHashes : NULL);
+  if (runFiles.empty()) {
+    runs.push_back(new PeptideRun(&run));
+  } else {
+    if (!run.empty()) {
+      runFiles.push_back(newRunFile());
+      writeRun(run, runFiles.back());
+      vector<PeptideOccurrence>().swap(run);
+    }
+    carp(CARP_DEBUG, "Merging %d sorted runs", (int)runFiles.size());
+    for (vector<string>::const_iterator i = runFiles.begin(); i != runFiles.end(); i++) {
+      runs.push_back(new PeptideRun(*i));
+    }
+  }
+  sort(targetHashes.begin(), targetHashes.end());
+  targetHashes.erase(unique(targetHashes.begin(), targetHashes.end()), targetHashes.end());
+
+  // Merge the runs, writing each target (and a decoy for it) once, in sequence order
+  typedef pair<PeptideOccurrence, size_t> RunHead;
+  priority_queue< RunHead, vector<RunHead>, greater<RunHead> > heads;
+  for (size_t i = 0; i < runs.size(); i++) {
+    PeptideOccurrence occurrence;
+    if (runs[i]->Next(&occurrence)) {
+      heads.push(make_pair(occurrence, i));
+    }
+  }
+  unordered_set<size_t> decoyHashes;
+  unordered_map<string, string> targetToDecoy;
+  int decoyFailures = 0;
+  int precision = Params::GetInt("mass-precision");
+  string sequence;
+  vector<int> proteins;
+  auto writePeptide = [&]() {
+    FLOAT_T mass = Crux::Peptide::calcSequenceMass(sequence, massType_);
+    string massStr = StringUtils::ToString(mass + MASS_PROTON, precision);
+    *targetList << sequence << '\t' << massStr << '\t' << proteinIds[proteins.front()];
+    for (vector<int>::const_iterator j = proteins.begin() + 1; j != proteins.end(); j++) {
+      *targetList << ',' << proteinIds[*j];
+    }
+    *targetList << '\n';
+
+    if (!makeDecoys) {
+      return;
+    }
+    string decoy;
+    if (!makeDecoy(sequence, targetHashes, decoyHashes, peptideShuffle, decoy)) {
+      ++decoyFailures;
+      return;
+    }
+    decoyHashes.insert(hash<string>()(decoy));
+    if (decoyList) {
+      *decoyList << decoy << '\t' << massStr << '\t' << decoyPrefix << proteinIds[proteins.front()];
+      for (vector<int>::const_iterator j = proteins.begin() + 1; j != proteins.end(); j++) {
+        *decoyList << ',' << decoyPrefix << proteinIds[*j];
       }
+      *decoyList << '\n';
     }
-    if (decoyFailures > 0) {
-      carp(CARP_WARNING, "Failed to generate decoys for %d targets", decoyFailures);
+    if (decoyFasta) {
+      targetToDecoy[sequence] = decoy;
+    }
+  };
+  while (!heads.empty()) {
+    PeptideOccurrence occurrence = heads.top().first;
+    size_t runIdx = heads.top().second;
+    heads.pop();
+    PeptideOccurrence next;
+    if (runs[runIdx]->Next(&next)) {
+      heads.push(make_pair(next, runIdx));
     }
+    if (occurrence.sequence != sequence) {
+      if (!proteins.empty()) {
+        writePeptide();
+      }
+      sequence.swap(occurrence.sequence);
+      proteins.clear();
+    }
+    proteins.push_back(occurrence.protein);
+  }
+  if (!proteins.empty()) {
+    writePeptide();
+  }
+  if (decoyFailures > 0) {
+    carp(CARP_WARNING, "Failed to generate decoys for %d targets", decoyFailures);
   }
 
+  for (vector<PeptideRun*>::const_iterator i = runs.begin(); i != runs.end(); i++) {
+    delete *i;
+  }
+  removeRunFiles();
+
   // Re-read FASTA and generate decoy FASTA
-  if (decoyFasta && (peptideShuffle || peptideReverse)) {
+  if (decoyFasta && makeDecoys) {
     ifstream* fasta = new ifstream(fastaPath.c_str(), ifstream::in);
     while (true) {
       string id, proteinSequence;
@@ -147,53 +369,14 @@ void GeneratePeptides::processFasta(
            i != peptides.end();
            i++) {
         const string& sequence = i->Sequence();
-        set<string>::const_iterator j = targets.find(sequence);
-        if (j != targets.end()) {
-          map<const string*, const string*>::const_iterator k = targetToDecoy.find(&*j);
-          if (k != targetToDecoy.end()) {
-            *decoyFasta << *k->second;
-            continue;
-          }
-        }
-        *decoyFasta << sequence;
+        unordered_map<string, string>::const_iterator j = targetToDecoy.find(sequence);
+        *decoyFasta << (j != targetToDecoy.end() ? j->second : sequence);
       }
       *decoyFasta << endl;
     }
     delete fasta;
   }
 
-  int precision = Params::GetInt("mass-precision");
-  for (map< OrderedPeptide, vector<string> >::const_iterator i = peptideToProtein.begin();
-       i != peptideToProtein.end();
-       i++) {
-    const string& sequence = i->first.Sequence();
-    FLOAT_T mass = i->first.Mass();
-    vector<string>::const_iterator j = i->second.begin();
-    *targetList << sequence << '\t'
-                << StringUtils::ToString(mass + MASS_PROTON, precision) << '\t'
-                << *j;
-    for (j = j + 1; j != i->second.end(); j++) {
-      string proteinId = *j;
-      *targetList << ',' << proteinId;
-    }
-    *targetList << endl;
-
-    if ((peptideShuffle || peptideReverse) && decoyList) {
-      set<string>::const_iterator target = targets.find(sequence);
-      map<const string*, const string*>::const_iterator k = targetToDecoy.find(&*target);
-      if (k != targetToDecoy.end()) {
-        j = i->second.begin();
-        *decoyList << *k->second << '\t'
-                   << StringUtils::ToString(mass + MASS_PROTON, precision) << '\t'
-                   << decoyPrefix << *j;
-        for (j = j + 1; j != i->second.end(); j++) {
-          *decoyList << ',' << decoyPrefix << *j;
-        }
-        *decoyList << endl;
-      }
-    }
-  }
-
   if (decoyFasta) {
     delete decoyFasta;
   }
@@ -555,8 +738,8 @@ bool GeneratePeptides::makeDecoyIdx(
  */
 bool GeneratePeptides::makeDecoy(
   const string& seq,  ///< sequence to make decoy from
-  const set<string>& targetSeqs,  ///< targets to check against
-  const set<string>& decoySeqs,  ///< decoys to check against
+  const vector<size_t>& targetHashes,  ///< sorted target hashes to check against
+  const unordered_set<size_t>& decoyHashes,  ///< decoy hashes to check against
   bool shuffle, ///< shuffle (if false, reverse)
   string& decoyOut  ///< string to store decoy
 ) {
@@ -597,8 +780,9 @@ bool GeneratePeptides::makeDecoy(
       // Re-add n/c
       string decoyCheck = decoyPre + decoyOut + decoyPost;
       // Check in sets
-      if (targetSeqs.find(decoyCheck) == targetSeqs.end() &&
-          decoySeqs.find(decoyCheck) == decoySeqs.end()) {
+      size_t decoyHash = hash<string>()(decoyCheck);
+      if (!binary_search(targetHashes.begin(), targetHashes.end(), decoyHash) &&
+          decoyHashes.find(decoyHash) == decoyHashes.end()) {
         decoyOut = decoyCheck;
         return true;
       }
@@ -611,8 +795,9 @@ bool GeneratePeptides::makeDecoy(
     // Re-add n/c
     string decoyCheck = decoyPre + decoyOut + decoyPost;
     // Check in sets
-    if (targetSeqs.find(decoyCheck) == targetSeqs.end() &&
-        decoySeqs.find(decoyCheck) == decoySeqs.end()) {
+    size_t decoyHash = hash<string>()(decoyCheck);
+    if (!binary_search(targetHashes.begin(), targetHashes.end(), decoyHash) &&
+        decoyHashes.find(decoyHash) == decoyHashes.end()) {
       decoyOut = decoyCheck;
       return true;
     }
@@ -728,6 +913,7 @@ vector<string> GeneratePeptides::getOptions() const {
     "isotopic-mass",
     "seed",
     "clip-nterm-methionine",
+    "num-threads",
     "decoy-format",
     "decoy-prefix",
     "keep-terminal-aminos",
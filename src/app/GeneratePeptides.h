@@ -2,6 +2,7 @@
 #define GENERATE_PEPTIDES_H
 
 #include <fstream>
+#include <unordered_set>
 #include <vector>
 
 #include "CruxApplication.h"
@@ -119,8 +120,8 @@ class GeneratePeptides : public CruxApplication {
    */
   static bool makeDecoy(
     const std::string& seq, ///< sequence to make decoy from
-    const std::set<std::string>& targetSeqs,  ///< targets to check against
-    const std::set<std::string>& decoySeqs,  ///< decoys to check against
+    const std::vector<size_t>& targetHashes,  ///< sorted target hashes to check against
+    const std::unordered_set<size_t>& decoyHashes,  ///< decoy hashes to check against
     bool shuffle, ///< shuffle (if false, reverse)
     std::string& decoyOut ///< string to store decoy
   );
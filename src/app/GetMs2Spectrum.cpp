@@ -44,6 +44,37 @@ GetMs2Spectrum::GetMs2Spectrum() {
 GetMs2Spectrum::~GetMs2Spectrum() {
 }
 
+/**
+ * Prints either the spectrum or its summary statistics to stdout.
+ */
+static void printSpectrum(Spectrum* spectrum, bool stats) {
+  if (!stats) {
+    spectrum->print(stdout);
+  } else {
+    int charge_state_index = 0; 
+    int charge_state_num = spectrum->getNumZStates();
+    std::vector<SpectrumZState> zstates_array = spectrum->getZStates();
+  
+    printf("Scan number: %i\n", spectrum->getFirstScan());
+    printf("Precursor m/z:%.2f\n", spectrum->getPrecursorMz());
+    printf("Total Ion Current:%.2f\n", spectrum->getTotalEnergy());
+    printf("Base Peak Intensity:%.1f\n", spectrum->getMaxPeakIntensity()); // base is max
+    printf("Number of peaks:%d\n", spectrum->getNumPeaks());
+    printf("Minimum m/z:%.1f\n", spectrum->getMinPeakMz());
+    printf("Maximum m/z:%.1f\n", spectrum->getMaxPeakMz());
+
+    for (charge_state_index = 0; charge_state_index < charge_state_num; ++charge_state_index) {
+      SpectrumZState& zstate = zstates_array[charge_state_index];
+      FLOAT_T charged_mass = spectrum->getPrecursorMz() * (FLOAT_T)zstate.getCharge();
+
+      printf("Charge state:%d\n", zstate.getCharge());
+      printf("Neutral mass:%.2f\n", zstate.getNeutralMass());
+      printf("Charged mass:%.2f\n", charged_mass);
+      printf("M+H+ mass:%.2f\n", zstate.getSinglyChargedMass());
+    }
+  }
+}
+
 /****************************************************************************
  * MAIN
  ****************************************************************************/
@@ -72,44 +103,32 @@ int GetMs2Spectrum::main(int argc, char** argv) {
   }
   carp(CARP_DETAILED_DEBUG, "Creating spectrum collection.");
   Crux::SpectrumCollection* collection = SpectrumCollectionFactory::create(ms2_filename);
-  collection->parse();
   int num_found = 0;
-  
-  for (SpectrumIterator iter = collection->begin(); iter != collection->end(); ++iter) {
-  
-    Spectrum* spectrum = *iter;
-    carp(CARP_DETAILED_DEBUG, "spectrum number:%d", spectrum->getFirstScan());
-    if (spectrum->getFirstScan() >= min_scan && spectrum->getFirstScan() <= max_scan) {
-
-      /* Print either the spectrum or stats. */
-      if (!options) {
-        spectrum->print(stdout);
-      } else {
-        int charge_state_index = 0; 
-        int charge_state_num = spectrum->getNumZStates();
-        std::vector<SpectrumZState> zstates_array = spectrum->getZStates();
-  
-        printf("Scan number: %i\n", spectrum->getFirstScan());
-        printf("Precursor m/z:%.2f\n", spectrum->getPrecursorMz());
-        printf("Total Ion Current:%.2f\n", spectrum->getTotalEnergy());
-        printf("Base Peak Intensity:%.1f\n", spectrum->getMaxPeakIntensity()); // base is max
-        printf("Number of peaks:%d\n", spectrum->getNumPeaks());
-        printf("Minimum m/z:%.1f\n", spectrum->getMinPeakMz());
-        printf("Maximum m/z:%.1f\n", spectrum->getMaxPeakMz());
-    
-        for (charge_state_index = 0; charge_state_index < charge_state_num; ++charge_state_index) {
-          SpectrumZState& zstate = zstates_array[charge_state_index];
-          FLOAT_T charged_mass = spectrum->getPrecursorMz() * (FLOAT_T)zstate.getCharge();
-
-          printf("Charge state:%d\n", zstate.getCharge());
-          printf("Neutral mass:%.2f\n", zstate.getNeutralMass());
-          printf("Charged mass:%.2f\n", charged_mass);
-          printf("M+H+ mass:%.2f\n", zstate.getSinglyChargedMass());
-        }
-      }
-      num_found++;
+
+  // A single scan is read directly; collections with a scan index seek to it.
+  Spectrum* single = NULL;
+  if (min_scan == max_scan) {
+    single = collection->getSpectrum(min_scan);
+    if (single != NULL && single->getFirstScan() != min_scan) {
+      delete single;
+      single = NULL;
     }
   }
+  if (single != NULL) {
+    printSpectrum(single, options);
+    num_found++;
+    delete single;
+  } else {
+    // Print each spectrum as it is parsed rather than holding the whole file.
+    collection->stream([&](Spectrum* spectrum) {
+      carp(CARP_DETAILED_DEBUG, "spectrum number:%d", spectrum->getFirstScan());
+      if (spectrum->getFirstScan() >= min_scan && spectrum->getFirstScan() <= max_scan) {
+        printSpectrum(spectrum, options);
+        num_found++;
+      }
+      delete spectrum;
+    });
+  }
   delete collection;
 
   carp(CARP_INFO, "Found %d spectra.\n", num_found);
@@ -10,8 +10,116 @@
 #include "util/StringUtils.h"
 #include "TideSearchApplication.h"
 
+#include <atomic>
+#include <memory>
+#include <thread>
+
 using namespace std;
 
+// number of PSMs per worker thread whose evidence vectors are built at once
+static const size_t PSMS_PER_THREAD = 64;
+
+// spectrum-side inputs and results for scoring one PSM
+struct PsmEvidence {
+  string filePath;
+  Crux::SpectrumCollection* collection;
+  int scan;
+  int charge;
+  int maxPrecursorMass;
+  double unmodifiedMass;  // peptide mass for the unmodified evidence vector
+  double modifiedMass;    // peptide mass for the modified one, NaN if none are scored
+  // filled in by computeEvidence
+  bool empty;
+  double precursorMz;
+  shared_ptr< const vector<double> > unmodifiedEvidence;
+  shared_ptr< const vector<double> > modifiedEvidence;
+};
+
+/* Builds the evidence vectors for a batch of PSMs on numThreads threads.
+ * Each distinct spectrum is read and preprocessed once, and PSMs of the same
+ * spectrum share evidence vectors built for the same masses.
+ */
+static void computeEvidence(
+  vector<PsmEvidence>& psms,
+  int numThreads,
+  double binWidth,
+  double binOffset
+) {
+  // group the PSMs by spectrum and charge, keeping first-seen order
+  map< pair<pair<Crux::SpectrumCollection*, int>, int>, size_t> groupIndex;
+  vector< vector<size_t> > groups;
+  for (size_t i = 0; i < psms.size(); i++) {
+    pair<pair<Crux::SpectrumCollection*, int>, int> key =
+      make_pair(make_pair(psms[i].collection, psms[i].scan), psms[i].charge);
+    map< pair<pair<Crux::SpectrumCollection*, int>, int>, size_t>::const_iterator j =
+      groupIndex.find(key);
+    if (j == groupIndex.end()) {
+      groupIndex[key] = groups.size();
+      groups.push_back(vector<size_t>(1, i));
+    } else {
+      groups[j->second].push_back(i);
+    }
+  }
+
+  atomic<size_t> nextGroup(0);
+  auto worker = [&]() {
+    size_t g;
+    while ((g = nextGroup++) < groups.size()) {
+      const PsmEvidence& first = psms[groups[g].front()];
+      Crux::Spectrum* cruxSpectrum = first.collection->getSpectrum(first.scan);
+      if (cruxSpectrum == NULL) {
+        carp(CARP_FATAL, "Spectrum %d not found in %s", first.scan, first.filePath.c_str());
+      }
+      bool empty = cruxSpectrum->getNumPeaks() == 0;
+      double precursorMz = cruxSpectrum->getPrecursorMz();
+      Spectrum spectrum(first.scan, precursorMz);
+      if (!empty) {
+        cruxSpectrum->sortPeaks(_PEAK_LOCATION);
+        spectrum.AddChargeState(first.charge);
+        spectrum.ReservePeaks(cruxSpectrum->getNumPeaks());
+        for (PeakIterator i = cruxSpectrum->begin(); i != cruxSpectrum->end(); i++) {
+          spectrum.AddPeak(i->getLocation(), i->getIntensity());
+        }
+      }
+      delete cruxSpectrum;
+
+      map< pair<double, int>, shared_ptr< const vector<double> > > cache;
+      auto evidenceFor = [&](double mass, int maxPrecursorMass) {
+        shared_ptr< const vector<double> >& evidence = cache[make_pair(mass, maxPrecursorMass)];
+        if (!evidence) {
+          evidence = make_shared< const vector<double> >(spectrum.CreateEvidenceVector(
+            binWidth, binOffset, first.charge, mass, maxPrecursorMass));
+        }
+        return evidence;
+      };
+      for (vector<size_t>::const_iterator i = groups[g].begin(); i != groups[g].end(); i++) {
+        PsmEvidence& psm = psms[*i];
+        psm.empty = empty;
+        psm.precursorMz = precursorMz;
+        psm.unmodifiedEvidence.reset();
+        psm.modifiedEvidence.reset();
+        if (empty) {
+          continue;
+        }
+        psm.unmodifiedEvidence = evidenceFor(psm.unmodifiedMass, psm.maxPrecursorMass);
+        if (!std::isnan(psm.modifiedMass)) {
+          psm.modifiedEvidence = evidenceFor(psm.modifiedMass, psm.maxPrecursorMass);
+        }
+      }
+    }
+  };
+
+  numThreads = min(numThreads, (int)groups.size());
+  vector<thread> threads;
+  for (int i = 1; i < numThreads; i++) {
+    threads.push_back(thread(worker));
+  }
+  worker();
+  for (vector<thread>::iterator i = threads.begin(); i != threads.end(); i++) {
+    i->join();
+  }
+}
+
 LocalizeModificationApplication::LocalizeModificationApplication() {
   for (int i = 0; i <= 100; i++) {
     progress_.insert(i);
@@ -26,11 +134,14 @@ LocalizeModificationApplication::~LocalizeModificationApplication() {
  *   1. Look at spectrum files for each match
  *     - Check that the file exists
  *     - Load spectra into memory as a SpectrumCollection
- *   2. Search modified peptides against spectrum
+ *   2. Search modified peptides against spectrum, in batches of PSMs
+ *     - Build the evidence vectors for the batch on num-threads threads
  *     - For each PSM, generate a modified version of the peptide for each residue
  *       where the modification is (spectrum neutral mass - peptide mass)
  *     - Score each of these modified peptides against the spectrum
  *     - Report to output file
+ *   Peptides are built and scored on the main thread, in input order, because
+ *   MassConstants and the modification definitions are global.
  */
 int LocalizeModificationApplication::main(int argc, char** argv) {
   string inputFile = Params::GetString("input PSM file");
@@ -97,99 +208,126 @@ int LocalizeModificationApplication::main(int argc, char** argv) {
   TheoreticalPeakSetBYSparse tps(200);
 
   int topMatch = Params::GetInt("top-match");
+  double minModMass = Params::GetDouble("min-mod-mass");
+  int numThreads = Params::GetInt("num-threads");
+  if (numThreads < 1) {
+    numThreads = max(1, (int)thread::hardware_concurrency());
+  }
   uint64_t curStep = 0;
+  vector<Crux::Match*> batch;
+  vector<PsmEvidence> batchEvidence;
+  bool firstBatch = true;
   matchIter = new MatchIterator(matches);
   while (matchIter->hasNext()) {
-    Crux::Match* match = matchIter->next();
-    Crux::Spectrum* cruxSpectrum = match->getSpectrum();
-    int scan = match->getSpectrum()->getFirstScan();
-    string spectrumFile = match->getFilePath();
-    Crux::SpectrumCollection* collection = spectrumCollections[spectrumFile];
-    if ((cruxSpectrum = collection->getSpectrum(scan)) == NULL) {
-      carp(CARP_FATAL, "Spectrum %d not found in %s", scan, spectrumFile.c_str());
-    } else if (cruxSpectrum->getNumPeaks() == 0) {
-      delete cruxSpectrum;
-      carp(CARP_WARNING, "Spectrum %d had 0 peaks, skipping", scan);
-      continue;
+    // Collect the next batch of PSMs and build their evidence vectors in parallel
+    batch.clear();
+    while (batch.size() < (size_t)numThreads * PSMS_PER_THREAD && matchIter->hasNext()) {
+      batch.push_back(matchIter->next());
+    }
+    if (firstBatch) {
+      // the evidence vectors need the bin width and offset before any match is scored
+      firstBatch = false;
+      VariableModTable* modTable = getModTable(batch.front());
+      MassConstants::Init(modTable->ParsedModTable(),
+                          modTable->ParsedNtpepModTable(), modTable->ParsedCtpepModTable(),
+                          nullptr, nullptr,
+                          binWidth, binOffset);
+      delete modTable;
     }
-    cruxSpectrum->sortPeaks(_PEAK_LOCATION);
-    double precursorMz = cruxSpectrum->getPrecursorMz();
-    int charge = match->getCharge();
-    Spectrum spectrum(scan, precursorMz);
-    spectrum.AddChargeState(charge);
-    spectrum.ReservePeaks(cruxSpectrum->getNumPeaks());
-    for (PeakIterator i = cruxSpectrum->begin(); i != cruxSpectrum->end(); i++) {
-      spectrum.AddPeak((*i)->getLocation(), (*i)->getIntensity());
+    batchEvidence.resize(batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+      Crux::Match* match = batch[i];
+      PsmEvidence& ev = batchEvidence[i];
+      ev.filePath = match->getFilePath();
+      ev.collection = spectrumCollections[ev.filePath];
+      ev.scan = match->getSpectrum()->getFirstScan();
+      ev.charge = match->getCharge();
+      double neutralMass = match->getNeutralMass();
+      ev.maxPrecursorMass = MassConstants::mass2bin(neutralMass + MAX_XCORR_OFFSET + 30) + 50;
+      ev.unmodifiedMass =
+        (MassConstants::mass2bin(match->getPeptide()->calcModifiedMass()) - 0.5 + binOffset) * binWidth;
+      ev.modifiedMass = fabs(calcModMass(match)) < minModMass
+        ? numeric_limits<double>::quiet_NaN()
+        : (MassConstants::mass2bin(neutralMass) - 0.5 + binOffset) * binWidth;
     }
-    delete cruxSpectrum;
-
-    // Create proteins/peptides
-    VariableModTable* modTable = getModTable(match);
-    MassConstants::Init(modTable->ParsedModTable(),
-                        modTable->ParsedNtpepModTable(), modTable->ParsedCtpepModTable(),
-                        nullptr, nullptr,
-                        binWidth, binOffset);
-    Crux::Peptide* cruxPeptide = match->getPeptide();
-    vector<const pb::Protein*> proteins = createPbProteins(cruxPeptide);
-    vector<pb::AuxLocation> auxLocs;
-    vector<pb::Peptide> peptides = createPbPeptides(match, modTable, &auxLocs);
-
-    // Score each peptide
-    carp(CARP_DETAILED_INFO, "Scoring modified forms of %s against spectrum %d",
-         cruxPeptide->getModifiedSequenceWithMasses().c_str(), scan);
-    Results results(modTable);
-    double neutralMass = match->getNeutralMass();
-    int maxPrecursorMass = MassConstants::mass2bin(neutralMass + MAX_XCORR_OFFSET + 30) + 50;
-    vector<double> evidence = spectrum.CreateEvidenceVector(binWidth, binOffset, charge,
-      (MassConstants::mass2bin(cruxPeptide->calcModifiedMass()) - 0.5 + binOffset) * binWidth, maxPrecursorMass);
-    for (vector<pb::Peptide>::const_iterator i = peptides.begin(); i != peptides.end(); i++) {
-      Peptide peptide(*i, proteins);
-      tps.Clear();
-      peptide.ComputeTheoreticalPeaks(&tps);
-
-      if (i == peptides.begin() + 1) {
-        // After we've scored the unmodified peptide, create new evidence vector for scoring the modified peptides
-        evidence = spectrum.CreateEvidenceVector(binWidth, binOffset, charge,
-          (MassConstants::mass2bin(neutralMass) - 0.5 + binOffset) * binWidth, maxPrecursorMass);
+    computeEvidence(batchEvidence, numThreads, binWidth, binOffset);
+
+    for (size_t b = 0; b < batch.size(); b++) {
+      Crux::Match* match = batch[b];
+      const PsmEvidence& ev = batchEvidence[b];
+      int scan = ev.scan;
+      if (ev.empty) {
+        carp(CARP_WARNING, "Spectrum %d had 0 peaks, skipping", scan);
+        continue;
       }
+      double precursorMz = ev.precursorMz;
+      int charge = ev.charge;
+
+      // Create proteins/peptides
+      VariableModTable* modTable = getModTable(match);
+      MassConstants::Init(modTable->ParsedModTable(),
+                          modTable->ParsedNtpepModTable(), modTable->ParsedCtpepModTable(),
+                          nullptr, nullptr,
+                          binWidth, binOffset);
+      Crux::Peptide* cruxPeptide = match->getPeptide();
+      vector<const pb::Protein*> proteins = createPbProteins(cruxPeptide);
+      vector<pb::AuxLocation> auxLocs;
+      vector<pb::Peptide> peptides = createPbPeptides(match, modTable, &auxLocs);
+
+      // Score each peptide
+      carp(CARP_DETAILED_INFO, "Scoring modified forms of %s against spectrum %d",
+           cruxPeptide->getModifiedSequenceWithMasses().c_str(), scan);
+      Results results(modTable);
+      double neutralMass = match->getNeutralMass();
+      const vector<double>* evidence = ev.unmodifiedEvidence.get();
+      for (vector<pb::Peptide>::const_iterator i = peptides.begin(); i != peptides.end(); i++) {
+        Peptide peptide(*i, proteins);
+        tps.Clear();
+        peptide.ComputeTheoreticalPeaks(&tps);
+
+        if (i == peptides.begin() + 1) {
+          // After we've scored the unmodified peptide, switch to the evidence vector for the modified peptides
+          evidence = ev.modifiedEvidence.get();
+        }
 
-      double xcorr = 0;
-      for (vector<unsigned int>::const_iterator j = peptide.peaks_1b.begin();
-          j != peptide.peaks_1b.end();
-          j++) {
-        xcorr += evidence[*j];
+        double xcorr = 0;
+        for (vector<unsigned int>::const_iterator j = peptide.peaks_1b.begin();
+            j != peptide.peaks_1b.end();
+            j++) {
+          xcorr += (*evidence)[*j];
+        }
+        results.Add(cruxPeptide, &peptide, xcorr / 10000);
+      }
+      delete modTable;
+      for (vector<const pb::Protein*>::const_iterator i = proteins.begin(); i != proteins.end(); i++) {
+        delete *i;
       }
-      results.Add(cruxPeptide, &peptide, xcorr / 10000);
-    }
-    delete modTable;
-    for (vector<const pb::Protein*>::const_iterator i = proteins.begin(); i != proteins.end(); i++) {
-      delete *i;
-    }
 
-    // Write to output file
-    results.Sort();
-    for (size_t i = 0; i < topMatch && i < results.Size(); i++) {
-      Crux::Peptide& peptide = *(results.Peptide(i));
-      char* flanking = peptide.getFlankingAAs();
-      string flankingStr(flanking);
-      free(flanking);
-      writer.setColumnCurrentRow(FILE_COL,                  match->getFilePath());
-      writer.setColumnCurrentRow(SCAN_COL,                  scan);
-      writer.setColumnCurrentRow(CHARGE_COL,                charge);
-      writer.setColumnCurrentRow(SPECTRUM_PRECURSOR_MZ_COL, precursorMz);
-      writer.setColumnCurrentRow(SPECTRUM_NEUTRAL_MASS_COL, neutralMass);
-      writer.setColumnCurrentRow(PEPTIDE_MASS_COL,          peptide.calcModifiedMass());
-      writer.setColumnCurrentRow(XCORR_SCORE_COL,           results.XCorr(i));
-      writer.setColumnCurrentRow(SEQUENCE_COL,              peptide.getModifiedSequenceWithMasses());
-      writer.setColumnCurrentRow(MODIFICATIONS_COL,         peptide.getModsString());
-      writer.setColumnCurrentRow(PROTEIN_ID_COL,            peptide.getProteinIdsLocations());
-      writer.setColumnCurrentRow(FLANKING_AA_COL,           flankingStr);
-      writer.setColumnCurrentRow(TARGET_DECOY_COL,          match->isDecoy() ? "decoy" : "target");
-      writer.writeRow();
-    }
+      // Write to output file
+      results.Sort();
+      for (size_t i = 0; i < topMatch && i < results.Size(); i++) {
+        Crux::Peptide& peptide = *(results.Peptide(i));
+        char* flanking = peptide.getFlankingAAs();
+        string flankingStr(flanking);
+        free(flanking);
+        writer.setColumnCurrentRow(FILE_COL,                  match->getFilePath());
+        writer.setColumnCurrentRow(SCAN_COL,                  scan);
+        writer.setColumnCurrentRow(CHARGE_COL,                charge);
+        writer.setColumnCurrentRow(SPECTRUM_PRECURSOR_MZ_COL, precursorMz);
+        writer.setColumnCurrentRow(SPECTRUM_NEUTRAL_MASS_COL, neutralMass);
+        writer.setColumnCurrentRow(PEPTIDE_MASS_COL,          peptide.calcModifiedMass());
+        writer.setColumnCurrentRow(XCORR_SCORE_COL,           results.XCorr(i));
+        writer.setColumnCurrentRow(SEQUENCE_COL,              peptide.getModifiedSequenceWithMasses());
+        writer.setColumnCurrentRow(MODIFICATIONS_COL,         peptide.getModsString());
+        writer.setColumnCurrentRow(PROTEIN_ID_COL,            peptide.getProteinIdsLocations());
+        writer.setColumnCurrentRow(FLANKING_AA_COL,           flankingStr);
+        writer.setColumnCurrentRow(TARGET_DECOY_COL,          match->isDecoy() ? "decoy" : "target");
+        writer.writeRow();
+      }
 
-    curStep += cruxPeptide->getLength() + 1;
-    reportProgress(curStep, numSteps);
+      curStep += cruxPeptide->getLength() + 1;
+      reportProgress(curStep, numSteps);
+    }
   }
   delete matchIter;
   delete matches;
@@ -223,6 +361,7 @@ vector<string> LocalizeModificationApplication::getOptions() const {
     "min-mod-mass",
     "mod-precision",
     "top-match",
+    "num-threads",
     "output-dir",
     "overwrite",
     "parameter-file",
@@ -8,7 +8,9 @@
 
 #include <cmath>
 #include <fstream>
+#include <mutex>
 #include <numeric>
+#include <thread>
 
 using namespace Crux;
 using namespace std;
@@ -258,6 +260,7 @@ vector<string> ParamMedicApplication::getOptions() const {
     "pm-min-common-frag-peaks",
     "pm-max-scan-separation",
     "pm-min-peak-pairs",
+    "num-threads",
     "verbosity",
     "fileroot",
     "output-dir",
@@ -444,6 +447,18 @@ void ErrorCalc::nextFile() {
   }
 }
 
+RunAttributeDetector* ErrorCalc::createEmpty() const {
+  return new ErrorCalc();
+}
+
+void ErrorCalc::merge(const RunAttributeDetector& other) {
+  const ErrorCalc& o = dynamic_cast<const ErrorCalc&>(other);
+  numTotalSpectra_ += o.numTotalSpectra_;
+  for (map<int, PerChargeErrorCalc*>::iterator i = calcs_.begin(); i != calcs_.end(); i++) {
+    i->second->merge(*o.calcs_.find(i->first)->second);
+  }
+}
+
 void ErrorCalc::calcMassErrorDist(
   string* precursorFailure,
   string* fragmentFailure,
@@ -750,23 +765,22 @@ void PerChargeErrorCalc::processSpectrum(
   peaks.resize(Params::GetInt("pm-top-n-frag-peaks"));
 
   int precursorBinIndex = getBinIndexPrecursor(precursorMz);
-  map< int, pair< const Spectrum*, vector<Peak> > >::const_iterator prevIter =
-    spectra_.find(precursorBinIndex);
+  map<int, BinSpectrum>::const_iterator prevIter = spectra_.find(precursorBinIndex);
   if (prevIter != spectra_.end()) {
     // there was a previous spectrum in this bin; check to see if they're a pair
-    const Spectrum* prev = prevIter->second.first;
-    const double precursorMzPrev = getPrecursorMz(prev);
+    const BinSpectrum& prev = prevIter->second;
+    const double precursorMzPrev = prev.precursorMz;
     const double precursorMzDiffPpm = (precursorMz - precursorMzPrev) * MILLION / precursorMz;
     ++numSpectraSameBin_;
     // check precursor
     if (abs(precursorMzDiffPpm) <= Params::GetDouble("pm-max-precursor-delta-ppm")) {
       // check scan count between the scans
       ++numSpectraWithinPpm_;
-      if (abs(spectrum->getFirstScan() - prev->getFirstScan()) <= Params::GetInt("pm-max-scan-separation")) {
+      if (abs(spectrum->getFirstScan() - prev.firstScan) <= Params::GetInt("pm-max-scan-separation")) {
         // count the fragment peaks in common
         ++numSpectraWithinPpmAndScans_;
         vector< pair<Peak, Peak> > pairedFragments =
-          pairFragments(prevIter->second.second, peaks);
+          pairFragments(prev.peaks, peaks);
         if (pairedFragments.size() >= Params::GetInt("pm-min-common-frag-peaks")) {
           // we've got a pair! record everything
           sort(pairedFragments.begin(), pairedFragments.end(), sortPairedFragments);
@@ -785,7 +799,10 @@ void PerChargeErrorCalc::processSpectrum(
     }
   }
   // make the new spectrum its bin's representative
-  spectra_[precursorBinIndex] = make_pair(spectrum, peaks);
+  BinSpectrum& cur = spectra_[precursorBinIndex];
+  cur.precursorMz = precursorMz;
+  cur.firstScan = spectrum->getFirstScan();
+  cur.peaks.swap(peaks);
 }
 
 void PerChargeErrorCalc::clearBins() {
@@ -796,6 +813,23 @@ void PerChargeErrorCalc::nextFile() {
   clearBins();
 }
 
+void PerChargeErrorCalc::merge(const RunAttributeDetector& other) {
+  const PerChargeErrorCalc& o = dynamic_cast<const PerChargeErrorCalc&>(other);
+  numTotalSpectra_ += o.numTotalSpectra_;
+  numPassingSpectra_ += o.numPassingSpectra_;
+  numSpectraSameBin_ += o.numSpectraSameBin_;
+  numSpectraWithinPpm_ += o.numSpectraWithinPpm_;
+  numSpectraWithinPpmAndScans_ += o.numSpectraWithinPpmAndScans_;
+  numMultipleFragBins_ += o.numMultipleFragBins_;
+  numSingleFragBins_ += o.numSingleFragBins_;
+  pairedFragmentPeaks_.insert(pairedFragmentPeaks_.end(),
+    o.pairedFragmentPeaks_.begin(), o.pairedFragmentPeaks_.end());
+  pairedPrecursorMzs_.insert(pairedPrecursorMzs_.end(),
+    o.pairedPrecursorMzs_.begin(), o.pairedPrecursorMzs_.end());
+  // the other detector saw the most recent file, so its bins are current
+  spectra_ = o.spectra_;
+}
+
 int PerChargeErrorCalc::getNumPassingSpectra() const{
   return numPassingSpectra_;
 }
@@ -1182,36 +1216,105 @@ vector<double> binSpectrum(const Spectrum* spectrum) {
   return matrix;
 }
 
-int processSpectra(const vector<string>& files, vector<RunAttributeDetector*> detectors) {
+// stream the spectra in one file through the detectors, one spectrum at a time
+static int processFile(const string& file, const vector<RunAttributeDetector*>& detectors) {
+  int minPeaks = Params::GetInt("pm-min-scan-frag-peaks");
+  bool ignoreNoCharge = Params::GetBool("pm-ignore-no-charge");
   int n = 0;
-  for (vector<string>::const_iterator i = files.begin(); i != files.end(); i++) {
-    carp(CARP_INFO, "param-medic processing input file %s...", i->c_str());
-    if (i > files.begin()) {
-      for (vector<RunAttributeDetector*>::const_iterator j = detectors.begin();
-           j != detectors.end();
-           j++) {
-        (*j)->nextFile();
-      }
-    }
-    SpectrumCollection* collection = SpectrumCollectionFactory::create(*i);
-    collection->parse();
-    bool ignoreNoCharge = Params::GetBool("pm-ignore-no-charge");
-    for (SpectrumIterator j = collection->begin(); j != collection->end(); j++) {
-      if ((*j)->getNumPeaks() < Params::GetInt("pm-min-scan-frag-peaks") ||
-          (ignoreNoCharge && (*j)->getChargeStateAssigned())) {
-        continue;
-      }
+  SpectrumCollection* collection = SpectrumCollectionFactory::create(file);
+  collection->stream([&](Spectrum* spectrum) {
+    if (spectrum->getNumPeaks() >= minPeaks &&
+        !(ignoreNoCharge && spectrum->getChargeStateAssigned())) {
       // bin the spectrum peaks
-      vector<double> binned = ParamMedic::binSpectrum(*j);
+      vector<double> binned = ParamMedic::binSpectrum(spectrum);
       // run each of the detectors on the binned peaks
       for (vector<RunAttributeDetector*>::const_iterator k = detectors.begin();
            k != detectors.end();
            k++) {
-        (*k)->processSpectrum(*j, binned);
+        (*k)->processSpectrum(spectrum, binned);
       }
       n++;
     }
-    delete collection;
+    delete spectrum;
+  });
+  delete collection;
+  return n;
+}
+
+int processSpectra(const vector<string>& files, vector<RunAttributeDetector*> detectors) {
+  int numThreads = Params::GetInt("num-threads");
+  if (numThreads < 1) {
+    numThreads = thread::hardware_concurrency();
+  }
+  numThreads = min(numThreads, (int)files.size());
+
+  // every file after the first gets its own detectors, merged in file order afterwards
+  vector< vector<RunAttributeDetector*> > fileDetectors(files.size(), detectors);
+  bool parallel = numThreads > 1;
+  for (size_t i = 1; parallel && i < files.size(); i++) {
+    for (size_t j = 0; j < detectors.size(); j++) {
+      if ((fileDetectors[i][j] = detectors[j]->createEmpty()) == NULL) {
+        parallel = false;
+        break;
+      }
+    }
+  }
+  if (!parallel) {
+    for (size_t i = 1; i < files.size(); i++) {
+      for (size_t j = 0; j < detectors.size(); j++) {
+        if (fileDetectors[i][j] != detectors[j]) {
+          delete fileDetectors[i][j];
+        }
+      }
+    }
+
+    int n = 0;
+    for (vector<string>::const_iterator i = files.begin(); i != files.end(); i++) {
+      carp(CARP_INFO, "param-medic processing input file %s...", i->c_str());
+      if (i > files.begin()) {
+        for (vector<RunAttributeDetector*>::const_iterator j = detectors.begin();
+             j != detectors.end();
+             j++) {
+          (*j)->nextFile();
+        }
+      }
+      n += processFile(*i, detectors);
+    }
+    return n;
+  }
+
+  vector<int> fileCounts(files.size(), 0);
+  size_t nextFile = 0;
+  mutex fileMutex;
+  auto worker = [&]() {
+    while (true) {
+      size_t i;
+      {
+        lock_guard<mutex> lock(fileMutex);
+        if (nextFile >= files.size()) {
+          return;
+        }
+        i = nextFile++;
+        carp(CARP_INFO, "param-medic processing input file %s...", files[i].c_str());
+      }
+      fileCounts[i] = processFile(files[i], fileDetectors[i]);
+    }
+  };
+  vector<thread> threads;
+  for (int i = 0; i < numThreads; i++) {
+    threads.push_back(thread(worker));
+  }
+  for (vector<thread>::iterator i = threads.begin(); i != threads.end(); i++) {
+    i->join();
+  }
+
+  int n = fileCounts[0];
+  for (size_t i = 1; i < files.size(); i++) {
+    for (size_t j = 0; j < detectors.size(); j++) {
+      detectors[j]->merge(*fileDetectors[i][j]);
+      delete fileDetectors[i][j];
+    }
+    n += fileCounts[i];
   }
   return n;
 }
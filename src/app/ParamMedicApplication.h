@@ -83,11 +83,17 @@ class RunAttributeResult {
 
 class RunAttributeDetector {
  public:
+  virtual ~RunAttributeDetector() {}
   virtual void processSpectrum(
     const Crux::Spectrum* spectrum,
     const std::vector<double>& binnedSpectrum) = 0;
   virtual void nextFile() {}
   virtual RunAttributeResult summarize() const { return RunAttributeResult(); }
+  // new detector of the same type that has seen no spectra, used to process
+  // files in parallel; NULL if the detector does not support it
+  virtual RunAttributeDetector* createEmpty() const { return NULL; }
+  // fold in a detector from createEmpty() that processed the next file(s)
+  virtual void merge(const RunAttributeDetector& other) {}
 };
 
 class PerChargeErrorCalc;
@@ -102,6 +108,8 @@ class ErrorCalc : public RunAttributeDetector {
     const std::vector<double>& binnedSpectrum);
 
   void nextFile();
+  RunAttributeDetector* createEmpty() const;
+  void merge(const RunAttributeDetector& other);
 
   void calcMassErrorDist(
     std::string* precursorFailure,
@@ -137,6 +145,7 @@ class PerChargeErrorCalc : public RunAttributeDetector {
     const std::vector<double>& binnedSpectrum);
   void clearBins();
   void nextFile();
+  void merge(const RunAttributeDetector& other);
 
   int getNumPassingSpectra() const;
   int getNumSpectraSameBin() const;
@@ -178,8 +187,14 @@ class PerChargeErrorCalc : public RunAttributeDetector {
   // number and position of bins
   int numMultipleFragBins_;
   int numSingleFragBins_;
+  // what is kept of a bin's current spectrum
+  struct BinSpectrum {
+    double precursorMz;
+    int firstScan;
+    std::vector<Peak> peaks;
+  };
   // map from bin index to current spectrum
-  std::map< int, std::pair< const Crux::Spectrum*, std::vector<Peak> > > spectra_;
+  std::map<int, BinSpectrum> spectra_;
   // the paired peak values that we'll use to estimate mass error
   std::vector< std::pair<Peak, Peak> > pairedFragmentPeaks_;
   std::vector< std::pair<double, double> > pairedPrecursorMzs_;
@@ -50,6 +50,21 @@ void PhosphoLossProportionCalc::processSpectrum(
   sumProportionsInPhosphoLoss_ += binnedSpectrum[bin];
 }
 
+RunAttributeDetector* PhosphoLossProportionCalc::createEmpty() const {
+  return new PhosphoLossProportionCalc();
+}
+
+void PhosphoLossProportionCalc::merge(const RunAttributeDetector& other) {
+  const PhosphoLossProportionCalc& o = dynamic_cast<const PhosphoLossProportionCalc&>(other);
+  sumProportionsInPhosphoLoss_ += o.sumProportionsInPhosphoLoss_;
+  numSpectraUsed_ += o.numSpectraUsed_;
+  for (map<int, double>::const_iterator i = o.sumsProportionsPerControlPeak_.begin();
+       i != o.sumsProportionsPerControlPeak_.end();
+       i++) {
+    sumsProportionsPerControlPeak_[i->first] += i->second;
+  }
+}
+
 RunAttributeResult PhosphoLossProportionCalc::summarize() const {
   RunAttributeResult result;
   if (numSpectraUsed_ == 0) {
@@ -163,6 +178,20 @@ void Tmt6vs10Detector::processSpectrum(
   }
 }
 
+RunAttributeDetector* Tmt6vs10Detector::createEmpty() const {
+  return new Tmt6vs10Detector();
+}
+
+void Tmt6vs10Detector::merge(const RunAttributeDetector& other) {
+  const Tmt6vs10Detector& o = dynamic_cast<const Tmt6vs10Detector&>(other);
+  for (map< int, vector<double> >::const_iterator i = o.nominalMassAllPeaks_.begin();
+       i != o.nominalMassAllPeaks_.end();
+       i++) {
+    vector<double>& peaks = nominalMassAllPeaks_[i->first];
+    peaks.insert(peaks.end(), i->second.begin(), i->second.end());
+  }
+}
+
 RunAttributeResult Tmt6vs10Detector::summarize() const {
   int nPeaksWithEnoughTmt10 = 0;
   for (map< int, vector<double> >::const_iterator i = nominalMassAllPeaks_.begin();
@@ -311,6 +340,25 @@ void ReporterIonProportionCalc::processSpectrum(
   tmt10Detector_.processSpectrum(spectrum, binnedSpectrum);
 }
 
+RunAttributeDetector* ReporterIonProportionCalc::createEmpty() const {
+  return new ReporterIonProportionCalc();
+}
+
+void ReporterIonProportionCalc::merge(const RunAttributeDetector& other) {
+  const ReporterIonProportionCalc& o = dynamic_cast<const ReporterIonProportionCalc&>(other);
+  for (map< REPORTER_ION_TYPE, map<int, double> >::const_iterator i =
+         o.reporterTypeBinSumProportion_.begin();
+       i != o.reporterTypeBinSumProportion_.end();
+       i++) {
+    map<int, double>& m = reporterTypeBinSumProportion_[i->first];
+    for (map<int, double>::const_iterator j = i->second.begin(); j != i->second.end(); j++) {
+      m[j->first] += j->second;
+    }
+  }
+  tmt10Detector_.merge(o.tmt10Detector_);
+  foundMs3Scans_ = foundMs3Scans_ || o.foundMs3Scans_;
+}
+
 RunAttributeResult ReporterIonProportionCalc::summarize() const {
   // summarize the control bins. These sums are used in the t-statistic calculation
   const map<int, double>& mControl = reporterTypeBinSumProportion_.find(CONTROL)->second;
@@ -528,6 +576,16 @@ void SilacDetector::processSpectrum(
   bins_.push_back(calcBinIndexMassPrecursor(mass));
 }
 
+RunAttributeDetector* SilacDetector::createEmpty() const {
+  return new SilacDetector();
+}
+
+void SilacDetector::merge(const RunAttributeDetector& other) {
+  const SilacDetector& o = dynamic_cast<const SilacDetector&>(other);
+  scans_.insert(scans_.end(), o.scans_.begin(), o.scans_.end());
+  bins_.insert(bins_.end(), o.bins_.begin(), o.bins_.end());
+}
+
 RunAttributeResult SilacDetector::summarize() const {
   // construct the full set of all separations to summarize, both control and SILAC-label
   set<int> separations;
@@ -15,6 +15,8 @@ class PhosphoLossProportionCalc : public RunAttributeDetector {
     const Crux::Spectrum* spectrum,
     const std::vector<double>& binnedSpectrum);
   RunAttributeResult summarize() const;
+  RunAttributeDetector* createEmpty() const;
+  void merge(const RunAttributeDetector& other);
  private:
   double sumProportionsInPhosphoLoss_;
   int numSpectraUsed_;
@@ -29,6 +31,8 @@ class Tmt6vs10Detector : public RunAttributeDetector {
     const Crux::Spectrum* spectrum,
     const std::vector<double>& binnedSpectrum);
   RunAttributeResult summarize() const;
+  RunAttributeDetector* createEmpty() const;
+  void merge(const RunAttributeDetector& other);
  private:
   std::map< int, std::vector<double> > nominalMassAllPeaks_;
   std::map<int, double> nominalMassTmt6Mass_; // map from nominal mass to precise TMT6 mass
@@ -44,6 +48,8 @@ class ReporterIonProportionCalc : public RunAttributeDetector {
     const Crux::Spectrum* spectrum,
     const std::vector<double>& binnedSpectrum);
   RunAttributeResult summarize() const;
+  RunAttributeDetector* createEmpty() const;
+  void merge(const RunAttributeDetector& other);
  private:
   enum REPORTER_ION_TYPE { TMT_2PLEX, TMT_6PLEX, ITRAQ_4PLEX, ITRAQ_8PLEX, CONTROL };
   std::vector<double> tmt6PlexOnlyReporterIonMzs_;
@@ -62,6 +68,8 @@ class SilacDetector : public RunAttributeDetector {
     const Crux::Spectrum* spectrum,
     const std::vector<double>& binnedSpectrum);
   RunAttributeResult summarize() const;
+  RunAttributeDetector* createEmpty() const;
+  void merge(const RunAttributeDetector& other);
  private:
   std::vector<int> modBinDistances_;
   std::vector<int> controlBinDistances_;
@@ -31,7 +31,7 @@ int ReadSpectrumRecordsApplication::main(int argc, char** argv) {
     }
     cout << endl;
     for (PeakIterator j = (*i)->begin(); j != (*i)->end(); j++) {
-      cout << (*j)->getLocation() << " " << (*j)->getIntensity() << endl;
+      cout << j->getLocation() << " " << j->getIntensity() << endl;
     }
   }
 
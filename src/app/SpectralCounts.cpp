@@ -1,8 +1,11 @@
+#include <algorithm>
 #include <iterator>
+#include <queue>
 #include "SpectralCounts.h"
 #include "util/crux-utils.h"
 #include "util/Params.h"
 #include "io/OutputFiles.h"
+#include "model/IonConstraint.h"
 #include "model/Peptide.h"
 #include "model/ProteinPeptideIterator.h"
 #include "io/SpectrumCollectionFactory.h"
@@ -446,51 +449,129 @@ void SpectralCounts::computeEmpai() {
 }
 
 /**
- * For the spectrum associated with the match, sum the intensities of
- * all b and y ions that are not modified.
- * \return The sum of unmodified b and y ions.
+ * Fills mzs with the m/z of the unmodified b and y ions of sequence,
+ * in the order IonSeries predicts them.  masses is scratch space.
  */
-FLOAT_T SpectralCounts::sumMatchIntensity(Match* match,
-                                        Crux::SpectrumCollection* spectra) {
-  FLOAT_T match_intensity = 0;
-  char* peptide_seq = match->getSequence();
-  MODIFIED_AA_T* modified_sequence = match->getModSequence();
-  int charge = match->getCharge();
-  Spectrum* temp = match->getSpectrum();
-  int scan = temp->getFirstScan();
-
-  Spectrum* spectrum = spectra->getSpectrum(scan);
-
-  if (spectrum == NULL) {
-    carp(CARP_FATAL, "scan: %d doesn't exist or not found!", scan);
-    return 0.0;
+void SpectralCounts::predictByIonMzs(const MODIFIED_AA_T* sequence, int length,
+                                     int max_charge, vector<FLOAT_T>& masses,
+                                     vector<FLOAT_T>& mzs) {
+  masses.resize(length + 1);
+  masses[0] = 0;
+  for (int i = 1; i <= length; i++) {
+    masses[i] = masses[i - 1] + get_mass_mod_amino_acid(sequence[i - 1], MONO);
   }
+  mzs.clear();
+  for (int cleavage_idx = 1; cleavage_idx < length; cleavage_idx++) {
+    FLOAT_T b_mass = masses[cleavage_idx];
+    for (int charge = 1; charge <= max_charge; charge++) {
+      mzs.push_back((b_mass + (MASS_H_MONO*(FLOAT_T)charge))/(FLOAT_T)charge);
+    }
+    FLOAT_T y_mass = masses[length] - masses[length - cleavage_idx];
+    y_mass += MASS_H2O_MONO;
+    for (int charge = 1; charge <= max_charge; charge++) {
+      mzs.push_back((y_mass + (MASS_H_MONO*(FLOAT_T)charge))/(FLOAT_T)charge);
+    }
+  }
+}
 
-  Ion* ion;
-  SCORER_TYPE_T score_type = XCORR;
-  IonConstraint* ion_constraint =
-    IonConstraint::newIonConstraintSmart(score_type, charge);
-  IonSeries* ion_series = new IonSeries(ion_constraint, charge);
-  ion_series->update(peptide_seq, modified_sequence);
-  ion_series->predictIons();
-  for (IonIterator ion_it = ion_series->begin();
-       ion_it != ion_series->end(); ++ion_it) {
-    ion = (*ion_it);
-    if (ion -> getType() == B_ION || ion -> getType() == Y_ION) {
-  
-      if (!ion->isModified()) {
-        Peak* peak = spectrum->getNearestPeak(ion->getMassZ(),
-                                                bin_width_);
-        if (peak != NULL) {
-          match_intensity += peak->getIntensity();
-        }
+bool SpectralCounts::peakMzLess(const pair<FLOAT_T, FLOAT_T>& x,
+                                const pair<FLOAT_T, FLOAT_T>& y) {
+  return x.first < y.first;
+}
+
+/**
+ * \returns The intensity of the peak nearest mz and within tolerance
+ * of it, or 0 if there is none.  Peaks are (m/z, intensity) sorted by
+ * m/z; of two equally near peaks the lower one is used.
+ */
+FLOAT_T SpectralCounts::nearestPeakIntensity(const vector< pair<FLOAT_T, FLOAT_T> >& peaks,
+                                             FLOAT_T mz, FLOAT_T tolerance) {
+  vector< pair<FLOAT_T, FLOAT_T> >::const_iterator above =
+    lower_bound(peaks.begin(), peaks.end(), make_pair(mz, (FLOAT_T)0), peakMzLess);
+  const pair<FLOAT_T, FLOAT_T>* nearest = NULL;
+  FLOAT_T min_distance = tolerance;
+  if (above != peaks.begin() && mz - (above - 1)->first <= min_distance) {
+    nearest = &*(above - 1);
+    min_distance = mz - nearest->first;
+  }
+  if (above != peaks.end() && above->first - mz <= tolerance &&
+      (nearest == NULL || above->first - mz < min_distance)) {
+    nearest = &*above;
+  }
+  return nearest != NULL ? nearest->second : 0;
+}
+
+/**
+ * For the spectrum associated with each match, sum the intensities of
+ * all b and y ions that are not modified.  Matches are grouped by scan
+ * so that each spectrum is read once as the file is streamed.
+ * \return The sum of unmodified b and y ions for each match, in the
+ * order of matches_.
+ */
+vector<FLOAT_T> SpectralCounts::sumMatchIntensities() {
+  vector<FLOAT_T> intensities(matches_.size(), 0);
+  map<int, vector< pair<size_t, Match*> > > scan_matches;
+  size_t match_idx = 0;
+  for (set<Match*>::iterator match_it = matches_.begin();
+       match_it != matches_.end(); ++match_it, ++match_idx) {
+    int scan = (*match_it)->getSpectrum()->getFirstScan();
+    scan_matches[scan].push_back(make_pair(match_idx, *match_it));
+  }
+
+  map<int, int> max_ion_charges; // by precursor charge
+  vector< pair<FLOAT_T, FLOAT_T> > peaks; // m/z, intensity
+  vector<FLOAT_T> masses;
+  vector<FLOAT_T> ion_mzs;
+  Crux::SpectrumCollection* spectra =
+    SpectrumCollectionFactory::create(Params::GetString("input-ms2"));
+  spectra->stream([&](Spectrum* spectrum) {
+    map<int, vector< pair<size_t, Match*> > >::iterator found =
+      scan_matches.find(spectrum->getFirstScan());
+    if (found == scan_matches.end()) {
+      delete spectrum;
+      return;
+    }
+    peaks.clear();
+    for (PeakIterator peak = spectrum->begin(); peak != spectrum->end(); ++peak) {
+      peaks.push_back(make_pair(peak->getLocation(), peak->getIntensity()));
+    }
+    delete spectrum;
+    stable_sort(peaks.begin(), peaks.end(), peakMzLess);
+
+    for (vector< pair<size_t, Match*> >::const_iterator i = found->second.begin();
+         i != found->second.end(); ++i) {
+      Match* match = i->second;
+      int charge = match->getCharge();
+      map<int, int>::iterator max_charge = max_ion_charges.find(charge);
+      if (max_charge == max_ion_charges.end()) {
+        IonConstraint* ion_constraint = IonConstraint::newIonConstraintSmart(XCORR, charge);
+        max_charge = max_ion_charges.insert(
+          make_pair(charge, min(ion_constraint->getMaxCharge(), charge))).first;
+        IonConstraint::free(ion_constraint);
+      }
+      MODIFIED_AA_T* modified_sequence = match->getModSequence();
+      if (modified_sequence == NULL) {
+        carp(CARP_FATAL, "Cannot predict ions for scan %d without a sequence.", found->first);
+      }
+      predictByIonMzs(modified_sequence, match->getPeptide()->getLength(),
+                      max_charge->second, masses, ion_mzs);
+      freeModSeq(modified_sequence);
+
+      FLOAT_T match_intensity = 0;
+      for (vector<FLOAT_T>::const_iterator mz = ion_mzs.begin(); mz != ion_mzs.end(); ++mz) {
+        match_intensity += nearestPeakIntensity(peaks, *mz, bin_width_);
       }
+      intensities[i->first] = match_intensity;
     }
-  }
-  delete ion_series;
-  free(peptide_seq);
+    // like a lookup by scan, only the first spectrum with a scan number is used
+    scan_matches.erase(found);
+  });
+  delete spectra;
 
-  return match_intensity;
+  if (!scan_matches.empty()) {
+    carp(CARP_FATAL, "scan: %d doesn't exist or not found!", scan_matches.begin()->first);
+  }
+  return intensities;
 }
 
 
@@ -507,14 +588,15 @@ FLOAT_T SpectralCounts::sumMatchIntensity(Match* match,
  * observed per protein.
  */
 void SpectralCounts::getPeptideScores() {
-  Crux::SpectrumCollection* spectra = NULL;
-  // for SIN, parse out spectrum collection from ms2 file
+  // for SIN, sum the ion intensities of every match from the ms2 file
+  vector<FLOAT_T> match_intensities;
   if( measure_ == MEASURE_SIN ) {
-    spectra = SpectrumCollectionFactory::create(Params::GetString("input-ms2"));
+    match_intensities = sumMatchIntensities();
   }
 
+  size_t match_idx = 0;
   for(set<Match*>::iterator match_it = matches_.begin();
-      match_it != matches_.end(); ++match_it) {
+      match_it != matches_.end(); ++match_it, ++match_idx) {
 
     FLOAT_T match_intensity = 1; // for NSAF just count each for the peptide/
 
@@ -522,7 +604,7 @@ void SpectralCounts::getPeptideScores() {
     // for sin, calculate total ion intensity for match by
     // summing up peak intensities
     if (measure_ == MEASURE_SIN) {
-      match_intensity = sumMatchIntensity(match, spectra);
+      match_intensity = match_intensities[match_idx];
     }
 
     // add ion_intensity to peptide scores
@@ -550,10 +632,6 @@ void SpectralCounts::getPeptideScores() {
 
   }
 
-  if (measure_ == MEASURE_SIN) {
-    delete spectra;
-  }
-
   // for emPAI we just need a count of unique peptides
   if (measure_ == MEASURE_EMPAI) {
     PeptideToScore::iterator itr = peptide_scores_.begin();
@@ -922,42 +1000,113 @@ void SpectralCounts::getMetaRanks() {
  * Greedily finds a peptide-to-protein mapping where each
  * peptide is only mapped to a single meta-protein. 
  *
- * Would of been better to implement with priority queue w/
- * adjancency lists: O(n*log(n)) but input size should be
- * small enough that performance should not be an issue.
+ * Meta proteins are kept in a priority queue and a peptide-to-meta
+ * protein index is used so that picking one only updates the meta
+ * proteins that share its peptides.
  */
 void SpectralCounts::performParsimonyAnalysis() {
   carp(CARP_DEBUG, "Performing Greedy Parsimony analysis");
   MetaMapping result(comparePeptideSets);
-  vector< pair<PeptideSet, MetaProtein > > peps_vector;
 
-  // get all meta mappings into a vector 
-  for (MetaMapping::iterator meta_iter = meta_mapping_.begin();
+  // number the meta proteins in map order and the peptides by sequence
+  vector<MetaMapping::const_iterator> groups;
+  map<Peptide*, int, bool(*)(Peptide*, Peptide*)> peptide_ids(Peptide::lessThan);
+  vector< vector<int> > group_peptides;
+  for (MetaMapping::const_iterator meta_iter = meta_mapping_.begin();
        meta_iter != meta_mapping_.end(); ++meta_iter) {
-    peps_vector.push_back((*meta_iter));
+    groups.push_back(meta_iter);
+    group_peptides.push_back(vector<int>());
+    for (PeptideSet::const_iterator pep_iter = meta_iter->first.begin();
+         pep_iter != meta_iter->first.end(); ++pep_iter) {
+      int id = peptide_ids.insert(make_pair(*pep_iter, (int)peptide_ids.size())).first->second;
+      group_peptides.back().push_back(id);
+    }
+  }
+  vector< vector<int> > peptide_groups(peptide_ids.size());
+  for (size_t i = 0; i < group_peptides.size(); i++) {
+    for (vector<int>::const_iterator j = group_peptides[i].begin();
+         j != group_peptides[i].end(); ++j) {
+      peptide_groups[*j].push_back(i);
+    }
   }
 
+  // Each round picks the largest remaining meta protein.  The old loop
+  // re-sorted with std::sort, which left the pick among equal sizes
+  // unspecified; ties are now broken as a stable sort by size would
+  // break them: to the one that was larger in the latest round where
+  // they differed, then to the later one in map order.  Each meta
+  // protein keeps the rounds in which its size changed, and each heap
+  // entry the length of that history when it was pushed, so older
+  // entries can be recognized.
+  vector< vector< pair<int, size_t> > > sizes(groups.size());
+  typedef pair<int, size_t> HeapEntry; // meta protein, history length
+  auto before = [&sizes](const HeapEntry& x, const HeapEntry& y) {
+    size_t i = x.second - 1;
+    size_t j = y.second - 1;
+    const vector< pair<int, size_t> >& x_sizes = sizes[x.first];
+    const vector< pair<int, size_t> >& y_sizes = sizes[y.first];
+    while (x_sizes[i].second == y_sizes[j].second) {
+      if (i == 0 && j == 0) {
+        return x.first < y.first;
+      }
+      int x_round = x_sizes[i].first;
+      int y_round = y_sizes[j].first;
+      if (x_round >= y_round) { --i; }
+      if (y_round >= x_round) { --j; }
+    }
+    return x_sizes[i].second < y_sizes[j].second;
+  };
+  priority_queue<HeapEntry, vector<HeapEntry>, decltype(before)> heap(before);
+  for (size_t i = 0; i < groups.size(); i++) {
+    sizes[i].push_back(make_pair(0, group_peptides[i].size()));
+    heap.push(make_pair(i, 1));
+  }
 
   // greedy algorithm to pick off the meta proteins with
   // most peptide mappings
-  while (!peps_vector.empty()) {
-    sort(peps_vector.begin(), peps_vector.end(), setsAreEqualSize);
-    pair<PeptideSet, MetaProtein> node = peps_vector.back();
-    peps_vector.pop_back();
-    if (node.first.size() == 0) { break; }// do not enter anything without peptide sizes
-    result.insert(node);
-    PeptideSet cur_peptides = node.first;
-    // update the peptide sets for the rest of meta proteins
-    for (vector< pair<PeptideSet, MetaProtein > >::iterator
-         iter = peps_vector.begin();
-         iter != peps_vector.end(); ++iter) {
-      PeptideSet peptides = (*iter).first;
-      PeptideSet difference(Peptide::lessThan);
-      set_difference(peptides.begin(), peptides.end(),
-                     cur_peptides.begin(), cur_peptides.end(),
-                     inserter(difference, difference.end()),
-                    Peptide::lessThan);
-      (*iter).first = difference;
+  vector<bool> picked(groups.size(), false);
+  vector<bool> covered(peptide_ids.size(), false);
+  vector<int> changed;
+  int round = 0;
+  while (!heap.empty()) {
+    HeapEntry top = heap.top();
+    heap.pop();
+    int group = top.first;
+    if (picked[group] || top.second != sizes[group].size()) {
+      continue;
+    }
+    if (sizes[group].back().second == 0) { break; }// do not enter anything without peptide sizes
+    picked[group] = true;
+    ++round;
+
+    // the remaining peptides go to this meta protein and are removed
+    // from every other one that contains them
+    PeptideSet cur_peptides(Peptide::lessThan);
+    changed.clear();
+    vector<int>::const_iterator i = group_peptides[group].begin();
+    for (PeptideSet::const_iterator pep_iter = groups[group]->first.begin();
+         pep_iter != groups[group]->first.end(); ++pep_iter, ++i) {
+      if (covered[*i]) {
+        continue;
+      }
+      covered[*i] = true;
+      cur_peptides.insert(cur_peptides.end(), *pep_iter);
+      for (vector<int>::const_iterator j = peptide_groups[*i].begin();
+           j != peptide_groups[*i].end(); ++j) {
+        if (picked[*j]) {
+          continue;
+        }
+        vector< pair<int, size_t> >& group_sizes = sizes[*j];
+        if (group_sizes.back().first != round) {
+          group_sizes.push_back(make_pair(round, group_sizes.back().second));
+          changed.push_back(*j);
+        }
+        --group_sizes.back().second;
+      }
+    }
+    result.insert(make_pair(cur_peptides, groups[group]->second));
+    for (vector<int>::const_iterator i = changed.begin(); i != changed.end(); ++i) {
+      heap.push(make_pair(*i, sizes[*i].size()));
     }
   }
   meta_mapping_ = result;
@@ -1167,16 +1316,6 @@ bool SpectralCounts::compareMetaProteins(MetaProtein set_one,
   return set_one.size() < set_two.size();
 }
 
-/**
- * Compare the size of the PeptideSets in the two given pairs.
- * \returns True if the PeptideSets are the same size, else false.
- */
-bool SpectralCounts::setsAreEqualSize(
-  const pair<PeptideSet, MetaProtein>& peps_one ,
-  const pair<PeptideSet, MetaProtein>& peps_two) {
-  return ((peps_one).first.size() < (peps_two).first.size());
-}
-
 bool SpectralCounts::compareMetaScorePair(
   const std::pair<FLOAT_T, MetaProtein>& x,
   const std::pair<FLOAT_T, MetaProtein>& y) {
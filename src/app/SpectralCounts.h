@@ -102,8 +102,13 @@ class SpectralCounts: public CruxApplication {
 
   void computeEmpai();
   void makeUniqueMapping();
-  FLOAT_T sumMatchIntensity(Crux::Match* match,
-                          Crux::SpectrumCollection* spectra);
+  std::vector<FLOAT_T> sumMatchIntensities();
+  static void predictByIonMzs(const MODIFIED_AA_T* sequence, int length, int max_charge,
+                              std::vector<FLOAT_T>& masses, std::vector<FLOAT_T>& mzs);
+  static bool peakMzLess(const std::pair<FLOAT_T, FLOAT_T>& x,
+                         const std::pair<FLOAT_T, FLOAT_T>& y);
+  static FLOAT_T nearestPeakIntensity(const std::vector< std::pair<FLOAT_T, FLOAT_T> >& peaks,
+                                      FLOAT_T mz, FLOAT_T tolerance);
   SCORER_TYPE_T get_qval_type(MatchCollection* match_collection);
 
   void writeRankedPeptides();
@@ -179,11 +184,10 @@ class SpectralCounts: public CruxApplication {
   // comparison function declarations
   static bool comparePeptideSets(PeptideSet, PeptideSet);
   static bool compareMetaProteins(MetaProtein, MetaProtein);
-  static bool setsAreEqualSize(const std::pair<PeptideSet, MetaProtein>&,
-                               const std::pair<PeptideSet, MetaProtein>&);
   static bool compareMetaScorePair(const std::pair<FLOAT_T, MetaProtein>&,
                                    const std::pair<FLOAT_T, MetaProtein>&);
- 
+
+  friend class SpectralCountsTest;
 }; // class
 
 
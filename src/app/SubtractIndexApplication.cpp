@@ -13,11 +13,36 @@
 #include "io/carp.h"
 #include "app/tide/abspath.h"
 #include "app/tide/records_to_vector-inl.h"
+#include <unordered_map>
+#include <unordered_set>
 
 #define CHECK(x) GOOGLE_CHECK(x)
 
 using namespace std;
 
+/**
+ * Reads the next peptide from an index.
+ * \returns false if there are no more peptides
+ */
+static bool readPeptide(HeadedRecordReader& reader, pb::Peptide* peptide) {
+  if (reader.Done()) {
+    return false;
+  }
+  reader.Read(peptide);
+  return true;
+}
+
+/**
+ * \returns the unmodified sequence of a peptide, as Peptide::Seq() does
+ */
+static string peptideSeq(const pb::Peptide& peptide, const ProteinVec& proteins) {
+  if (peptide.has_decoy_sequence()) {
+    return peptide.decoy_sequence();
+  }
+  const pb::Location& location = peptide.first_location();
+  return proteins[location.protein_id()]->residues().substr(location.pos(), peptide.length());
+}
+
 /**
  * \returns a blank SubtractIndexApplication object
  */
@@ -139,130 +164,75 @@ int SubtractIndexApplication::main(int argc, char** argv) {
   CHECK(writer.OK());
 
   int mass_precision = Params::GetInt("mass-precision");
-  vector< pair<pb::Peptide, bool> > pepList1;
-  vector<pb::Peptide> pepList2;
-  bool done = false;
-  while (!peptide_reader1.Done()) {
-    // populate lists of peptides
-    pb::Peptide pep1;
-    peptide_reader1.Read(&pep1);
-    pepList1.push_back(make_pair(pep1, false));
-    while (pepList1.front().first.mass() == pepList1.back().first.mass()) {
-      if (peptide_reader1.Done()) {
-        done = true;
-        break;
-      }
-      peptide_reader1.Read(&pep1);
-      pepList1.push_back(make_pair(pep1, false));
-    }
-    if (done) {
-      break;
-    }
-    double curMass = pepList1.front().first.mass();
-    if (!pepList2.empty() && pepList2.back().mass() < curMass) {
-      pepList2.clear();
+  // both indexes are sorted by mass, so walk them together one mass at a time
+  pb::Peptide next1, next2;
+  bool has1 = readPeptide(peptide_reader1, &next1);
+  bool has2 = readPeptide(peptide_reader2, &next2);
+  vector<pb::Peptide> pepList1;
+  vector<bool> matched;
+  unordered_set<string> targets2;
+  unordered_map<string, size_t> targetToDecoy;
+  while (has1) {
+    // populate the peptides of index 1 with the current mass
+    double curMass = next1.mass();
+    pepList1.clear();
+    while (has1 && next1.mass() == curMass) {
+      pepList1.push_back(pb::Peptide());
+      pepList1.back().Swap(&next1);
+      has1 = readPeptide(peptide_reader1, &next1);
     }
-    if (pepList2.empty() || pepList2.front().mass() == curMass) {
-      while (!peptide_reader2.Done()) {
-        pb::Peptide pep2;
-        peptide_reader2.Read(&pep2);
-        if (pep2.mass() < curMass) {
-          continue;
-        }
-        pepList2.push_back(pep2);
-        if (pep2.mass() > curMass) {
-          break;
-        }
+    // and the target sequences of index 2 with the same mass
+    targets2.clear();
+    while (has2 && next2.mass() <= curMass) {
+      if (next2.mass() == curMass && !next2.has_decoy_index()) {
+        targets2.insert(getModifiedPeptideSeq(&next2, &proteins2));
       }
+      has2 = readPeptide(peptide_reader2, &next2);
     }
 
-    // match targets to decoys
-    map<vector< pair<pb::Peptide, bool> >::iterator, vector< pair<pb::Peptide, bool> >::iterator> targetToDecoy;
-    for (vector< pair<pb::Peptide, bool> >::iterator i = pepList1.begin(); i != pepList1.end(); i++) {
-      if (i->first.has_decoy_index()) {
-        continue;
-      }
-      Peptide iPep(i->first, proteins1);
-      for (vector< pair<pb::Peptide, bool> >::iterator j = pepList1.begin(); j != pepList1.end(); j++) {
-        if (!j->first.has_decoy_index()) {
-          continue;
-        }
-        Peptide jPep(j->first, proteins1);
-        const pb::Protein* jProtein = proteins1[jPep.FirstLocProteinId()];
-        const string& residues = jProtein->residues();
-        const string originalTarget = residues.substr(residues.length() - jPep.Len());
-        if (iPep.Seq() == originalTarget) {
-          targetToDecoy[i] = j;
-          break;
+    matched.assign(pepList1.size(), false);
+    if (!targets2.empty()) {
+      // match targets to decoys, through the target each decoy was made from
+      targetToDecoy.clear();
+      for (size_t i = 0; i < pepList1.size(); i++) {
+        const pb::Peptide& pep = pepList1[i];
+        if (pep.has_decoy_index()) {
+          const string& residues = proteins1[pep.first_location().protein_id()]->residues();
+          targetToDecoy.emplace(residues.substr(residues.length() - pep.length()), i);
         }
       }
-    }
 
-    // match peptides in lists
-    for (vector< pair<pb::Peptide, bool> >::iterator i = pepList1.begin(); i != pepList1.end(); i++) {
-      if (i->first.mass() > curMass) {
-        break;
-      } else if (i->first.has_decoy_index()) {
-        continue; // don't match decoys
-      }
-      string pepStr1 = getModifiedPeptideSeq(&i->first, &proteins1);
-      for (vector<pb::Peptide>::const_iterator j = pepList2.begin(); j != pepList2.end(); j++) {
-        if (j->mass() > curMass) {
-          break;
-        } else if (j->has_decoy_index()) {
-          continue;
+      // match peptides in lists
+      for (size_t i = 0; i < pepList1.size(); i++) {
+        const pb::Peptide& pep = pepList1[i];
+        if (pep.has_decoy_index() ||
+            targets2.find(getModifiedPeptideSeq(&pep, &proteins1)) == targets2.end()) {
+          continue; // don't match decoys
         }
-        string pepStr2 = getModifiedPeptideSeq(&*j, &proteins2);
-        if (pepStr1 == pepStr2) {
-          i->second = true;
-          map<vector< pair<pb::Peptide, bool> >::iterator, vector< pair<pb::Peptide, bool> >::iterator>::iterator lookup = targetToDecoy.find(i);
-          if (lookup != targetToDecoy.end()) {
-            lookup->second->second = true; // mark decoy as matched
-          }
-          break;
+        matched[i] = true;
+        unordered_map<string, size_t>::const_iterator lookup =
+          targetToDecoy.find(peptideSeq(pep, proteins1));
+        if (lookup != targetToDecoy.end()) {
+          matched[lookup->second] = true; // mark decoy as matched
         }
       }
     }
 
     // write peptides
-    for (vector< pair<pb::Peptide, bool> >::iterator i = pepList1.begin(); i != pepList1.end(); i++) {
-      if (i->first.mass() > curMass) {
-        break;
-      } else if (!i->second) {
-        CHECK(writer.Write(&i->first));
-        if (write_peptides) {
-          string pepStr = getModifiedPeptideSeq(&i->first, &proteins1);
-          double mass = i->first.mass();
-          if (!i->first.has_decoy_index()) {
-            if (out_target_list) {
-              *out_target_list << pepStr << '\t'
-                               << StringUtils::ToString(mass, mass_precision)
-                               << endl;
-            }
-          } else {
-            if (out_decoy_list) {
-              *out_decoy_list << pepStr << '\t'
-                              << StringUtils::ToString(mass, mass_precision)
-                              << endl;
-            }
-          }
-        }
-      }
-    }
-
-    // clean up peptide lists
-    if (!pepList1.empty()) {
-      if (pepList1.back().first.mass() == curMass) {
-        pepList1.clear();
-      } else {
-        pepList1.erase(pepList1.begin(), pepList1.end() - 1);
+    for (size_t i = 0; i < pepList1.size(); i++) {
+      if (matched[i]) {
+        continue;
       }
-    }
-    if (!pepList2.empty()) {
-      if (pepList2.back().mass() == curMass) {
-        pepList2.clear();
-      } else {
-        pepList2.erase(pepList2.begin(), pepList2.end() - 1);
+      pb::Peptide& pep = pepList1[i];
+      CHECK(writer.Write(&pep));
+      if (write_peptides) {
+        string pepStr = getModifiedPeptideSeq(&pep, &proteins1);
+        ofstream* out_list = !pep.has_decoy_index() ? out_target_list : out_decoy_list;
+        if (out_list) {
+          *out_list << pepStr << '\t'
+                    << StringUtils::ToString(pep.mass(), mass_precision)
+                    << endl;
+        }
       }
     }
   }
@@ -18,6 +18,7 @@ bool TideMatchSet::concat_ = false;
 string TideMatchSet::decoy_prefix_ = "";
 int TideMatchSet::psm_id_mzTab_  = 1;
 string TideMatchSet::fasta_file_name_ = "null";
+vector<string> TideMatchSet::index_names_;
 
 
 // column IDs are defined in ./src/io/MatchColumns.h and /src/io/MatchColumns.cpp
@@ -183,6 +184,10 @@ string TideMatchSet::getHeader(TSV_OUTPUT_FORMATS_T format, string tide_index_mz
         header += '\t';
         header += get_column_header(header_cols[i]);
       }
+      if (format == TIDE_SEARCH_TSV && index_names_.size() > 1) {
+        header += '\t';
+        header += get_column_header(INDEX_NAME_COL);
+      }
       header += '\n';
       return header;
     case TIDE_SEARCH_MZTAB_TSV:
@@ -427,6 +432,7 @@ void TideMatchSet::gatherTargetsDecoys() {
       break;
     }
   }  
+  psm_scores_processed_ = true;
 }
 
 void TideMatchSet::calculateAdditionalScores(PSMScores& psm_scores, const SpectrumCollection::SpecCharge* sc) {  // Additional scores are:  delta_cn, delta_lcn, tailor;
@@ -823,6 +829,10 @@ cnt[i] counts only decoys, for i = 0-->decoy_num
       if (i < numHeaders-1)  // If not the last column, add a column separator
         report += '\t';
     }
+    if (format == TIDE_SEARCH_TSV && index_names_.size() > 1) {  // multi-index search
+      report += '\t';
+      report += index_names_[peptide->IndexId()];
+    }
     report += '\n'; 
   }
 }
@@ -121,6 +121,7 @@ class TideMatchSet {
   static bool concat_;
   static int psm_id_mzTab_;
   static string fasta_file_name_;
+  static vector<string> index_names_;  // searched peptide indices; reported per PSM if more than one
 
 //  private:
   PSMScores concat_or_target_psm_scores_;
@@ -44,6 +44,12 @@ const double TideSearchApplication::XCORR_SCALING = 100000000.0;
  * tide/spectrum_preprocess2.cc). */
 const double TideSearchApplication::RESCALE_FACTOR = 20.0;
 
+const char* TideSearchApplication::search_stage_names_[NUMBER_SEARCH_STAGES] = {
+  "spectrum-lock-wait", "spectrum-reading", "active-range", "preprocessing",
+  "xcorr-scoring", "pvalue-scoring", "gather-psms", "report-formatting",
+  "results-lock-wait", "results-writing"
+};
+
 // Things done:
 // -- handle terminal mod structure in the peptides internally. GH issue: #639
 // -- missing charge states, 0 charege states,, override charge states handled. --> need to update doc. GH issue: #557, #607
@@ -53,6 +59,8 @@ const double TideSearchApplication::RESCALE_FACTOR = 20.0;
 TideSearchApplication::TideSearchApplication() {
   remove_index_ = "";
   spectrum_flag_ = NULL;
+  results_to_memory_ = false;
+  delete_spectrum_records_ = true;
   decoy_num_ = 0;
   num_range_skipped_ = 0;
   num_precursors_skipped_ = 0;
@@ -76,6 +84,11 @@ TideSearchApplication::TideSearchApplication() {
   out_pin_target_ = NULL;        // pin output format for percolator
   out_pin_decoy_ = NULL;        // pin output format for percolator for the decoy psms only
   total_spectra_num_ = 0;       // The total number of spectra searched. This is counted during the spectrum conversion
+  checkpoint_interval_ = 0;
+  resume_ = false;
+  checkpoint_pending_ = false;
+  spectra_in_flight_ = 0;
+  profile_search_ = false;
 
   for (int i = 0; i < NUMBER_LOCK_TYPES; i++) {  // LOCK_TYPES are defined in model/objects.h
     locks_array_.push_back(new boost::mutex());
@@ -166,13 +179,22 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
   }
  
   // Get a peptide reader to the peptide index datasets along with proteins, auxlocs. 
-  vector<const pb::Protein*> proteins;
-  vector<const pb::AuxLocation*> locations;
-  pb::Header peptides_header;
-  string peptides_file = FileUtils::Join(input_index, "pepix");  
-  HeadedRecordReader peptide_reader = HeadedRecordReader(peptides_file, &peptides_header);
-  getPeptideIndexData(input_index, proteins, locations, peptides_header);
-  tide_index_mzTab_file_path_ = FileUtils::Join(input_index, TideIndexApplication::tide_index_mzTab_filename_);
+  // Several comma-separated indices are searched in one pass; their peptides
+  // are merged by mass in the active peptide queues.
+  vector<string> input_indices = StringUtils::Split(input_index, ',');
+  vector<ProteinVec> proteins(input_indices.size());
+  vector<vector<const pb::AuxLocation*> > locations(input_indices.size());
+  vector<pb::Header> peptides_headers(input_indices.size());
+  vector<string> peptides_files;
+  TideMatchSet::index_names_.clear();
+  for (size_t i = 0; i < input_indices.size(); ++i) {
+    peptides_files.push_back(FileUtils::Join(input_indices[i], "pepix"));
+    HeadedRecordReader peptide_reader = HeadedRecordReader(peptides_files[i], &peptides_headers[i]);
+    getPeptideIndexData(input_indices[i], proteins[i], locations[i], peptides_headers[i],
+                        i == 0 ? NULL : &peptides_headers[0]);
+    TideMatchSet::index_names_.push_back(input_indices[i]);
+  }
+  tide_index_mzTab_file_path_ = FileUtils::Join(input_indices[0], TideIndexApplication::tide_index_mzTab_filename_);
 
   TideMatchSet::curScoreFunction_ = curScoreFunction_;
   TideMatchSet::top_matches_ = top_matches_;
@@ -182,24 +204,36 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
   TideMatchSet::mod_precision_ = Params::GetInt("mod-precision");
   TideMatchSet::concat_ = Params::GetBool("concat");  
 
+  // Checkpoints are not written for results kept in memory (cascade-search).
+  checkpoint_file_ = make_file_path("tide-search.checkpoint.txt");
+  checkpoint_interval_ = results_to_memory_ ? 0 : Params::GetInt("checkpoint-interval");
+  resume_ = !results_to_memory_ && Params::GetBool("resume");
+  if (resume_) {
+    readCheckpoint(input_files);
+  }
+
   // Create the output files, print headers
   createOutputFiles(); 
 
   // Convert the original file names into spectrum records if needed 
   // Update the file names in the variable inputFiles_ locally.
   // Run spectrum file convertion in parallel.
-  for (vector<string>::const_iterator original_file_name = input_files.begin(); original_file_name != input_files.end(); ++original_file_name) {
-    inputFiles_.push_back(TideSearchApplication::InputFile(*original_file_name, *original_file_name, false));
-  }
-  // Launch threads to convert files
-  boost::thread_group threadgroup_input_files;
-  for (int t = 1; t < num_threads_; ++t) {
-    boost::thread * currthread = new boost::thread(boost::bind(&TideSearchApplication::getInputFiles, this, t));
-    threadgroup_input_files.add_thread(currthread);
+  // The conversion is skipped if the spectrum files were already converted
+  // by a previous search (e.g. in an earlier round of cascade-search).
+  if (inputFiles_.empty()) {
+    for (vector<string>::const_iterator original_file_name = input_files.begin(); original_file_name != input_files.end(); ++original_file_name) {
+      inputFiles_.push_back(TideSearchApplication::InputFile(*original_file_name, *original_file_name, false));
+    }
+    // Launch threads to convert files
+    boost::thread_group threadgroup_input_files;
+    for (int t = 1; t < num_threads_; ++t) {
+      boost::thread * currthread = new boost::thread(boost::bind(&TideSearchApplication::getInputFiles, this, t));
+      threadgroup_input_files.add_thread(currthread);
+    }
+    getInputFiles(0);
+    // Join threads
+    threadgroup_input_files.join_all();
   }
-  getInputFiles(0);
-  // Join threads
-  threadgroup_input_files.join_all();
 
   if (total_spectra_num_ > 0) {
     carp(CARP_INFO, "There were a total of %d spectrum conversions from %d input spectrum files.",
@@ -211,12 +245,22 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
   vector<HeadedRecordReader*> peptide_reader_threads;
   vector<ActivePeptideQueue*> APQ;
   for (int i = 0; i < num_threads_; i++) {
-    peptide_reader_threads.push_back(new HeadedRecordReader(peptides_file, &peptides_header));
-    APQ.push_back(new ActivePeptideQueue(peptide_reader_threads.back()->Reader(), proteins, &locations));
+    vector<RecordReader*> readers;
+    vector<const ProteinVec*> index_proteins;
+    vector<vector<const pb::AuxLocation*>*> index_locations;
+    for (size_t j = 0; j < input_indices.size(); ++j) {
+      peptide_reader_threads.push_back(new HeadedRecordReader(peptides_files[j], &peptides_headers[j]));
+      readers.push_back(peptide_reader_threads.back()->Reader());
+      index_proteins.push_back(&proteins[j]);
+      index_locations.push_back(&locations[j]);
+    }
+    APQ.push_back(new ActivePeptideQueue(readers, index_proteins, index_locations));
   }
 
   carp(CARP_INFO, "Starting search.");
   // Read the first spectrum records from each input files 
+  // When resuming, the spectra searched before the checkpoint are skipped.
+  spectra_consumed_.resize(inputFiles_.size(), 0);
   int file_cnt = 0;
   pb::Spectrum pb_spectrum; // spectrum message struct
   for (vector<InputFile>::iterator spectrum_file = inputFiles_.begin(); spectrum_file != inputFiles_.end(); ++spectrum_file, ++file_cnt) {
@@ -224,6 +268,9 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
     string spectrum_records_file = spectrum_file->SpectrumRecords;
     spectrum_reader_.push_back(new HeadedRecordReader(spectrum_records_file));
 
+    for (long int i = 0; i < spectra_consumed_[file_cnt] && !spectrum_reader_.back()->Done(); ++i) {
+      spectrum_reader_.back()->Read(&pb_spectrum);
+    }
     if (!spectrum_reader_.back()->Done() ) {
       spectrum_reader_.back()->Read(&pb_spectrum);
       spectrum_heap_.push_back(make_pair(pb_spectrum, file_cnt));
@@ -236,6 +283,11 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
   // make a heap with the spectrum records 
   make_heap(spectrum_heap_.begin(), spectrum_heap_.end(), compare_spectrum());
 
+  profile_search_ = Params::GetBool("profile-search");
+  if (profile_search_) {
+    thread_profiles_.assign(num_threads_, thread_profile());
+  }
+
   // Create thread data
   vector<thread_data> thread_data_array;
   for (int t = 0; t < num_threads_; ++t) {
@@ -274,11 +326,14 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
   carp(CARP_INFO, "Average number of candidates per spectrum-charge combination: %lf ",
     ((double)total_candidate_peptides_) /  (double)num_spectra_searched_ );
   carp(CARP_INFO, "%d spectrum-charge combinations loaded, %d spectrum-charge combinations searched. ", num_spectra_, num_spectra_searched_);
+  if (profile_search_) {
+    writeProfile();
+  }
   
-  // Delete stuffs
-  if (out_tsv_target_ != NULL)
+  // Delete stuffs. In-memory results are kept until the caller releases them.
+  if (out_tsv_target_ != NULL && !results_to_memory_)
     delete out_tsv_target_;
-  if (out_tsv_decoy_ != NULL)
+  if (out_tsv_decoy_ != NULL && !results_to_memory_)
     delete out_tsv_decoy_;
   if (out_mztab_target_ != NULL)
     delete out_mztab_target_;
@@ -288,14 +343,28 @@ int TideSearchApplication::main(const vector<string>& input_files, const string
     delete out_pin_target_;
   if (out_pin_decoy_ != NULL)
     delete out_pin_decoy_;
+  checkpoint_streams_.clear();
+
+  // The search is complete, an old checkpoint must not be resumed.
+  if (checkpoint_interval_ > 0 || resume_) {
+    FileUtils::Remove(checkpoint_file_);
+  }
   
-  convertResults();
+  if (!results_to_memory_) {
+    convertResults();
+  }
 
   // Delete temporary spectrumrecords file
- for (vector<TideSearchApplication::InputFile>::iterator original_file_name = inputFiles_.begin(); original_file_name != inputFiles_.end(); ++original_file_name) {
-    if ((*original_file_name).Keep == false) {
-      carp(CARP_DEBUG, "Deleting %s", (*original_file_name).SpectrumRecords.c_str());
-      remove((*original_file_name).SpectrumRecords.c_str());
+  for (vector<HeadedRecordReader*>::iterator i = spectrum_reader_.begin(); i != spectrum_reader_.end(); ++i) {
+    delete *i;
+  }
+  spectrum_reader_.clear();
+  if (delete_spectrum_records_) {
+    for (vector<TideSearchApplication::InputFile>::iterator original_file_name = inputFiles_.begin(); original_file_name != inputFiles_.end(); ++original_file_name) {
+      if ((*original_file_name).Keep == false) {
+        carp(CARP_DEBUG, "Deleting %s", (*original_file_name).SpectrumRecords.c_str());
+        remove((*original_file_name).SpectrumRecords.c_str());
+      }
     }
   }
 
@@ -307,17 +376,34 @@ void TideSearchApplication::spectrum_search(void *threadarg) {
 
   ActivePeptideQueue* active_peptide_queue = my_data->active_peptide_queue_;
   int thread_id = my_data->thread_id_;
+  thread_profile* profile = profile_search_ ? &thread_profiles_[thread_id] : NULL;
 
   int input_file_source;
   pb::Spectrum pb_spectrum;  
+  bool searching = false;  // whether this thread has taken a spectrum off the heap
   while (true){
 
     // Get the next spectrum records with the smallest neutral mass from the heap and load the next spectrum records from the input files.
+    StageTimer lock_timer(profile, STAGE_SPECTRUM_LOCK_WAIT);
     locks_array_[LOCK_SPECTRUM_READING]->lock();
+    if (checkpoint_interval_ > 0) {
+      // The previous spectrum of this thread is done. Wait while a checkpoint is pending.
+      if (searching) {
+        finishSpectrum();
+        searching = false;
+      }
+      boost::unique_lock<boost::mutex> checkpoint_lock(*locks_array_[LOCK_SPECTRUM_READING], boost::adopt_lock);
+      while (checkpoint_pending_) {
+        checkpoint_cond_.wait(checkpoint_lock);
+      }
+      checkpoint_lock.release();
+    }
+    lock_timer.stop();
     if (spectrum_heap_.size() == 0) {
       locks_array_[LOCK_SPECTRUM_READING]->unlock();
       return;
     }
+    StageTimer reading_timer(profile, STAGE_SPECTRUM_READING);
     // access the lightest spectra in the heap
     auto spectrum_pair = spectrum_heap_.front();   
     input_file_source = spectrum_pair.second;
@@ -340,6 +426,14 @@ void TideSearchApplication::spectrum_search(void *threadarg) {
     if (print_interval_ > 0 && num_spectra_ > 0 && num_spectra_ % print_interval_ == 0) {
       carp(CARP_INFO, "%d spectrum-charge combinations searched.", num_spectra_);
     }
+    if (checkpoint_interval_ > 0) {
+      ++spectra_consumed_[input_file_source];
+      ++spectra_in_flight_;
+      searching = true;
+      if (num_spectra_ % checkpoint_interval_ == 0) {
+        checkpoint_pending_ = true;
+      }
+    }
 
     pb_spectrum = spectrum_pair.first;
     locks_array_[LOCK_SPECTRUM_READING]->unlock();
@@ -349,6 +443,7 @@ void TideSearchApplication::spectrum_search(void *threadarg) {
     int charge = spectrum->ChargeState(0);
     double neutral_mass = pb_spectrum.neutral_mass();
     SpectrumCollection::SpecCharge* sc = new SpectrumCollection::SpecCharge(neutral_mass, charge, spectrum, 0);
+    reading_timer.stop();
    
     // Search one spectrum against its candidate peptides
 
@@ -368,7 +463,14 @@ void TideSearchApplication::spectrum_search(void *threadarg) {
       continue; 
    }
 
-    if (spectrum_flag_ != NULL) {  // TODO: Do something, possibly for cascade search
+    // Skip the spectra which were accepted in an earlier round of cascade-search
+    // before any candidate peptides are decoded or the spectrum is preprocessed.
+    // The key follows the one used in AssignConfidenceApplication.
+    if (spectrum_flag_ != NULL &&
+        spectrum_flag_->find(make_pair(spectrum_file_name, (unsigned int)(scan_num * 10 + charge))) != spectrum_flag_->end()) {
+      delete spectrum;
+      delete sc;
+      continue;
     }
 
     double min_range, max_range;
@@ -376,9 +478,14 @@ void TideSearchApplication::spectrum_search(void *threadarg) {
     vector<double>* max_mass = new vector<double>();
     
     computeWindow(*sc, min_mass, max_mass, &min_range, &max_range);
+    StageTimer range_timer(profile, STAGE_ACTIVE_RANGE);
     active_peptide_queue->SetActiveRange(min_mass, max_mass, min_range, max_range);
+    range_timer.stop();
     delete min_mass;
     delete max_mass;
+    if (profile != NULL) {
+      profile->addCandidates(active_peptide_queue->nCandPeptides_);
+    }
 
     if (active_peptide_queue->nCandPeptides_ == 0) { // No peptides to score.
       delete spectrum;
@@ -390,10 +497,12 @@ void TideSearchApplication::spectrum_search(void *threadarg) {
     long num_isotopes_skipped = 0;
     long num_retained = 0;
 
+    StageTimer preprocessing_timer(profile, STAGE_PREPROCESSING);
     ObservedPeakSet observed(use_neutral_loss_peaks_, use_flanking_peaks_);
     observed.PreprocessSpectrum(*(sc->spectrum), charge, &num_range_skipped,
       &num_precursors_skipped,
       &num_isotopes_skipped, &num_retained);
+    preprocessing_timer.stop();
 
     locks_array_[LOCK_CANDIDATES]->lock();
     total_candidate_peptides_ += active_peptide_queue->nCandPeptides_;
@@ -409,18 +518,22 @@ void TideSearchApplication::spectrum_search(void *threadarg) {
 
     // Calculate the scores needed
     switch (curScoreFunction_) {
-      case PVALUES:
+      case PVALUES: {
+        StageTimer pvalue_timer(profile, STAGE_PVALUE_SCORING);
         PValueScoring(sc, active_peptide_queue, psm_scores);
+      }
         //break; // Run standard xcorr scoring in case of combined p-value calculations
-      case XCORR_SCORE:
+      case XCORR_SCORE: {
         // Spectrum preprocessing for xcorr scoring
+        StageTimer xcorr_timer(profile, STAGE_XCORR_SCORING);
         XCorrScoring(sc->charge, observed, active_peptide_queue, psm_scores);
         break;
+      }
       // case HYPERSCOR: TODO add new scoring functions here
     } 
     // Print the top-N results to the output files, 
     // The delta_cn, delta_lcn, repeat_ion_match, and tailor score calculation happens in PrintResults
-    PrintResults(sc, spectrum_file_name, input_file_source, &psm_scores);
+    PrintResults(sc, spectrum_file_name, input_file_source, &psm_scores, profile);
 
     delete spectrum;
     delete sc;
@@ -1193,7 +1306,7 @@ vector<int> TideSearchApplication::getNegativeIsotopeErrors() {
 }
 
 
-void TideSearchApplication::getPeptideIndexData(const string input_index, ProteinVec& proteins, vector<const pb::AuxLocation*>& locations, pb::Header& peptides_header){
+void TideSearchApplication::getPeptideIndexData(const string input_index, ProteinVec& proteins, vector<const pb::AuxLocation*>& locations, pb::Header& peptides_header, const pb::Header* primary_header){
 
   string peptides_file = FileUtils::Join(input_index, "pepix");  
   string proteins_file = FileUtils::Join(input_index, "protix");
@@ -1218,8 +1331,12 @@ void TideSearchApplication::getPeptideIndexData(const string input_index, Protei
                        "This will not affect your results, but this index may need to be "
                        "re-created to work with future versions of tide-index. ");
   }
+  if (primary_header != NULL && decoy_prefix != TideMatchSet::decoy_prefix_) {
+    carp(CARP_FATAL, "The decoy prefix of index %s differs from that of the first index.",
+         input_index.c_str());
+  }
   TideMatchSet::decoy_prefix_ = decoy_prefix;  
-  if (headerSource.has_filename()){
+  if (headerSource.has_filename() && primary_header == NULL){
     TideMatchSet::fasta_file_name_ = headerSource.filename();
   }
   
@@ -1234,7 +1351,29 @@ void TideSearchApplication::getPeptideIndexData(const string input_index, Protei
   }
 
   const pb::Header::PeptidesHeader& pepHeader = peptides_header.peptides_header();
-  decoy_num_ = pepHeader.has_decoys_per_target() ? pepHeader.decoys_per_target() : 0;
+  int decoy_num = pepHeader.has_decoys_per_target() ? pepHeader.decoys_per_target() : 0;
+
+  if (primary_header != NULL) {
+    // Additional indices share the mass constants and residue statistics
+    // of the first index, so their peptides must be encoded the same way.
+    const pb::Header::PeptidesHeader& primary = primary_header->peptides_header();
+    if (pepHeader.mods().SerializeAsString() != primary.mods().SerializeAsString() ||
+        pepHeader.nterm_mods().SerializeAsString() != primary.nterm_mods().SerializeAsString() ||
+        pepHeader.cterm_mods().SerializeAsString() != primary.cterm_mods().SerializeAsString() ||
+        pepHeader.nprotterm_mods().SerializeAsString() != primary.nprotterm_mods().SerializeAsString() ||
+        pepHeader.cprotterm_mods().SerializeAsString() != primary.cprotterm_mods().SerializeAsString() ||
+        pepHeader.monoisotopic_precursor() != primary.monoisotopic_precursor()) {
+      carp(CARP_FATAL, "Index %s was created with different modifications or mass type "
+           "than the first index. Indices searched together must share these settings.",
+           input_index.c_str());
+    }
+    if (decoy_num != decoy_num_) {
+      carp(CARP_FATAL, "Index %s has %d decoys per target, but the first index has %d.",
+           input_index.c_str(), decoy_num, decoy_num_);
+    }
+    return;
+  }
+  decoy_num_ = decoy_num;
 
   // Initizalize the Mass Constants class
   MassConstants::Init(&pepHeader.mods(), &pepHeader.nterm_mods(), &pepHeader.cterm_mods(),
@@ -1403,6 +1542,7 @@ vector<string> TideSearchApplication::getOptions() const {
   string arr[] = {
     "auto-mz-bin-width",
     "auto-precursor-window",
+    "checkpoint-interval",
     "concat",
     "deisotope",
     "elution-window-size",
@@ -1441,8 +1581,10 @@ vector<string> TideSearchApplication::getOptions() const {
     "precursor-window",
     "precursor-window-type",
     "print-search-progress",
+    "profile-search",
     "remove-precursor-peak",
     "remove-precursor-tolerance",
+    "resume",
     "scan-number",
     "score-function",
     "skip-preprocessing",
@@ -1541,18 +1683,47 @@ vector< pair<string, string> > TideSearchApplication::getOutputs() const {
   outputs.push_back(make_pair("tide-search.log.txt",
     "a log file containing a copy of all messages that were printed to the "
     "screen during execution."));
+  outputs.push_back(make_pair("tide-search.profile.txt",
+    "a tab-delimited text file with the number of calls and the time spent by each "
+    "search thread in each stage of the search, written only if --profile-search is T."));
+  outputs.push_back(make_pair("tide-search.candidates.txt",
+    "a tab-delimited text file with a histogram, per search thread, of the number of "
+    "candidate peptides per spectrum-charge combination, written only if "
+    "--profile-search is T."));
+  outputs.push_back(make_pair("tide-search.checkpoint.txt",
+    "the state of an unfinished search, written only if --checkpoint-interval is "
+    "positive. It is used by --resume and removed when the search completes."));
   return outputs;
 }
 bool TideSearchApplication::needsOutputDirectory() const {
   return true;
 }
 
+bool TideSearchApplication::resumesOutputs() const {
+  return true;
+}
+
 COMMAND_T TideSearchApplication::getCommand() const {
   return TIDE_SEARCH_COMMAND;
 }
 
 void TideSearchApplication::processParams() {
-  const string index = Params::GetString("tide database");
+  string index = Params::GetString("tide database");
+
+  // Several comma-separated index directories are searched in one pass.
+  // The enzyme and digestion settings are taken from the first one.
+  vector<string> indices = StringUtils::Split(index, ',');
+  if (indices.size() > 1 && !FileUtils::Exists(index)) {
+    for (vector<string>::const_iterator i = indices.begin(); i != indices.end(); ++i) {
+      if (!FileUtils::Exists(*i)) {
+        carp(CARP_FATAL, "'%s' does not exist", i->c_str());
+      } else if (FileUtils::IsRegularFile(*i)) {
+        carp(CARP_FATAL, "'%s' is not a tide-index directory. Only peptide indices "
+             "can be searched together.", i->c_str());
+      }
+    }
+    index = indices[0];
+  }
 
   if (!FileUtils::Exists(index)) {
     carp(CARP_FATAL, "'%s' does not exist", index.c_str());
@@ -1700,29 +1871,38 @@ void TideSearchApplication::createOutputFiles() {
   target_file_name = make_file_path("tide-search.target.txt");
   decoy_file_name  = make_file_path("tide-search.decoy.txt");
 
-  if (overwrite) {
+  if (overwrite && !resume_) {
     remove(concat_file_name.c_str());  
     remove(target_file_name.c_str());  
     remove(decoy_file_name.c_str());  
   }
 
+  if (results_to_memory_) {  // tsv results are handed over in memory, no files are created
+    string header = TideMatchSet::getHeader(TIDE_SEARCH_TSV, tide_index_mzTab_file_path_);
+    output_file_name_ = concat ? concat_file_name : target_file_name;
+    out_tsv_target_ = new stringstream();
+    *out_tsv_target_ << header;
+    if (!concat && decoy_num_ > 0) {
+      out_tsv_decoy_ = new stringstream();
+      *out_tsv_decoy_ << header;
+    }
+    return;
+  }
+
   if (Params::GetBool("txt-output") == true) {  // original tide-search output format in tab-delimited text files (txt)
     string header = TideMatchSet::getHeader(TIDE_SEARCH_TSV, tide_index_mzTab_file_path_);
 
     if (concat) {
 
-      out_tsv_target_ = create_stream_in_path(concat_file_name.c_str(), NULL, overwrite);
+      out_tsv_target_ = openOutputStream(concat_file_name, header, overwrite);
       output_file_name_ = concat_file_name;
-      *out_tsv_target_ << header; 
 
     } else {
 
-      out_tsv_target_ = create_stream_in_path(target_file_name.c_str(), NULL, overwrite);
+      out_tsv_target_ = openOutputStream(target_file_name, header, overwrite);
       output_file_name_ = target_file_name;
-      *out_tsv_target_ << header; 
       if (decoy_num_ > 0) {
-        out_tsv_decoy_ = create_stream_in_path(decoy_file_name.c_str(), NULL, overwrite);
-        *out_tsv_decoy_ << header;
+        out_tsv_decoy_ = openOutputStream(decoy_file_name, header, overwrite);
       }
     }  
   }
@@ -1732,7 +1912,7 @@ void TideSearchApplication::createOutputFiles() {
   target_file_name = make_file_path("tide-search.target.mzTab");
   decoy_file_name  = make_file_path("tide-search.decoy.mzTab");
 
-  if (overwrite) {
+  if (overwrite && !resume_) {
     remove(concat_file_name.c_str());  
     remove(target_file_name.c_str());  
     remove(decoy_file_name.c_str());  
@@ -1744,25 +1924,130 @@ void TideSearchApplication::createOutputFiles() {
     string header = TideMatchSet::getHeader(TIDE_SEARCH_MZTAB_TSV, tide_index_mzTab_file_path_);  // Gets the column headers
     if (concat) {
 
-      out_mztab_target_ = create_stream_in_path(concat_file_name.c_str(), NULL, overwrite);
+      out_mztab_target_ = openOutputStream(concat_file_name, header, overwrite);
       output_file_name_ = concat_file_name;
-      *out_mztab_target_ << header; 
 
     } else {
 
-      out_mztab_target_ = create_stream_in_path(target_file_name.c_str(), NULL, overwrite);
+      out_mztab_target_ = openOutputStream(target_file_name, header, overwrite);
       output_file_name_ = target_file_name;
-      *out_mztab_target_ << header; 
 
       if (decoy_num_ > 0) {
-        out_mztab_decoy_ = create_stream_in_path(decoy_file_name.c_str(), NULL, overwrite);
-        *out_mztab_decoy_ << header;
+        out_mztab_decoy_ = openOutputStream(decoy_file_name, header, overwrite);
       }
     }  
   }
 
 }
 
+ofstream* TideSearchApplication::openOutputStream(const string& file_name, const string& header, bool overwrite) {
+  ofstream* stream;
+  if (resume_) {
+    // Continue the file of the interrupted search after the last checkpoint
+    map<string, streamoff>::const_iterator offset = resume_offsets_.find(file_name);
+    if (offset == resume_offsets_.end()) {
+      carp(CARP_FATAL, "The checkpoint %s has no entry for %s. Was the search restarted "
+           "with different parameters?", checkpoint_file_.c_str(), file_name.c_str());
+    }
+    stream = FileUtils::GetResumeStream(file_name, offset->second);
+    if (stream == NULL) {
+      carp(CARP_FATAL, "Cannot resume writing %s", file_name.c_str());
+    }
+  } else {
+    stream = create_stream_in_path(file_name.c_str(), NULL, overwrite);
+    *stream << header;
+  }
+  checkpoint_streams_.push_back(make_pair(file_name, stream));
+  return stream;
+}
+
+// Called with the spectrum reading lock held, when a thread is done with a spectrum.
+void TideSearchApplication::finishSpectrum() {
+  --spectra_in_flight_;
+  if (checkpoint_pending_ && spectra_in_flight_ == 0) {
+    writeCheckpoint();
+    checkpoint_pending_ = false;
+    checkpoint_cond_.notify_all();
+  }
+}
+
+void TideSearchApplication::writeCheckpoint() {
+  // Write to a temporary file first, so that a crash leaves the previous checkpoint intact
+  string temp_file = checkpoint_file_ + ".tmp";
+  ofstream checkpoint(temp_file.c_str());
+  checkpoint << "spectra\t" << num_spectra_ << '\t' << num_spectra_searched_ << '\t'
+             << total_candidate_peptides_ << '\n';
+  checkpoint << "peaks\t" << num_range_skipped_ << '\t' << num_precursors_skipped_ << '\t'
+             << num_isotopes_skipped_ << '\t' << num_retained_ << '\n';
+  checkpoint << "mztab-psm-id\t" << TideMatchSet::psm_id_mzTab_ << '\n';
+  for (size_t i = 0; i < inputFiles_.size(); ++i) {
+    checkpoint << "input\t" << spectra_consumed_[i] << '\t' << (inputFiles_[i].Keep ? 1 : 0) << '\t'
+               << inputFiles_[i].OriginalName << '\t' << inputFiles_[i].SpectrumRecords << '\n';
+  }
+  locks_array_[LOCK_RESULTS]->lock();
+  for (vector<pair<string, ofstream*> >::iterator i = checkpoint_streams_.begin(); i != checkpoint_streams_.end(); ++i) {
+    i->second->flush();
+    checkpoint << "output\t" << (long long)i->second->tellp() << '\t' << i->first << '\n';
+  }
+  locks_array_[LOCK_RESULTS]->unlock();
+  checkpoint.close();
+  if (!checkpoint) {
+    carp(CARP_WARNING, "Could not write checkpoint %s", temp_file.c_str());
+    return;
+  }
+  FileUtils::Rename(temp_file, checkpoint_file_);
+  carp(CARP_DEBUG, "Checkpoint written after %d spectrum-charge combinations.", num_spectra_);
+}
+
+void TideSearchApplication::readCheckpoint(const vector<string>& input_files) {
+  if (!FileUtils::Exists(checkpoint_file_)) {
+    carp(CARP_FATAL, "Cannot resume the search: checkpoint %s does not exist.", checkpoint_file_.c_str());
+  }
+  carp(CARP_INFO, "Resuming search from checkpoint %s", checkpoint_file_.c_str());
+  ifstream checkpoint(checkpoint_file_.c_str());
+  string line;
+  vector<InputFile> spectrum_files;
+  while (getline(checkpoint, line)) {
+    vector<string> fields = StringUtils::Split(line, '\t');
+    if (fields[0] == "spectra" && fields.size() == 4) {
+      num_spectra_ = StringUtils::FromString<long int>(fields[1]);
+      num_spectra_searched_ = StringUtils::FromString<long int>(fields[2]);
+      total_candidate_peptides_ = StringUtils::FromString<long int>(fields[3]);
+    } else if (fields[0] == "peaks" && fields.size() == 5) {
+      num_range_skipped_ = StringUtils::FromString<long int>(fields[1]);
+      num_precursors_skipped_ = StringUtils::FromString<long int>(fields[2]);
+      num_isotopes_skipped_ = StringUtils::FromString<long int>(fields[3]);
+      num_retained_ = StringUtils::FromString<long int>(fields[4]);
+    } else if (fields[0] == "mztab-psm-id" && fields.size() == 2) {
+      TideMatchSet::psm_id_mzTab_ = StringUtils::FromString<int>(fields[1]);
+    } else if (fields[0] == "input" && fields.size() == 5) {
+      spectra_consumed_.push_back(StringUtils::FromString<long int>(fields[1]));
+      spectrum_files.push_back(InputFile(fields[3], fields[4], fields[2] == "1"));
+    } else if (fields[0] == "output" && fields.size() == 3) {
+      resume_offsets_[fields[2]] = StringUtils::FromString<long long>(fields[1]);
+    } else {
+      carp(CARP_FATAL, "Invalid line in checkpoint %s: %s", checkpoint_file_.c_str(), line.c_str());
+    }
+  }
+
+  // The spectrumrecords of the interrupted search are reused.
+  if (spectrum_files.size() != input_files.size()) {
+    carp(CARP_FATAL, "The checkpoint was written for %d spectrum files, but %d were given.",
+         spectrum_files.size(), input_files.size());
+  }
+  for (size_t i = 0; i < spectrum_files.size(); ++i) {
+    if (spectrum_files[i].OriginalName != input_files[i]) {
+      carp(CARP_FATAL, "The checkpoint was written for spectrum file %s, not %s.",
+           spectrum_files[i].OriginalName.c_str(), input_files[i].c_str());
+    }
+    if (!FileUtils::Exists(spectrum_files[i].SpectrumRecords)) {
+      carp(CARP_FATAL, "Cannot resume the search: %s does not exist.",
+           spectrum_files[i].SpectrumRecords.c_str());
+    }
+  }
+  inputFiles_ = spectrum_files;
+}
+
 void TideSearchApplication::convertResults() const {
   PSMConvertApplication converter;
   if (!Params::GetBool("concat")) {
@@ -1812,35 +2097,79 @@ void TideSearchApplication::convertResults() const {
   }
 }
 
-void TideSearchApplication::PrintResults(const SpectrumCollection::SpecCharge* sc, string spectrum_file_name, int spectrum_file_cnt, TideMatchSet* psm_scores) {
+void TideSearchApplication::PrintResults(const SpectrumCollection::SpecCharge* sc, string spectrum_file_name, int spectrum_file_cnt, TideMatchSet* psm_scores,
+                                         thread_profile* profile) {
   string concat_or_target_report;
   string decoy_report;
 
+  StageTimer gather_timer(profile, STAGE_GATHER_PSMS);
+  psm_scores->gatherTargetsDecoys();
+  gather_timer.stop();
+
   if (out_mztab_target_ != NULL) {
+    StageTimer format_timer(profile, STAGE_REPORT_FORMATTING);
     psm_scores->getReport(TIDE_SEARCH_MZTAB_TSV, spectrum_file_name, sc, spectrum_file_cnt, concat_or_target_report, decoy_report); 
-    locks_array_[LOCK_RESULTS]->lock();
-    *out_mztab_target_ << concat_or_target_report;
-    locks_array_[LOCK_RESULTS]->unlock();
-
-    if (out_mztab_decoy_ != NULL) {
-      locks_array_[LOCK_RESULTS]->lock();
-      *out_mztab_decoy_ << decoy_report;
-      locks_array_[LOCK_RESULTS]->unlock();
-    }
+    format_timer.stop();
+    writeResults(out_mztab_target_, concat_or_target_report, out_mztab_decoy_, decoy_report, profile);
   }
 
   if ( out_tsv_target_ != NULL) {
+    StageTimer format_timer(profile, STAGE_REPORT_FORMATTING);
     psm_scores->getReport(TIDE_SEARCH_TSV, spectrum_file_name, sc, spectrum_file_cnt, concat_or_target_report, decoy_report); 
-    locks_array_[LOCK_RESULTS]->lock();
-    *out_tsv_target_ << concat_or_target_report;
-    locks_array_[LOCK_RESULTS]->unlock();
-    
-    if (out_tsv_decoy_ != NULL) {
-      locks_array_[LOCK_RESULTS]->lock();
-      *out_tsv_decoy_ << decoy_report;
-      locks_array_[LOCK_RESULTS]->unlock();
+    format_timer.stop();
+    writeResults(out_tsv_target_, concat_or_target_report, out_tsv_decoy_, decoy_report, profile);
+  }
+}
+
+void TideSearchApplication::writeResults(ostream* target, const string& target_report, ostream* decoy, const string& decoy_report,
+                                         thread_profile* profile) {
+  StageTimer wait_timer(profile, STAGE_RESULTS_LOCK_WAIT);
+  locks_array_[LOCK_RESULTS]->lock();
+  wait_timer.stop();
+  StageTimer write_timer(profile, STAGE_RESULTS_WRITING);
+  *target << target_report;
+  if (decoy != NULL) {
+    *decoy << decoy_report;
+  }
+  locks_array_[LOCK_RESULTS]->unlock();
+}
+
+void TideSearchApplication::writeProfile() const {
+  bool overwrite = Params::GetBool("overwrite");
+
+  // Time spent per thread in each stage of the search, followed by the totals
+  string stage_file_name = make_file_path("tide-search.profile.txt");
+  ofstream* stage_file = create_stream_in_path(stage_file_name.c_str(), NULL, overwrite);
+  *stage_file << "thread\tstage\tcalls\tseconds\n";
+  thread_profile total;
+  for (size_t t = 0; t < thread_profiles_.size(); ++t) {
+    for (int stage = 0; stage < NUMBER_SEARCH_STAGES; ++stage) {
+      *stage_file << t << '\t' << search_stage_names_[stage] << '\t' << thread_profiles_[t].calls_[stage]
+                  << '\t' << thread_profiles_[t].seconds_[stage] << '\n';
+      total.calls_[stage] += thread_profiles_[t].calls_[stage];
+      total.seconds_[stage] += thread_profiles_[t].seconds_[stage];
+    }
+  }
+  for (int stage = 0; stage < NUMBER_SEARCH_STAGES; ++stage) {
+    *stage_file << "all\t" << search_stage_names_[stage] << '\t' << total.calls_[stage]
+                << '\t' << total.seconds_[stage] << '\n';
+  }
+  delete stage_file;
+
+  // Number of spectrum-charge combinations per number of candidate peptides
+  string histogram_file_name = make_file_path("tide-search.candidates.txt");
+  ofstream* histogram_file = create_stream_in_path(histogram_file_name.c_str(), NULL, overwrite);
+  *histogram_file << "thread\tmin candidates\tmax candidates\tspectra\n";
+  for (size_t t = 0; t < thread_profiles_.size(); ++t) {
+    const vector<long int>& candidates = thread_profiles_[t].candidates_;
+    for (size_t bin = 0; bin < candidates.size(); ++bin) {
+      long int min_candidates = bin == 0 ? 0 : 1L << (bin - 1);
+      long int max_candidates = bin == 0 ? 0 : (1L << bin) - 1;
+      *histogram_file << t << '\t' << min_candidates << '\t' << max_candidates << '\t' << candidates[bin] << '\n';
     }
   }
+  delete histogram_file;
+  carp(CARP_INFO, "Search profile written to %s and %s.", stage_file_name.c_str(), histogram_file_name.c_str());
 }
 
 //Added by Andy Lin in Feb 2016
@@ -1906,3 +2235,30 @@ double TideSearchApplication::calcCombinedPval(
 void TideSearchApplication::setSpectrumFlag(map<pair<string, unsigned int>, bool>* spectrum_flag) {
   spectrum_flag_ = spectrum_flag;
 }
+
+void TideSearchApplication::setSpectrumFiles(const vector<InputFile>& spectrum_files) {
+  inputFiles_ = spectrum_files;
+}
+
+const vector<TideSearchApplication::InputFile>& TideSearchApplication::getSpectrumFiles() const {
+  return inputFiles_;
+}
+
+void TideSearchApplication::setDeleteSpectrumRecords(bool delete_spectrum_records) {
+  delete_spectrum_records_ = delete_spectrum_records;
+}
+
+void TideSearchApplication::setResultsToMemory(bool results_to_memory) {
+  results_to_memory_ = results_to_memory;
+}
+
+void TideSearchApplication::releaseResultStreams(istream*& target, istream*& decoy) {
+  if (!results_to_memory_) {
+    target = decoy = NULL;
+    return;
+  }
+  target = dynamic_cast<stringstream*>(out_tsv_target_);
+  decoy = dynamic_cast<stringstream*>(out_tsv_decoy_);
+  out_tsv_target_ = NULL;
+  out_tsv_decoy_ = NULL;
+}
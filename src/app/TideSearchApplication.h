@@ -7,6 +7,8 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <sstream>
+#include <chrono>
 #include <gflags/gflags.h>
 #include "peptides.pb.h"
 #include "spectrum.pb.h"
@@ -22,7 +24,7 @@ using namespace std;
 
 
 class TideSearchApplication : public CruxApplication {
- private:
+ public:
   struct InputFile {
     std::string OriginalName;
     std::string SpectrumRecords;
@@ -41,6 +43,8 @@ class TideSearchApplication : public CruxApplication {
   map<pair<string, unsigned int>, bool>* spectrum_flag_;
   string output_file_name_;
   std::string remove_index_;  
+  bool results_to_memory_;  // keep the tsv results in memory instead of writing files (cascade-search)
+  bool delete_spectrum_records_;  // delete temporary spectrumrecords files when the search is done
   double bin_width_;
   double bin_offset_;
   bool use_neutral_loss_peaks_;
@@ -70,8 +74,8 @@ class TideSearchApplication : public CruxApplication {
   int total_spectra_num_;
   string tide_index_mzTab_file_path_;
 
-  ofstream* out_tsv_target_; // original tide-search output format in tab-delimited text files (txt)
-  ofstream* out_tsv_decoy_;  // original tide-search output format in tab-delimited text files (txt) for the decoy psms only
+  ostream* out_tsv_target_; // original tide-search output format in tab-delimited text files (txt)
+  ostream* out_tsv_decoy_;  // original tide-search output format in tab-delimited text files (txt) for the decoy psms only
   ofstream* out_mztab_target_;      // mzTAB output format
   ofstream* out_mztab_decoy_;      // mzTAB output format for the decoy psms only
   ofstream* out_pin_target_;        // pin output format for percolator
@@ -79,13 +83,100 @@ class TideSearchApplication : public CruxApplication {
 
   vector<boost::mutex *> locks_array_;  
 
+  // Checkpoints of long searches. A checkpoint is written when all spectra
+  // taken off the heap have been searched and their results written; it
+  // records per input file how many spectra were taken and the output sizes.
+  int checkpoint_interval_;
+  bool resume_;
+  bool checkpoint_pending_;  // no more spectra are taken off the heap until the checkpoint is written
+  int spectra_in_flight_;
+  string checkpoint_file_;
+  vector<long int> spectra_consumed_;
+  map<string, streamoff> resume_offsets_;
+  vector<pair<string, ofstream*> > checkpoint_streams_;
+  boost::condition_variable checkpoint_cond_;
+
+  ofstream* openOutputStream(const string& file_name, const string& header, bool overwrite);
+  void finishSpectrum();
+  void writeCheckpoint();
+  void readCheckpoint(const vector<string>& input_files);
+
   void getInputFiles(int thread_id);
-  void getPeptideIndexData(string, ProteinVec& proteins, vector<const pb::AuxLocation*>& locations, pb::Header& peptides_header);
+  // For the second and later indices of a multi-index search, primary_header
+  // is the header of the first index; their settings are checked against it.
+  void getPeptideIndexData(string, ProteinVec& proteins, vector<const pb::AuxLocation*>& locations, pb::Header& peptides_header,
+                           const pb::Header* primary_header = NULL);
   void createOutputFiles();
 
   void convertResults() const;  
 
-  void PrintResults(const SpectrumCollection::SpecCharge* sc, string spectrum_file_name, int spectrum_file_cnt, TideMatchSet* psm_scores);
+  // Stages of the search timed per thread by --profile-search
+  enum SEARCH_STAGE_T {
+    STAGE_SPECTRUM_LOCK_WAIT,
+    STAGE_SPECTRUM_READING,
+    STAGE_ACTIVE_RANGE,
+    STAGE_PREPROCESSING,
+    STAGE_XCORR_SCORING,
+    STAGE_PVALUE_SCORING,
+    STAGE_GATHER_PSMS,
+    STAGE_REPORT_FORMATTING,
+    STAGE_RESULTS_LOCK_WAIT,
+    STAGE_RESULTS_WRITING,
+    NUMBER_SEARCH_STAGES
+  };
+  static const char* search_stage_names_[NUMBER_SEARCH_STAGES];
+
+  struct thread_profile {
+    double seconds_[NUMBER_SEARCH_STAGES];
+    long int calls_[NUMBER_SEARCH_STAGES];
+    vector<long int> candidates_;  // spectra per number of candidates; bin i > 0 holds [2^(i-1), 2^i)
+    thread_profile() {
+      fill(seconds_, seconds_ + NUMBER_SEARCH_STAGES, 0.0);
+      fill(calls_, calls_ + NUMBER_SEARCH_STAGES, 0);
+    }
+    void addCandidates(int num_candidates) {
+      size_t bin = 0;
+      for (; num_candidates > 0; num_candidates >>= 1) {
+        ++bin;
+      }
+      if (bin >= candidates_.size()) {
+        candidates_.resize(bin + 1, 0);
+      }
+      ++candidates_[bin];
+    }
+  };
+
+  // Adds the time until stop() or destruction to a stage of a thread profile.
+  // Does nothing if the profile is NULL.
+  class StageTimer {
+   public:
+    StageTimer(thread_profile* profile, SEARCH_STAGE_T stage) : profile_(profile), stage_(stage) {
+      if (profile_ != NULL) {
+        start_ = std::chrono::steady_clock::now();
+      }
+    }
+    ~StageTimer() { stop(); }
+    void stop() {
+      if (profile_ != NULL) {
+        profile_->seconds_[stage_] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+        ++profile_->calls_[stage_];
+        profile_ = NULL;
+      }
+    }
+   private:
+    thread_profile* profile_;
+    SEARCH_STAGE_T stage_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  bool profile_search_;
+  vector<thread_profile> thread_profiles_;
+  void writeProfile() const;
+
+  void PrintResults(const SpectrumCollection::SpecCharge* sc, string spectrum_file_name, int spectrum_file_cnt, TideMatchSet* psm_scores,
+                    thread_profile* profile = NULL);
+  void writeResults(ostream* target, const string& target_report, ostream* decoy, const string& decoy_report,
+                    thread_profile* profile);
 
 
   vector<pair<pb::Spectrum, int>> spectrum_heap_; // vector -> first = neutral_mass, second = file number
@@ -188,6 +279,21 @@ class TideSearchApplication : public CruxApplication {
   static int PeakMatching(ObservedPeakSet& observed, vector<unsigned int>& peak_list, int& matching_peaks, int& repeat_matching_peaks);
   void setSpectrumFlag(map<pair<string, unsigned int>, bool>* spectrum_flag);
 
+  /**
+   * Functions used by cascade-search to share one spectrum conversion
+   * across several searches and to pass the results on in memory.
+   */
+  void setSpectrumFiles(const vector<InputFile>& spectrum_files);
+  const vector<InputFile>& getSpectrumFiles() const;
+  void setDeleteSpectrumRecords(bool delete_spectrum_records);
+  void setResultsToMemory(bool results_to_memory);
+
+  /**
+   * Returns the in-memory tsv results and hands their ownership to
+   * the caller. The decoy stream is NULL if no separate decoys exist.
+   */
+  void releaseResultStreams(istream*& target, istream*& decoy);
+
 
   /**
    * Constructor
@@ -238,6 +344,11 @@ class TideSearchApplication : public CruxApplication {
    */
   virtual bool needsOutputDirectory() const;
 
+  /**
+   * Returns true: --resume continues the outputs from the checkpoint
+   */
+  virtual bool resumesOutputs() const;
+
   /**
    * Returns the command ID 
    */
@@ -1,5 +1,50 @@
 #include "CKronik2.h"
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+//Peptides remaining across all partitions, for the progress counter
+struct sLinkProgress{
+  int startCount;
+  atomic<int> pepCount;
+  int lastPercent;
+  int* percent;
+  mutex m;
+
+  void update(int used){
+    int remaining=(pepCount-=used);
+    int pct=100-(int)((float)remaining/(float)startCount*100.0);
+    lock_guard<mutex> lock(m);
+    *percent=pct;
+    if(pct>lastPercent){
+      cerr << "\b\b\b" << pct;
+      lastPercent=pct;
+    }
+  }
+};
+
+//Position of a Hardklor peptide, sorted by charge and mass to partition the data
+typedef struct sPepRef{
+  int charge;
+  double monoMass;
+  int scan;
+  int pos;
+} sPepRef;
+
+static bool comparePepRef(const sPepRef& a, const sPepRef& b){
+  if(a.charge!=b.charge) return a.charge<b.charge;
+  if(a.monoMass!=b.monoMass) return a.monoMass<b.monoMass;
+  if(a.scan!=b.scan) return a.scan<b.scan;
+  return a.pos<b.pos;
+}
+
+static bool compareScanPos(const sPepRef& a, const sPepRef& b){
+  if(a.scan!=b.scan) return a.scan<b.scan;
+  return a.pos<b.pos;
+}
+
 //-------------------------------------
 //   Constructors and Destructors
 //-------------------------------------
@@ -7,6 +52,7 @@ CKronik2::CKronik2(){
   dPPMTol   = 10.0; 
   iGapTol   = 1;   
   iMatchTol = 3;    
+  iThreads  = 1;
 }
 CKronik2::~CKronik2(){
 }
@@ -15,6 +61,7 @@ CKronik2::CKronik2(const CKronik2& c){
   dPPMTol=c.dPPMTol;
   iGapTol=c.iGapTol;
   iMatchTol=c.iMatchTol;
+  iThreads=c.iThreads;
   iPercent=c.iPercent;
   vPeps.clear();
   for(unsigned int i=0;i<c.vPeps.size();i++) vPeps.push_back(c.vPeps[i]);
@@ -31,6 +78,7 @@ CKronik2& CKronik2::operator=(const CKronik2& c){
     dPPMTol=c.dPPMTol;
     iGapTol=c.iGapTol;
     iMatchTol=c.iMatchTol;
+    iThreads=c.iThreads;
     iPercent=c.iPercent;
     vPeps.clear();
     for(unsigned int i=0;i<c.vPeps.size();i++) vPeps.push_back(c.vPeps[i]);
@@ -133,33 +181,12 @@ bool CKronik2::processHK(char*  in, char* out) {
 	double td;
 	char tag;
 	bool firstScan;
-  int sIndex,pIndex;
-  int i,j,k,k1,k2;
 
 	char line[256];
 	char* tok;
 
-	int pepCount=0;
   vector<sScan> allScans;
 
-  double mass;
-  double ppm;
-  int charge;
-  int gap;
-  int matchCount;
-  bool bMatch;
-
-  sPepProfile s;
-  sProfileData p;
-
-  //for tracking which peptides
-  iTwo t;
-  vector<iTwo> vLeft;
-  vector<iTwo> vRight;
-
-  //clear data
-  vPeps.clear();
-
   //Read in the Hardklor results
   firstScan=true;
 	hkr = fopen(in,"rt");
@@ -185,7 +212,6 @@ bool CKronik2::processHK(char*  in, char* out) {
 			strcpy(scan.file,tok);
       //fscanf(hkr,"\t%d\t%f%s\n",&scan.scanNum,&scan.rTime,scan.file);
 		} else {
-			pepCount++;
 			fscanf(hkr,"\t%lf\t%d\t%f\t%lf\t%lf-%lf\t%lf\t%s\t%lf\n", &pep.monoMass,&pep.charge,&pep.intensity,&pep.basePeak,&td,&td,&td,pep.mods,&pep.xCorr);
 			scan.vPep->push_back(pep);
 		}
@@ -193,19 +219,179 @@ bool CKronik2::processHK(char*  in, char* out) {
   allScans.push_back(scan);
 	fclose(hkr);
 
+  return processHK(allScans,out);
+}
+
+//Finds persistent peptide signals in Hardklor results that are already in memory,
+//one sScan per Hardklor scan in file order. allScans is consumed by the analysis.
+bool CKronik2::processHK(vector<sScan>& allScans, char* out) {
+  size_t i,j;
+  int pepCount=0;
+  sLinkProgress prog;
+
+  //clear data
+  vPeps.clear();
+
+  for(i=0;i<allScans.size();i++) pepCount+=allScans[i].vPep->size();
+
   cout << pepCount << " peptides from " << allScans.size() << " scans." << endl;
 
   for(i=0;i<allScans.size();i++) allScans[i].sortIntRev();
 
   cout << "Finding persistent peptide signals:" << endl;
 
-  int startCount=pepCount;
-  int lastPercent=0;
+  prog.startCount=pepCount;
+  prog.pepCount=pepCount;
+  prog.lastPercent=0;
+  prog.percent=&iPercent;
+
+  cerr << prog.lastPercent;
+
+  if(iThreads<2){
+    linkPeptides(allScans,NULL,vPeps,NULL,prog);
+  } else {
+
+    //Peptides only link to others of the same charge within the ppm tolerance, so
+    //the data split at mass gaps wider than that can be analyzed independently.
+    //Signals are merged back in the order a single pass would have found them.
+    vector<sPepRef> vRef;
+    sPepRef r;
+    for(i=0;i<allScans.size();i++){
+      for(j=0;j<allScans[i].vPep->size();j++){
+        r.charge=allScans[i].vPep->at(j).charge;
+        r.monoMass=allScans[i].vPep->at(j).monoMass;
+        r.scan=(int)i;
+        r.pos=(int)j;
+        vRef.push_back(r);
+      }
+    }
+    sort(vRef.begin(),vRef.end(),comparePepRef);
+
+    vector<size_t> vCut;
+    size_t target=vRef.size()/(iThreads*4)+1;
+    vCut.push_back(0);
+    for(i=1;i<vRef.size();i++){
+      if(i-vCut.back()<target) continue;
+      if(vRef[i].charge!=vRef[i-1].charge ||
+         vRef[i].monoMass-vRef[i-1].monoMass > 2*dPPMTol*vRef[i].monoMass/1000000) vCut.push_back(i);
+    }
+    vCut.push_back(vRef.size());
+
+    size_t partCount=vCut.size()-1;
+    vector< vector<sPepProfile> > vPartPeps(partCount);
+    vector< vector<sSeedKey> > vPartKeys(partCount);
+    atomic<size_t> next(0);
+    vector<thread> vThreads;
+    int threadCount = (int)partCount<iThreads ? (int)partCount : iThreads;
+
+    for(int t=0;t<threadCount;t++){
+      vThreads.push_back(thread([&](){
+        size_t part,k;
+        while((part=next++)<partCount){
+
+          //copy the partition's peptides, keeping their order within each scan
+          vector<sPepRef> v(vRef.begin()+vCut[part],vRef.begin()+vCut[part+1]);
+          sort(v.begin(),v.end(),compareScanPos);
+          vector<sScan> vScans(allScans.size());
+          vector< vector<int> > vPos(allScans.size());
+          for(k=0;k<allScans.size();k++){
+            vScans[k].scanNum=allScans[k].scanNum;
+            vScans[k].rTime=allScans[k].rTime;
+            vScans[k].file[0]='\0';
+          }
+          for(k=0;k<v.size();k++){
+            vScans[v[k].scan].vPep->push_back(allScans[v[k].scan].vPep->at(v[k].pos));
+            vPos[v[k].scan].push_back(v[k].pos);
+          }
+
+          linkPeptides(vScans,&vPos,vPartPeps[part],&vPartKeys[part],prog);
+        }
+      }));
+    }
+    for(i=0;i<vThreads.size();i++) vThreads[i].join();
+
+    //merge by seed order: highest intensity first, then earliest scan and position
+    vector< pair<size_t,size_t> > vOrder;
+    for(i=0;i<partCount;i++){
+      for(j=0;j<vPartKeys[i].size();j++) vOrder.push_back(make_pair(i,j));
+    }
+    sort(vOrder.begin(),vOrder.end(),[&](const pair<size_t,size_t>& a, const pair<size_t,size_t>& b){
+      const sSeedKey& ka=vPartKeys[a.first][a.second];
+      const sSeedKey& kb=vPartKeys[b.first][b.second];
+      if(ka.intensity!=kb.intensity) return ka.intensity>kb.intensity;
+      if(ka.scan!=kb.scan) return ka.scan<kb.scan;
+      return ka.pos<kb.pos;
+    });
+    vPeps.reserve(vOrder.size());
+    for(i=0;i<vOrder.size();i++) vPeps.push_back(vPartPeps[vOrder[i].first][vOrder[i].second]);
+  }
+
+  cerr << endl;
+
+  if(out[0]!='\0'){
+    FILE* f;
+    f=fopen(out,"wt");
+
+    //Heading line
+	  fprintf(f,"File\tFirst Scan\tLast Scan\tNum of Scans\tCharge\tMonoisotopic Mass\tBase Isotope Peak\t");
+	  fprintf(f,"Best Intensity\tSummed Intensity\tFirst RTime\tLast RTime\tBest RTime\tBest Correlation\tModifications\n");
+
+    for(i=0;i<vPeps.size();i++){
+		  fprintf(f,"%s\t%d\t%d\t%d\t%d\t%lf\t%lf\t%f\t%f\t%f\t%f\t%f\t%lf\t%s\n","NULL",
+																																		   vPeps[i].lowScan,
+																																		   vPeps[i].highScan,
+                                                                       vPeps[i].datapoints,
+																																		   vPeps[i].charge,
+																																		   vPeps[i].monoMass,
+																																		   vPeps[i].basePeak,
+																																		   vPeps[i].intensity,
+																																		   vPeps[i].sumIntensity,
+																																		   vPeps[i].firstRTime,
+																																		   vPeps[i].lastRTime,
+																																		   vPeps[i].rTime,
+																																		   vPeps[i].xCorr,
+																																		   vPeps[i].mods);
+	  }
+    
+	  fclose(f);
+  }
+
+  return true;
+}
+
+
+
+//Links each remaining peptide, most intense first, with matching peptides in the
+//neighboring scans. When vPos is given it holds the original position of every
+//peptide in allScans, and the seed of each signal is reported in keys.
+void CKronik2::linkPeptides(vector<sScan>& allScans, vector< vector<int> >* vPos, vector<sPepProfile>& peps, vector<sSeedKey>* keys, sLinkProgress& prog){
+  int sIndex,pIndex;
+  int i,j,k,k1,k2;
+
+  int pepCount=0;
+  int used;
+
+  double mass;
+  double ppm;
+  int charge;
+  int gap;
+  int matchCount;
+  bool bMatch;
+
+  sPepProfile s;
+  sProfileData p;
+  sSeedKey key;
 
-  cerr << lastPercent;
+  //for tracking which peptides
+  iTwo t;
+  vector<iTwo> vLeft;
+  vector<iTwo> vRight;
+
+  for(i=0;i<allScans.size();i++) pepCount+=allScans[i].vPep->size();
 
   //Perform the Kronik analysis
   while(pepCount>0){
+    used=0;
     if(!findMax(allScans,sIndex,pIndex)) break;
 
     mass=allScans[sIndex].vPep->at(pIndex).monoMass;
@@ -383,68 +569,43 @@ bool CKronik2::processHK(char*  in, char* out) {
       s.sumIntensity=0.0f;
       for(i=0;i<s.datapoints;i++) s.sumIntensity+=s.profile[i].intensity;
 
-      vPeps.push_back(s);
+      peps.push_back(s);
+      if(keys!=NULL){
+        key.intensity=allScans[sIndex].vPep->at(pIndex).intensity;
+        key.scan=sIndex;
+        key.pos=vPos->at(sIndex)[pIndex];
+        keys->push_back(key);
+      }
 
       //Erase datapoints already used
       for(i=0;i<vLeft.size();i++){
         if(vLeft[i].pep<0) continue;
         allScans[vLeft[i].scan].vPep->erase(allScans[vLeft[i].scan].vPep->begin()+vLeft[i].pep);
+        if(vPos!=NULL) vPos->at(vLeft[i].scan).erase(vPos->at(vLeft[i].scan).begin()+vLeft[i].pep);
         pepCount--;
+        used++;
       }
       for(i=0;i<vRight.size();i++){
         if(vRight[i].pep<0) continue;
         allScans[vRight[i].scan].vPep->erase(allScans[vRight[i].scan].vPep->begin()+vRight[i].pep);
+        if(vPos!=NULL) vPos->at(vRight[i].scan).erase(vPos->at(vRight[i].scan).begin()+vRight[i].pep);
         pepCount--;
+        used++;
       }
     }
 
     //erase the one we're looking at
     allScans[sIndex].vPep->erase(allScans[sIndex].vPep->begin()+pIndex);
+    if(vPos!=NULL) vPos->at(sIndex).erase(vPos->at(sIndex).begin()+pIndex);
     pepCount--;
+    used++;
 
     //update percent
-    iPercent=100-(int)((float)pepCount/(float)startCount*100.0);
-    if(iPercent>lastPercent){
-      cerr << "\b\b\b" << iPercent;
-      lastPercent=iPercent;
-    }
+    prog.update(used);
 
   }
-  cerr << endl;
-
-  if(out[0]!='\0'){
-    FILE* f;
-    f=fopen(out,"wt");
-
-    //Heading line
-	  fprintf(f,"File\tFirst Scan\tLast Scan\tNum of Scans\tCharge\tMonoisotopic Mass\tBase Isotope Peak\t");
-	  fprintf(f,"Best Intensity\tSummed Intensity\tFirst RTime\tLast RTime\tBest RTime\tBest Correlation\tModifications\n");
-
-    for(i=0;i<vPeps.size();i++){
-		  fprintf(f,"%s\t%d\t%d\t%d\t%d\t%lf\t%lf\t%f\t%f\t%f\t%f\t%f\t%lf\t%s\n","NULL",
-																																		   vPeps[i].lowScan,
-																																		   vPeps[i].highScan,
-                                                                       vPeps[i].datapoints,
-																																		   vPeps[i].charge,
-																																		   vPeps[i].monoMass,
-																																		   vPeps[i].basePeak,
-																																		   vPeps[i].intensity,
-																																		   vPeps[i].sumIntensity,
-																																		   vPeps[i].firstRTime,
-																																		   vPeps[i].lastRTime,
-																																		   vPeps[i].rTime,
-																																		   vPeps[i].xCorr,
-																																		   vPeps[i].mods);
-	  }
-    
-	  fclose(f);
-  }
-
-  return true;
 }
 
-
-
 bool CKronik2::findMax(vector<sScan>& v, int& s, int& p){
   bool found = false;
   float max=0;
@@ -535,6 +696,10 @@ void CKronik2::setMatchTol(int i){
   iMatchTol=i;
 }
 
+void CKronik2::setThreads(int i){
+  iThreads=i;
+}
+
 void CKronik2::setGapTol(int i){
   iGapTol=i;
 }
@@ -263,6 +263,16 @@ typedef struct iTwo{
   int pep;
 } iTwo;
 
+//Seed of a persistent peptide signal: its intensity, scan index, and original
+//position within the scan. Orders signals found in separate mass partitions.
+typedef struct sSeedKey{
+  float intensity;
+  int scan;
+  int pos;
+} sSeedKey;
+
+struct sLinkProgress;
+
 class CKronik2 {
 public:
 
@@ -282,11 +292,13 @@ public:
   void setPPMTol(double d);
   void setMatchTol(int i);
   void setGapTol(int i);
+  void setThreads(int i);
 
   //Automation
   int getPercent();
   bool loadHK(char* in);
   bool processHK(char* in, char* out="\0");
+  bool processHK(vector<sScan>& allScans, char* out="\0");
 
   //Tools
   bool getRT(int scanNum, float& rt);
@@ -313,6 +325,7 @@ public:
 protected:
 private:
   bool findMax(vector<sScan>& v, int& s, int& p);
+  void linkPeptides(vector<sScan>& allScans, vector< vector<int> >* vPos, vector<sPepProfile>& peps, vector<sSeedKey>* keys, sLinkProgress& prog);
   double interpolate(int x1, int x2, double y1, double y2, int x);
   
   //Statistics functions
@@ -329,6 +342,7 @@ private:
   int iGapTol;      //default 1
   int iMatchTol;    //Default 3
   int iPercent;
+  int iThreads;     //default 1
 
   //Sorting Functions
   void sortPeptide();
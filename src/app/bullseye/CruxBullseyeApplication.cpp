@@ -3,7 +3,9 @@
  * \brief Given a ms1 and ms2 file, run hardklor followed by the bullseye algorithm.
  *****************************************************************************/
 #include "CruxBullseyeApplication.h"
+#include "CKronik2.h"
 #include "app/hardklor/CruxHardklorApplication.h"
+#include "app/hardklor/HardklorTypes.h"
 #include "util/CarpStreamBuf.h"
 #include "io/DelimitedFileWriter.h"
 
@@ -43,6 +45,39 @@ int CruxBullseyeApplication::main(int argc, char** argv) {
   );
 }
 
+/**
+ * Groups in-memory Hardklor results by scan, as bullseye would read them
+ * from hardklor.mono.txt.
+ */
+void CruxBullseyeApplication::toBullseyeScans(
+  const string& spectra_file,
+  const vector<hkScan>& scans,
+  const vector<hkMem>& results,
+  vector<sScan>* bullseye_scans
+) {
+  sScan scan;
+  sPep pep;
+  bullseye_scans->reserve(scans.size());
+  for (size_t i = 0; i < scans.size(); i++) {
+    scan.clear();
+    scan.scanNum = scans[i].scan;
+    scan.rTime = scans[i].rTime;
+    strncpy(scan.file, spectra_file.c_str(), sizeof(scan.file) - 1);
+    scan.file[sizeof(scan.file) - 1] = '\0';
+    size_t end = i + 1 < scans.size() ? scans[i + 1].firstResult : results.size();
+    for (size_t j = scans[i].firstResult; j < end; j++) {
+      pep.monoMass = results[j].monoMass;
+      pep.charge = results[j].charge;
+      pep.intensity = results[j].intensity;
+      pep.basePeak = results[j].mz;
+      pep.xCorr = results[j].corr;
+      strcpy(pep.mods, results[j].mods);
+      scan.vPep->push_back(pep);
+    }
+    bullseye_scans->push_back(scan);
+  }
+}
+
 /**
  * main method for CruxBullseyeApplication
  */
@@ -54,11 +89,24 @@ int CruxBullseyeApplication::main(
 ) {
   /* Get parameters. */
   string hardklor_output = Params::GetString("hardklor-file");
+  vector<sScan> hardklor_scans;
+  bool hardklor_in_memory = false;
   if (hardklor_output.empty()) {
     hardklor_output = make_file_path("hardklor.mono.txt");
     if (Params::GetBool("overwrite") || (!FileUtils::Exists(hardklor_output))) {
       carp(CARP_DEBUG, "Calling hardklor");
-      bool ret = CruxHardklorApplication::main(input_ms1);
+      bool ret;
+      if (Params::GetBool("bullseye-hardklor-output")) {
+        ret = CruxHardklorApplication::main(input_ms1);
+      } else {
+        // Hand the results straight to bullseye instead of writing and
+        // re-reading hardklor.mono.txt
+        vector<hkScan> scans;
+        vector<hkMem> results;
+        ret = CruxHardklorApplication::main(input_ms1, &scans, &results);
+        toBullseyeScans(input_ms1, scans, results, &hardklor_scans);
+        hardklor_in_memory = true;
+      }
       if (ret != 0) {
         carp(CARP_WARNING, "Hardklor failed:%d", ret);
         return ret;
@@ -100,6 +148,9 @@ int CruxBullseyeApplication::main(
   
   be_args_vec.push_back("-t");
   be_args_vec.push_back(Params::GetString("retention-tolerance"));
+
+  be_args_vec.push_back("-T");
+  be_args_vec.push_back(Params::GetString("num-threads"));
   
 
 
@@ -127,7 +178,8 @@ int CruxBullseyeApplication::main(
   cout.rdbuf(&buffer);
 
   /* Call bullseyeMain */
-  int ret = bullseyeMain(be_argc, be_argv);
+  int ret = bullseyeMain(be_argc, be_argv,
+                         hardklor_in_memory ? &hardklor_scans : NULL);
 
   // Recover stream
   cout.rdbuf(old);
@@ -205,6 +257,9 @@ vector<string> CruxBullseyeApplication::getOptions() const {
     "bullseye-min-mass",
     "retention-tolerance",
     "spectrum-format",
+    "bullseye-hardklor-output",
+    "hardklor-model-cache",
+    "num-threads",
     "parameter-file",
     "verbosity"
   };
@@ -232,7 +287,8 @@ vector< pair<string, string> > CruxBullseyeApplication::getOutputs() const {
     "were not inferred."));
   outputs.push_back(make_pair("hardklor.mono.txt",
     "a tab-delimited text file containing one line for each isotope "
-    "distribution, as described <a href=\"hardklor.html\">here</a>."));
+    "distribution, as described <a href=\"hardklor.html\">here</a>. "
+    "Only written when bullseye-hardklor-output is T."));
   outputs.push_back(make_pair("bullseye.params.txt",
     "a file containing the name and value of all parameters/options for the "
     "current operation. Not all parameters in the file may have been used in "
@@ -11,13 +11,27 @@
 
 #include <string>
 #include <fstream>
+#include <vector>
+
+struct hkMem;
+struct hkScan;
+struct sScan;
 
 class CruxBullseyeApplication: public CruxApplication {
 
  protected:
 
-  //Calls the main method in bullseye
-  int bullseyeMain(int argc, char* argv[]);
+  //Calls the main method in bullseye; Hardklor results are read from
+  //hardklorScans instead of the Hardklor file argument when it is given
+  int bullseyeMain(int argc, char* argv[], std::vector<sScan>* hardklorScans = NULL);
+
+  //Converts in-memory Hardklor results to bullseye's scan records
+  static void toBullseyeScans(
+    const std::string& spectra_file,
+    const std::vector<hkScan>& scans,
+    const std::vector<hkMem>& results,
+    std::vector<sScan>* bullseye_scans
+  );
 
  public:
 
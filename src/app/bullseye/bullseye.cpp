@@ -4,13 +4,34 @@
 #ifdef CRUX
 #include "CruxBullseyeApplication.h"
 #endif
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <thread>
 #include <vector>
 
 using namespace MSToolkit;
 
+//Precursor m/z window of a persistent peptide, for matching MS/MS scans that
+//did not isolate its base peak. Bounds are exclusive.
+typedef struct sPrecursorWindow{
+  double lowMass;
+  double highMass;
+  float firstRTime;
+  float lastRTime;
+  int index;  //position in the persistent peptide list
+} sPrecursorWindow;
+
+//Precursor windows of one charge state, sorted by lowMass
+typedef struct sWindowIndex{
+  int charge;
+  double maxWidth;
+  vector<sPrecursorWindow> windows;
+} sWindowIndex;
+
 MSFileFormat getFileFormat(char* c);
+void buildWindowIndex(CKronik2& p, vector<sWindowIndex>& vIndex);
+void findHits(CKronik2& p, int* lookup, vector<sWindowIndex>& vIndex, double mz, float rTime, vector<int>& vHit);
 void matchMS2(CKronik2& p, char* ms2File, char* outFile, char* outFile2);
 void usage();
 
@@ -18,11 +39,13 @@ double mean,stD;
 double ppmTolerance;
 double rtTolerance;
 bool bMatchPrecursorOnly;
+int numThreads;
 
 #ifdef CRUX
-int CruxBullseyeApplication::bullseyeMain(int argc, char* argv[]){
+int CruxBullseyeApplication::bullseyeMain(int argc, char* argv[], vector<sScan>* hardklorScans){
 #else
 int main(int argc, char* argv[]){
+  vector<sScan>* hardklorScans=NULL;
 #endif
   int i;
   CKronik2 p1;
@@ -35,6 +58,7 @@ int main(int argc, char* argv[]){
   ppmTolerance=10.0;
   rtTolerance=0.5;
   bMatchPrecursorOnly=false;
+  numThreads=1;
 
 	//Set default parameters for some options
 	double contam=2.0;
@@ -82,6 +106,11 @@ int main(int argc, char* argv[]){
 			case 't':
 				rtTolerance=atof(argv[i+1]);
 				break;
+      case 'T':
+        numThreads=atoi(argv[i+1]);
+        if(numThreads<1) numThreads=(int)thread::hardware_concurrency();
+        if(numThreads<1) numThreads=1;
+        break;
 			default:
 				cout << "Invalid flag!\n" << endl;
 				usage();
@@ -91,7 +120,9 @@ int main(int argc, char* argv[]){
 		}
 	}
 
-	p1.processHK(argv[argc-4]);
+	p1.setThreads(numThreads);
+	if(hardklorScans!=NULL) p1.processHK(*hardklorScans);
+	else p1.processHK(argv[argc-4]);
 	if (p1.size() == 0) {
 		cout << "No analysis results, exiting..." << endl;
 		exit(0);
@@ -120,15 +151,123 @@ int main(int argc, char* argv[]){
   
 }
 
+//Indexes the precursor windows of the persistent peptides by charge state.
+//The window bounds are computed exactly as matchMS2 always has.
+void buildWindowIndex(CKronik2& p, vector<sWindowIndex>& vIndex){
+  unsigned int i;
+  int j;
+  double mz;
+  sPrecursorWindow w;
+  sWindowIndex wi;
+
+  vIndex.clear();
+  for(i=0;i<p.size();i++){
+    mz=(p.at(i).monoMass+p.at(i).charge*1.00727649)/p.at(i).charge;
+    w.lowMass = mz-0.05;
+    switch(p.at(i).charge){
+      case 1:
+        w.highMass = mz + 3.10;
+        break;
+      case 2:
+        w.highMass = mz + 2.10;
+        break;
+      default:
+        w.highMass = mz + 4/p.at(i).charge +0.05;
+        break;
+    }
+    w.firstRTime=p.at(i).firstRTime;
+    w.lastRTime=p.at(i).lastRTime;
+    w.index=i;
+
+    for(j=0;j<(int)vIndex.size();j++){
+      if(vIndex[j].charge==p.at(i).charge) break;
+    }
+    if(j==(int)vIndex.size()){
+      wi.charge=p.at(i).charge;
+      wi.maxWidth=0;
+      vIndex.push_back(wi);
+    }
+    vIndex[j].windows.push_back(w);
+    if(w.highMass-w.lowMass > vIndex[j].maxWidth) vIndex[j].maxWidth=w.highMass-w.lowMass;
+  }
+
+  for(j=0;j<(int)vIndex.size();j++){
+    stable_sort(vIndex[j].windows.begin(),vIndex[j].windows.end(),
+      [](const sPrecursorWindow& a, const sPrecursorWindow& b){ return a.lowMass<b.lowMass; });
+  }
+}
+
+//Finds the persistent peptides that may be the precursor of an MS/MS scan.
+//Base peak matches come first, then window matches, each in list order.
+void findHits(CKronik2& p, int* lookup, vector<sWindowIndex>& vIndex, double mz, float rTime, vector<int>& vHit){
+  int i,j;
+  int lo,hi,mid;
+  int first,last;
+  double ppm;
+  size_t n,windowHits;
+
+  vHit.clear();
+
+  //see if we can pick it up on base peak alone; the hits within the lookup
+  //range are contiguous because the list is sorted by base peak
+  j=(int)(mz+0.5);
+  first=lookup[j-1];
+  last=lookup[j+1];
+  lo=first;
+  hi=last+1;
+  while(lo<hi){
+    mid=(lo+hi)/2;
+    ppm = (p.at(mid).basePeak-mz)/mz*1000000;
+    if(ppm<=-ppmTolerance) lo=mid+1;
+    else hi=mid;
+  }
+  for(i=lo;i<=last;i++){
+    ppm = (p.at(i).basePeak-mz)/mz*1000000;
+    if(ppm>=ppmTolerance) break;
+    if( fabs(ppm)<ppmTolerance &&
+        rTime > p.at(i).firstRTime-rtTolerance &&
+        rTime < p.at(i).lastRTime+rtTolerance ) {
+      vHit.push_back(i);
+    }
+  }
+
+  //if base peak wasn't enough, perhaps a different peak was isolated
+  if(bMatchPrecursorOnly) return;
+  windowHits=vHit.size();
+  for(j=0;j<(int)vIndex.size();j++){
+    vector<sPrecursorWindow>& v=vIndex[j].windows;
+
+    //windows containing mz start after mz-maxWidth and before mz
+    lo=0;
+    hi=(int)v.size();
+    while(lo<hi){
+      mid=(lo+hi)/2;
+      if(v[mid].lowMass < mz-vIndex[j].maxWidth-0.000001) lo=mid+1;
+      else hi=mid;
+    }
+    for(n=lo;n<v.size() && v[n].lowMass<mz;n++){
+      if( mz < v[n].highMass &&
+          rTime > v[n].firstRTime-rtTolerance &&
+          rTime < v[n].lastRTime+rtTolerance ) {
+        vHit.push_back(v[n].index);
+      }
+    }
+  }
+  sort(vHit.begin()+windowHits,vHit.end());
+}
+
 void matchMS2(CKronik2& p, char* ms2File, char* outFile, char* outFile2){
 
   Spectrum s;
+  vector<Spectrum> vChunk;
+  vector< vector<int> > vChunkHits;
+  vector<sWindowIndex> vIndex;
+  vector<thread> vThreads;
   MSReader r,rPos,rNeg;
   MSObject o,o2;
-  int i,j;
+  int i,j,k;
   int fragCount=0;
   int lookup[8001];
-  double lowMass, highMass,ppm;
   int x,z;
   int a,b;
   int c=0;
@@ -193,6 +332,7 @@ void matchMS2(CKronik2& p, char* ms2File, char* outFile, char* outFile2){
     }
     lookup[i]=j;
   }
+  if(!bMatchPrecursorOnly) buildWindowIndex(p,vIndex);
   cout << "Done!" << endl;
 
   //Read in the data
@@ -220,131 +360,113 @@ void matchMS2(CKronik2& p, char* ms2File, char* outFile, char* outFile2){
 
   while(s.getScanNumber()>0){
 
-    j=(int)(s.getMZ()+0.5);
-    x=0;
-    vHit.clear();
-		
-    //see if we can pick it up on base peak alone
-    for(i=lookup[j-1];i<=lookup[j+1];i++){
-      ppm = (p.at(i).basePeak-s.getMZ())/s.getMZ()*1000000;
-      if( fabs(ppm)<ppmTolerance &&
-          s.getRTime() > p.at(i).firstRTime-rtTolerance &&
-          s.getRTime() < p.at(i).lastRTime+rtTolerance ) {
-        x++;
-        index=i;
-        vHit.push_back(i);
+    //Read a chunk of scans, then match their precursors on all threads. Results
+    //are written in scan order, so output does not depend on the thread count.
+    vChunk.clear();
+    while(s.getScanNumber()>0 && vChunk.size()<2000){
+      vChunk.push_back(s);
+      r.readFile(NULL,s);
+
+      //Update file position counter
+      if (r.getPercent() > iPercent){
+        if(iPercent<10) cerr << "\b";
+        else if (iPercent<100) cerr << "\b\b";
+        else cerr << "\b\b\b";
+        cerr.flush();
+        iPercent=r.getPercent();
+        cerr << iPercent;
+        cerr.flush();
       }
     }
 
-    //if base peak wasn't enough, perhaps a different peak was isolated
-    if(!bMatchPrecursorOnly){
-      for(i=0;i<p.size();i++){
-        lowMass = (p.at(i).monoMass+p.at(i).charge*1.00727649)/p.at(i).charge-0.05;
-        switch(p.at(i).charge){
-          case 1:
-            highMass = (p.at(i).monoMass+p.at(i).charge*1.00727649)/p.at(i).charge + 3.10;
-            break;
-          case 2:
-            highMass = (p.at(i).monoMass+p.at(i).charge*1.00727649)/p.at(i).charge + 2.10;
-            break;
-          default:
-            highMass = (p.at(i).monoMass+p.at(i).charge*1.00727649)/p.at(i).charge + 4/p.at(i).charge +0.05;
-            break;
-        }
-        if( s.getMZ() > lowMass &&
-            s.getMZ() < highMass &&
-            s.getRTime() > p.at(i).firstRTime-rtTolerance &&
-            s.getRTime() < p.at(i).lastRTime+rtTolerance ) {
-          x++;
-          index=i;
-          vHit.push_back(i);
+    vChunkHits.assign(vChunk.size(),vector<int>());
+    vThreads.clear();
+    for(i=0;i<numThreads;i++){
+      vThreads.push_back(thread([&,i](){
+        for(size_t n=i;n<vChunk.size();n+=numThreads){
+          findHits(p,lookup,vIndex,vChunk[n].getMZ(),vChunk[n].getRTime(),vChunkHits[n]);
         }
-      }
+      }));
     }
+    for(i=0;i<(int)vThreads.size();i++) vThreads[i].join();
+
+    for(k=0;k<(int)vChunk.size();k++){
+      Spectrum& sp=vChunk[k];
+      vHit.swap(vChunkHits[k]);
+      x=(int)vHit.size();
+      if(x>0) index=vHit[x-1];
+
+      vI.push_back(x);
+      sp.setFileType(MS2);
+
+      if(x==0) {
+        z++;
+        o2.add(sp);
+        if(o2.size()>500){
+          rNeg.appendFile(outFile2,o2);
+          o2.clear();
+        }
+        ch[0]++;
+      } else if(x==1) {
+        a++;
+        while(sp.sizeZ()>0) sp.eraseZ(0);
+        if(posFF==mgf){
+          sp.addZState(p.at(index).charge,(p.at(index).monoMass+1.00727649*p.at(index).charge)/p.at(index).charge);
+        } else {
+          sp.addZState(p.at(index).charge,p.at(index).monoMass+1.00727649);
+          sp.addEZState(p.at(index).charge,p.at(index).monoMass+1.00727649,p.at(index).rTime,p.at(index).sumIntensity);
+        }
+        o.add(sp);
+        if(o.size()>500){
+          rPos.appendFile(outFile,o);
+          o.clear();
+        }
+        c++;
+      } else {
+        while(sp.sizeZ()>0) sp.eraseZ(0);
 
-    vI.push_back(x);
-    s.setFileType(MS2);
+        //erase redundancies in multiple hit list
+        for(i=0;i<vHit.size()-1;i++){
+          for(j=i+1;j<vHit.size();j++){
+            if(p.at(vHit[i]).charge == p.at(vHit[j]).charge) {
+              sprintf(str1,"%.2f\n",p.at(vHit[i]).monoMass+1.00727649);
+              sprintf(str2,"%.2f\n",p.at(vHit[j]).monoMass+1.00727649);
+
+              if(strcmp(str1,str2)==0) {
+                if(p.at(vHit[i]).intensity < p.at(vHit[j]).intensity) vHit[i]=vHit[j];
+                vHit.erase(vHit.begin()+j);
+                j--;
+              }
 
-    if(x==0) {
-      z++;
-      o2.add(s);
-      if(o2.size()>500){
-        rNeg.appendFile(outFile2,o2);
-        o2.clear();
-      }
-      ch[0]++;
-    } else if(x==1) {
-      a++;
-      while(s.sizeZ()>0) s.eraseZ(0);
-      if(posFF==mgf){
-        s.addZState(p.at(index).charge,(p.at(index).monoMass+1.00727649*p.at(index).charge)/p.at(index).charge);
-      } else {
-        s.addZState(p.at(index).charge,p.at(index).monoMass+1.00727649);
-        s.addEZState(p.at(index).charge,p.at(index).monoMass+1.00727649,p.at(index).rTime,p.at(index).sumIntensity);
-      }
-      o.add(s);
-      if(o.size()>500){
-        rPos.appendFile(outFile,o);
-        o.clear();
-      }
-      c++;
-    } else {
-      while(s.sizeZ()>0) s.eraseZ(0);
-
-      //erase redundancies in multiple hit list
-      for(i=0;i<vHit.size()-1;i++){
-        for(j=i+1;j<vHit.size();j++){
-          if(p.at(vHit[i]).charge == p.at(vHit[j]).charge) {
-            sprintf(str1,"%.2f\n",p.at(vHit[i]).monoMass+1.00727649);
-            sprintf(str2,"%.2f\n",p.at(vHit[j]).monoMass+1.00727649);
-
-            if(strcmp(str1,str2)==0) {
-              if(p.at(vHit[i]).intensity < p.at(vHit[j]).intensity) vHit[i]=vHit[j];
-              vHit.erase(vHit.begin()+j);
-              j--;
             }
+          }
+        }
 
+        for(i=0;i<vHit.size();i++) {
+          if(posFF==mgf){
+            sp.addZState(p.at(vHit[i]).charge,(p.at(vHit[i]).monoMass+1.00727649*p.at(vHit[i]).charge)/p.at(vHit[i]).charge);
+          } else {
+            sp.addZState(p.at(vHit[i]).charge,p.at(vHit[i]).monoMass+1.00727649);
+            sp.addEZState(p.at(vHit[i]).charge,p.at(vHit[i]).monoMass+1.00727649,p.at(vHit[i]).rTime,p.at(vHit[i]).sumIntensity);
           }
         }
-      }
 
-      for(i=0;i<vHit.size();i++) {
-        if(posFF==mgf){
-          s.addZState(p.at(vHit[i]).charge,(p.at(vHit[i]).monoMass+1.00727649*p.at(vHit[i]).charge)/p.at(vHit[i]).charge);
+        if(vHit.size()==1) {
+          a++;
+          c++;
         } else {
-          s.addZState(p.at(vHit[i]).charge,p.at(vHit[i]).monoMass+1.00727649);
-          s.addEZState(p.at(vHit[i]).charge,p.at(vHit[i]).monoMass+1.00727649,p.at(vHit[i]).rTime,p.at(vHit[i]).sumIntensity);
+          b++;
+          d+=vHit.size();
         }
-      }
 
-      if(vHit.size()==1) {
-        a++;
-        c++;
-      } else {
-        b++;
-        d+=vHit.size();
-      }
+        o.add(sp);
+        if(o.size()>500){
+          rPos.appendFile(outFile,o);
+          o.clear();
+        }
 
-      o.add(s);
-      if(o.size()>500){
-        rPos.appendFile(outFile,o);
-        o.clear();
       }
-
-    }
-    r.readFile(NULL,s);
-
-    for(i=0;i<vHit.size();i++) ch[p.at(vHit[i]).charge]++;
-
-    //Update file position counter
-    if (r.getPercent() > iPercent){
-      if(iPercent<10) cerr << "\b";
-      else if (iPercent<100) cerr << "\b\b";
-      else cerr << "\b\b\b";
-      cerr.flush();
-      iPercent=r.getPercent();
-      cerr << iPercent;
-      cerr.flush();
+      for(i=0;i<vHit.size();i++) ch[p.at(vHit[i]).charge]++;
     }
   }
 
@@ -460,6 +582,9 @@ void usage(){
 		   << "            time over which a peptide can be matched to the MS/MS\n"
 			 << "            spectrum.\n"
        << "            Default value: 0.5\n" << endl;
+  cout << "  -T <num>  Number of threads used to find persistent peptides and to\n"
+       << "            match MS/MS spectra. Use 0 for one thread per core.\n"
+       << "            Default value: 1\n" << endl;
 	cout << "\nPlease read the README.txt file for more information on Bullseye." << endl;
 
 }
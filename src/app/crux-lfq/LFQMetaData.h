@@ -3,7 +3,7 @@
 #include <unordered_map>
 #include <vector>
 
-#include "IndexedMassSpectralPeak.h"
+#include "Ms1PeakIndex.h"
 #include "Ms1ScanInfo.h"
 
 using std::string;
@@ -12,34 +12,27 @@ using std::vector;
 
 namespace CruxLFQ {
 
+/**
+ * Per-file quantification context: the MS1 peak index and scan list of one
+ * spectrum file. Each file in flight gets its own instance, so several files
+ * can be quantified at the same time. The context does not own the data.
+ */
 class LFQMetaData {
    private:
-    vector<vector<IndexedMassSpectralPeak>*>* indexedPeaks;
+    const Ms1PeakIndex* indexedPeaks;
     unordered_map<string, vector<Ms1ScanInfo>>* ms1Scans;
-    LFQMetaData() {}                                      // Private constructor to prevent instantiation
-    LFQMetaData(const LFQMetaData&) = delete;             // Disable copy constructor
-    LFQMetaData& operator=(const LFQMetaData&) = delete;  // Disable assignment operator
 
    public:
-    static LFQMetaData& getInstance() {
-        static LFQMetaData instance;
-        return instance;
-    }
-
-    void setIndexedPeaks(vector<vector<IndexedMassSpectralPeak>*>* peaks) {
-        indexedPeaks = peaks;
-    }
-
-    void setMs1Scans(unordered_map<string, vector<Ms1ScanInfo>>* scans) {
-        ms1Scans = scans;
-    }
+    LFQMetaData(const Ms1PeakIndex* peaks,
+                unordered_map<string, vector<Ms1ScanInfo>>* scans)
+        : indexedPeaks(peaks), ms1Scans(scans) {}
 
-    vector<vector<IndexedMassSpectralPeak>*>* getIndexedPeaks() {
+    const Ms1PeakIndex* getIndexedPeaks() const {
         return indexedPeaks;
     }
 
-    unordered_map<string, vector<Ms1ScanInfo>>* getMs1Scans() {
+    unordered_map<string, vector<Ms1ScanInfo>>* getMs1Scans() const {
         return ms1Scans;
     }
 };
-}  // namespace CruxLFQ
\ No newline at end of file
+}  // namespace CruxLFQ
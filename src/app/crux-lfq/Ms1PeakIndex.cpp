@@ -0,0 +1,182 @@
+#include "Ms1PeakIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace CruxLFQ {
+
+namespace {
+const char CACHE_MAGIC[8] = {'C', 'R', 'U', 'X', 'L', 'F', 'Q', 'I'};
+const uint32_t CACHE_VERSION = 1;
+
+template <typename T>
+void writeValue(std::ofstream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool readValue(std::ifstream& in, T& value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+template <typename T>
+void writeArray(std::ofstream& out, const vector<T>& values) {
+    if (!values.empty()) {
+        out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    }
+}
+
+template <typename T>
+bool readArray(std::ifstream& in, vector<T>& values, uint64_t count) {
+    values.resize(count);
+    return count == 0 ||
+           static_cast<bool>(in.read(reinterpret_cast<char*>(values.data()), count * sizeof(T)));
+}
+}  // namespace
+
+Ms1PeakIndex::Ms1PeakIndex(int binsPerDalton) : binsPerDalton_(binsPerDalton) {}
+
+int Ms1PeakIndex::bin(double mz) const {
+    return static_cast<int>(std::round(mz * binsPerDalton_));
+}
+
+void Ms1PeakIndex::addScan(int nativeScanNumber, double retentionTime) {
+    scans_.emplace_back(nativeScanNumber, static_cast<int>(scans_.size()), retentionTime);
+}
+
+void Ms1PeakIndex::countPeak(double mz) {
+    // During counting, binOffsets_[b + 1] holds the number of peaks in bin b.
+    size_t slot = static_cast<size_t>(bin(mz)) + 1;
+    if (binOffsets_.size() <= slot) {
+        binOffsets_.resize(slot + 1, 0);
+    }
+    binOffsets_[slot]++;
+}
+
+void Ms1PeakIndex::reserve() {
+    if (binOffsets_.empty()) {
+        binOffsets_.push_back(0);
+    }
+    for (size_t b = 1; b < binOffsets_.size(); b++) {
+        binOffsets_[b] += binOffsets_[b - 1];
+    }
+    cursor_.assign(binOffsets_.begin(), binOffsets_.end() - 1);
+    uint32_t total = binOffsets_.back();
+    mz_.resize(total);
+    intensity_.resize(total);
+    scanIndex_.resize(total);
+}
+
+void Ms1PeakIndex::addPeak(double mz, double intensity, int zeroBasedMs1ScanIndex) {
+    uint32_t pos = cursor_[bin(mz)]++;
+    mz_[pos] = static_cast<float>(mz);
+    intensity_[pos] = static_cast<float>(intensity);
+    scanIndex_[pos] = zeroBasedMs1ScanIndex;
+}
+
+std::pair<uint32_t, uint32_t> Ms1PeakIndex::scanRange(int b, int zeroBasedMs1ScanIndex) const {
+    if (b < 0 || b >= numBins()) {
+        return std::make_pair(0u, 0u);
+    }
+    vector<int32_t>::const_iterator binBegin = scanIndex_.begin() + binOffsets_[b];
+    vector<int32_t>::const_iterator binEnd = scanIndex_.begin() + binOffsets_[b + 1];
+    std::pair<vector<int32_t>::const_iterator, vector<int32_t>::const_iterator> range =
+        std::equal_range(binBegin, binEnd, zeroBasedMs1ScanIndex);
+    return std::make_pair(static_cast<uint32_t>(range.first - scanIndex_.begin()),
+                          static_cast<uint32_t>(range.second - scanIndex_.begin()));
+}
+
+IndexedMassSpectralPeak Ms1PeakIndex::peakAt(uint32_t i) const {
+    const Ms1ScanInfo& scan = scans_[scanIndex_[i]];
+    return IndexedMassSpectralPeak(mz_[i], intensity_[i], scanIndex_[i],
+                                   scan.oneBasedScanNumber, scan.retentionTime);
+}
+
+size_t Ms1PeakIndex::memoryBytes() const {
+    return binOffsets_.capacity() * sizeof(uint32_t) +
+           cursor_.capacity() * sizeof(uint32_t) +
+           mz_.capacity() * sizeof(float) +
+           intensity_.capacity() * sizeof(float) +
+           scanIndex_.capacity() * sizeof(int32_t) +
+           scans_.capacity() * sizeof(Ms1ScanInfo);
+}
+
+bool Ms1PeakIndex::write(const string& path, uint64_t sourceSize, int64_t sourceTime) const {
+    // Write to a temporary name first so an interrupted run never leaves a
+    // truncated cache under the real name.
+    string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    out.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    writeValue(out, CACHE_VERSION);
+    writeValue(out, static_cast<int32_t>(binsPerDalton_));
+    writeValue(out, sourceSize);
+    writeValue(out, sourceTime);
+    writeValue(out, static_cast<uint64_t>(binOffsets_.size()));
+    writeValue(out, static_cast<uint64_t>(mz_.size()));
+    writeValue(out, static_cast<uint64_t>(scans_.size()));
+    writeArray(out, binOffsets_);
+    writeArray(out, mz_);
+    writeArray(out, intensity_);
+    writeArray(out, scanIndex_);
+    for (const Ms1ScanInfo& scan : scans_) {
+        writeValue(out, static_cast<int32_t>(scan.oneBasedScanNumber));
+        writeValue(out, scan.retentionTime);
+    }
+    out.close();
+    if (!out) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+bool Ms1PeakIndex::read(const string& path, uint64_t sourceSize, int64_t sourceTime) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    char magic[sizeof(CACHE_MAGIC)];
+    uint32_t version;
+    int32_t binsPerDalton;
+    uint64_t cachedSize, numOffsets, numPeaks, numScans;
+    int64_t cachedTime;
+    if (!in.read(magic, sizeof(magic)) ||
+        memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 ||
+        !readValue(in, version) || version != CACHE_VERSION ||
+        !readValue(in, binsPerDalton) || binsPerDalton != binsPerDalton_ ||
+        !readValue(in, cachedSize) || cachedSize != sourceSize ||
+        !readValue(in, cachedTime) || cachedTime != sourceTime ||
+        !readValue(in, numOffsets) || !readValue(in, numPeaks) ||
+        !readValue(in, numScans)) {
+        return false;
+    }
+    if (!readArray(in, binOffsets_, numOffsets) ||
+        !readArray(in, mz_, numPeaks) ||
+        !readArray(in, intensity_, numPeaks) ||
+        !readArray(in, scanIndex_, numPeaks)) {
+        return false;
+    }
+    scans_.clear();
+    scans_.reserve(numScans);
+    for (uint64_t i = 0; i < numScans; i++) {
+        int32_t nativeScanNumber;
+        double retentionTime;
+        if (!readValue(in, nativeScanNumber) || !readValue(in, retentionTime)) {
+            return false;
+        }
+        addScan(nativeScanNumber, retentionTime);
+    }
+    if (binOffsets_.empty() || binOffsets_.back() != numPeaks) {
+        return false;
+    }
+    cursor_.clear();
+    return true;
+}
+
+}  // namespace CruxLFQ
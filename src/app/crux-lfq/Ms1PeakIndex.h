@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "IndexedMassSpectralPeak.h"
+#include "Ms1ScanInfo.h"
+
+using std::string;
+using std::vector;
+
+namespace CruxLFQ {
+
+/**
+ * Flat MS1 peak index. Peaks are bucketed by m/z bin and stored as parallel
+ * float arrays; binOffsets_[b] .. binOffsets_[b + 1] addresses bin b, whose
+ * peaks are in scan order. Retention time and native scan number live once
+ * per scan rather than once per peak.
+ *
+ * Construction is two passes over the same peaks: countPeak() for each peak,
+ * then reserve(), then addPeak() for each peak in scan order.
+ */
+class Ms1PeakIndex {
+   public:
+    explicit Ms1PeakIndex(int binsPerDalton);
+
+    int bin(double mz) const;
+
+    void addScan(int nativeScanNumber, double retentionTime);
+    void countPeak(double mz);
+    void reserve();
+    void addPeak(double mz, double intensity, int zeroBasedMs1ScanIndex);
+
+    /** Number of m/z bins; bins at or past this are empty. */
+    int numBins() const {
+        return binOffsets_.empty() ? 0 : static_cast<int>(binOffsets_.size()) - 1;
+    }
+
+    /** Range [first, second) of peaks in bin b that belong to the given scan. */
+    std::pair<uint32_t, uint32_t> scanRange(int b, int zeroBasedMs1ScanIndex) const;
+
+    double mzAt(uint32_t i) const { return mz_[i]; }
+    double intensityAt(uint32_t i) const { return intensity_[i]; }
+    int scanAt(uint32_t i) const { return scanIndex_[i]; }
+    IndexedMassSpectralPeak peakAt(uint32_t i) const;
+
+    const vector<Ms1ScanInfo>& scans() const { return scans_; }
+    size_t numPeaks() const { return mz_.size(); }
+    size_t memoryBytes() const;
+
+    /**
+     * Writes the index to a sidecar file. The size and modification time of
+     * the source spectrum file are recorded so a stale cache is not reused.
+     */
+    bool write(const string& path, uint64_t sourceSize, int64_t sourceTime) const;
+
+    /**
+     * Reads a sidecar written by write(). Returns false if the file is
+     * missing, truncated, or was built from a different source file.
+     */
+    bool read(const string& path, uint64_t sourceSize, int64_t sourceTime);
+
+   private:
+    int binsPerDalton_;
+    vector<uint32_t> binOffsets_;
+    vector<uint32_t> cursor_;
+    vector<float> mz_;
+    vector<float> intensity_;
+    vector<int32_t> scanIndex_;
+    vector<Ms1ScanInfo> scans_;
+};
+
+}  // namespace CruxLFQ
@@ -4,6 +4,7 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cfloat>  // For DBL_MAX
 #include <cmath>
 #include <csignal>
@@ -277,83 +278,205 @@ string calcFormula(string seq) {
     return s;
 }
 
+namespace {
+
+// Mercury output for one elemental formula at charge 1.
+struct MercuryDistribution {
+    double monoMass;
+    vector<double> masses;
+    vector<double> abundances;
+};
+
+MercuryDistribution runMercury(CMercury8& mercury, const string& formula) {
+    char buffer[512];
+    strncpy(buffer, formula.c_str(), sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+    mercury.GoMercury(buffer, 1);
+
+    MercuryDistribution dist;
+    dist.monoMass = mercury.getMonoMass();
+    for (auto i : mercury.FixedData) {
+        dist.masses.push_back(i.mass);
+        dist.abundances.push_back(i.data);
+    }
+    return dist;
+}
+
+// Averagine correction for modifications (mirrors C# FlashLFQ): adds
+// massDiff worth of averagine to the elements of baseFormula.
+string averagineCorrectedFormula(const string& baseFormula, double massDiff) {
+    static const double kAvgC = 4.9384, kAvgH = 7.7583, kAvgO = 1.4773;
+    static const double kAvgN = 1.3577, kAvgS = 0.0417;
+    static const double kAvgMass = 12.011 * kAvgC + 1.00794 * kAvgH +
+                                   15.999 * kAvgO + 14.007 * kAvgN +
+                                   32.065 * kAvgS;
+
+    // Parse element counts from base formula string (e.g. "C45H72N12O15S2")
+    int fC = 0, fH = 0, fN = 0, fO = 0, fS = 0;
+    for (const char* p = baseFormula.c_str(); *p; p++) {
+        if      (*p == 'C') fC = atoi(p + 1);
+        else if (*p == 'H') fH = atoi(p + 1);
+        else if (*p == 'N') fN = atoi(p + 1);
+        else if (*p == 'O') fO = atoi(p + 1);
+        else if (*p == 'S') fS = atoi(p + 1);
+    }
+    double averagines = massDiff / kAvgMass;
+    fC = std::max(0, fC + static_cast<int>(std::round(averagines * kAvgC)));
+    fH = std::max(0, fH + static_cast<int>(std::round(averagines * kAvgH)));
+    fO = std::max(0, fO + static_cast<int>(std::round(averagines * kAvgO)));
+    fN = std::max(0, fN + static_cast<int>(std::round(averagines * kAvgN)));
+    fS = std::max(0, fS + static_cast<int>(std::round(averagines * kAvgS)));
+
+    char corrected[512];
+    if (fS > 0)
+        snprintf(corrected, sizeof(corrected), "C%dH%dN%dO%dS%d", fC, fH, fN, fO, fS);
+    else
+        snprintf(corrected, sizeof(corrected), "C%dH%dN%dO%d", fC, fH, fN, fO);
+    return corrected;
+}
+
+// Runs Mercury for every formula not yet in the cache, spreading the unique
+// formulas over numThreads threads with one CMercury8 per thread.
+void computeMissingDistributions(
+    const vector<string>& formulas,
+    unordered_map<string, MercuryDistribution>& cache,
+    int numThreads) {
+    vector<string> missing;
+    std::unordered_set<string> seen;
+    for (const string& formula : formulas) {
+        if (!formula.empty() && cache.find(formula) == cache.end() &&
+            seen.insert(formula).second) {
+            missing.push_back(formula);
+        }
+    }
+    if (missing.empty()) {
+        return;
+    }
+
+    vector<MercuryDistribution> results(missing.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        char* fn = nullptr;
+        CMercury8 mercury(fn);
+        for (size_t i = next++; i < missing.size(); i = next++) {
+            results[i] = runMercury(mercury, missing[i]);
+        }
+    };
+    numThreads = std::max(1, std::min(numThreads, static_cast<int>(missing.size())));
+    vector<std::thread> threads;
+    for (int i = 1; i < numThreads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < missing.size(); i++) {
+        cache[missing[i]] = std::move(results[i]);
+    }
+}
+
+// The cache file has one formula per line: formula, monoisotopic mass, then
+// mass/abundance pairs, tab separated.
+void readIsotopeCache(const string& path, unordered_map<string, MercuryDistribution>& cache) {
+    std::ifstream in(path.c_str());
+    string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        string formula;
+        MercuryDistribution dist;
+        if (!(fields >> formula >> dist.monoMass)) {
+            continue;
+        }
+        double mass, abundance;
+        while (fields >> mass >> abundance) {
+            dist.masses.push_back(mass);
+            dist.abundances.push_back(abundance);
+        }
+        if (!dist.masses.empty()) {
+            cache[formula] = std::move(dist);
+        }
+    }
+}
+
+void writeIsotopeCache(const string& path, const unordered_map<string, MercuryDistribution>& cache) {
+    string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath.c_str());
+    out.precision(17);
+    for (const auto& entry : cache) {
+        out << entry.first << '\t' << entry.second.monoMass;
+        for (size_t i = 0; i < entry.second.masses.size(); i++) {
+            out << '\t' << entry.second.masses[i] << '\t' << entry.second.abundances[i];
+        }
+        out << '\n';
+    }
+    out.close();
+    if (out) {
+        std::rename(tmpPath.c_str(), path.c_str());
+    } else {
+        carp(CARP_WARNING, "Could not write isotope distribution cache %s", path.c_str());
+    }
+}
+
+}  // namespace
+
 unordered_map<string, vector<pair<double, double>>>
 calculateTheoreticalIsotopeDistributions(
     vector<Identification>& allIdentifications) {
     unordered_map<string, vector<pair<double, double>>>
         modifiedSequenceToIsotopicDistribution;
 
-    for (auto& identification : allIdentifications) {
-        string peptide_sequence = identification.sequence;
-        // int charge = identification.precursorCharge; // This code was commented out whilst debugging.
-        int charge = 1;
-
-        if (modifiedSequenceToIsotopicDistribution.find(peptide_sequence) !=
-            modifiedSequenceToIsotopicDistribution.end()) {
-            continue;
+    // Distributions are keyed by modified sequence. The monoisotopic mass of
+    // the first identification of each sequence drives the correction.
+    vector<const Identification*> firstIdentifications;
+    std::unordered_set<string> seenSequences;
+    for (const auto& identification : allIdentifications) {
+        if (seenSequences.insert(identification.sequence).second) {
+            firstIdentifications.push_back(&identification);
         }
+    }
 
-        vector<pair<double, double>> isotopicMassesAndNormalizedAbundances;
+    // Mercury runs once per unique elemental formula, in parallel, and its
+    // output can be kept between runs.
+    int numThreads = MaxThreads > 0 ? MaxThreads : std::thread::hardware_concurrency();
+    string cacheFile = Params::GetString("lfq-isotope-cache");
+    unordered_map<string, MercuryDistribution> formulaToDistribution;
+    if (!cacheFile.empty()) {
+        readIsotopeCache(cacheFile, formulaToDistribution);
+    }
+    size_t cachedFormulas = formulaToDistribution.size();
 
-        string formula = calcFormula(peptide_sequence);
-        char* fn = nullptr;
-        char baseFormula[512];
-        strncpy(baseFormula, formula.c_str(), sizeof(baseFormula) - 1);
-        baseFormula[sizeof(baseFormula) - 1] = '\0';
-        CMercury8 baseDist(fn);
-        baseDist.GoMercury(baseFormula, charge);
-
-        double monoisotopic = identification.monoIsotopicMass;
-
-        // Averagine correction for modifications (mirrors C# FlashLFQ)
-        static const double kAvgC = 4.9384, kAvgH = 7.7583, kAvgO = 1.4773;
-        static const double kAvgN = 1.3577, kAvgS = 0.0417;
-        static const double kAvgMass = 12.011 * kAvgC + 1.00794 * kAvgH +
-                                       15.999 * kAvgO + 14.007 * kAvgN +
-                                       32.065 * kAvgS;
-
-        double massDiff = monoisotopic - baseDist.getMonoMass();
-        double distMonoMass;
-        vector<double> masses;
-        vector<double> abundances;
+    vector<string> baseFormulas;
+    for (const Identification* identification : firstIdentifications) {
+        baseFormulas.push_back(calcFormula(identification->sequence));
+    }
+    computeMissingDistributions(baseFormulas, formulaToDistribution, numThreads);
 
+    vector<string> correctedFormulas(firstIdentifications.size());
+    for (size_t k = 0; k < firstIdentifications.size(); k++) {
+        double massDiff = firstIdentifications[k]->monoIsotopicMass -
+                          formulaToDistribution[baseFormulas[k]].monoMass;
         if (std::abs(massDiff) > 20.0) {
-            // Parse element counts from base formula string (e.g. "C45H72N12O15S2")
-            int fC = 0, fH = 0, fN = 0, fO = 0, fS = 0;
-            for (const char* p = baseFormula; *p; p++) {
-                if      (*p == 'C') fC = atoi(p + 1);
-                else if (*p == 'H') fH = atoi(p + 1);
-                else if (*p == 'N') fN = atoi(p + 1);
-                else if (*p == 'O') fO = atoi(p + 1);
-                else if (*p == 'S') fS = atoi(p + 1);
-            }
-            double averagines = massDiff / kAvgMass;
-            fC = std::max(0, fC + static_cast<int>(std::round(averagines * kAvgC)));
-            fH = std::max(0, fH + static_cast<int>(std::round(averagines * kAvgH)));
-            fO = std::max(0, fO + static_cast<int>(std::round(averagines * kAvgO)));
-            fN = std::max(0, fN + static_cast<int>(std::round(averagines * kAvgN)));
-            fS = std::max(0, fS + static_cast<int>(std::round(averagines * kAvgS)));
-
-            char corrected[512];
-            if (fS > 0)
-                sprintf(corrected, "C%dH%dN%dO%dS%d", fC, fH, fN, fO, fS);
-            else
-                sprintf(corrected, "C%dH%dN%dO%d", fC, fH, fN, fO);
-
-            CMercury8 corrDist(fn);
-            corrDist.GoMercury(corrected, charge);
-            distMonoMass = corrDist.getMonoMass();
-            for (auto i : corrDist.FixedData) {
-                masses.push_back(i.mass);
-                abundances.push_back(i.data);
-            }
-        } else {
-            distMonoMass = baseDist.getMonoMass();
-            for (auto i : baseDist.FixedData) {
-                masses.push_back(i.mass);
-                abundances.push_back(i.data);
-            }
+            correctedFormulas[k] = averagineCorrectedFormula(baseFormulas[k], massDiff);
         }
+    }
+    computeMissingDistributions(correctedFormulas, formulaToDistribution, numThreads);
+
+    if (!cacheFile.empty() && formulaToDistribution.size() > cachedFormulas) {
+        writeIsotopeCache(cacheFile, formulaToDistribution);
+    }
+
+    for (size_t k = 0; k < firstIdentifications.size(); k++) {
+        const string& peptide_sequence = firstIdentifications[k]->sequence;
+        double monoisotopic = firstIdentifications[k]->monoIsotopicMass;
+        const MercuryDistribution& dist = formulaToDistribution[
+            correctedFormulas[k].empty() ? baseFormulas[k] : correctedFormulas[k]];
+
+        vector<pair<double, double>> isotopicMassesAndNormalizedAbundances;
+        double distMonoMass = dist.monoMass;
+        vector<double> masses = dist.masses;
+        vector<double> abundances = dist.abundances;
 
         double highestAbundance =
             *std::max_element(abundances.begin(), abundances.end());
@@ -444,35 +567,35 @@ void processRange(int start, int end,
                   PpmTolerance& ppmTolerance,
                   unordered_map<string, vector<pair<double, double>>>&
                       modifiedSequenceToIsotopicDistribution,
+                  const LFQMetaData& metaData,
+                  const vector<vector<uint32_t>>* sweptXics,
                   CruxLFQResults* lfqResults) {
+    // Peaks are collected locally and appended once, so that threads working
+    // on this file or on other files do not contend for the results lock.
+    vector<ChromatographicPeak> rangePeaks;
     for (int i = start; i < end; ++i) {
         const Identification& identification = ms2IdsForThisFile[i];
 
         ChromatographicPeak msmsFeature(identification, false, spectralFile);
 
-        for (const auto& chargeState : chargeStates) {
+        for (size_t c = 0; c < chargeStates.size(); ++c) {
+            int chargeState = chargeStates[c];
             if (ID_SPECIFIC_CHARGE_STATE &&
                 chargeState != identification.precursorCharge) {
                 continue;
             }
 
-            // we use a memory address here so as to be more efficent
-            vector<IndexedMassSpectralPeak*>&& xic_ptr = peakFind(
-                identification.ms2RetentionTimeInMinutes,
-                identification.peakFindingMass, chargeState,
-                identification.spectralFile, peakfindingTol);
-
             std::vector<IndexedMassSpectralPeak> xic;
-
-            // Transforming the vector of pointers to a vector of objects
-            std::transform(xic_ptr.begin(), xic_ptr.end(), std::back_inserter(xic),
-                           [](IndexedMassSpectralPeak* ptr) {
-                               if (ptr) {
-                                   return *ptr;
-                               } else {
-                                   return IndexedMassSpectralPeak();
-                               }
-                           });
+            if (sweptXics != nullptr) {
+                for (uint32_t pos : (*sweptXics)[i * chargeStates.size() + c]) {
+                    xic.push_back(metaData.getIndexedPeaks()->peakAt(pos));
+                }
+            } else {
+                xic = peakFind(
+                    identification.ms2RetentionTimeInMinutes,
+                    identification.peakFindingMass, chargeState,
+                    identification.spectralFile, peakfindingTol, metaData);
+            }
 
             xic.erase(std::remove_if(xic.begin(), xic.end(),
                                      [&](const IndexedMassSpectralPeak& p) {
@@ -484,7 +607,7 @@ void processRange(int start, int end,
 
             vector<IsotopicEnvelope>&& isotopicEnvelopes = getIsotopicEnvelopes(
                 xic, identification, chargeState,
-                modifiedSequenceToIsotopicDistribution);
+                modifiedSequenceToIsotopicDistribution, metaData);
 
             msmsFeature.isotopicEnvelopes.insert(
                 msmsFeature.isotopicEnvelopes.end(), isotopicEnvelopes.begin(),
@@ -495,7 +618,7 @@ void processRange(int start, int end,
 
         msmsFeature.calculateIntensityForThisFeature(INTEGRATE);
 
-        cutPeak(msmsFeature, identification.ms2RetentionTimeInMinutes);
+        cutPeak(msmsFeature, identification.ms2RetentionTimeInMinutes, metaData);
 
         if (msmsFeature.isotopicEnvelopes.empty()) {
             continue;
@@ -545,13 +668,14 @@ void processRange(int start, int end,
 
         msmsFeature.calculateIntensityForThisFeature(INTEGRATE);
 
-        // May need to change this
-        {
-            std::lock_guard<std::mutex> lock(mtx);
-            lfqResults->Peaks[spectralFile].push_back(msmsFeature);
-        }
-
+        rangePeaks.push_back(msmsFeature);
     }
+
+    // The entry for spectralFile is created before any worker starts, and
+    // at() does not modify the map.
+    std::lock_guard<std::mutex> lock(mtx);
+    vector<ChromatographicPeak>& filePeaks = lfqResults->Peaks.at(spectralFile);
+    filePeaks.insert(filePeaks.end(), rangePeaks.begin(), rangePeaks.end());
 }
 
 void quantifyMs2IdentifiedPeptides(
@@ -560,7 +684,9 @@ void quantifyMs2IdentifiedPeptides(
     const vector<int>& chargeStates,
     unordered_map<string, vector<pair<double, double>>>&
         modifiedSequenceToIsotopicDistribution,
-    CruxLFQResults* lfqResults) {
+    const LFQMetaData& metaData,
+    CruxLFQResults* lfqResults,
+    int numThreads) {
     carp(CARP_INFO, "Quantifying MS2, this may take some time...");
 
     if (ms2IdsForThisFile.empty()) {
@@ -569,11 +695,32 @@ void quantifyMs2IdentifiedPeptides(
 
     PpmTolerance peakfindingTol(PEAK_FINDING_PPM_TOLERANCE);
     PpmTolerance ppmTolerance(PPM_TOLERANCE);
-    if (MaxThreads == 0) {
-        MaxThreads = std::thread::hardware_concurrency();
+    if (numThreads <= 0) {
+        numThreads = MaxThreads > 0 ? MaxThreads : std::thread::hardware_concurrency();
     }
 
-    const int numThreads = std::min(MaxThreads, static_cast<int>(ms2IdsForThisFile.size()));
+    // With the sweep, all XICs of the file are extracted up front; target
+    // i * chargeStates.size() + c is identification i at charge state c.
+    vector<vector<uint32_t>> sweptXics;
+    if (XIC_SWEEP) {
+        const vector<Ms1ScanInfo>& ms1Scans = metaData.getIndexedPeaks()->scans();
+        vector<XicTarget> targets;
+        targets.reserve(ms2IdsForThisFile.size() * chargeStates.size());
+        for (const Identification& identification : ms2IdsForThisFile) {
+            int precursorScanIndex = findPrecursorScanIndex(
+                identification.ms2RetentionTimeInMinutes, ms1Scans);
+            for (int chargeState : chargeStates) {
+                // Skipped charge states get an empty XIC.
+                bool skip = ID_SPECIFIC_CHARGE_STATE &&
+                            chargeState != identification.precursorCharge;
+                targets.push_back(XicTarget{identification.peakFindingMass, chargeState,
+                                            skip ? SKIPPED_XIC_TARGET : precursorScanIndex});
+            }
+        }
+        sweptXics = sweepXics(targets, peakfindingTol, metaData, numThreads);
+    }
+
+    numThreads = std::max(1, std::min(numThreads, static_cast<int>(ms2IdsForThisFile.size())));
     const int batchSize = (ms2IdsForThisFile.size() + numThreads - 1) / numThreads;
 
     // Create and run threads
@@ -588,6 +735,8 @@ void quantifyMs2IdentifiedPeptides(
                                           &peakfindingTol,
                                           &ppmTolerance,
                                           &modifiedSequenceToIsotopicDistribution,
+                                          &metaData,
+                                          &sweptXics,
                                           &lfqResults]() {
             processRange(start, end,
                          ms2IdsForThisFile,
@@ -596,6 +745,8 @@ void quantifyMs2IdentifiedPeptides(
                          peakfindingTol,
                          ppmTolerance,
                          modifiedSequenceToIsotopicDistribution,
+                         metaData,
+                         XIC_SWEEP ? &sweptXics : nullptr,
                          lfqResults);
         }));
     }
@@ -614,45 +765,12 @@ double toMass(double massToChargeRatio, int charge) {
     return std::abs(charge) * massToChargeRatio - charge * PROTONMASS;
 }
 
-int binarySearchForIndexedPeak(const vector<IndexedMassSpectralPeak>* indexedPeaks, int zeroBasedScanIndex) {
-    int m = 0;
-    int l = 0;
-    int r = static_cast<int>(indexedPeaks->size()) - 1;
-
-    while (l <= r) {
-        m = l + ((r - l) / 2);
-
-        if (r - l < 2) {
-            break;
-        }
-        if (indexedPeaks->operator[](m).zeroBasedMs1ScanIndex < zeroBasedScanIndex) {
-            l = m + 1;
-        } else {
-            r = m - 1;
-        }
-    }
-
-    for (int i = m; i >= 0; i--) {
-        if (indexedPeaks->operator[](i).zeroBasedMs1ScanIndex < zeroBasedScanIndex) {
-            break;
-        }
-
-        m--;
-    }
-
-    if (m < 0) {
-        m = 0;
-    }
-
-    return m;
-}
-
-IndexedMassSpectralPeak* getIndexedPeak(
+int64_t getIndexedPeak(
     const double& theorMass, int zeroBasedScanIndex, PpmTolerance tolerance,
-    int chargeState) {
-    auto metaData = &LFQMetaData::getInstance();
-    auto indexedPeaks = metaData->getIndexedPeaks();
-    IndexedMassSpectralPeak* bestPeak = nullptr;
+    int chargeState, const LFQMetaData& metaData) {
+    const Ms1PeakIndex* indexedPeaks = metaData.getIndexedPeaks();
+    int64_t bestPeak = NO_INDEXED_PEAK;
+    double bestError = 0.0;
 
     double maxValue = tolerance.GetMaximumValue(theorMass);
     double maxMzValue = toMz(maxValue, chargeState);
@@ -663,36 +781,27 @@ IndexedMassSpectralPeak* getIndexedPeak(
     int floorMz = static_cast<int>(std::floor(minMzValue * BINS_PER_DALTON));
 
     for (int j = floorMz; j <= ceilingMz; j++) {
-        if (j < indexedPeaks->size() && indexedPeaks->operator[](j)->size() > 0) {
-            auto bin = indexedPeaks->operator[](j);
-            int index = binarySearchForIndexedPeak(bin, zeroBasedScanIndex);
-            size_t binSize = bin->size();
-            for (int i = index; i < binSize; i++) {
-                auto* peak = &bin->operator[](i);
-                if (peak->zeroBasedMs1ScanIndex > zeroBasedScanIndex) {
-                    break;
-                }
-                double expMass = toMass(peak->mz, chargeState);
-
-                if (
-                    tolerance.Within(expMass, theorMass) &&
-                    peak->zeroBasedMs1ScanIndex == zeroBasedScanIndex &&
-                    (bestPeak == nullptr || std::abs(expMass - theorMass) < std::abs(toMass(bestPeak->mz, chargeState) - theorMass))) {
-                    bestPeak = peak;
-                }
+        std::pair<uint32_t, uint32_t> range = indexedPeaks->scanRange(j, zeroBasedScanIndex);
+        for (uint32_t i = range.first; i < range.second; i++) {
+            double expMass = toMass(indexedPeaks->mzAt(i), chargeState);
+            double error = std::abs(expMass - theorMass);
+
+            if (tolerance.Within(expMass, theorMass) &&
+                (bestPeak == NO_INDEXED_PEAK || error < bestError)) {
+                bestPeak = i;
+                bestError = error;
             }
         }
     }
     return bestPeak;
 }
 
-vector<IndexedMassSpectralPeak*> peakFind(
+vector<IndexedMassSpectralPeak> peakFind(
     double idRetentionTime,
     const double& mass,
     int charge, const string& spectra_file,
-    PpmTolerance tolerance) {
-    auto metaData = &LFQMetaData::getInstance();
-    unordered_map<string, vector<Ms1ScanInfo>>& ms1ScansMap = *metaData->getMs1Scans();
+    PpmTolerance tolerance, const LFQMetaData& metaData) {
+    unordered_map<string, vector<Ms1ScanInfo>>& ms1ScansMap = *metaData.getMs1Scans();
     int precursorScanIndex = -1;
     size_t vecSize = 0;
 
@@ -700,13 +809,7 @@ vector<IndexedMassSpectralPeak*> peakFind(
     if (it != ms1ScansMap.end()) {
         const vector<Ms1ScanInfo>& ms1ScanVec = it->second;
         vecSize = ms1ScanVec.size();  // Calculate size here
-        for (const auto& ms1Scan : ms1ScanVec) {
-            if (ms1Scan.retentionTime < idRetentionTime) {
-                precursorScanIndex = ms1Scan.zeroBasedMs1ScanIndex;
-            } else {
-                break;
-            }
-        }
+        precursorScanIndex = findPrecursorScanIndex(idRetentionTime, ms1ScanVec);
     } else {
         static int missCount = 0;
         if (missCount < 5) {
@@ -721,14 +824,15 @@ vector<IndexedMassSpectralPeak*> peakFind(
 
     // go right
     int missedScans = 0;
-    vector<IndexedMassSpectralPeak*> xic;
+    const Ms1PeakIndex* indexedPeaks = metaData.getIndexedPeaks();
+    vector<IndexedMassSpectralPeak> xic;
     for (int t = precursorScanIndex; t < vecSize; t++) {
-        auto* peak = getIndexedPeak(mass, t, tolerance, charge);
-        if (peak == nullptr && t != precursorScanIndex) {
+        int64_t peak = getIndexedPeak(mass, t, tolerance, charge, metaData);
+        if (peak == NO_INDEXED_PEAK && t != precursorScanIndex) {
             missedScans++;
-        } else if (peak != nullptr) {
+        } else if (peak != NO_INDEXED_PEAK) {
             missedScans = 0;
-            xic.push_back(peak);
+            xic.push_back(indexedPeaks->peakAt(peak));
         }
         if (missedScans > MISSED_SCANS_ALLOWED) {
             break;
@@ -738,12 +842,12 @@ vector<IndexedMassSpectralPeak*> peakFind(
     // go left
     missedScans = 0;
     for (int t = precursorScanIndex - 1; t >= 0; t--) {
-        auto* peak = getIndexedPeak(mass, t, tolerance, charge);
-        if (peak == nullptr && t != precursorScanIndex) {
+        int64_t peak = getIndexedPeak(mass, t, tolerance, charge, metaData);
+        if (peak == NO_INDEXED_PEAK && t != precursorScanIndex) {
             missedScans++;
-        } else if (peak != nullptr) {
+        } else if (peak != NO_INDEXED_PEAK) {
             missedScans = 0;
-            xic.push_back(peak);
+            xic.push_back(indexedPeaks->peakAt(peak));
         }
         if (missedScans > MISSED_SCANS_ALLOWED) {
             break;
@@ -752,17 +856,199 @@ vector<IndexedMassSpectralPeak*> peakFind(
 
     std::sort(
         xic.begin(), xic.end(),
-        [](const IndexedMassSpectralPeak* x, const IndexedMassSpectralPeak* y) {
-            return x->retentionTime < y->retentionTime;
+        [](const IndexedMassSpectralPeak& x, const IndexedMassSpectralPeak& y) {
+            return x.retentionTime < y.retentionTime;
         });
     return xic;
 }
 
+int findPrecursorScanIndex(double idRetentionTime, const vector<Ms1ScanInfo>& ms1Scans) {
+    auto it = std::lower_bound(
+        ms1Scans.begin(), ms1Scans.end(), idRetentionTime,
+        [](const Ms1ScanInfo& scan, double rt) { return scan.retentionTime < rt; });
+    return it == ms1Scans.begin() ? -1 : (it - 1)->zeroBasedMs1ScanIndex;
+}
+
+namespace {
+
+// Peaks of each scan sorted by m/z, as positions in the Ms1PeakIndex.
+struct ScanMajorPeaks {
+    vector<uint32_t> offsets;
+    vector<uint32_t> order;
+};
+
+ScanMajorPeaks buildScanMajorPeaks(const Ms1PeakIndex& index) {
+    ScanMajorPeaks peaks;
+    size_t numScans = index.scans().size();
+    peaks.offsets.assign(numScans + 1, 0);
+    for (uint32_t i = 0; i < index.numPeaks(); i++) {
+        peaks.offsets[index.scanAt(i) + 1]++;
+    }
+    for (size_t t = 1; t <= numScans; t++) {
+        peaks.offsets[t] += peaks.offsets[t - 1];
+    }
+    vector<uint32_t> cursor(peaks.offsets.begin(), peaks.offsets.end() - 1);
+    peaks.order.resize(index.numPeaks());
+    for (uint32_t i = 0; i < index.numPeaks(); i++) {
+        peaks.order[cursor[index.scanAt(i)]++] = i;
+    }
+    // Positions are already in bin order; the stable sort only fixes the
+    // order within a bin, and keeps index order for equal m/z.
+    for (size_t t = 0; t < numScans; t++) {
+        std::stable_sort(peaks.order.begin() + peaks.offsets[t],
+                         peaks.order.begin() + peaks.offsets[t + 1],
+                         [&index](uint32_t a, uint32_t b) {
+                             return index.mzAt(a) < index.mzAt(b);
+                         });
+    }
+    return peaks;
+}
+
+struct SweepTarget {
+    double lowMz;
+    double highMz;
+    size_t target;
+};
+
+// Walks the scans in one direction for a set of targets sorted by lowMz.
+// A target joins at its start scan and leaves once it has missed more than
+// MISSED_SCANS_ALLOWED scans, exactly as in peakFind.
+void sweepDirection(const vector<SweepTarget>& sorted, const vector<XicTarget>& targets,
+                    const Ms1PeakIndex& index, const ScanMajorPeaks& scanPeaks,
+                    const PpmTolerance& tolerance, bool right,
+                    vector<vector<uint32_t>>& xics) {
+    int numScans = static_cast<int>(index.scans().size());
+    // Targets grouped by the scan at which their walk starts.
+    vector<vector<size_t>> startAt(numScans);
+    for (size_t k = 0; k < sorted.size(); k++) {
+        int p = targets[sorted[k].target].precursorScanIndex;
+        if (p == SKIPPED_XIC_TARGET) {
+            continue;
+        }
+        // As in peakFind, an identification before the first scan has no XIC.
+        int start = right ? p : p - 1;
+        if (start >= 0 && start < numScans) {
+            startAt[start].push_back(k);
+        }
+    }
+
+    vector<size_t> active, merged;
+    vector<int> missed(sorted.size(), 0);
+    for (int step = 0; step < numScans; step++) {
+        int t = right ? step : numScans - 1 - step;
+        if (!startAt[t].empty()) {
+            merged.clear();
+            std::merge(active.begin(), active.end(), startAt[t].begin(), startAt[t].end(),
+                       std::back_inserter(merged));
+            active.swap(merged);
+        }
+        if (active.empty()) {
+            continue;
+        }
+
+        uint32_t first = scanPeaks.offsets[t];
+        uint32_t last = scanPeaks.offsets[t + 1];
+        uint32_t lowPtr = first;
+        size_t kept = 0;
+        for (size_t a = 0; a < active.size(); a++) {
+            const SweepTarget& sweepTarget = sorted[active[a]];
+            const XicTarget& target = targets[sweepTarget.target];
+            while (lowPtr < last && index.mzAt(scanPeaks.order[lowPtr]) < sweepTarget.lowMz) {
+                lowPtr++;
+            }
+            int64_t best = NO_INDEXED_PEAK;
+            double bestError = 0.0;
+            for (uint32_t q = lowPtr; q < last; q++) {
+                uint32_t pos = scanPeaks.order[q];
+                if (index.mzAt(pos) > sweepTarget.highMz) {
+                    break;
+                }
+                double expMass = toMass(index.mzAt(pos), target.charge);
+                double error = std::abs(expMass - target.mass);
+                // Ties go to the lower index position, which is the peak
+                // getIndexedPeak would have found first.
+                if (tolerance.Within(expMass, target.mass) &&
+                    (best == NO_INDEXED_PEAK || error < bestError ||
+                     (error == bestError && pos < best))) {
+                    best = pos;
+                    bestError = error;
+                }
+            }
+
+            if (best == NO_INDEXED_PEAK) {
+                if (!right || t != target.precursorScanIndex) {
+                    missed[active[a]]++;
+                }
+            } else {
+                missed[active[a]] = 0;
+                xics[sweepTarget.target].push_back(static_cast<uint32_t>(best));
+            }
+            if (missed[active[a]] <= MISSED_SCANS_ALLOWED) {
+                active[kept++] = active[a];
+            }
+        }
+        active.resize(kept);
+    }
+}
+
+}  // namespace
+
+vector<vector<uint32_t>> sweepXics(
+    const vector<XicTarget>& targets, PpmTolerance tolerance,
+    const LFQMetaData& metaData, int numThreads) {
+    const Ms1PeakIndex& index = *metaData.getIndexedPeaks();
+    vector<vector<uint32_t>> xics(targets.size());
+    if (targets.empty() || index.scans().empty()) {
+        return xics;
+    }
+    ScanMajorPeaks scanPeaks = buildScanMajorPeaks(index);
+
+    // The m/z window is padded by one bin; Within() makes the final call, as
+    // it does in getIndexedPeak.
+    const double pad = 1.0 / BINS_PER_DALTON;
+    vector<SweepTarget> sorted;
+    sorted.reserve(targets.size());
+    for (size_t i = 0; i < targets.size(); i++) {
+        const XicTarget& target = targets[i];
+        SweepTarget sweepTarget;
+        sweepTarget.lowMz = toMz(tolerance.GetMinimumValue(target.mass), target.charge) - pad;
+        sweepTarget.highMz = toMz(tolerance.GetMaximumValue(target.mass), target.charge) + pad;
+        sweepTarget.target = i;
+        sorted.push_back(sweepTarget);
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const SweepTarget& a, const SweepTarget& b) { return a.lowMz < b.lowMz; });
+
+    // Each thread sweeps a contiguous m/z slice of the targets.
+    numThreads = std::max(1, std::min(numThreads, static_cast<int>(sorted.size())));
+    size_t sliceSize = (sorted.size() + numThreads - 1) / numThreads;
+    auto sweepSlice = [&](size_t begin, size_t end) {
+        vector<SweepTarget> slice(sorted.begin() + begin, sorted.begin() + end);
+        sweepDirection(slice, targets, index, scanPeaks, tolerance, true, xics);
+        sweepDirection(slice, targets, index, scanPeaks, tolerance, false, xics);
+    };
+    vector<std::thread> threads;
+    for (size_t begin = 0; begin < sorted.size(); begin += sliceSize) {
+        threads.emplace_back(sweepSlice, begin, std::min(begin + sliceSize, sorted.size()));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (auto& xic : xics) {
+        std::sort(xic.begin(), xic.end(), [&index](uint32_t a, uint32_t b) {
+            return index.scanAt(a) < index.scanAt(b);
+        });
+    }
+    return xics;
+}
+
 vector<IsotopicEnvelope> getIsotopicEnvelopes(
     const vector<IndexedMassSpectralPeak>& xic,
     const Identification& identification, const int chargeState,
     unordered_map<string, vector<pair<double, double>>>&
-        modifiedSequenceToIsotopicDistribution) {
+        modifiedSequenceToIsotopicDistribution,
+    const LFQMetaData& metaData) {
     vector<IsotopicEnvelope> isotopicEnvelopes;
 
     vector<pair<double, double>> isotopeMassShifts = modifiedSequenceToIsotopicDistribution[identification.sequence];
@@ -824,17 +1110,21 @@ vector<IsotopicEnvelope> getIsotopicEnvelopes(
                                          theoreticalIsotopeMassShifts[i] + shift.first * C13MinusC12;
                     double theoreticalIsotopeIntensity = theoreticalIsotopeAbundances[i] * peak.intensity;
 
-                    IndexedMassSpectralPeak* isotopePeak = getIndexedPeak(isotopeMass, peak.zeroBasedMs1ScanIndex, isotopeTolerance, chargeState);
+                    int64_t isotopePeak = getIndexedPeak(isotopeMass, peak.zeroBasedMs1ScanIndex, isotopeTolerance, chargeState, metaData);
+                    if (isotopePeak == NO_INDEXED_PEAK) {
+                        break;
+                    }
+                    double isotopeIntensity = metaData.getIndexedPeaks()->intensityAt(isotopePeak);
 
-                    if (isotopePeak == nullptr || isotopePeak->intensity < theoreticalIsotopeIntensity / 4.0 || isotopePeak->intensity > theoreticalIsotopeIntensity * 4.0) {
+                    if (isotopeIntensity < theoreticalIsotopeIntensity / 4.0 || isotopeIntensity > theoreticalIsotopeIntensity * 4.0) {
                         break;
                     }
 
-                    shift.second.emplace_back(std::make_tuple(isotopePeak->intensity,
+                    shift.second.emplace_back(std::make_tuple(isotopeIntensity,
                                                               theoreticalIsotopeIntensity,
                                                               isotopeMass));
                     if (shift.first == 0) {
-                        experimentalIsotopeIntensities[i] = isotopePeak->intensity;
+                        experimentalIsotopeIntensities[i] = isotopeIntensity;
                     }
                 }
             }
@@ -847,7 +1137,8 @@ vector<IsotopicEnvelope> getIsotopicEnvelopes(
 
         // Check that the experimental envelope matches the theoretical
         if (checkIsotopicEnvelopeCorrelation(massShiftToIsotopePeaks, peak,
-                                             chargeState, isotopeTolerance)) {
+                                             chargeState, isotopeTolerance,
+                                             metaData)) {
             for (size_t i = 0; i < experimentalIsotopeIntensities.size(); ++i) {
                 if (experimentalIsotopeIntensities[i] == 0) {
                     experimentalIsotopeIntensities[i] =
@@ -890,7 +1181,7 @@ void setToNegativeOneIfNaN(double& value) {
 bool checkIsotopicEnvelopeCorrelation(
     map<int, vector<IsotopePeak>>& massShiftToIsotopePeaks,
     const IndexedMassSpectralPeak peak, int chargeState,
-    PpmTolerance& isotopeTolerance) {
+    PpmTolerance& isotopeTolerance, const LFQMetaData& metaData) {
     filterResults results =
         filterMassShiftToIsotopePeaks(massShiftToIsotopePeaks[0]);
     double corr = Pearson(results.expIntensity, results.theorIntensity);
@@ -906,15 +1197,15 @@ bool checkIsotopicEnvelopeCorrelation(
             unexpectedMass = std::min(unexpectedMass, theorMass);
         }
         unexpectedMass -= C13MinusC12;
-        IndexedMassSpectralPeak* unexpectedPeak =
+        int64_t unexpectedPeak =
             getIndexedPeak(unexpectedMass, peak.zeroBasedMs1ScanIndex,
-                           isotopeTolerance, chargeState);
+                           isotopeTolerance, chargeState, metaData);
 
-        if (unexpectedPeak == nullptr) {
+        if (unexpectedPeak == NO_INDEXED_PEAK) {
             shift.second.emplace_back(std::make_tuple(0.0, 0.0, unexpectedMass));
         } else {
             shift.second.emplace_back(
-                std::make_tuple(unexpectedPeak->intensity, 0.0, unexpectedMass));
+                std::make_tuple(metaData.getIndexedPeaks()->intensityAt(unexpectedPeak), 0.0, unexpectedMass));
         }
     }
 
@@ -938,12 +1229,12 @@ bool checkIsotopicEnvelopeCorrelation(
     return res;
 }
 
-void cutPeak(ChromatographicPeak& peak, double identificationTime) {
+void cutPeak(ChromatographicPeak& peak, double identificationTime,
+             const LFQMetaData& metaData) {
     // find out if we need to split this peak by using the discrimination factor
     // this method assumes that the isotope envelopes in a chromatographic peak
     // are already sorted by MS1 scan number
-    auto metaData = &LFQMetaData::getInstance();
-    auto ms1Scans = metaData->getMs1Scans();
+    auto ms1Scans = metaData.getMs1Scans();
     bool cutThisPeak = false;
 
     if (peak.isotopicEnvelopes.size() < 5) {
@@ -1056,34 +1347,38 @@ void cutPeak(ChromatographicPeak& peak, double identificationTime) {
         peak.SplitRT = valleyEnvelope.indexedPeak.retentionTime;
 
         // recursively cut
-        cutPeak(peak, identificationTime);
+        cutPeak(peak, identificationTime, metaData);
     }
 }
 
 void runErrorChecking(const string& spectraFile, CruxLFQResults& lfqResults) {
     carp(CARP_INFO, "Checking errors");
 
-    lfqResults.Peaks[spectraFile].erase(
-        std::remove_if(lfqResults.Peaks[spectraFile].begin(),
-                       lfqResults.Peaks[spectraFile].end(),
+    // Other files may be checked concurrently; only this file's entry is
+    // touched, and at() never inserts into the map.
+    vector<ChromatographicPeak>& filePeaks = lfqResults.Peaks.at(spectraFile);
+
+    filePeaks.erase(
+        std::remove_if(filePeaks.begin(),
+                       filePeaks.end(),
                        [](const ChromatographicPeak& p) {
                            return (&p == nullptr) ||
                                   (p.isMbrPeak && p.isotopicEnvelopes.empty());
                        }),
-        lfqResults.Peaks[spectraFile].end());
+        filePeaks.end());
 
     // merge duplicate peaks and handle MBR/MSMS peakfinding conflicts
     unordered_map<IndexedMassSpectralPeak, ChromatographicPeak>
         errorCheckedPeaksGroupedByApex;
     vector<ChromatographicPeak> errorCheckedPeaks;
 
-    std::sort(lfqResults.Peaks[spectraFile].begin(),
-              lfqResults.Peaks[spectraFile].end(),
+    std::sort(filePeaks.begin(),
+              filePeaks.end(),
               [](const ChromatographicPeak& a, const ChromatographicPeak& b) {
                   return a.isMbrPeak < b.isMbrPeak;
               });
 
-    for (ChromatographicPeak& tryPeak : lfqResults.Peaks[spectraFile]) {
+    for (ChromatographicPeak& tryPeak : filePeaks) {
         tryPeak.calculateIntensityForThisFeature(INTEGRATE);
         tryPeak.resolveIdentifications();
 
@@ -1140,7 +1435,7 @@ void runErrorChecking(const string& spectraFile, CruxLFQResults& lfqResults) {
         }
     }
 
-    lfqResults.Peaks[spectraFile] = errorCheckedPeaks;
+    filePeaks = errorCheckedPeaks;
 }
 
 }  // namespace CruxLFQ
@@ -49,6 +49,7 @@ extern bool QUANTIFY_AMBIGUOUS_PEPTIDES;            // Default value is false
 extern bool USE_SHARED_PEPTIDES_FOR_PROTEIN_QUANT;  // Default value is false
 extern bool NORMALIZE;                              // Default value is false
 extern int MaxThreads;                              // Default value is 1
+extern bool XIC_SWEEP;                              // Default value is true
 
 string calcFormula(string seq);
 
@@ -210,7 +211,7 @@ struct ChromatographicPeak;
 class Peptide;
 
 struct IndexedSpectralResults {
-    vector<vector<IndexedMassSpectralPeak>> _indexedPeaks;
+    Ms1PeakIndex _indexedPeaks{BINS_PER_DALTON};
 
     unordered_map<string, vector<Ms1ScanInfo>> _ms1Scans;
 };
@@ -269,17 +270,24 @@ void quantifyMs2IdentifiedPeptides(
     const vector<int>& chargeStates,
     unordered_map<string, vector<pair<double, double>>>&
         modifiedSequenceToIsotopicDistribution,
-    CruxLFQResults* lfqResults);
+    const LFQMetaData& metaData,
+    CruxLFQResults* lfqResults,
+    int numThreads = 0);
 
 double toMz(double mass, int charge);
 
 double toMass(double massToChargeRatio, int charge);
 
-int binarySearchForIndexedPeak(const vector<IndexedMassSpectralPeak>* indexedPeaks, int zeroBasedScanIndex);
+/** Returned by getIndexedPeak when no peak is within tolerance. */
+const int64_t NO_INDEXED_PEAK = -1;
 
-IndexedMassSpectralPeak* getIndexedPeak(
+/**
+ * \returns the position in the file's Ms1PeakIndex of the peak closest to
+ * theorMass in the given scan, or NO_INDEXED_PEAK.
+ */
+int64_t getIndexedPeak(
     const double& theorMass, int zeroBasedScanIndex, PpmTolerance tolerance,
-    int chargeState);
+    int chargeState, const LFQMetaData& metaData);
 
 void processRange(int start, int end,
                   const vector<Identification>& ms2IdsForThisFile,
@@ -288,22 +296,53 @@ void processRange(int start, int end,
                   PpmTolerance& ppmTolerance,
                   unordered_map<string, vector<pair<double, double>>>&
                       modifiedSequenceToIsotopicDistribution,
+                  const LFQMetaData& metaData,
+                  const vector<vector<uint32_t>>* sweptXics,
                   CruxLFQResults* lfqResults);
 
-vector<IndexedMassSpectralPeak*> peakFind(
+vector<IndexedMassSpectralPeak> peakFind(
     double idRetentionTime, const double& mass, int charge, const string& spectra_file,
-    PpmTolerance tolerance);
+    PpmTolerance tolerance, const LFQMetaData& metaData);
+
+/**
+ * \returns the zero-based index of the last MS1 scan acquired before the
+ * given retention time, or -1 if there is none. Scans must be in RT order.
+ */
+int findPrecursorScanIndex(double idRetentionTime, const vector<Ms1ScanInfo>& ms1Scans);
+
+/** Precursor scan index of an XicTarget that is not to be extracted. */
+const int SKIPPED_XIC_TARGET = -2;
+
+/** A mass and charge whose XIC is extracted by sweepXics. */
+struct XicTarget {
+    double mass;
+    int charge;
+    int precursorScanIndex;
+};
+
+/**
+ * Extracts the XICs of all targets in one pass over the scans of a file.
+ * Targets are sorted by m/z and matched against each scan's m/z-sorted
+ * peaks, walking right from and left of each precursor scan with the same
+ * missed-scan rule as peakFind. \returns for each target the positions of
+ * its peaks in the Ms1PeakIndex, in scan order; the peaks are the ones
+ * peakFind would return.
+ */
+vector<vector<uint32_t>> sweepXics(
+    const vector<XicTarget>& targets, PpmTolerance tolerance,
+    const LFQMetaData& metaData, int numThreads);
 
 vector<IsotopicEnvelope> getIsotopicEnvelopes(
     const vector<IndexedMassSpectralPeak>& xic,
     const Identification& identification, const int chargeState,
     unordered_map<string, vector<pair<double, double>>>&
-        modifiedSequenceToIsotopicDistribution);
+        modifiedSequenceToIsotopicDistribution,
+    const LFQMetaData& metaData);
 
 bool checkIsotopicEnvelopeCorrelation(
     map<int, vector<IsotopePeak>>& massShiftToIsotopePeaks,
     const IndexedMassSpectralPeak peak, int chargeState,
-    PpmTolerance& isotopeTolerance);
+    PpmTolerance& isotopeTolerance, const LFQMetaData& metaData);
 
 struct filterResults {
     vector<double> expIntensity;
@@ -316,7 +355,8 @@ void setToNegativeOneIfNaN(double& value);
 
 vector<PSM> create_psm(const string& psm_file);
 
-void cutPeak(ChromatographicPeak& peak, double identificationTime);
+void cutPeak(ChromatographicPeak& peak, double identificationTime,
+             const LFQMetaData& metaData);
 
 void runErrorChecking(const string& spectraFile, CruxLFQResults& lfqResults);
 
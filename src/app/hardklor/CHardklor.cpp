@@ -173,6 +173,7 @@ void CHardklor::Analyze(Spectrum* s) {
   int winCount=0;
 
   vResults.clear();
+  vScans.clear();
 
   //Ouput file info to user
 	if(bEcho){
@@ -292,7 +293,9 @@ void CHardklor::Analyze(Spectrum* s) {
 			  else if(cs.xml) WriteScanLine(curSpec,fptr,1);
 			  else WriteScanLine(curSpec,fptr,0);
       } else {
+        if(cs.scan.iUpper>0 && curSpec.getScanNumber()>cs.scan.iUpper) break;
         currentScanNumber = curSpec.getScanNumber();
+        ScanToMem(curSpec);
       }
 		} else {
 			break; //exit if there is no spectrum left to analyze
@@ -2270,6 +2273,22 @@ int CHardklor::Size(){
   return vResults.size();
 }
 
+int CHardklor::SizeScans(){
+  return vScans.size();
+}
+
+hkScan& CHardklor::Scan(const int& index){
+  return vScans[index];
+}
+
+void CHardklor::ScanToMem(Spectrum& s){
+  hkScan hks;
+  hks.scan = s.getScanNumber();
+  hks.rTime = s.getRTime();
+  hks.firstResult = (int)vResults.size();
+  vScans.push_back(hks);
+}
+
 void CHardklor::SetResultsToMemory(bool b){
   bMem=b;
 }
@@ -59,10 +59,12 @@ class CHardklor{
   //Methods:
 	void Echo(bool b);
   int GoHardklor(CHardklorSetting sett, Spectrum* s=NULL);
+  hkScan& Scan(const int& index);
 	void SetAveragine(CAveragine *a);
 	void SetMercury(CMercury8 *m);
   void SetResultsToMemory(bool b);
   int Size();
+  int SizeScans();
 
  protected:
 
@@ -73,6 +75,7 @@ class CHardklor{
   int compareData(const void*, const void*);
   double LinReg(float *match, float *mismatch);
   void ResultToMem(SSObject& obj, CPeriodicTable* PT);
+  void ScanToMem(Spectrum& s);
   void WriteParams(std::fstream& fptr, int format=1); 
   void WritePepLine(SSObject& obj, CPeriodicTable* PT, std::fstream& fptr, int format=0); 
   void WriteScanLine(Spectrum& s, std::fstream& fptr, int format=0); 
@@ -109,6 +112,7 @@ class CHardklor{
 
   //Vector for holding results in memory should that be needed
   std::vector<hkMem> vResults;
+  std::vector<hkScan> vScans;
 
   //Temporary Data Members:
   char bestCh[200];
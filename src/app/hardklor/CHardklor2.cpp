@@ -1,5 +1,10 @@
 #include "CHardklor2.h"
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 using namespace std;
 
 CHardklor2::CHardklor2(CAveragine *a, CMercury8 *m, CModelLibrary *lib){
@@ -9,6 +14,7 @@ CHardklor2::CHardklor2(CAveragine *a, CMercury8 *m, CModelLibrary *lib){
 	bEcho=true;
   bMem=false;
 	PT=NULL;
+  iThreads=1;
 }
 
 CHardklor2::~CHardklor2(){
@@ -34,11 +40,10 @@ int CHardklor2::GoHardklor(CHardklorSetting sett, Spectrum* s){
 	MSReader r;
 	Spectrum curSpec,c;
 	vector<int> v;
-	FILE* fout;
+	FILE* fout=NULL;
 	int TotalScans;
 	int manyPep, zeroPep, lowSigPep;
 	int iPercent;
-	int minutes, seconds;
 	int i;
 	vector<pepHit> vPeps;
 
@@ -54,6 +59,7 @@ int CHardklor2::GoHardklor(CHardklorSetting sett, Spectrum* s){
 	getTimerFrequency(timerFrequency);
 
   vResults.clear();
+  vScans.clear();
 
 	//For noise reduction
 	CNoiseReduction nr(&r,cs);
@@ -117,6 +123,15 @@ int CHardklor2::GoHardklor(CHardklorSetting sett, Spectrum* s){
     return -2;
   }
 
+  //Analyze scans on a pool of workers; results are still output in scan order
+  if(iThreads>1 && s==NULL){
+    if(bEcho) cout << iPercent;
+    TotalScans=ParallelHardklor(r,nr,curSpec,fout,iPercent);
+    if(!bMem) fclose(fout);
+    PrintSummary(TotalScans);
+    return 1;
+  }
+
 	//Write scan information to output file.
   if(!bMem){
     if(cs.reducedOutput) WriteScanLine(curSpec,fout,2);
@@ -124,6 +139,7 @@ int CHardklor2::GoHardklor(CHardklorSetting sett, Spectrum* s){
     else WriteScanLine(curSpec,fout,0);
   } else {
     currentScanNumber = curSpec.getScanNumber();
+    ScanToMem(curSpec);
   }
 
 	//Output progress indicator
@@ -135,20 +151,8 @@ int CHardklor2::GoHardklor(CHardklorSetting sett, Spectrum* s){
 		getExactTime(startTime);
 		TotalScans++;
 		
-		//Smooth if requested
-		if(cs.smooth>0) SG_Smooth(curSpec,cs.smooth,4);
-
-		//Centroid if needed; notice that this copy wastes a bit of time.
-		//TODO: make this more efficient
-		if(cs.boxcar==0 && !cs.centroid) Centroid(curSpec,c);
-		else c=curSpec;
-
-		//There is a bug when using noise reduction that results in out of order m/z values
-		//TODO: fix noise reduction so sorting isn't needed
-		if(c.size()>0) c.sortMZ();
-
 		//Analyze
-		QuickHardklor(c,vPeps);
+		AnalyzeScan(curSpec,c,vPeps);
 
 		//export results
 		for(i=0;i<(int)vPeps.size();i++){
@@ -189,17 +193,7 @@ int CHardklor2::GoHardklor(CHardklorSetting sett, Spectrum* s){
 
 		//Read next spectrum from file.
 		getExactTime(startTime);
-		if(cs.boxcar==0) {
-			r.readFile(NULL,curSpec);
-		} else {
-			if(cs.boxcarFilter==0){
-				//possible to not filter?
-        nr.DeNoiseD(curSpec);
-			} else {
-			//case 5: nr.DeNoise(curSpec); break; //this is for filtering without boxcar
-				nr.DeNoiseC(curSpec);
-			}
-		}
+		ReadNextScan(r,nr,curSpec);
 
 		getExactTime(stopTime);
 		tmpTime1=toMicroSec(stopTime);
@@ -208,7 +202,10 @@ int CHardklor2::GoHardklor(CHardklorSetting sett, Spectrum* s){
 
 		if(curSpec.getScanNumber()!=0){
 			//Write scan information to output file.
-			if(cs.reducedOutput){
+			if(bMem){
+				currentScanNumber = curSpec.getScanNumber();
+				ScanToMem(curSpec);
+			} else if(cs.reducedOutput){
 				WriteScanLine(curSpec,fout,2);
 			} else if(cs.xml) {
 				fprintf(fout,"</Spectrum>\n");
@@ -223,39 +220,28 @@ int CHardklor2::GoHardklor(CHardklorSetting sett, Spectrum* s){
 
 	if(!bMem) fclose(fout);
 
-	if(bEcho) {
-		cout << "\n" << endl;
-		cout << "  Total number of scans analyzed: " << TotalScans << endl;
+	PrintSummary(TotalScans);
+	return 1;
 
-		i=(int)timeToSec(loadTime,timerFrequency);
-		minutes = (int)(i/60);
-		seconds = i - (60*minutes);
-		cout << "\nFile access time: " << minutes << " minutes, " << seconds << " seconds." << endl;
-		i=(int)timeToSec(analysisTime,timerFrequency);
-		minutes = (int)(i/60);
-		seconds = i - (60*minutes);
-		cout << "Analysis Time:    " << minutes << " minutes, " << seconds << " seconds." << endl;
+}
 
-		if (minutes==0 && seconds==0){
-			cout << "IMPOSSIBLE!!!" << endl;
-		} else if(minutes <=2){
-			cout << "HOLY FRIJOLE!!" << endl;
-		} else if(minutes<=5) {
-			cout << "Like lightning!" << endl;
-		} else if(minutes<=10){
-			cout << "That's pretty damn fast!" << endl;
-		} else if(minutes<=20){
-			cout << "Monkeys calculate faster than that!" << endl;
-		} else if(minutes<=30){
-			cout << "You should have taken a lunch break." << endl;
-		} else if(minutes<=40){
-			cout << "Oi! Too freakin' slow!!" << endl;
-		} else {
-			cout << "You might be able to eek out some better performance by adjusting your parameters." << endl;
-		}
-	}
-	return 1;
+//Smooths, centroids, and deconvolves one scan. s is smoothed in place and the
+//peaks that were analyzed are left in c, which the output lines refer to.
+void CHardklor2::AnalyzeScan(Spectrum& s, Spectrum& c, vector<pepHit>& vPeps){
+
+	//Smooth if requested
+	if(cs.smooth>0) SG_Smooth(s,cs.smooth,4);
 
+	//Centroid if needed; notice that this copy wastes a bit of time.
+	//TODO: make this more efficient
+	if(cs.boxcar==0 && !cs.centroid) Centroid(s,c);
+	else c=s;
+
+	//There is a bug when using noise reduction that results in out of order m/z values
+	//TODO: fix noise reduction so sorting isn't needed
+	if(c.size()>0) c.sortMZ();
+
+	QuickHardklor(c,vPeps);
 }
 
 int CHardklor2::BinarySearch(Spectrum& s, double mz, bool floor){
@@ -608,6 +594,152 @@ bool CHardklor2::MatchSubSpectrum(Spectrum& s, int peakIndex, pepHit& pep){
 
 }
 
+//Multithreaded counterpart of the GoHardklor scan loop. The calling thread reads
+//(and denoises) scans and outputs the results; each worker owns a CHardklor2 that
+//shares the read-only model library. Scans are output in the order they were
+//read, so the output is identical to the single-threaded output. At most a few
+//scans per worker are held in memory at once. Returns the number of scans analyzed.
+int CHardklor2::ParallelHardklor(MSReader& r, CNoiseReduction& nr, Spectrum& first, FILE* fout, int& iPercent){
+
+  struct ScanJob {
+    Spectrum spec;
+    Spectrum c;
+    vector<pepHit> vPeps;
+    bool done;
+    ScanJob() : done(false) {}
+  };
+
+  deque<ScanJob> window;   //scans read but not yet written, in scan order
+  deque<ScanJob*> todo;    //scans waiting for a worker
+  mutex mtx;
+  condition_variable cvWork;
+  condition_variable cvDone;
+  bool bFinished=false;
+  size_t maxInFlight=(size_t)iThreads*4;
+  int format=0;
+  int TotalScans=0;
+  int scanNumber;
+  bool bFirst=true;
+  int i;
+
+  if(cs.reducedOutput) format=2;
+  else if(cs.xml) format=1;
+
+  getExactTime(startTime);
+  auto wallStart=toMicroSec(startTime);
+  auto loadStart=loadTime;
+
+  vector<thread> workers;
+  for(i=0;i<iThreads;i++){
+    workers.push_back(thread([&](){
+      CHardklor2 worker(averagine,mercury,models);
+      worker.cs=cs;
+      worker.PT=PT;
+      while(true){
+        ScanJob* job;
+        {
+          unique_lock<mutex> lock(mtx);
+          cvWork.wait(lock,[&]{ return !todo.empty() || bFinished; });
+          if(todo.empty()) return;
+          job=todo.front();
+          todo.pop_front();
+        }
+        worker.AnalyzeScan(job->spec,job->c,job->vPeps);
+        {
+          lock_guard<mutex> lock(mtx);
+          job->done=true;
+        }
+        cvDone.notify_one();
+      }
+    }));
+  }
+
+  //Writes the oldest scan in the window, waiting for its analysis if needed
+  auto writeFront=[&](){
+    {
+      unique_lock<mutex> lock(mtx);
+      cvDone.wait(lock,[&]{ return window.front().done; });
+    }
+    ScanJob& job=window.front();
+    if(bMem){
+      currentScanNumber=job.spec.getScanNumber();
+      ScanToMem(job.spec);
+      for(size_t j=0;j<job.vPeps.size();j++) ResultToMem(job.vPeps[j],job.c);
+    } else {
+      if(format==1 && !bFirst) fprintf(fout,"</Spectrum>\n");
+      WriteScanLine(job.spec,fout,format);
+      for(size_t j=0;j<job.vPeps.size();j++) WritePepLine(job.vPeps[j],job.c,fout,format);
+    }
+    bFirst=false;
+    window.pop_front();
+  };
+
+  window.push_back(ScanJob());
+  window.back().spec=first;
+
+  while(true){
+    TotalScans++;
+    scanNumber=window.back().spec.getScanNumber();
+    {
+      lock_guard<mutex> lock(mtx);
+      todo.push_back(&window.back());
+    }
+    cvWork.notify_one();
+
+    //Update progress
+    if(bEcho){
+      if (r.getPercent() > iPercent){
+        if(iPercent<10) cout << "\b";
+        else cout << "\b\b";
+        cout.flush();
+        iPercent=r.getPercent();
+        cout << iPercent;
+        cout.flush();
+      }
+    }
+
+    //Check if any user limits were made and met
+    if( (cs.scan.iUpper == cs.scan.iLower) && (cs.scan.iLower != 0) ){
+      break;
+    } else if( (cs.scan.iLower < cs.scan.iUpper) && (scanNumber >= cs.scan.iUpper) ){
+      break;
+    }
+
+    //Bound the number of scans held in memory
+    while(window.size()>=maxInFlight) writeFront();
+
+    //Read next spectrum from file.
+    getExactTime(startTime);
+    window.push_back(ScanJob());
+    ReadNextScan(r,nr,window.back().spec);
+    getExactTime(stopTime);
+    tmpTime1=toMicroSec(stopTime);
+    tmpTime2=toMicroSec(startTime);
+    loadTime+=(tmpTime1-tmpTime2);
+
+    if(window.back().spec.getScanNumber()==0){
+      window.pop_back();
+      break;
+    }
+  }
+
+  while(!window.empty()) writeFront();
+
+  {
+    lock_guard<mutex> lock(mtx);
+    bFinished=true;
+  }
+  cvWork.notify_all();
+  for(i=0;i<(int)workers.size();i++) workers[i].join();
+
+  //Everything that was not spent reading counts as analysis time
+  getExactTime(stopTime);
+  tmpTime1=toMicroSec(stopTime);
+  analysisTime+=(tmpTime1-wallStart)-(loadTime-loadStart);
+
+  return TotalScans;
+}
+
 double CHardklor2::PeakMatcher(vector<Result>& vMR, Spectrum& s, double lower, double upper, double deltaM, int matchIndex, int& matchCount, int& indexOverlap, vector<int>& vMatchIndex, vector<float>& vMatchIntensity){
 
 	vMatchIndex.clear();
@@ -794,6 +926,43 @@ double CHardklor2::PeakMatcherB(vector<Result>& vMR, Spectrum& s, double lower,
 	return corr;
 }
 
+void CHardklor2::PrintSummary(int TotalScans){
+	int i;
+	int minutes, seconds;
+
+	if(bEcho) {
+		cout << "\n" << endl;
+		cout << "  Total number of scans analyzed: " << TotalScans << endl;
+
+		i=(int)timeToSec(loadTime,timerFrequency);
+		minutes = (int)(i/60);
+		seconds = i - (60*minutes);
+		cout << "\nFile access time: " << minutes << " minutes, " << seconds << " seconds." << endl;
+		i=(int)timeToSec(analysisTime,timerFrequency);
+		minutes = (int)(i/60);
+		seconds = i - (60*minutes);
+		cout << "Analysis Time:    " << minutes << " minutes, " << seconds << " seconds." << endl;
+
+		if (minutes==0 && seconds==0){
+			cout << "IMPOSSIBLE!!!" << endl;
+		} else if(minutes <=2){
+			cout << "HOLY FRIJOLE!!" << endl;
+		} else if(minutes<=5) {
+			cout << "Like lightning!" << endl;
+		} else if(minutes<=10){
+			cout << "That's pretty damn fast!" << endl;
+		} else if(minutes<=20){
+			cout << "Monkeys calculate faster than that!" << endl;
+		} else if(minutes<=30){
+			cout << "You should have taken a lunch break." << endl;
+		} else if(minutes<=40){
+			cout << "Oi! Too freakin' slow!!" << endl;
+		} else {
+			cout << "You might be able to eek out some better performance by adjusting your parameters." << endl;
+		}
+	}
+}
+
 void CHardklor2::QuickCharge(Spectrum& s, int index, vector<int>& v){
 
 	int i,j;
@@ -1223,6 +1392,22 @@ void CHardklor2::QuickHardklor(Spectrum& s, vector<pepHit>& vPeps) {
 
 }
 
+//Reads the next scan, denoising it if boxcar averaging is on. The scan number
+//is zero when there are no more scans.
+void CHardklor2::ReadNextScan(MSReader& r, CNoiseReduction& nr, Spectrum& s){
+	if(cs.boxcar==0) {
+		r.readFile(NULL,s);
+	} else {
+		if(cs.boxcarFilter==0){
+			//possible to not filter?
+      nr.DeNoiseD(s);
+		} else {
+		//case 5: nr.DeNoise(curSpec); break; //this is for filtering without boxcar
+			nr.DeNoiseC(s);
+		}
+	}
+}
+
 //Reduces the number of features (cs.depth) per 1 Da window. This removes a lot
 //of false hits resulting from jagged tails on really large peaks. Criteria for
 //removal is lowest peak intensity
@@ -1356,14 +1541,36 @@ void CHardklor2::ResultToMem(pepHit& ph, Spectrum& s){
   vResults.push_back(hkm);
 }
 
+hkScan& CHardklor2::Scan(const int& index){
+  return vScans[index];
+}
+
+void CHardklor2::ScanToMem(Spectrum& s){
+  hkScan hks;
+  hks.scan = s.getScanNumber();
+  hks.rTime = s.getRTime();
+  hks.firstResult = (int)vResults.size();
+  vScans.push_back(hks);
+}
+
 void CHardklor2::SetResultsToMemory(bool b){
   bMem=b;
 }
 
+//Number of threads analyzing scans. Values above one use a worker pool when
+//results are written to a file.
+void CHardklor2::SetThreads(int n){
+  iThreads = n<1 ? 1 : n;
+}
+
 int CHardklor2::Size(){
   return vResults.size();
 }
 
+int CHardklor2::SizeScans(){
+  return vScans.size();
+}
+
 void CHardklor2::WritePepLine(pepHit& ph, Spectrum& s, FILE* fptr, int format){
   int i,j;
 
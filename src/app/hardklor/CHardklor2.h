@@ -36,13 +36,17 @@ class CHardklor2{
   void  Echo(bool b);
   int   GoHardklor(CHardklorSetting sett, Spectrum* s=NULL);
   void    QuickCharge(Spectrum& s, int index, std::vector<int>& v);
+  hkScan& Scan(const int& index);
   void  SetResultsToMemory(bool b);
+  void  SetThreads(int n);
   int   Size();
+  int   SizeScans();
 
  protected:
 
  private:
   //Methods:
+  void    AnalyzeScan(Spectrum& s, Spectrum& c, std::vector<pepHit>& vPeps);
   int     BinarySearch(Spectrum& s, double mz, bool floor);
   double  CalcFWHM(double mz,double res,int iType);
   void    Centroid(Spectrum& s, Spectrum& out);
@@ -50,11 +54,15 @@ class CHardklor2{
   int     CompareData(const void*, const void*);
   double  LinReg(std::vector<float>& mer, std::vector<float>& obs);
   bool    MatchSubSpectrum(Spectrum& s, int peakIndex, pepHit& pep);
+  int     ParallelHardklor(MSReader& r, CNoiseReduction& nr, Spectrum& first, FILE* fout, int& iPercent);
   double  PeakMatcher(std::vector<Result>& vMR, Spectrum& s, double lower, double upper, double deltaM, int matchIndex, int& matchCount, int& indexOverlap, std::vector<int>& vMatchIndex, std::vector<float>& vMatchIntensity);
   double  PeakMatcherB(std::vector<Result>& vMR, Spectrum& s, double lower, double upper, double deltaM, int matchIndex, int& matchCount, std::vector<int>& vMatchIndex, std::vector<float>& vMatchIntensity);
+  void    PrintSummary(int TotalScans);
   void    QuickHardklor(Spectrum& s, std::vector<pepHit>& vPeps);
+  void    ReadNextScan(MSReader& r, CNoiseReduction& nr, Spectrum& s);
   void    RefineHits(std::vector<pepHit>& vPeps, Spectrum& s);
   void    ResultToMem(pepHit& ph, Spectrum& s);
+  void    ScanToMem(Spectrum& s);
   void    WritePepLine(pepHit& ph, Spectrum& s, FILE* fptr, int format=0); 
   void    WriteScanLine(Spectrum& s, FILE* fptr, int format=0); 
 
@@ -71,9 +79,11 @@ class CHardklor2{
   bool              bEcho;
   bool              bMem;
   int               currentScanNumber;
+  int               iThreads;
 
   //Vector for holding results in memory should that be needed
   std::vector<hkMem> vResults;
+  std::vector<hkScan> vScans;
 
   //Temporary Data Members:
   char bestCh[200];
@@ -1,6 +1,42 @@
 #include "CModelLibrary.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
+namespace {
+
+const char CACHE_MAGIC[8]={'H','K','M','O','D','E','L','S'};
+const unsigned int CACHE_VERSION=1;
+
+//One per model in the cache file; the peaks of all models follow the records.
+typedef struct cachedModel{
+	double zeroMass;
+	float area;
+	int size;
+} cachedModel;
+
+//Returns the contents of a data file, or an empty string for the built-in defaults.
+string readDataFile(const string& fn){
+	if(fn.empty()) return "";
+	ifstream in(fn.c_str(),ios::binary);
+	ostringstream s;
+	s << in.rdbuf();
+	return s.str();
+}
+
+}
+
 CModelLibrary::CModelLibrary(CAveragine* avg, CMercury8* mer){
 	averagine=avg;
 	mercury=mer;
@@ -10,6 +46,11 @@ CModelLibrary::CModelLibrary(CAveragine* avg, CMercury8* mer){
 	chargeCount=0;
 	varCount=0;
 	merCount=0;
+	threads=1;
+
+	bDataFiles=false;
+	mappedData=NULL;
+	mappedSize=0;
 }
 
 CModelLibrary::~CModelLibrary(){
@@ -23,14 +64,10 @@ CModelLibrary::~CModelLibrary(){
 
 bool CModelLibrary::buildLibrary(int lowCharge, int highCharge, vector<CHardklorVariant>& pepVariants){
 
-	int i,j,k;
-	unsigned int n;
-
-	vector<Peak_T> vMR;
-	Peak_T p;
-	float da;
-	double mass;
-	char av[64];
+	int i,j;
+	string key;
+	string path;
+	char name[64];
 
 	if(libModel!=NULL) {
 		cout << "library memory already in use." << endl;
@@ -54,37 +91,21 @@ bool CModelLibrary::buildLibrary(int lowCharge, int highCharge, vector<CHardklor
 			libModel[i][j][0].size=0;
 			libModel[i][j][0].zeroMass=0.0;
 			libModel[i][j][0].peaks=NULL;
-			for(k=1;k<merCount;k++){
-
-				mass=k*5*i-(1.007276466*i);
-				averagine->clear();
-				averagine->calcAveragine(mass,pepVariants[j]);
-				averagine->getAveragine(&av[0]);
-        //cout << mass << "\t" << pepVariants[j].sizeAtom() << "\t" << pepVariants[j].sizeEnrich() << "\t" << av << endl;
-        for(n=0;n<(unsigned int)pepVariants[j].sizeEnrich();n++){
-          mercury->Enrich(pepVariants[j].atEnrich(n).atomNum,pepVariants[j].atEnrich(n).isotope,pepVariants[j].atEnrich(n).ape);
-        }
-				mercury->GoMercury(&av[0],i);
-
-				vMR.clear();
-				da=0.0f;
-				for(n=0; n<mercury->FixedData.size(); n++) {
-					if(mercury->FixedData[n].data<1.0) continue;
-					p.intensity=(float)mercury->FixedData[n].data;
-					p.mz=mercury->FixedData[n].mass;
-					da+=p.intensity;
-					vMR.push_back(p);
-				}
-				da/=100.0f;
+		}
+	}
+
+	//Reuse a library built earlier from the same inputs
+	if(!cacheDir.empty() && bDataFiles){
+		key=cacheKey(pepVariants);
+		sprintf(name,"hardklor-models-%016llx.bin",(unsigned long long)hash<string>()(key));
+		path=cacheDir+"/"+name;
+		if(readCache(path,key)) return true;
+	}
 
-				libModel[i][j][k].area = da;
-				libModel[i][j][k].size = vMR.size();
-				libModel[i][j][k].peaks = new Peak_T[vMR.size()];
-				libModel[i][j][k].zeroMass = mercury->getZeroMass();
+	buildModels(pepVariants);
 
-				for(n=0;n<vMR.size();n++) libModel[i][j][k].peaks[n]=vMR[n];
-			}
-		}
+	if(!path.empty() && !writeCache(path,key)) {
+		cout << "Unable to write model library cache " << path << endl;
 	}
 
 	return true;
@@ -99,8 +120,10 @@ void CModelLibrary::eraseLibrary(){
 
 	for(i=chargeMin;i<chargeCount;i++){
 		for(j=0;j<varCount;j++){
-			for(k=0;k<merCount;k++){
-				delete [] libModel[i][j][k].peaks;
+			if(mappedData==NULL){
+				for(k=0;k<merCount;k++){
+					delete [] libModel[i][j][k].peaks;
+				}
 			}
 			delete [] libModel[i][j];
 		}
@@ -109,6 +132,7 @@ void CModelLibrary::eraseLibrary(){
 	delete [] libModel;
 
 	libModel=NULL;
+	unmapCache();
 	
 }
 
@@ -118,3 +142,280 @@ mercuryModel* CModelLibrary::getModel(int charge, int var, double mz){
 	return &libModel[charge][var][intMZ];
 
 }
+
+void CModelLibrary::setCacheDir(const string& dir){
+	cacheDir=dir;
+}
+
+void CModelLibrary::setDataFiles(const char* isotopeFn, const char* hardklorFn){
+	isotopeFile=isotopeFn;
+	hardklorFile=hardklorFn;
+	bDataFiles=true;
+}
+
+void CModelLibrary::setThreads(int n){
+	threads = n<1 ? 1 : n;
+}
+
+//Computes the averagine model of one charge, variant and 5 Da mass step.
+void CModelLibrary::buildModel(CAveragine* avg, CMercury8* mer, int charge, CHardklorVariant& variant, int index, mercuryModel& model){
+
+	unsigned int n;
+
+	vector<Peak_T> vMR;
+	Peak_T p;
+	float da;
+	double mass;
+	char av[64];
+
+	mass=index*5*charge-(1.007276466*charge);
+	avg->clear();
+	avg->calcAveragine(mass,variant);
+	avg->getAveragine(&av[0]);
+  //cout << mass << "\t" << variant.sizeAtom() << "\t" << variant.sizeEnrich() << "\t" << av << endl;
+  for(n=0;n<(unsigned int)variant.sizeEnrich();n++){
+    mer->Enrich(variant.atEnrich(n).atomNum,variant.atEnrich(n).isotope,variant.atEnrich(n).ape);
+  }
+	mer->GoMercury(&av[0],charge);
+
+	vMR.clear();
+	da=0.0f;
+	for(n=0; n<mer->FixedData.size(); n++) {
+		if(mer->FixedData[n].data<1.0) continue;
+		p.intensity=(float)mer->FixedData[n].data;
+		p.mz=mer->FixedData[n].mass;
+		da+=p.intensity;
+		vMR.push_back(p);
+	}
+	da/=100.0f;
+
+	model.area = da;
+	model.size = vMR.size();
+	model.peaks = new Peak_T[vMR.size()];
+	model.zeroMass = mer->getZeroMass();
+
+	for(n=0;n<vMR.size();n++) model.peaks[n]=vMR[n];
+}
+
+//Fills in every model. Averagine and Mercury keep state between calls, so each
+//thread works with its own pair made from the same data files.
+void CModelLibrary::buildModels(vector<CHardklorVariant>& pepVariants){
+
+	int i,j,k;
+	int steps=merCount-1;
+	int total=(chargeCount-chargeMin)*varCount*steps;
+
+	if(threads<2 || !bDataFiles){
+		for(i=chargeMin;i<chargeCount;i++){
+			for(j=0;j<varCount;j++){
+				for(k=1;k<merCount;k++) buildModel(averagine,mercury,i,pepVariants[j],k,libModel[i][j][k]);
+			}
+		}
+		return;
+	}
+
+	atomic<int> next(0);
+	vector<thread> workers;
+	for(i=0;i<threads;i++){
+		workers.push_back(thread([&](){
+			CAveragine avg(&isotopeFile[0],&hardklorFile[0]);
+			CMercury8 mer(&isotopeFile[0]);
+			int w;
+			while((w=next++)<total){
+				int charge=chargeMin+w/(varCount*steps);
+				int var=(w/steps)%varCount;
+				buildModel(&avg,&mer,charge,pepVariants[var],w%steps+1,libModel[charge][var][w%steps+1]);
+			}
+		}));
+	}
+	for(i=0;i<(int)workers.size();i++) workers[i].join();
+}
+
+//Everything the models depend on: charge range, variants, and the isotope and
+//averagine data.
+string CModelLibrary::cacheKey(vector<CHardklorVariant>& pepVariants){
+
+	int j;
+	unsigned int n;
+	ostringstream s;
+
+	s.precision(17);
+	s << "charge " << chargeMin << " " << chargeCount-1 << " steps " << merCount << "\n";
+	for(j=0;j<varCount;j++){
+		s << "variant";
+		for(n=0;n<(unsigned int)pepVariants[j].sizeAtom();n++){
+			s << " " << pepVariants[j].atAtom(n).iLower << ":" << pepVariants[j].atAtom(n).iUpper;
+		}
+		s << " |";
+		for(n=0;n<(unsigned int)pepVariants[j].sizeEnrich();n++){
+			s << " " << pepVariants[j].atEnrich(n).atomNum << ":" << pepVariants[j].atEnrich(n).isotope << ":" << pepVariants[j].atEnrich(n).ape;
+		}
+		s << "\n";
+	}
+	s << "isotopes\n" << readDataFile(isotopeFile) << "\naveragine\n" << readDataFile(hardklorFile);
+	return s.str();
+}
+
+//Loads a library written by writeCache. The file is memory mapped and the model
+//peaks point into it, so loading does not copy the peaks.
+bool CModelLibrary::readCache(const string& path, const string& key){
+
+	int i,j,k;
+	char* data;
+	size_t size;
+	size_t pos;
+	size_t peakPos;
+	size_t peakCount;
+	unsigned int version;
+	unsigned int peakSize;
+	unsigned long long keyLength;
+	int dims[4];
+	cachedModel* rec;
+
+#ifdef _MSC_VER
+	ifstream in(path.c_str(),ios::binary|ios::ate);
+	if(!in) return false;
+	size=(size_t)in.tellg();
+	data=new char[size];
+	in.seekg(0);
+	if(!in.read(data,size)) {
+		delete [] data;
+		return false;
+	}
+#else
+	int fd=open(path.c_str(),O_RDONLY);
+	if(fd<0) return false;
+	struct stat st;
+	if(fstat(fd,&st)!=0 || st.st_size==0) {
+		close(fd);
+		return false;
+	}
+	size=(size_t)st.st_size;
+	data=(char*)mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if(data==(char*)MAP_FAILED) return false;
+#endif
+	mappedData=data;
+	mappedSize=size;
+
+	//Header
+	pos=sizeof(CACHE_MAGIC)+2*sizeof(unsigned int)+sizeof(keyLength);
+	if(size<pos || memcmp(data,CACHE_MAGIC,sizeof(CACHE_MAGIC))!=0) {
+		unmapCache();
+		return false;
+	}
+	memcpy(&version,data+sizeof(CACHE_MAGIC),sizeof(version));
+	memcpy(&peakSize,data+sizeof(CACHE_MAGIC)+sizeof(version),sizeof(peakSize));
+	memcpy(&keyLength,data+sizeof(CACHE_MAGIC)+2*sizeof(unsigned int),sizeof(keyLength));
+	if(version!=CACHE_VERSION || peakSize!=sizeof(Peak_T) || keyLength!=key.size() ||
+		 size<pos+keyLength+sizeof(dims) || memcmp(data+pos,key.data(),key.size())!=0) {
+		unmapCache();
+		return false;
+	}
+	pos+=keyLength;
+	memcpy(dims,data+pos,sizeof(dims));
+	pos=(pos+sizeof(dims)+7)/8*8;
+	if(dims[0]!=chargeMin || dims[1]!=chargeCount || dims[2]!=varCount || dims[3]!=merCount) {
+		unmapCache();
+		return false;
+	}
+
+	//Model records and then the peaks, both at an 8 byte boundary
+	rec=(cachedModel*)(data+pos);
+	peakPos=pos+(size_t)(chargeCount-chargeMin)*varCount*merCount*sizeof(cachedModel);
+	if(size<peakPos) {
+		unmapCache();
+		return false;
+	}
+	peakCount=0;
+	for(i=0;i<(chargeCount-chargeMin)*varCount*merCount;i++) peakCount+=rec[i].size;
+	if(size!=peakPos+peakCount*sizeof(Peak_T)) {
+		unmapCache();
+		return false;
+	}
+
+	peakCount=0;
+	for(i=chargeMin;i<chargeCount;i++){
+		for(j=0;j<varCount;j++){
+			for(k=0;k<merCount;k++){
+				libModel[i][j][k].area=rec->area;
+				libModel[i][j][k].size=rec->size;
+				libModel[i][j][k].zeroMass=rec->zeroMass;
+				libModel[i][j][k].peaks = rec->size>0 ? (Peak_T*)(data+peakPos)+peakCount : NULL;
+				peakCount+=rec->size;
+				rec++;
+			}
+		}
+	}
+
+	return true;
+}
+
+//Writes the library to a temporary file that is renamed when complete, so
+//concurrent or interrupted runs never leave a partial cache behind.
+bool CModelLibrary::writeCache(const string& path, const string& key){
+
+	int i,j,k;
+	unsigned int version=CACHE_VERSION;
+	unsigned int peakSize=sizeof(Peak_T);
+	unsigned long long keyLength=key.size();
+	int dims[4]={chargeMin,chargeCount,varCount,merCount};
+	cachedModel rec;
+	long pos;
+	bool ok;
+
+	string tmp=path+".tmp";
+	FILE* f=fopen(tmp.c_str(),"wb");
+	if(f==NULL) return false;
+
+	fwrite(CACHE_MAGIC,1,sizeof(CACHE_MAGIC),f);
+	fwrite(&version,sizeof(version),1,f);
+	fwrite(&peakSize,sizeof(peakSize),1,f);
+	fwrite(&keyLength,sizeof(keyLength),1,f);
+	fwrite(key.data(),1,key.size(),f);
+	fwrite(dims,sizeof(dims),1,f);
+	pos=ftell(f);
+	while(pos%8!=0){
+		fputc(0,f);
+		pos++;
+	}
+
+	memset(&rec,0,sizeof(rec));
+	for(i=chargeMin;i<chargeCount;i++){
+		for(j=0;j<varCount;j++){
+			for(k=0;k<merCount;k++){
+				rec.zeroMass=libModel[i][j][k].zeroMass;
+				rec.area=libModel[i][j][k].area;
+				rec.size=libModel[i][j][k].size;
+				fwrite(&rec,sizeof(rec),1,f);
+			}
+		}
+	}
+
+	for(i=chargeMin;i<chargeCount;i++){
+		for(j=0;j<varCount;j++){
+			for(k=0;k<merCount;k++){
+				if(libModel[i][j][k].size>0) fwrite(libModel[i][j][k].peaks,sizeof(Peak_T),libModel[i][j][k].size,f);
+			}
+		}
+	}
+
+	ok=(ferror(f)==0);
+	if(fclose(f)!=0) ok=false;
+	if(!ok || rename(tmp.c_str(),path.c_str())!=0) {
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+void CModelLibrary::unmapCache(){
+	if(mappedData==NULL) return;
+#ifdef _MSC_VER
+	delete [] mappedData;
+#else
+	munmap(mappedData,mappedSize);
+#endif
+	mappedData=NULL;
+	mappedSize=0;
+}
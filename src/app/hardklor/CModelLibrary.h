@@ -5,6 +5,7 @@
 #include "CAveragine.h"
 #include "CMercury8.h"
 #include "CHardklorVariant.h"
+#include <string>
 #include <vector>
 
 class CModelLibrary {
@@ -19,20 +20,45 @@ public:
 	void eraseLibrary();
 	mercuryModel* getModel(int charge, int var, double mz);
 
+	//Data files the averagine and mercury objects were made from. Needed to build
+	//the library on more than one thread and to key the library cache.
+	void setDataFiles(const char* isotopeFile, const char* hardklorFile);
+	//Directory holding built libraries; empty disables the cache.
+	void setCacheDir(const std::string& dir);
+	void setThreads(int n);
+
 protected:
 
 private:
 
+	//Functions
+	void buildModel(CAveragine* avg, CMercury8* mer, int charge, CHardklorVariant& variant, int index, mercuryModel& model);
+	void buildModels(std::vector<CHardklorVariant>& pepVariants);
+	std::string cacheKey(std::vector<CHardklorVariant>& pepVariants);
+	bool readCache(const std::string& path, const std::string& key);
+	bool writeCache(const std::string& path, const std::string& key);
+	void unmapCache();
+
 	//Data Members
 	int chargeMin;
 	int chargeCount;
 	int varCount;
 	int merCount;
+	int threads;
 
 	CAveragine* averagine;
 	CMercury8* mercury;
 	mercuryModel*** libModel;
 
+	bool bDataFiles;
+	std::string isotopeFile;
+	std::string hardklorFile;
+	std::string cacheDir;
+
+	//Model peaks point into this block when the library was loaded from the cache
+	char* mappedData;
+	size_t mappedSize;
+
 };
 
 #endif
@@ -15,6 +15,8 @@
 #include "util/StringUtils.h"
 #include "io/DelimitedFileWriter.h"
 
+#include <thread>
+
 using namespace std;
 
 CruxHardklorApplication::CruxHardklorApplication() {
@@ -28,6 +30,16 @@ int CruxHardklorApplication::main(int argc, char** argv) {
 }
 
 int CruxHardklorApplication::main(const string& ms1) {
+  return main(ms1, NULL, NULL);
+}
+
+int CruxHardklorApplication::main(
+  const string& ms1,
+  vector<hkScan>* scans,
+  vector<hkMem>* results
+) {
+  bool inMemory = scans != NULL && results != NULL;
+
   carp(CARP_INFO, "Hardklor v2.19, April 10 2015");
   carp(CARP_INFO, "Mike Hoopmann, Mike MacCoss");
   carp(CARP_INFO, "Copyright 2007-2015");
@@ -95,7 +107,7 @@ int CruxHardklorApplication::main(const string& ms1) {
   }
 
   // Create all the output files that will be used
-  for (int i = 0; i< hp.size(); i++) {
+  for (int i = 0; i < hp.size() && !inMemory; i++) {
     const char* out = &hp.queue(i).outFile[0];
     if (FileUtils::Exists(out) && !Params::GetBool("overwrite")) {
       carp(CARP_FATAL, "The file '%s' already exists and cannot be overwritten. "
@@ -115,9 +127,19 @@ int CruxHardklorApplication::main(const string& ms1) {
   CAveragine* averagine = new CAveragine(hp.queue(0).MercuryFile, hp.queue(0).HardklorFile);
   CMercury8* mercury = new CMercury8(hp.queue(0).MercuryFile);
   CModelLibrary* models = new CModelLibrary(averagine, mercury);
+  int numThreads = Params::GetInt("num-threads");
+  if (numThreads < 1) {
+    numThreads = (int)std::thread::hardware_concurrency();
+  }
+  models->setDataFiles(hp.queue(0).MercuryFile, hp.queue(0).HardklorFile);
+  models->setThreads(numThreads);
+  models->setCacheDir(Params::GetString("hardklor-model-cache"));
 
   CHardklor h(averagine, mercury);
   CHardklor2 h2(averagine, mercury, models);
+  h2.SetThreads(numThreads);
+  h.SetResultsToMemory(inMemory);
+  h2.SetResultsToMemory(inMemory);
   vector<CHardklorVariant> pepVariants;
   CHardklorVariant hkv;
 
@@ -133,8 +155,14 @@ int CruxHardklorApplication::main(const string& ms1) {
       models->eraseLibrary();
       models->buildLibrary(hp.queue(i).minCharge, hp.queue(i).maxCharge, pepVariants);
       h2.GoHardklor(hp.queue(i));
+      if (inMemory) {
+        appendResults(h2, scans, results);
+      }
     } else {
       h.GoHardklor(hp.queue(i));
+      if (inMemory) {
+        appendResults(h, scans, results);
+      }
     }
   }
 
@@ -149,6 +177,27 @@ int CruxHardklorApplication::main(const string& ms1) {
   return 0;
 }
 
+/**
+ * Copies the in-memory results of one Hardklor run, offsetting the scans'
+ * result indices past results that are already there.
+ */
+template<typename HK>
+void CruxHardklorApplication::appendResults(
+  HK& hardklor,
+  vector<hkScan>* scans,
+  vector<hkMem>* results
+) {
+  int offset = results->size();
+  for (int i = 0; i < hardklor.SizeScans(); i++) {
+    hkScan scan = hardklor.Scan(i);
+    scan.firstResult += offset;
+    scans->push_back(scan);
+  }
+  for (int i = 0; i < hardklor.Size(); i++) {
+    results->push_back(hardklor[i]);
+  }
+}
+
 void CruxHardklorApplication::addArg(
   vector<char*>* args,
   const string& arg
@@ -250,6 +299,8 @@ vector<string> CruxHardklorApplication::getOptions() const {
     "smooth",
     "sn-window",
     "static-sn",
+    "num-threads",
+    "hardklor-model-cache",
     "parameter-file",
     "verbosity"
   };
@@ -11,6 +11,10 @@
 
 #include <string>
 #include <fstream>
+#include <vector>
+
+struct hkMem;
+struct hkScan;
 
 class CruxHardklorApplication: public CruxApplication {
 
@@ -57,8 +61,26 @@ class CruxHardklorApplication: public CruxApplication {
   static int main(
     const std::string& ms1 ///< file path of spectra to process
   );
+
+  /**
+   * \brief runs hardklor on the input spectra, keeping the results in memory
+   * instead of writing them to a file
+   * \returns whether hardklor was successful or not
+   */
+  static int main(
+    const std::string& ms1, ///< file path of spectra to process
+    std::vector<hkScan>* scans, ///< scans analyzed, in file order -out
+    std::vector<hkMem>* results ///< results of all scans -out
+  );
   
  protected:
+  template<typename HK>
+  static void appendResults(
+    HK& hardklor,
+    std::vector<hkScan>* scans,
+    std::vector<hkMem>* results
+  );
+
   static void addArg(
     std::vector<char*>* args,
     const std::string& arg
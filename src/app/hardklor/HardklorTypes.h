@@ -136,4 +136,12 @@ typedef struct hkMem{
   char mods[32];
 } hkMem;
 
+//Scan header for results stored to memory. The scan's results are the hkMem
+//entries from firstResult up to the next scan's firstResult.
+typedef struct hkScan{
+  int scan;
+  float rTime;
+  int firstResult;
+} hkScan;
+
 #endif
@@ -17,12 +17,9 @@ ActivePeptideQueue::ActivePeptideQueue(RecordReader* reader,
                                        const vector<const pb::Protein*>& proteins, 
                                        vector<const pb::AuxLocation*>* locations, 
                                        bool dia_mode)
-  : reader_(reader),
-    proteins_(proteins),
-    theoretical_peak_set_(1000),   // probably overkill, but no harm
-    locations_(locations),
+  : theoretical_peak_set_(1000),   // probably overkill, but no harm
     dia_mode_(dia_mode) {
-  CHECK(reader_->OK());
+  AddSource(reader, &proteins, locations);
   min_candidates_ = 30;
   nPeptides_ = 0;
   nCandPeptides_ = 0;
@@ -30,6 +27,58 @@ ActivePeptideQueue::ActivePeptideQueue(RecordReader* reader,
   CandPeptidesDecoy_ = 0;  
 }
 
+ActivePeptideQueue::ActivePeptideQueue(const vector<RecordReader*>& readers,
+                                       const vector<const vector<const pb::Protein*>*>& proteins,
+                                       const vector<vector<const pb::AuxLocation*>*>& locations,
+                                       bool dia_mode)
+  : theoretical_peak_set_(1000),
+    dia_mode_(dia_mode) {
+  CHECK(readers.size() == proteins.size() && readers.size() == locations.size());
+  for (size_t i = 0; i < readers.size(); ++i) {
+    AddSource(readers[i], proteins[i], locations[i]);
+  }
+  min_candidates_ = 30;
+  nPeptides_ = 0;
+  nCandPeptides_ = 0;
+  CandPeptidesTarget_ = 0;
+  CandPeptidesDecoy_ = 0;  
+}
+
+void ActivePeptideQueue::AddSource(RecordReader* reader,
+                                   const vector<const pb::Protein*>* proteins,
+                                   vector<const pb::AuxLocation*>* locations) {
+  CHECK(reader->OK());
+  sources_.push_back(PeptideSource());
+  PeptideSource& source = sources_.back();
+  source.reader_ = reader;
+  source.proteins_ = proteins;
+  source.locations_ = locations;
+  source.has_next_ = !reader->Done();
+  if (source.has_next_) {
+    reader->Read(&source.next_pb_peptide_);
+  }
+}
+
+int ActivePeptideQueue::ReadNextPeptide() {
+  int lightest = -1;
+  for (size_t i = 0; i < sources_.size(); ++i) {
+    if (sources_[i].has_next_ && (lightest < 0 ||
+        sources_[i].next_pb_peptide_.mass() < sources_[lightest].next_pb_peptide_.mass())) {
+      lightest = (int)i;
+    }
+  }
+  if (lightest < 0) {
+    return -1;
+  }
+  PeptideSource& source = sources_[lightest];
+  current_pb_peptide_.Swap(&source.next_pb_peptide_);
+  source.has_next_ = !source.reader_->Done();
+  if (source.has_next_) {
+    source.reader_->Read(&source.next_pb_peptide_);
+  }
+  return lightest;
+}
+
 ActivePeptideQueue::~ActivePeptideQueue() {
 }
 
@@ -82,14 +131,16 @@ int ActivePeptideQueue::SetActiveRange(vector<double>* min_mass, vector<double>*
     if (!queue_.empty()) {
       ComputeTheoreticalPeaksBack();
     }
-    while (!(done = reader_->Done())) {
+    int source_idx;
+    while (!(done = (source_idx = ReadNextPeptide()) < 0)) {
       // read all peptides lighter than max_range
-      reader_->Read(&current_pb_peptide_);
       if (current_pb_peptide_.mass() < min_range) {
         // we would delete current_pb_peptide_;
         continue; // skip peptides that fall below min_range
       }
-      Peptide* peptide = new Peptide(current_pb_peptide_, proteins_, locations_);
+      const PeptideSource& source = sources_[source_idx];
+      Peptide* peptide = new Peptide(current_pb_peptide_, *source.proteins_,
+                                     source.locations_, source_idx);
       assert(peptide != NULL);
       queue_.push_back(peptide);
       //Modified for tailor score calibration method by AKF
@@ -18,6 +18,14 @@ class ActivePeptideQueue {
         vector<const pb::AuxLocation*>* locations=NULL, 
         bool dia_mode = false);
 
+  // Reads several peptide indices at once. The peptides of the readers are
+  // merged by mass into one queue; Peptide::IndexId() tells the reader
+  // (position in the vectors) a peptide came from.
+  ActivePeptideQueue(const vector<RecordReader*>& readers,
+        const vector<const vector<const pb::Protein*>*>& proteins,
+        const vector<vector<const pb::AuxLocation*>*>& locations,
+        bool dia_mode = false);
+
   ~ActivePeptideQueue();
 
   int SetActiveRange(vector<double>* min_mass, vector<double>* max_mass, 
@@ -45,9 +53,21 @@ class ActivePeptideQueue {
 
   void ComputeTheoreticalPeaksBack();    
 
-  RecordReader* reader_;
-  const vector<const pb::Protein*>& proteins_; 
-  vector<const pb::AuxLocation*>* locations_;
+  // Moves the lightest pending peptide of all sources into
+  // current_pb_peptide_. Returns the source index, or -1 if all are done.
+  int ReadNextPeptide();
+
+  struct PeptideSource {
+    RecordReader* reader_;
+    const vector<const pb::Protein*>* proteins_; 
+    vector<const pb::AuxLocation*>* locations_;
+    pb::Peptide next_pb_peptide_;  // read ahead to compare masses across sources
+    bool has_next_;
+  };
+  void AddSource(RecordReader* reader, const vector<const pb::Protein*>* proteins,
+        vector<const pb::AuxLocation*>* locations);
+
+  vector<PeptideSource> sources_;
   
   TheoreticalPeakSetBYSparse theoretical_peak_set_;
   pb::Peptide current_pb_peptide_;
@@ -14,7 +14,8 @@
 
 Peptide::Peptide(const pb::Peptide& peptide,
         const vector<const pb::Protein*>& proteins,
-        vector<const pb::AuxLocation*>* locations)
+        vector<const pb::AuxLocation*>* locations,
+        int index_id)
   : len_(peptide.length()), 
   mass_(peptide.mass()), 
   id_(peptide.id()),
@@ -26,7 +27,8 @@ Peptide::Peptide(const pb::Peptide& peptide,
   first_loc_protein_id_(peptide.first_location().protein_id()),
   first_loc_pos_(peptide.first_location().pos()), 
   protein_length_(proteins[first_loc_protein_id_]->residues().length()),
-  decoyIdx_(peptide.has_decoy_index() ? peptide.decoy_index() : -1) {
+  decoyIdx_(peptide.has_decoy_index() ? peptide.decoy_index() : -1),
+  index_id_(index_id) {
     
   // Here we make sure that tide-search is compatible with old and new tide-index protocol buffers.
   // Set residues_ by pointing to the first occurrence in proteins.
@@ -55,9 +55,12 @@ class Peptide {
 
   // The proteins parameter is presumed to live in memory all the time while the
   // Peptide exists, so that residues_ can refer to the amino acid sequence.
+  // The index_id identifies the peptide index the peptide was read from when
+  // several indices are searched together.
   Peptide(const pb::Peptide& peptide,
           const vector<const pb::Protein*>& proteins,
-          vector<const pb::AuxLocation*>* locations = NULL);
+          vector<const pb::AuxLocation*>* locations = NULL,
+          int index_id = 0);
 
   // CAUTION: We do NOT expect this destructor to get called when FIFO 
   // allocation is used. It will get called only when normal system memory
@@ -115,6 +118,7 @@ class Peptide {
   int FirstLocProteinId() const { return first_loc_protein_id_; }
   int FirstLocPos() const { return first_loc_pos_; }
   int ProteinLenth() const {return protein_length_;}
+  int IndexId() const { return index_id_; }
   vector<ModCoder::Mod> Mods() const {
     return mods_;
   }
@@ -162,6 +166,7 @@ class Peptide {
   double nterm_mod_;
   double cterm_mod_;
   int decoyIdx_;
+  int index_id_;
   string decoy_seq_;
 
   const vector<const pb::Protein*>* proteins_;
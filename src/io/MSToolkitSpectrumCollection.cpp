@@ -18,10 +18,14 @@ using namespace std;
  */
 MSToolkitSpectrumCollection::MSToolkitSpectrumCollection(
   const string& filename   ///< The spectrum collection filename.
-) : SpectrumCollection(filename) {
+) : SpectrumCollection(filename), reader_(NULL), readerIndexed_(false) {
 
 }
 
+MSToolkitSpectrumCollection::~MSToolkitSpectrumCollection() {
+  delete reader_;
+}
+
 /**
  * Parses all the spectra from file designated by the filename member
  * variable.
@@ -79,7 +83,6 @@ bool MSToolkitSpectrumCollection::parse(int ms_level, bool dia_mode) {
     Crux::Spectrum* parsed_spectrum = new Crux::Spectrum();
     if (parsed_spectrum->parseMstoolkitSpectrum(mst_spectrum, filename_.c_str())) {
       addSpectrumToEnd(parsed_spectrum);
-      spectraByScan_[first_scan] = parsed_spectrum;
     } else {
       delete parsed_spectrum;
     }
@@ -88,7 +91,47 @@ bool MSToolkitSpectrumCollection::parse(int ms_level, bool dia_mode) {
   }
   delete mst_spectrum;
   delete mst_reader;
-  
+
+  is_parsed_ = true;
+  return true;
+}
+
+/**
+ * Reads the spectrum with the given first scan from the file.  mzML and
+ * mzXML files carry a scan index, so their reader is opened once and
+ * each later scan is a single seek; other formats are reopened per scan.
+ * \returns True if the scan was found.
+ */
+bool MSToolkitSpectrumCollection::readSpectrum(
+  int first_scan,      ///< The first scan of the spectrum to retrieve -in
+  Crux::Spectrum* spectrum   ///< Put the spectrum info here
+  ) {
+  carp(CARP_DEBUG, "Using mstoolkit to parse spectrum");
+  MSToolkit::Spectrum mst_spectrum;
+  lock_guard<mutex> lock(readerMutex_);
+  if (reader_ == NULL) {
+    reader_ = new MSToolkit::MSReader();
+    reader_->setFilter(MSToolkit::MS2);
+    switch (reader_->checkFileFormat(filename_.c_str())) {
+    case MSToolkit::mzXML:
+    case MSToolkit::mzML:
+    case MSToolkit::mzXMLgz:
+    case MSToolkit::mzMLgz:
+      readerIndexed_ = true;
+      break;
+    default:
+      readerIndexed_ = false;
+    }
+    reader_->readFile(filename_.c_str(), mst_spectrum, first_scan);
+  } else {
+    reader_->readFile(readerIndexed_ ? NULL : filename_.c_str(),
+                      mst_spectrum, first_scan);
+  }
+
+  if (mst_spectrum.getScanNumber() == 0) {
+    return false;
+  }
+  spectrum->parseMstoolkitSpectrum(&mst_spectrum, filename_.c_str());
   return true;
 }
 
@@ -102,24 +145,14 @@ bool MSToolkitSpectrumCollection::getSpectrum(
   int first_scan,      ///< The first scan of the spectrum to retrieve -in
   Crux::Spectrum* spectrum   ///< Put the spectrum info here
   ) {
-  carp(CARP_DEBUG, "Using mstoolkit to parse spectrum");
-  MSToolkit::MSReader* mst_reader = new MSToolkit::MSReader();
-  MSToolkit::Spectrum* mst_spectrum = new MSToolkit::Spectrum();
-  bool parsed = false;
-
-  mst_reader->readFile(filename_.c_str(), *mst_spectrum, first_scan);
-
-  if(mst_spectrum->getScanNumber() != 0) {
-    spectrum->parseMstoolkitSpectrum(mst_spectrum,
-                                     filename_.c_str());
-    parsed = true;
-  } else {
-    carp(CARP_ERROR, "Spectrum %d does not exist in file", first_scan);
-    parsed = false;
+  if (is_parsed_ && SpectrumCollection::getSpectrum(first_scan, spectrum)) {
+    return true;
   }
-  delete mst_spectrum;
-  delete mst_reader;
-  return parsed;
+  if (!readSpectrum(first_scan, spectrum)) {
+    carp(CARP_DEBUG, "Spectrum %d does not exist in file", first_scan);
+    return false;
+  }
+  return true;
 }
 
 /**
@@ -130,23 +163,11 @@ bool MSToolkitSpectrumCollection::getSpectrum(
 Crux::Spectrum* MSToolkitSpectrumCollection::getSpectrum(
   int first_scan      ///< The first scan of the spectrum to retrieve -in
   ) {
-  carp(CARP_DEBUG, "Using mstoolkit to parse spectrum");
-  MSToolkit::MSReader* mst_reader = new MSToolkit::MSReader();
-  MSToolkit::Spectrum* mst_spectrum = new MSToolkit::Spectrum();
-  Crux::Spectrum* return_spec = NULL;  
-
-  mst_reader->readFile(filename_.c_str(), *mst_spectrum, first_scan);
-
-  if(mst_spectrum->getScanNumber() != 0) {
-    return_spec = new Crux::Spectrum();
-    return_spec->parseMstoolkitSpectrum(mst_spectrum,
-                                        filename_.c_str()); 
-  } else {
-    carp(CARP_ERROR, "Spectrum %d does not exist in file", first_scan);
-    return_spec = NULL;
+  Crux::Spectrum* return_spec = new Crux::Spectrum();
+  if (!getSpectrum(first_scan, return_spec)) {
+    delete return_spec;
+    return NULL;
   }
-  delete mst_spectrum;
-  delete mst_reader;
   return return_spec;
 }
 
@@ -8,6 +8,11 @@
 #define MSTOOLKIT_SPECTRUM_COLLECTION_H
 
 #include "SpectrumCollection.h"
+#include <mutex>
+
+namespace MSToolkit {
+  class MSReader;
+}
 
 /**
  * \class SpectrumCollection
@@ -16,6 +21,19 @@
 class MSToolkitSpectrumCollection : public Crux::SpectrumCollection {
 
  protected:
+  MSToolkit::MSReader* reader_;  ///< kept open for indexed random access
+  bool readerIndexed_;  ///< reader_ reads scans through the file's scan index
+  std::mutex readerMutex_;
+
+  /**
+   * Reads the spectrum with the given first scan from the file, reusing
+   * the open reader and its scan index when the format has one.
+   * \returns True if the scan was found.
+   */
+  bool readSpectrum(
+    int first_scan,      ///< The first scan of the spectrum to retrieve -in
+    Crux::Spectrum* spectrum   ///< Put the spectrum info here
+  );
 
  public:
   /**
@@ -25,6 +43,8 @@ class MSToolkitSpectrumCollection : public Crux::SpectrumCollection {
     const std::string& filename ///< The spectrum collection filename. -in
   );
 
+  virtual ~MSToolkitSpectrumCollection();
+
   /**
    * Parses all the spectra from file designated by the filename member
    * variable.
@@ -61,6 +61,8 @@ void MatchCollectionParser::loadDatabase(
       decoy_database = new Database();
     }
     database->parse();
+    // Every protein id of every match is looked up, so index them now.
+    database->buildProteinIndex();
   }
 }
 
@@ -203,6 +205,24 @@ MatchCollection* MatchCollectionParser::create(
   return collection;
 }
 
+/**
+ * \returns a MatchCollection object using tab-delimited matches read
+ * from a stream, e.g. search results kept in memory
+ */
+MatchCollection* MatchCollectionParser::create(
+  istream* match_stream, ///< stream of tab-delimited matches
+  const string& match_name, ///< name reported as the file path
+  const string& fasta_path ///< path to the protein database
+  ) {
+  carp(CARP_DEBUG, "match stream:%s", match_name.c_str());
+  if (database_ == NULL || decoy_database_ == NULL) {
+    loadDatabase(fasta_path, database_, decoy_database_);
+  }
+  MatchCollection* collection = MatchFileReader::parse(match_stream, database_, decoy_database_);
+  collection->setFilePath(match_name, false);
+  return collection;
+}
+
 /*
  * Local Variables:
  * mode: c
@@ -11,6 +11,8 @@
 #include "model/MatchCollection.h"
 #include "model/Protein.h"
 
+#include <iostream>
+
 /**
  * Instantiates a MatchCollection based on the extension of the
  * given file.
@@ -34,6 +36,15 @@ class MatchCollectionParser {
     const std::string& fasta_path  ///< path to the protein database
   );
 
+  /**
+   * \returns a MatchCollection object using tab-delimited matches read
+   * from a stream, e.g. search results kept in memory
+   */
+  MatchCollection* create(
+    std::istream* match_stream, ///< stream of tab-delimited matches
+    const std::string& match_name, ///< name reported as the file path
+    const std::string& fasta_path  ///< path to the protein database
+  );
 
   /**
    * Creates database object(s) from fasta or index file
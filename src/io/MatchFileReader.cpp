@@ -44,6 +44,11 @@ MatchFileReader::MatchFileReader(istream* iptr) : DelimitedFileReader(iptr, true
   parseHeader();
 }
 
+MatchFileReader::MatchFileReader(istream* iptr, Database* database, Database* decoy_database)
+  : DelimitedFileReader(iptr, true, '\t'), PSMReader("", database, decoy_database) {
+  parseHeader();
+}
+
 /**
  * Destructor
  */
@@ -183,6 +188,13 @@ MatchCollection* MatchFileReader::parse(
   return MatchFileReader(file_path, database, decoy_database).parse();
 }
 
+MatchCollection* MatchFileReader::parse(
+  istream* iptr,
+  Database* database,
+  Database* decoy_database) {
+  return MatchFileReader(iptr, database, decoy_database).parse();
+}
+
 MatchCollection* MatchFileReader::parse() {
   MatchCollection* match_collection = new MatchCollection();
   match_collection->preparePostProcess();
@@ -63,6 +63,11 @@ class MatchFileReader: public DelimitedFileReader, public PSMReader {
       std::istream* iptr
     );
 
+    MatchFileReader(
+      std::istream* iptr,
+      Database* database,
+      Database* decoy_database = NULL);
+
     /**
      * Destructor
      */
@@ -133,6 +138,12 @@ class MatchFileReader: public DelimitedFileReader, public PSMReader {
       Database* decoy_database
     );
 
+    static MatchCollection* parse(
+      std::istream* iptr,
+      Database* database,
+      Database* decoy_database
+    );
+
     MatchCollection* parse();
 };
 
@@ -261,7 +261,6 @@ bool PWIZSpectrumCollection::parse(int ms_level, bool dia_mode) {
     	carp(CARP_DETAILED_DEBUG, "curr_ms1_scan: %d ", curr_ms1_scan );
 
     	addSpectrumToEnd(crux_spectrum);
-    	spectraByScan_[scan_number_begin] = crux_spectrum;
     } else {
     	delete crux_spectrum;
     }
@@ -281,6 +280,12 @@ bool PWIZSpectrumCollection::getSpectrum(
   int first_scan,      ///< The first scan of the spectrum to retrieve -in
   Crux::Spectrum* spectrum   ///< Put the spectrum info here
   ) {
+  if (!is_parsed_) {
+    bool found;
+    if (readSpectrum(first_scan, spectrum, found)) {
+      return found;
+    }
+  }
   parse();
   return SpectrumCollection::getSpectrum(first_scan, spectrum);
 }
@@ -293,8 +298,69 @@ bool PWIZSpectrumCollection::getSpectrum(
 Crux::Spectrum* PWIZSpectrumCollection::getSpectrum(
   int first_scan      ///< The first scan of the spectrum to retrieve -in
   ) {
-  parse();
-  return SpectrumCollection::getSpectrum(first_scan);
+  Crux::Spectrum* spectrum = new Crux::Spectrum();
+  if (!getSpectrum(first_scan, spectrum)) {
+    delete spectrum;
+    return NULL;
+  }
+  return spectrum;
+}
+
+/**
+ * Looks the scan up by its native id, which mzML files resolve through
+ * their index, and converts only that spectrum.
+ * \returns False if the file's ids do not carry scan numbers, or if the
+ * spectrum gives another scan number than parse() would assign it; then
+ * found is not set and the whole file must be parsed instead.
+ */
+bool PWIZSpectrumCollection::readSpectrum(
+  int first_scan,      ///< The first scan of the spectrum to retrieve -in
+  Crux::Spectrum* spectrum,  ///< Put the spectrum info here -out
+  bool& found          ///< Whether the scan is an MS2 spectrum with peaks -out
+  ) {
+  lock_guard<mutex> lock(readerMutex_);
+  pwiz::msdata::CVID native_id_format =
+    pwiz::msdata::id::getDefaultNativeIDFormat(*reader_);
+  // Peak list ids (e.g. MGF) hold a position, not a scan number.
+  if (native_id_format == pwiz::msdata::MS_multiple_peak_list_nativeID_format) {
+    return false;
+  }
+  string id = pwiz::msdata::id::translateScanNumberToNativeID(
+    native_id_format, StringUtils::ToString(first_scan));
+  if (id.empty()) {
+    return false;
+  }
+  pwiz::msdata::SpectrumListPtr all_spectra = reader_->run.spectrumListPtr;
+  size_t index = all_spectra->find(id);
+  if (index >= all_spectra->size()) {
+    return false;
+  }
+  carp(CARP_DEBUG, "Reading scan %d from spectrum index %d.", first_scan, (int)index);
+  pwiz::msdata::SpectrumPtr pwiz_spectrum;
+  try {
+    pwiz_spectrum = all_spectra->spectrum(index, true);
+  } catch (boost::bad_lexical_cast) {
+    carp(CARP_FATAL, "boost::bad_lexical_cast occured while parsing spectrum.\n"
+                     "Do your spectra contain z-lines?");
+  }
+
+  // parse() prefers the scans given in the peak list or title to the id.
+  int scan_number_begin, scan_number_end;
+  string ms_peak_list_scans = pwiz_spectrum->cvParam(pwiz::msdata::MS_peak_list_scans).value;
+  string ms_spectrum_title = pwiz_spectrum->cvParam(pwiz::msdata::MS_spectrum_title).value;
+  if ((ms_peak_list_scans.empty() ||
+       !get_first_last_scan_from_string(ms_peak_list_scans, scan_number_begin, scan_number_end)) &&
+      (ms_spectrum_title.empty() ||
+       !parseFirstLastScanFromTitle(ms_spectrum_title, scan_number_begin, scan_number_end))) {
+    scan_number_begin = scan_number_end = first_scan;  // from the native id
+  }
+  if (scan_number_begin != first_scan) {
+    return false;
+  }
+  found = pwiz_spectrum->defaultArrayLength >= 1 &&
+    pwiz_spectrum->cvParam(pwiz::msdata::MS_ms_level).valueAs<int>() == 2 &&
+    spectrum->parsePwizSpecInfo(pwiz_spectrum, scan_number_begin, scan_number_end);
+  return true;
 }
 
 /*
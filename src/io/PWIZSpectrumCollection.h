@@ -8,6 +8,7 @@
 #define PWIZ_SPECTRUM_COLLECTION_H
 
 #include "SpectrumCollection.h"
+#include <mutex>
 
 #include "pwiz/data/msdata/MSDataFile.hpp"
 
@@ -19,6 +20,18 @@ class PWIZSpectrumCollection : public Crux::SpectrumCollection {
 
  protected:
   pwiz::msdata::MSDataFile* reader_;
+  std::mutex readerMutex_;
+
+  /**
+   * Reads the MS2 spectrum with the given scan number through the file's
+   * native ids, without parsing the other spectra.
+   * \returns False if the scan cannot be located this way.
+   */
+  bool readSpectrum(
+    int first_scan,      ///< The first scan of the spectrum to retrieve -in
+    Crux::Spectrum* spectrum,  ///< Put the spectrum info here -out
+    bool& found          ///< Whether the scan is an MS2 spectrum with peaks -out
+  );
   
   /**
    * Parses the first/last scan from the title
@@ -100,8 +100,8 @@ SpectrumIterator SpectrumCollection::end() {
 }
 
 /*
- * Parses a single spectrum from a spectrum_collection with first scan
- * number equal to first_scan.
+ * Copies the spectrum with first scan number equal to first_scan out of
+ * the collection.
  * \returns The newly allocated Spectrum or NULL if scan number not found.
  */
 Spectrum* SpectrumCollection::getSpectrum(
@@ -128,19 +128,11 @@ bool SpectrumCollection::getSpectrum(
   Spectrum* spectrum   ///< Put the spectrum info here
 ) {
   map<int, Spectrum*>::const_iterator i = spectraByScan_.find(first_scan);
-  if (i != spectraByScan_.end()) {
-    spectrum->copyFrom(i->second);
-    return true;
-  }
-  for (SpectrumIterator spectrum_iterator = this->begin();
-       spectrum_iterator != this->end();
-       ++spectrum_iterator) {
-    if ((*spectrum_iterator)->getFirstScan() == first_scan) {
-      spectrum->copyFrom(*spectrum_iterator);
-      return true;
-    }
+  if (i == spectraByScan_.end()) {
+    return false;
   }
-  return false;
+  spectrum->copyFrom(i->second);
+  return true;
 }
 
 
@@ -154,8 +146,13 @@ bool SpectrumCollection::getSpectrum(
 void SpectrumCollection::addSpectrumToEnd(
   Spectrum* spectrum ///< spectrum to add to spectrum_collection -in
   ) {
+  if (sink_) {
+    sink_(spectrum);
+    return;
+  }
   // set spectrum
   spectra_.push_back(spectrum);
+  spectraByScan_.insert(make_pair(spectrum->getFirstScan(), spectrum));
   num_charged_spectra_ += spectrum->getNumZStates();
 }
 
@@ -167,7 +164,11 @@ void SpectrumCollection::addSpectrumToEnd(
 void SpectrumCollection::addSpectrum(
   Spectrum* spectrum ///< spectrum to add to spectrum_collection -in
   ) {
-    
+  if (sink_) {
+    sink_(spectrum);
+    return;
+  }
+
   unsigned int add_index = 0;
 
   // find correct location
@@ -180,6 +181,7 @@ void SpectrumCollection::addSpectrum(
   }
 
   spectra_.insert(spectra_.begin()+add_index, spectrum);
+  spectraByScan_.insert(make_pair(spectrum->getFirstScan(), spectrum));
 
   num_charged_spectra_ += spectrum->getNumZStates();
 }
@@ -204,6 +206,10 @@ void SpectrumCollection::removeSpectrum(
   
   num_charged_spectra_ -= spectrum->getNumZStates();
 
+  map<int, Spectrum*>::iterator by_scan = spectraByScan_.find(scan_num);
+  if (by_scan != spectraByScan_.end() && by_scan->second == spectra_[spectrum_index]) {
+    spectraByScan_.erase(by_scan);
+  }
   delete spectra_[spectrum_index];
   spectra_[spectrum_index] = NULL;
   spectra_.erase(spectra_.begin() + spectrum_index);
@@ -236,6 +242,22 @@ int SpectrumCollection::getNumChargedSpectra() {
 }
 
 
+/**
+ * Parses the file, handing each spectrum to sink instead of storing it.
+ */
+bool SpectrumCollection::stream(
+  const SpectrumSink& sink, ///< receives each parsed spectrum -in
+  int ms_level ///< ms level of the spectra to read -in
+  ) {
+  sink_ = sink;
+  bool success = parse(ms_level);
+  sink_ = SpectrumSink();
+  // the sink owns the spectra now, so nothing may be looked up by scan
+  spectraByScan_.clear();
+  is_parsed_ = false;
+  return success;
+}
+
 /**
  * \returns True if the spectrum_collection file has been parsed.
  */
@@ -12,6 +12,7 @@
 #include "model/Spectrum.h"
 
 #include <deque>
+#include <functional>
 
 /**
  * \class SpectrumCollection
@@ -23,12 +24,19 @@ class SpectrumCollection {
 
   friend class ::FilteredSpectrumChargeIterator;
 
+ public:
+  /**
+   * Receives spectra as they are parsed when streaming; takes ownership.
+   */
+  typedef std::function<void(Crux::Spectrum*)> SpectrumSink;
+
  protected:
   std::deque<Crux::Spectrum*> spectra_;  ///< spectra from the file
   std::map<int, Crux::Spectrum*> spectraByScan_;
   std::string filename_;                  ///< filename
   bool is_parsed_;      ///< file has been read and spectra_ populated 
   int num_charged_spectra_;  ///< sum of all charge states from all spectra
+  SpectrumSink sink_;  ///< if set, parsed spectra go here instead of spectra_
   
   /**
    * Base class constructor is protected.  Sets filename and
@@ -88,6 +96,14 @@ class SpectrumCollection {
    */
   virtual bool parse(int ms_level=2, bool dia_mode = false) = 0;
 
+  /**
+   * Parses the file like parse(), but hands each spectrum to sink as
+   * soon as it is read instead of keeping it in the collection, so the
+   * whole file never has to be held in memory.
+   * \returns TRUE if the spectra are parsed successfully. FALSE if otherwise.
+   */
+  bool stream(const SpectrumSink& sink, int ms_level = 2);
+
   /**
    * Parses a single spectrum from a spectrum_collection with first scan
    * number equal to first_scan.
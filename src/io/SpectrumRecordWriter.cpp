@@ -169,9 +169,9 @@ void SpectrumRecordWriter::addPeaks(
   uint64_t intensity_sum = 0;
 
   for (PeakIterator i = s->begin(); i != s->end(); ++i) {
-    FLOAT_T peakMz = (*i)->getLocation();
+    FLOAT_T peakMz = i->getLocation();
     uint64_t mz = peakMz * mz_denom + 0.5;
-    uint64_t intensity = (*i)->getIntensity() * intensity_denom + 0.5;
+    uint64_t intensity = i->getIntensity() * intensity_denom + 0.5;
     /*
     if (mz < last) {
       // Unsorted peaks, this should never happen since peaks get sorted earlier
@@ -33,10 +33,10 @@ int get_verbosity_level(void) {
  * Open log file for carp messages.
  *
  * Parameters must have been processed before calling this function.
+ * An existing log file is replaced only if overwrite is set.
  */
-void open_log_file(string log_file_name) {
+void open_log_file(string log_file_name, bool overwrite) {
   string output_dir = Params::GetString("output-dir");
-  bool overwrite = Params::GetBool("overwrite");
   log_file_name = prefix_fileroot_to_name(log_file_name);
   log_file = create_file_in_path(log_file_name, output_dir.c_str(), overwrite);
 }
@@ -96,8 +96,9 @@ int get_verbosity_level(void);
  * Open log file for carp messages.
  *
  * Parameters must have been processed before calling this function.
+ * An existing log file is replaced only if overwrite is set.
  */
-void open_log_file(std::string log_file_name);
+void open_log_file(std::string log_file_name, bool overwrite);
 
 /**
  * Print command line to log file.
@@ -50,7 +50,7 @@ void Database::init(){
   file_size_ = 0;
   is_hashed_ = false;
   proteins_ = new vector<Protein*>();
-  protein_map_ = new map<const char*, Protein*, cmp_str>();
+  protein_map_ = new unordered_map<const char*, Protein*, hash_str, eq_str>();
   decoys_ = NO_DECOYS;
 }
 
@@ -769,6 +769,24 @@ Protein* Database::getProteinAtIdx(
   return proteins_->at(protein_idx);
 }
 
+/**
+ * Indexes the proteins by id string for getProteinByIdString.  When
+ * ids repeat, the first protein with the id is found.
+ */
+void Database::buildProteinIndex() {
+  protein_map_->clear();
+  protein_map_->reserve(proteins_->size());
+  for (unsigned int protein_idx = 0;
+    protein_idx < proteins_->size();
+    protein_idx++) {
+
+    Protein* current_protein = proteins_->at(protein_idx);
+    string& current_id = current_protein->getIdPointer();
+    protein_map_->insert(make_pair(current_id.c_str(), current_protein));
+  }
+  is_hashed_ = true;
+}
+
 /**
  *\returns the protein designated by protein id of the database
  */
@@ -776,34 +794,12 @@ Protein* Database::getProteinByIdString(
   const char* protein_id ///< The id string for this protein -in
   ) {
 
-  //TODO - Implement as a hashtable rather than a map to make 
-  //this even faster if needed.
-  Protein* protein = NULL;
-  if (is_hashed_) {
-    map<const char*, Protein*, cmp_str>::iterator find_iter;
-    find_iter = protein_map_->find(protein_id);
-
-    if (find_iter != protein_map_->end()) {
-      protein = find_iter->second;
-    }
-  } else {
-    //create the hashtable of protein ids
-    for (unsigned int protein_idx = 0;
-      protein_idx < proteins_->size();
-      protein_idx++) {
-
-      Protein* current_protein = proteins_->at(protein_idx);
-      string& current_id = current_protein->getIdPointer();
-      protein_map_->insert(make_pair(current_id.c_str(), current_protein));
-
-      if (current_id == protein_id) {
-        protein = current_protein;
-      }
-        
-    }
-    is_hashed_ = true;
+  if (!is_hashed_) {
+    buildProteinIndex();
   }
-  return protein;
+  unordered_map<const char*, Protein*, hash_str, eq_str>::const_iterator find_iter =
+    protein_map_->find(protein_id);
+  return find_iter != protein_map_->end() ? find_iter->second : NULL;
 }
 
 /**
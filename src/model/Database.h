@@ -15,6 +15,7 @@
 #include "PeptideConstraint.h"
 #include <string>
 #include <map>
+#include <unordered_map>
 
 #ifdef _MSC_VER
 #include "util/WinCrux.h"
@@ -28,6 +29,26 @@ struct cmp_str {
   }
 };
 
+//Hash function for c type strings (FNV-1a).
+struct hash_str {
+
+  size_t operator()(char const *s) const {
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *s != '\0'; ++s) {
+      hash = (hash ^ (unsigned char)*s) * 1099511628211ULL;
+    }
+    return (size_t)hash;
+  }
+};
+
+//Equality function for c type strings.
+struct eq_str {
+
+  bool operator()(char const *a, char const *b) const {
+    return strcmp(a, b) == 0;
+  }
+};
+
 
 class Database {
  protected:
@@ -37,7 +58,7 @@ class Database {
                          ///  A database has only one associated file.
   bool is_parsed_;  ///< Has this database been parsed yet.
   std::vector<Crux::Protein*>* proteins_; ///< Proteins in this database.
-  std::map<const char*, Crux::Protein*, cmp_str>* protein_map_; //map for proteins 
+  std::unordered_map<const char*, Crux::Protein*, hash_str, eq_str>* protein_map_; //proteins by id
   bool is_hashed_; //Indicator of whether the database has been hashed/mapped.
   unsigned long int size_; ///< The size of the database in bytes (convenience)
   bool use_light_protein_; ///< should I use the light/heavy protein option
@@ -244,6 +265,12 @@ class Database {
     unsigned int protein_idx ///< The index of the protein to retrieve -in
     );
 
+  /**
+   * Indexes the proteins by id string for getProteinByIdString.  The
+   * index is otherwise built on the first lookup.
+   */
+  void buildProteinIndex();
+
   /**
    *\returns the protein designated by protein id of the database
    */
@@ -1363,43 +1363,86 @@ vector<FLOAT_T> MatchCollection::extractScores(
 }
 
 /**
- * Given a hash table that maps from a score to its q-value, assign
- * q-values to all of the matches in a given collection.
+ * Given parallel arrays of scores and their q-values, assign q-values
+ * to all of the matches in a given collection.  Where a score appears
+ * more than once, its last q-value is used.
  */
 void MatchCollection::assignQValues(
-  const map<FLOAT_T, FLOAT_T>* score_to_qvalue_hash,
+  const vector<FLOAT_T>& scores,
+  const vector<FLOAT_T>& qvalues,
   SCORER_TYPE_T score_type,
   SCORER_TYPE_T derived_score_type
 ){
+  vector<FLOAT_T> qvalue_per_match =
+    lookupQValues(scores, qvalues, extractScores(score_type));
+  for (size_t i = 0; i < match_.size(); i++) {
+    match_[i]->setScore(derived_score_type, qvalue_per_match[i]);
+  }
+  scored_type_[derived_score_type] = true;
+}
 
-  // Iterate over the matches filling in the q-values
-  MatchIterator* match_iterator = 
-    new MatchIterator(this, score_type, false);
+/**
+ * Looks up the q-value of each query score in the parallel arrays of
+ * scores and q-values.  Where a score appears more than once, its last
+ * q-value is used.  Non-finite queries get NaN.
+ */
+vector<FLOAT_T> MatchCollection::lookupQValues(
+  const vector<FLOAT_T>& scores,
+  const vector<FLOAT_T>& qvalues,
+  const vector<FLOAT_T>& queries
+){
+  if (scores.size() != qvalues.size()) {
+    carp(CARP_FATAL, "Got %d q-values for %d scores.", qvalues.size(), scores.size());
+  }
 
-  while(match_iterator->hasNext()){
-    Match* match = match_iterator->next();
-    FLOAT_T score = match->getScore(score_type);
+  // Build a table of (score, q-value) sorted by score with one entry per
+  // score.  The scores usually arrive sorted, so the sort is often skipped.
+  vector< pair<FLOAT_T, FLOAT_T> > table;
+  table.reserve(scores.size());
+  for (size_t i = 0; i < scores.size(); i++) {
+    if (!isinf(scores[i]) && !isnan(scores[i])) {
+      table.push_back(make_pair(scores[i], qvalues[i]));
+    }
+  }
+  struct ScoreOrder {
+    bool operator()(const pair<FLOAT_T, FLOAT_T>& x, const pair<FLOAT_T, FLOAT_T>& y) const {
+      return x.first < y.first;
+    }
+  };
+  if (!is_sorted(table.begin(), table.end(), ScoreOrder())) {
+    // stable, so the last of several equal scores stays last
+    stable_sort(table.begin(), table.end(), ScoreOrder());
+  }
+  size_t unique = 0;
+  for (size_t i = 0; i < table.size(); i++) {
+    if (unique > 0 && table[unique - 1].first == table[i].first) {
+      table[unique - 1].second = table[i].second;
+    } else {
+      table[unique++] = table[i];
+    }
+  }
+  table.resize(unique);
 
-    FLOAT_T qvalue;
+  vector<FLOAT_T> found(queries.size());
+  for (size_t i = 0; i < queries.size(); i++) {
+    FLOAT_T score = queries[i];
     // If the score is not a number, punt.
     if ( isinf(score) || isnan(score) ) {
       carp(CARP_DEBUG, "Found inf or nan score.");
-      qvalue = numeric_limits<double>::quiet_NaN();
-    } else {
-      // Retrieve the corresponding q-value.
-      map<FLOAT_T, FLOAT_T>::const_iterator map_position 
-	= score_to_qvalue_hash->find(score);
-      if (map_position == score_to_qvalue_hash->end()) {
-	carp(CARP_FATAL,
-	     "Cannot find q-value corresponding to score of %g.",
-	     score);
-      }
-      qvalue = map_position->second;
+      found[i] = numeric_limits<double>::quiet_NaN();
+      continue;
+    }
+    // Retrieve the corresponding q-value.
+    vector< pair<FLOAT_T, FLOAT_T> >::const_iterator position = lower_bound(
+      table.begin(), table.end(), make_pair(score, (FLOAT_T)0), ScoreOrder());
+    if (position == table.end() || position->first != score) {
+      carp(CARP_FATAL,
+           "Cannot find q-value corresponding to score of %g.",
+           score);
     }
-    match->setScore(derived_score_type, qvalue);
+    found[i] = position->second;
   }
-  scored_type_[derived_score_type] = true;
-  delete match_iterator;
+  return found;
 }
 
 /*
@@ -362,15 +362,28 @@ class MatchCollection {
   ) const;
 
   /**
-   * Given a hash table that maps from a score to its q-value, assign
-   * q-values to all of the matches in a given collection.
+   * Given parallel arrays of scores and their q-values, assign q-values
+   * to all of the matches in a given collection.  Where a score appears
+   * more than once, its last q-value is used.
    */
   void assignQValues(
-    const map<FLOAT_T, FLOAT_T>* score_to_qvalue_hash,
+    const std::vector<FLOAT_T>& scores,
+    const std::vector<FLOAT_T>& qvalues,
     SCORER_TYPE_T score_type,
     SCORER_TYPE_T derived_score_type
     );
 
+  /**
+   * Looks up the q-value of each query score in the parallel arrays of
+   * scores and q-values, as assignQValues does.  Non-finite queries get
+   * NaN.
+   */
+  static std::vector<FLOAT_T> lookupQValues(
+    const std::vector<FLOAT_T>& scores,
+    const std::vector<FLOAT_T>& qvalues,
+    const std::vector<FLOAT_T>& queries
+    );
+
   /*******************************************
    * match_collection post_process extension
    ******************************************/
@@ -110,36 +110,11 @@ bool Peak::compareByMZ(const Peak& x, const Peak& y) {
 }
 
 
-std::vector<Peak*> allocate_peak_vector(unsigned int num_peaks) {
-  std::vector<Peak*> ans;
-
-  for (unsigned int idx = 0; idx < num_peaks; idx++) {
-    ans.push_back(new Peak(0,0));
-  }
-
-  return ans;
-}
-
-void free_peak_vector(std::vector<Peak*> &peaks) {
-  for (unsigned int idx = 0; idx < peaks.size(); idx++) {
-    delete peaks[idx];
-  }
-  peaks.clear();
-}
-
-bool compare_peaks_by_intensity(Peak* peak_one, Peak* peak_two) {
-  return (peak_one->getIntensity() > peak_two->getIntensity());
-}
-
-bool compare_peaks_by_mz(Peak* peak_one, Peak* peak_two) {
-  return (peak_one->getLocation() < peak_two->getLocation());
-}
-
-void sort_peaks(std::vector<Peak*> &peak_array, PEAK_SORT_TYPE_T sort_type) {
+void sort_peaks(std::vector<Peak> &peak_array, PEAK_SORT_TYPE_T sort_type) {
   if (sort_type == _PEAK_INTENSITY) {
-    sort(peak_array.begin(), peak_array.end(), compare_peaks_by_intensity);
+    sort(peak_array.begin(), peak_array.end(), Peak::compareByIntensity);
   } else if (sort_type == _PEAK_LOCATION) {
-    sort(peak_array.begin(), peak_array.end(), compare_peaks_by_mz);
+    sort(peak_array.begin(), peak_array.end(), Peak::compareByMZ);
   } else {
     carp(CARP_ERROR, "no matching peak sort type");
   }
@@ -92,20 +92,16 @@ private:
 };
 
 /**
- * Return a vector of allocated Peak pointers
+ * \typedef PeakIterator
+ * \brief An object to iterate over the peaks in a spectrum
  */
-std::vector<Peak*> allocate_peak_vector(unsigned int num_peaks);
-
-/**
- * Free a Peak pointer array
- */
-void free_peak_vector(std::vector<Peak*> &peaks);
+typedef std::vector<Peak>::const_iterator PeakIterator;
 
 /**
  * Sort peaks by their intensity or location
  * Use the lib function sort()
  */
-void sort_peaks(std::vector<Peak*> &peak_array, PEAK_SORT_TYPE_T sort_type);
+void sort_peaks(std::vector<Peak> &peak_array, PEAK_SORT_TYPE_T sort_type);
 
 /*
  * Local Variables:
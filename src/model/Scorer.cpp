@@ -499,7 +499,7 @@ bool Scorer::createIntensityArraySp(
   int charge               ///< the peptide charge -in 
   )
 {
-  Peak * peak = NULL;
+  const Peak * peak = NULL;
   FLOAT_T peak_location = 0;
   FLOAT_T max_intensity = 0;
   int mz = 0;
@@ -521,7 +521,7 @@ bool Scorer::createIntensityArraySp(
     peak_iterator != spectrum->end();
     ++peak_iterator) {
 
-    peak = *peak_iterator;
+    peak = &*peak_iterator;
     peak_location = peak->getLocation();
 
     // skip all peaks larger than experimental mass
@@ -835,7 +835,7 @@ bool Scorer::createIntensityArrayObserved(
   for (PeakIterator peak_iterator = spectrum->begin();
     peak_iterator != spectrum->end();
     ++peak_iterator) {
-    Peak* peak = *peak_iterator;
+    const Peak* peak = &*peak_iterator;
     FLOAT_T peak_location = peak->getLocation();
     if (peak_location < experimental_mass_cut_off && peak_location > max_peak
         && peak->getIntensity() > 0) {
@@ -851,7 +851,7 @@ bool Scorer::createIntensityArrayObserved(
   for (PeakIterator peak_iterator = spectrum->begin();
        peak_iterator != spectrum->end();
        ++peak_iterator) {
-    Peak* peak = *peak_iterator;
+    const Peak* peak = &*peak_iterator;
     FLOAT_T peak_location = peak->getLocation();
 
     // skip all peaks larger than experimental mass
@@ -97,11 +97,7 @@ Spectrum::Spectrum (
  */
 Spectrum::~Spectrum()
 {
-  free_peak_vector(peaks_);
-  
-  if(has_mz_peak_array_){
-    delete [] mz_peak_array_;
-  }
+  clearMzPeakArray();
 }
 
 /**
@@ -124,16 +120,11 @@ const Peak* Spectrum::getPeak(size_t i) {
   if (i >= peaks_.size()) {
     return NULL;
   }
-  return peaks_[i];
+  return &peaks_[i];
 }
 
 vector<Peak> Spectrum::getPeaks() const {
-  vector<Peak> peaks;
-  peaks.reserve(peaks_.size());
-  for (vector<Peak*>::const_iterator i = peaks_.begin(); i != peaks_.end(); i++) {
-    peaks.push_back(**i);
-  }
-  return peaks;
+  return peaks_;
 }
 
 /**
@@ -182,8 +173,8 @@ void Spectrum::print(FILE* file) ///< output file to print at -out
   for(int peak_idx = 0; peak_idx < (int)peaks_.size(); ++peak_idx){
     fprintf(file, "%.*f %.4f\n",
             mass_precision,
-            peaks_[peak_idx]->getLocation(),
-            peaks_[peak_idx]->getIntensity());
+            peaks_[peak_idx].getLocation(),
+            peaks_[peak_idx].getIntensity());
   }
 }
 
@@ -292,16 +283,18 @@ void Spectrum::printSqt(
  has_peaks_(old_spectrum.has_peaks_),
  sorted_by_mz_(old_spectrum.sorted_by_mz_),
  sorted_by_intensity_(old_spectrum.sorted_by_intensity_),
- has_mz_peak_array_(old_spectrum.has_mz_peak_array_),
+ has_mz_peak_array_(false),
+ mz_peak_array_(NULL),
  charge_state_assigned_(old_spectrum.charge_state_assigned_),
  retention_time_(old_spectrum.retention_time_)
 
 {
 
   // copy each peak
+  reservePeaks((int)old_spectrum.peaks_.size());
   for(int peak_idx=0; peak_idx < (int)old_spectrum.peaks_.size(); ++peak_idx){
-    this->addPeak(old_spectrum.peaks_[peak_idx]->getIntensity(),
-                  old_spectrum.peaks_[peak_idx]->getLocation());
+    this->addPeak(old_spectrum.peaks_[peak_idx].getIntensity(),
+                  old_spectrum.peaks_[peak_idx].getLocation());
   }
 
   /*  Should we do this??
@@ -325,13 +318,13 @@ void Spectrum::copyFrom(Spectrum *src) {
  has_peaks_ = src-> has_peaks_;
  sorted_by_mz_ = src->sorted_by_mz_;
  sorted_by_intensity_ = src->sorted_by_intensity_;
- has_mz_peak_array_ = src->has_mz_peak_array_;
  charge_state_assigned_ = src->charge_state_assigned_;
  retention_time_ = src->retention_time_;
  // copy each peak
+ reservePeaks((int)(peaks_.size() + src->peaks_.size()));
  for(int peak_idx=0; peak_idx < (int)src->peaks_.size(); ++peak_idx){
-   this->addPeak(src->peaks_[peak_idx]->getIntensity(),
-                  src->peaks_[peak_idx]->getLocation());
+   this->addPeak(src->peaks_[peak_idx].getIntensity(),
+                  src->peaks_[peak_idx].getLocation());
   }
 
   /*  Should we do this??
@@ -354,10 +347,10 @@ bool Spectrum::parseMstoolkitSpectrum
   // clear any existing values
   zstates_.clear();
 
-  free_peak_vector(peaks_);
+  peaks_.clear();
   i_lines_v_.clear();
   d_lines_v_.clear();
-  if( mz_peak_array_ ){ delete [] mz_peak_array_; }
+  clearMzPeakArray();
 
   MSToolkit::Spectrum* mst_real_spectrum = (MSToolkit::Spectrum*)mst_spectrum;
 
@@ -371,6 +364,7 @@ bool Spectrum::parseMstoolkitSpectrum
   // setfilename of empty spectrum
   filename_ = filename;
 
+  reservePeaks(mst_real_spectrum->size());
   for(int peak_idx = 0; peak_idx < (int)mst_real_spectrum->size(); peak_idx++){
     this->addPeak(mst_real_spectrum->at(peak_idx).intensity,
                   mst_real_spectrum->at(peak_idx).mz);
@@ -406,10 +400,10 @@ bool Spectrum::parsePwizSpecInfo(
   // clear any existing values
   zstates_.clear();
   ezstates_.clear();
-  free_peak_vector(peaks_);
+  peaks_.clear();
   i_lines_v_.clear();
   d_lines_v_.clear();
-  if( mz_peak_array_ ){ free(mz_peak_array_); }
+  clearMzPeakArray();
 
   // assign new values
   first_scan_ = firstScan;
@@ -431,9 +425,10 @@ bool Spectrum::parsePwizSpecInfo(
   // }
  // get peaks
   int num_peaks = pwiz_spectrum->defaultArrayLength;
-  vector<double> mzs = pwiz_spectrum->getMZArray()->data;
-  vector<double> intensities = pwiz_spectrum->getIntensityArray()->data;
+  const vector<double>& mzs = pwiz_spectrum->getMZArray()->data;
+  const vector<double>& intensities = pwiz_spectrum->getIntensityArray()->data;
 
+  reservePeaks(num_peaks);
   for (int peak_idx = 0; peak_idx < num_peaks; peak_idx++) {
     addPeak(intensities[peak_idx], mzs[peak_idx]);
   }
@@ -579,12 +574,18 @@ void Spectrum::addPeak
   FLOAT_T location_mz ///< the location of peak to add -in
   )
 {
-  Peak *peak = new Peak(intensity, location_mz);
-  peaks_.push_back(peak);
+  clearMzPeakArray();
+  peaks_.push_back(Peak(intensity, location_mz));
   updateFields(intensity, location_mz);
   has_peaks_ = true;
 }
 
+void Spectrum::reservePeaks(int count) {
+  if (count > 0) {
+    peaks_.reserve(count);
+  }
+}
+
 void Spectrum::truncatePeaks(int count) {
   if (count < 0) {
     count = 0;
@@ -594,10 +595,11 @@ void Spectrum::truncatePeaks(int count) {
   }
   min_peak_mz_ = count > 0 ? numeric_limits<FLOAT_T>::max() : 0;
   max_peak_mz_ = 0;
-  vector<Peak*>::const_iterator removePoint = peaks_.begin() + count;
-  for (vector<Peak*>::const_iterator i = peaks_.begin(); i != peaks_.end(); i++) {
+  clearMzPeakArray();
+  vector<Peak>::const_iterator removePoint = peaks_.begin() + count;
+  for (vector<Peak>::const_iterator i = peaks_.begin(); i != peaks_.end(); i++) {
     if (i < removePoint) {
-      FLOAT_T mz = (*i)->getLocation();
+      FLOAT_T mz = i->getLocation();
       if (mz < min_peak_mz_) {
         min_peak_mz_ = mz;
       }
@@ -605,11 +607,16 @@ void Spectrum::truncatePeaks(int count) {
         max_peak_mz_ = mz;
       }
     } else {
-      total_energy_ -= (*i)->getIntensity();
-      delete *i;
+      total_energy_ -= i->getIntensity();
     }
   }
-  peaks_.resize(count);
+  peaks_.erase(peaks_.begin() + count, peaks_.end());
+}
+
+void Spectrum::clearMzPeakArray() {
+  delete [] mz_peak_array_;
+  mz_peak_array_ = NULL;
+  has_mz_peak_array_ = false;
 }
 
 /**
@@ -629,7 +636,7 @@ void Spectrum::populateMzPeakArray()
     mz_peak_array_[peak_idx] = NULL;
   }
   for(int peak_idx = 0; peak_idx < (int)peaks_.size(); peak_idx++){
-    Peak * peak = peaks_[peak_idx];
+    Peak * peak = &peaks_[peak_idx];
     FLOAT_T peak_mz = peak->getLocation();
     int mz_idx = (int) (peak_mz * MZ_TO_PEAK_ARRAY_RESOLUTION);
     if (mz_peak_array_[mz_idx] != NULL){
@@ -700,11 +707,11 @@ Peak* Spectrum::getMaxIntensityPeak(
   FLOAT_T max_intensity = -BILLION;
   Peak* max_intensity_peak = NULL;
 
-  for (PeakIterator peak_iter = begin();
-    peak_iter != end();
+  for (vector<Peak>::iterator peak_iter = peaks_.begin();
+    peak_iter != peaks_.end();
     ++peak_iter) {
 
-    Peak* peak = *peak_iter;
+    Peak* peak = &*peak_iter;
     FLOAT_T peak_mz = peak->getLocation();
     FLOAT_T distance = fabs(mz - peak_mz);
     FLOAT_T intensity = peak->getIntensity();
@@ -916,8 +923,8 @@ FLOAT_T Spectrum::getMaxPeakIntensity()
   FLOAT_T max_intensity = -1;
 
   for(int peak_idx = 0; peak_idx < (int)peaks_.size(); ++peak_idx){
-    if (max_intensity <= peaks_[peak_idx]->getIntensity()) {
-      max_intensity = peaks_[peak_idx]->getIntensity();
+    if (max_intensity <= peaks_[peak_idx].getIntensity()) {
+      max_intensity = peaks_[peak_idx].getIntensity();
     }
   }
   return max_intensity; 
@@ -933,7 +940,7 @@ bool Spectrum::getChargeStateAssigned() const {
 void Spectrum::sumNormalize()
 {
   for(int peak_idx = 0; peak_idx < (int)peaks_.size(); peak_idx++){
-    Peak * peak = peaks_[peak_idx];
+    Peak * peak = &peaks_[peak_idx];
     FLOAT_T new_intensity = peak->getIntensity() / total_energy_;
     peak->setIntensity(new_intensity);
   }
@@ -948,6 +955,7 @@ void Spectrum::sortPeaks(PEAK_SORT_TYPE_T type)
       (type == _PEAK_INTENSITY && sorted_by_intensity_)) {
     return;
   }
+  clearMzPeakArray();
   sort_peaks(peaks_, type);
   sorted_by_mz_ = (type == _PEAK_LOCATION);
   sorted_by_intensity_ = (type == _PEAK_INTENSITY);
@@ -962,13 +970,12 @@ void Spectrum::putHighestPeak() {
   }
   size_t max_mz_peak_index = 0;
   for (size_t i = 1; i < peaks_.size(); ++i) {
-    if (Peak::compareByMZ(*peaks_[max_mz_peak_index], *peaks_[i])) {
+    if (Peak::compareByMZ(peaks_[max_mz_peak_index], peaks_[i])) {
       max_mz_peak_index = i;
     }
   }
-  Peak* temp = peaks_[max_mz_peak_index];
-  peaks_[max_mz_peak_index] = peaks_.back();
-  peaks_.back() = temp;
+  clearMzPeakArray();
+  swap(peaks_[max_mz_peak_index], peaks_.back());
 }
 
 /**
@@ -976,12 +983,13 @@ void Spectrum::putHighestPeak() {
  */
 void Spectrum::rankPeaks()
 {
+  clearMzPeakArray();
   sort_peaks(peaks_, _PEAK_INTENSITY);
   sorted_by_intensity_ = true;
   sorted_by_mz_ = false;
   int rank = (int)peaks_.size();
   for(int peak_idx = 0; peak_idx < (int) peaks_.size(); peak_idx++){
-    Peak * peak = peaks_[peak_idx];
+    Peak * peak = &peaks_[peak_idx];
     FLOAT_T new_rank = rank/(float)peaks_.size();
     rank--;
     peak->setIntensityRank(new_rank);
@@ -1015,19 +1023,19 @@ bool Spectrum::assignZState() {
   // sum peaks below and above the precursor m/z window separately
   FLOAT_T left_sum = 0.00001;
   FLOAT_T right_sum = 0.00001;
-  for (vector<Peak*>::const_iterator i = peaks_.begin(); i != peaks_.end(); i++) {
-    FLOAT_T location = (*i)->getLocation();
+  for (vector<Peak>::const_iterator i = peaks_.begin(); i != peaks_.end(); i++) {
+    FLOAT_T location = i->getLocation();
     if (location < precursor_mz_ - 20) {
-      left_sum += (*i)->getIntensity();
+      left_sum += i->getIntensity();
     } else if (location > precursor_mz_ + 20) {
-      right_sum += (*i)->getIntensity();
+      right_sum += i->getIntensity();
     } // else, skip peaks around precursor
   }
 
   // What is the justification for this? Ask Mike MacCoss
   FLOAT_T FractionWindow = 0;
   FLOAT_T CorrectionFactor = 1;
-  FLOAT_T max_peak_mz = peaks_.back()->getLocation();
+  FLOAT_T max_peak_mz = peaks_.back().getLocation();
   if ((precursor_mz_ * 2) >= max_peak_mz) {
     FractionWindow = (precursor_mz_ * 2) - max_peak_mz;
     CorrectionFactor = fabs((precursor_mz_ - FractionWindow)) / precursor_mz_;
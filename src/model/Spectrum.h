@@ -48,7 +48,7 @@ class Spectrum{
   FLOAT_T          precursor_mz_;  ///< The m/z of precursor (MS-MS spectra)
   std::vector<SpectrumZState> zstates_;
   std::vector<SpectrumZState> ezstates_;
-  std::vector<Peak*>  peaks_;         ///< The spectrum peaks
+  std::vector<Peak>   peaks_;         ///< The spectrum peaks, stored contiguously
   FLOAT_T          min_peak_mz_;   ///< The minimum m/z of all peaks
   FLOAT_T          max_peak_mz_;   ///< The maximum m/z of all peaks
   double           total_energy_;  ///< The sum of intensities in all peaks
@@ -64,6 +64,8 @@ class Spectrum{
   bool             sorted_by_intensity_; ///< ... or by intensity?
   bool             has_mz_peak_array_; ///< Is the mz_peak_array populated.
   Peak         **mz_peak_array_;  ///< Allows rapid peak retrieval by mz.
+                                  ///< Points into peaks_, so it is cleared
+                                  ///< whenever peaks are added or reordered.
   bool             charge_state_assigned_;
   FLOAT_T          retention_time_;
 
@@ -90,6 +92,11 @@ class Spectrum{
      FLOAT_T location  ///< the location of the peak that has been added -in
      );
 
+  /**
+   * Frees mz_peak_array_, which is rebuilt on the next lookup by m/z.
+   */
+  void clearMzPeakArray();
+
  public:
   /**
    * Default constructor.
@@ -364,6 +371,11 @@ class Spectrum{
      FLOAT_T location_mz ///< the location of peak to add -in
      );
 
+  /**
+   * Allocates room for count peaks, so adding them does not reallocate.
+   */
+  void reservePeaks(int count);
+
   void truncatePeaks(int count);
 
   /**
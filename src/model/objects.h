@@ -49,12 +49,6 @@ typedef enum _peak_sort_type PEAK_SORT_TYPE_T;
  */
 namespace Crux { class Spectrum; }
 
-/**
- * \typedef PeakIterator
- * \brief An object to iterate over the peaks in a spectrum
- */
-typedef std::vector<Peak*>::const_iterator PeakIterator;
-
 /**
  * \class SpectrumCollection
  * \brief A collection of spectra
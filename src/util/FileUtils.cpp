@@ -19,6 +19,18 @@ bool FileUtils::IsDir(const string& path) {
   return boost::filesystem::is_directory(path);
 }
 
+unsigned long long FileUtils::Size(const string& path) {
+  boost::system::error_code ec;
+  boost::uintmax_t size = boost::filesystem::file_size(path, ec);
+  return ec ? 0 : size;
+}
+
+long long FileUtils::ModificationTime(const string& path) {
+  boost::system::error_code ec;
+  time_t modified = boost::filesystem::last_write_time(path, ec);
+  return ec ? 0 : modified;
+}
+
 // returns true if a new directory was created, otherwise false
 bool FileUtils::Mkdir(const string& path) {
   return boost::filesystem::create_directory(path);
@@ -66,6 +78,20 @@ ofstream* FileUtils::GetWriteStream(const string& path, bool overwrite) {
   return stream;
 }
 
+ofstream* FileUtils::GetResumeStream(const string& path, streamoff size) {
+  if (!IsRegularFile(path) || boost::filesystem::file_size(path) < (boost::uintmax_t)size) {
+    return NULL;
+  }
+  boost::filesystem::resize_file(path, size);
+  ofstream* stream = new ofstream(path.c_str(), ios::in | ios::out);
+  if (!stream->good()) {
+    delete stream;
+    return NULL;
+  }
+  stream->seekp(0, ios::end);
+  return stream;
+}
+
 string FileUtils::BaseName(const string& path) {
   boost::filesystem::path p(path);
   return p.has_filename() ? p.filename().string() : "";
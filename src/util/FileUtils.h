@@ -9,12 +9,17 @@ class FileUtils {
   static bool Exists(const std::string& path);
   static bool IsRegularFile(const std::string& path);
   static bool IsDir(const std::string& path);
+  // Size in bytes and last modification time; 0 if the file does not exist
+  static unsigned long long Size(const std::string& path);
+  static long long ModificationTime(const std::string& path);
   static bool Mkdir(const std::string& path);
   static void Rename(const std::string& from, const std::string& to);
   static void Remove(const std::string& path);
   static std::string Join(const std::string& path1, const std::string& path2);
   static std::string Read(const std::string& path);
   static std::ofstream* GetWriteStream(const std::string& path, bool overwrite);
+  // Cuts an existing file to size bytes and opens it for writing at its end
+  static std::ofstream* GetResumeStream(const std::string& path, std::streamoff size);
   static std::string BaseName(const std::string& path);
   static std::string DirName(const std::string& path);
   static std::string Stem(const std::string& path);
@@ -482,6 +482,24 @@ Params::Params() : finalized_(false) {
     "Show search progress by printing every n spectra searched. Set to 0 to show no "
     "search progress.",
     "Available for tide-search", true);
+  InitBoolParam("profile-search", false,
+    "Measure the time each search thread spends in the stages of the search (spectrum "
+    "reading, candidate selection, preprocessing, scoring, reporting and waiting for "
+    "locks) and the number of candidate peptides per spectrum. The results are written "
+    "to tide-search.profile.txt and tide-search.candidates.txt.",
+    "Available for tide-search", true);
+  InitIntParam("checkpoint-interval", 0, 0, BILLION,
+    "Write a checkpoint to the output directory after every n spectrum-charge "
+    "combinations searched, so that an interrupted search can be continued with "
+    "--resume T. DIAmeter writes a checkpoint after each spectrum file if n is "
+    "positive. Set to 0 to write no checkpoints.",
+    "Available for tide-search and diameter", true);
+  InitBoolParam("resume", false,
+    "Continue an interrupted search from the checkpoint in the output directory. "
+    "The search must be restarted with the same spectrum files, database and "
+    "parameters. Results written after the checkpoint are discarded, and existing "
+    "files in the output directory are overwritten.",
+    "Available for tide-search and diameter", true);
   // Sp scoring params
   InitDoubleParam("max-mz", 4000, 0, BILLION,
     "Used in scoring sp.",
@@ -704,7 +722,10 @@ InitStringParam("protein-name-separator", ",",
     "on the command line (space delimited), prior to the name of the database.");
   InitArgParam("tide database",
     "Either a FASTA file or a directory containing a database index created by a previous "
-    "run of crux tide-index.");
+    "run of crux tide-index. Tide-search also accepts a comma-separated list of index "
+    "directories, which are searched together in a single pass; the indices must share "
+    "the same modifications and number of decoys per target, and an \"index name\" "
+    "column reports which index each match came from.");
   // **** Tide options ****
   InitStringParam("decoy-format", "shuffle", "none|shuffle|peptide-reverse",
     "Include a decoy version of every peptide by shuffling or reversing the "
@@ -1380,6 +1401,12 @@ InitStringParam("protein-name-separator", ",",
     "Specify this parameter to T in order to treat peptides carrying different or "
     "no modifications as being the same. Works only if estimation = peptide-level.",
     "Used by assign-confidence.", true);
+  InitBoolParam("columnar", false,
+    "Read only the score, label, spectrum and peptide columns of tab-delimited input "
+    "into compact arrays, and write each target by copying its input row with the "
+    "q-value column appended. This uses far less memory on large searches, but the "
+    "output keeps the columns of the input and no pepXML or mzIdentML is written.",
+    "Used by assign-confidence.", true);
   InitStringParam("percolator-intraset-features", "F",
     "Set a feature for percolator that in later versions is not an option.",
     "Shouldn't be variable; hide from user.", false);
@@ -1696,6 +1723,12 @@ InitStringParam("protein-name-separator", ",",
     "spectrum. Setting this parameter to 0 turns off this feature, and different noise "
     "thresholds will be used for each local mass window in a spectrum.",
     "Available for crux hardklor", true);
+  InitStringParam("hardklor-model-cache", "",
+    "Directory in which to store the averagine model library that Hardklor builds at "
+    "startup. Later runs with the same charge range, averagine modifications and data "
+    "files load the library from this directory instead of rebuilding it. Leave empty "
+    "to always rebuild the library.",
+    "Available for crux hardklor and crux bullseye", true);
   InitBoolParam("hardklor-xml-output", false,
     "Output XML instead of tab-delimited text.",
     "Available for crux hardklor", false);
@@ -1711,6 +1744,10 @@ InitStringParam("protein-name-separator", ",",
   InitStringParam("hardklor-file", "",
     "Input hardklor file into bullseye",
     "Hidden option for crux bullseye.", false);
+  InitBoolParam("bullseye-hardklor-output", false,
+    "Write the Hardklor results to hardklor.mono.txt. Otherwise Bullseye passes them "
+    "from Hardklor to the persistence analysis in memory and no file is written.",
+    "Available for crux bullseye", true);
   InitDoubleParam("max-persist", 2.0, 0, BILLION,
     "Ignore PPIDs that persist for longer than this length of time in the MS1 spectra. The "
     "unit of time is whatever unit is used in your data file (usually minutes). These PPIDs "
@@ -2284,6 +2321,33 @@ InitStringParam("protein-name-separator", ",",
   InitDoubleParam("lfq-q-value-threshold", 0.01, 0, 1.0,
                   "The q-value threshold used by ",
                   "Used by LFQ.", true);
+  InitStringParam("lfq-isotope-cache", "",
+                  "File in which theoretical isotope distributions are kept between runs, keyed "
+                  "by elemental composition. It is read at startup if it exists and rewritten "
+                  "when new compositions were computed. Leave empty to disable the cache.",
+                  "Used by LFQ.", true);
+  InitBoolParam("lfq-xic-sweep", true,
+                "Extract the XICs of all identifications of a spectrum file in one sweep over "
+                "its MS1 scans (T), or walk the scans separately for each identification and "
+                "charge state (F). Both give the same peaks.  Default = T.",
+                "Used by LFQ.", true);
+  InitIntParam("lfq-concurrent-files", 2, 1, 1000,
+                "The maximum number of spectrum files that are parsed, indexed and quantified "
+                "at the same time. With a value greater than 1, parsing of one file overlaps "
+                "quantification of another.  Default = 2.",
+                "Used by LFQ.", true);
+  InitBoolParam("lfq-index-cache", false,
+                "Save the MS1 peak index of each spectrum file to a sidecar file named after "
+                "the spectrum file with the extension .lfqidx, and reuse it on later runs "
+                "instead of parsing the spectra again. A sidecar is ignored if the spectrum "
+                "file has changed since it was written.  Default = F.",
+                "Used by LFQ.", true);
+  InitIntParam("lfq-memory-budget", 0, 0, 100000000,
+                "Approximate upper bound, in megabytes, on the memory used by the spectrum files "
+                "that are in flight at once. A file is not started while the files already in "
+                "flight would exceed the budget; one file is always allowed. Set to 0 for no "
+                "limit.  Default = 0.",
+                "Used by LFQ.", true);
 
   Categorize();
 }
@@ -2684,6 +2748,11 @@ void Params::Categorize() {
   items.insert("is-rt-seconds");
   items.insert("is-psm-filtered");
   items.insert("lfq-q-value-threshold");
+  items.insert("lfq-concurrent-files");
+  items.insert("lfq-memory-budget");
+  items.insert("lfq-index-cache");
+  items.insert("lfq-xic-sweep");
+  items.insert("lfq-isotope-cache");
   AddCategory("crux-lfq", items);
 
 }
@@ -0,0 +1,435 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "app/AssignConfidenceApplication.h"
+#include "util/FileUtils.h"
+#include "util/Params.h"
+#include "util/StringUtils.h"
+#include "util/utils.h"
+
+using namespace std;
+
+// ============================================================
+// AssignConfidenceApplication: columnar vs. match collection path
+// ============================================================
+
+class AssignConfidenceTest : public ::testing::Test {
+ protected:
+    // q-value of each target PSM, keyed by scan, charge, rank and sequence
+    typedef map<string, double> QValues;
+
+    void SetUp() override {
+        // run() sets these global parameters; TearDown puts them back
+        for (const char* name : {"output-dir", "score", "estimation-method"}) {
+            saved_strings_[name] = Params::GetString(name);
+        }
+        for (const char* name : {"overwrite", "columnar", "use-old-atdc"}) {
+            saved_bools_[name] = Params::GetBool(name);
+        }
+        saved_threads_ = Params::GetInt("num-threads");
+        dir_ = (boost::filesystem::temp_directory_path() /
+                boost::filesystem::unique_path("assign-confidence-%%%%-%%%%")).string();
+        ASSERT_TRUE(FileUtils::Mkdir(dir_));
+    }
+
+    void TearDown() override {
+        for (map<string, string>::const_iterator i = saved_strings_.begin();
+             i != saved_strings_.end(); ++i) {
+            Params::Set(i->first, i->second);
+        }
+        for (map<string, bool>::const_iterator i = saved_bools_.begin();
+             i != saved_bools_.end(); ++i) {
+            Params::Set(i->first, i->second);
+        }
+        Params::Set("num-threads", saved_threads_);
+        FileUtils::Remove(dir_);
+    }
+
+    // A separate target-decoy search: two ranked PSMs per spectrum in each
+    // file, with distinct scores so that no competition is decided at random,
+    // and peptides that recur across spectra for peptide-level estimation.
+    // Scores are xcorrs, or combined p-values without an xcorr rank column
+    // as tide-search writes them.
+    void writeSearchResults(bool pvalues) {
+        score_ = pvalues ? "combined p-value" : "xcorr score";
+        rank_ = pvalues ? "combined p-value rank" : "xcorr rank";
+        mt19937 rng(47);
+        const int num_spectra = 150;
+        vector<int> offsets(num_spectra * 4);
+        for (size_t i = 0; i < offsets.size(); i++) {
+            offsets[i] = (int)i;
+        }
+        shuffle(offsets.begin(), offsets.end(), rng);
+        const string residues = "ACDEFGHIKLMNPQRSTVWY";
+        ofstream target(FileUtils::Join(dir_, "search.target.txt").c_str());
+        ofstream decoy(FileUtils::Join(dir_, "search.decoy.txt").c_str());
+        const string header =
+            "file\tscan\tcharge\tspectrum precursor m/z\tspectrum neutral mass\t"
+            "peptide mass\t" + score_ + '\t' + rank_ + "\tdistinct matches/spectrum\t"
+            "sequence\tprotein id\tflanking aa\n";
+        target << header;
+        decoy << header;
+        for (int scan = 1; scan <= num_spectra; scan++) {
+            int charge = 2 + scan % 2;
+            for (int file = 0; file < 2; file++) {
+                ofstream& out = file == 0 ? target : decoy;
+                // targets of the first third of the spectra are correct
+                double bonus = file == 0 && scan <= num_spectra / 3 ? 3.0 : 0.0;
+                double scores[2];
+                for (int j = 0; j < 2; j++) {
+                    int offset = offsets[((scan - 1) * 2 + file) * 2 + j];
+                    scores[j] = !pvalues ? bonus + 0.5 + 0.001 * offset :
+                        (bonus > 0.0 ? 1e-6 : 1e-3) * (1 + offset);
+                }
+                if (pvalues) {
+                    sort(scores, scores + 2);
+                } else {
+                    sort(scores, scores + 2, greater<double>());
+                }
+                for (int rank = 1; rank <= 2; rank++) {
+                    int peptide = rng() % 80;
+                    string sequence = string(file == 0 ? "PEP" : "DEC") +
+                        residues[peptide / 20] + residues[peptide % 20] + "K";
+                    string protein = (file == 0 ? "P" : "decoy_P") + StringUtils::ToString(peptide);
+                    out << "demo.ms2\t" << scan << '\t' << charge << "\t500.0000\t"
+                        << 500.0 * charge - 1.00727 * charge << "\t700.0000\t"
+                        << StringUtils::ToString(scores[rank - 1], pvalues ? 8 : 4) << '\t'
+                        << rank << "\t10\t"
+                        << sequence << '\t' << protein << "(1)\tKR\n";
+                }
+            }
+        }
+    }
+
+    QValues run(const string& method, bool columnar) {
+        string output_dir = FileUtils::Join(dir_, columnar ? "columnar" : "collection");
+        FileUtils::Mkdir(output_dir);
+        Params::Set("output-dir", output_dir);
+        Params::Set("overwrite", true);
+        Params::Set("score", score_);
+        Params::Set("estimation-method", method);
+        Params::Set("columnar", columnar);
+        AssignConfidenceApplication app;
+        EXPECT_EQ(0, app.main(vector<string>(1, FileUtils::Join(dir_, "search.target.txt"))));
+        return readQValues(FileUtils::Join(output_dir, "assign-confidence.target.txt"),
+                           method == "mix-max" ? "mix-max q-value" : "tdc q-value");
+    }
+
+    QValues readQValues(const string& path, const string& qvalue_header) const {
+        QValues result;
+        ifstream in(path.c_str());
+        string line;
+        getline(in, line);
+        vector<string> header = StringUtils::Split(line, '\t');
+        int scan = find(header.begin(), header.end(), "scan") - header.begin();
+        int charge = find(header.begin(), header.end(), "charge") - header.begin();
+        int rank = find(header.begin(), header.end(), rank_) - header.begin();
+        int sequence = find(header.begin(), header.end(), "sequence") - header.begin();
+        int qvalue = find(header.begin(), header.end(), qvalue_header) - header.begin();
+        EXPECT_LT(qvalue, (int)header.size()) << qvalue_header << " not in " << path;
+        while (getline(in, line)) {
+            vector<string> fields = StringUtils::Split(line, '\t');
+            if (qvalue >= (int)fields.size()) {
+                continue;
+            }
+            string key = fields[scan] + '\t' + fields[charge] + '\t' +
+                fields[rank] + '\t' + fields[sequence];
+            result[key] = atof(fields[qvalue].c_str());
+        }
+        return result;
+    }
+
+    static void expectSameQValues(const QValues& expected, const QValues& actual) {
+        ASSERT_EQ(expected.size(), actual.size());
+        for (QValues::const_iterator i = expected.begin(), j = actual.begin();
+             i != expected.end(); ++i, ++j) {
+            EXPECT_EQ(i->first, j->first);
+            EXPECT_NEAR(i->second, j->second, 1e-6) << i->first;
+        }
+    }
+
+    typedef AssignConfidenceApplication::AtdcScoreSet AtdcScoreSet;
+    typedef AtdcScoreSet::PsmScore PsmScore;
+
+    // getScores and fdps, as the ATDC estimation runs them
+    static vector<FLOAT_T> atdcFdps(vector<PsmScore> targets,
+                                    const vector< vector<PsmScore> >& decoys,
+                                    bool ascending) {
+        vector<FLOAT_T> target_scores;
+        vector< vector<FLOAT_T> > decoy_scores;
+        AtdcScoreSet::getScores(targets, decoys, ascending, target_scores, decoy_scores);
+        return AtdcScoreSet(target_scores, decoy_scores, ascending).fdps();
+    }
+
+    static bool psmScoreLess(const PsmScore& x, const PsmScore& y) {
+        return x.get<0>() != y.get<0>() ? x.get<0>() < y.get<0>() :
+            boost::make_tuple(x.get<1>(), x.get<2>(), x.get<3>()) <
+            boost::make_tuple(y.get<1>(), y.get<2>(), y.get<3>());
+    }
+
+    // The serial map lookup and per-decoy-set loop that getScores and
+    // fdps replaced.  Targets must have distinct <file, scan> so that
+    // their order is the same under either sort.
+    static vector<FLOAT_T> referenceAtdcFdps(vector<PsmScore> targets,
+                                             const vector< vector<PsmScore> >& decoys,
+                                             bool ascending) {
+        if (ascending) {
+            sort(targets.begin(), targets.end(), psmScoreLess);
+        } else {
+            sort(targets.begin(), targets.end(),
+                 [](const PsmScore& x, const PsmScore& y) {
+                     return x.get<0>() != y.get<0>() ? x.get<0>() > y.get<0>() : psmScoreLess(x, y);
+                 });
+        }
+        map< boost::tuple<int, int, int>, size_t > idx_map;
+        for (size_t i = 0; i < targets.size(); i++) {
+            idx_map[boost::make_tuple(targets[i].get<1>(), targets[i].get<2>(), targets[i].get<3>())] = i;
+        }
+        // <target score, [decoy scores]>, negated so that lower is better
+        vector< pair<FLOAT_T, vector<FLOAT_T> > > scores;
+        for (size_t i = 0; i < targets.size(); i++) {
+            scores.push_back(make_pair(ascending ? targets[i].get<0>() : -targets[i].get<0>(),
+                                       vector<FLOAT_T>(decoys.size(),
+                                                       numeric_limits<FLOAT_T>::quiet_NaN())));
+        }
+        for (size_t i = 0; i < decoys.size(); i++) {
+            for (vector<PsmScore>::const_iterator j = decoys[i].begin(); j != decoys[i].end(); ++j) {
+                FLOAT_T score = j->get<0>();
+                scores[idx_map[boost::make_tuple(j->get<1>(), j->get<2>(), j->get<3>())]].second[i] =
+                    ascending ? score : -score;
+            }
+        }
+
+        const size_t num_scores = scores.size();
+        const size_t num_decoy_sets = decoys.size();
+        const FLOAT_T bc1 = -1/(FLOAT_T)num_decoy_sets;
+        // the value x is in the nth bin if edges[n] < x <= edges[n+1]
+        auto hist_bin = [&](vector<int>& hist, FLOAT_T x) {
+            for (size_t i = 0; i < num_scores; i++) {
+                if (x <= scores[i].first) {
+                    hist[i]++;
+                    return;
+                }
+            }
+        };
+        vector<size_t> opt_idx_cnt(num_scores, 0);
+        vector<FLOAT_T> sum_ntds(num_scores, 0);
+        vector<FLOAT_T> sum_ndds(num_scores, 0);
+        for (size_t i = 0; i < num_decoy_sets; i++) {
+            vector<int> ntds(num_scores, 0);
+            vector<int> ndds(num_scores, 0);
+            for (size_t j = 0; j < num_scores; j++) {
+                FLOAT_T score_target = scores[j].first;
+                FLOAT_T score_decoy = scores[j].second[i];
+                bool target_better = score_target != score_decoy ?
+                    score_target < score_decoy : myrandom_limit(2) == 0;
+                if (target_better) {
+                    opt_idx_cnt[j]++;
+                    hist_bin(ntds, score_target);
+                } else {
+                    hist_bin(ndds, score_decoy);
+                }
+            }
+            int ntds_total = 0, ndds_total = 0;
+            for (size_t j = 0; j < num_scores; j++) {
+                sum_ntds[j] += (ntds_total += ntds[j]);
+                sum_ndds[j] += (ndds_total += ndds[j]);
+            }
+        }
+
+        bool old_atdc = Params::GetBool("use-old-atdc");
+        if (old_atdc) {
+            for (size_t i = 0; i < num_scores; i++) {
+                sum_ntds[i] /= num_decoy_sets;
+                sum_ndds[i] /= num_decoy_sets;
+            }
+        }
+        vector<bool> is_target_psm(num_scores, true);
+        int num_target_psms = 0;
+        vector< vector<int> > opt_idx_cnt_mat(num_decoy_sets + 1, vector<int>(num_scores, 0));
+        vector<size_t> current_opt_idx(num_decoy_sets + 1, 0);
+        size_t lowest_opt_idx = num_decoy_sets + 1;
+        for (size_t i = 0; i < num_scores; i++) {
+            size_t idx = opt_idx_cnt[i];
+            size_t idx2 = old_atdc ? current_opt_idx[idx]++ : ++current_opt_idx[idx];
+            opt_idx_cnt_mat[idx][idx2] = i;
+            if (idx < lowest_opt_idx) {
+                lowest_opt_idx = idx;
+            }
+            int denominator = old_atdc ? 1 : num_decoy_sets;
+            if ((FLOAT_T)num_target_psms <= (sum_ntds[i] / denominator) - 0.5) {
+                num_target_psms++;
+                continue;
+            }
+            if (old_atdc) {
+                is_target_psm[opt_idx_cnt_mat[lowest_opt_idx][--current_opt_idx[lowest_opt_idx]]] = false;
+            } else {
+                is_target_psm[opt_idx_cnt_mat[lowest_opt_idx][current_opt_idx[lowest_opt_idx]--]] = false;
+            }
+            for ( ; lowest_opt_idx < num_decoy_sets + 1 && current_opt_idx[lowest_opt_idx] == 0;
+                  lowest_opt_idx++);
+        }
+
+        int target_psms_total = 0;
+        if (old_atdc) {
+            for (size_t i = 0; i < num_scores; i++) {
+                if (is_target_psm[i]) {
+                    target_psms_total++;
+                }
+                sum_ndds[i] = (1 + sum_ndds[i]) / max(1, target_psms_total);
+            }
+        } else if (bc1 >= 0) {
+            for (size_t i = 0; i < num_scores; i++) {
+                if (is_target_psm[i]) {
+                    target_psms_total++;
+                }
+                sum_ndds[i] = (bc1 + sum_ndds[i] / num_decoy_sets) / max(1, target_psms_total);
+            }
+        } else {
+            vector<FLOAT_T> ndds(num_scores, 0);
+            FLOAT_T prev = 0;
+            for (size_t i = 0; i < num_scores; i++) {
+                ndds[i] = sum_ndds[i] - prev;
+                prev = sum_ndds[i];
+            }
+            for (size_t i = 0; i < num_scores; i++) {
+                if (is_target_psm[i]) {
+                    target_psms_total++;
+                }
+                sum_ndds[i] = ((min((FLOAT_T)num_decoy_sets, max((FLOAT_T)1, ndds[i])) + sum_ndds[i]) /
+                               num_decoy_sets) / max(1, target_psms_total);
+            }
+        }
+        return sum_ndds;
+    }
+
+    // Targets on distinct spectra of two files, and several decoy sets
+    // each holding one PSM per target spectrum in shuffled order.  Scores
+    // are coarse so that targets tie with each other and with decoys, and
+    // some decoy scores are NaN.
+    static void atdcScores(mt19937& rng, size_t num_decoy_sets, vector<PsmScore>& targets,
+                           vector< vector<PsmScore> >& decoys) {
+        const int num_spectra = 300;
+        targets.clear();
+        for (int i = 0; i < num_spectra; i++) {
+            targets.push_back(boost::make_tuple((FLOAT_T)(rng() % 40) / 10, i % 2, 1 + i / 2,
+                                                2 + (int)(rng() % 2)));
+        }
+        decoys.assign(num_decoy_sets, vector<PsmScore>());
+        for (size_t i = 0; i < num_decoy_sets; i++) {
+            for (int j = 0; j < num_spectra; j++) {
+                FLOAT_T score = rng() % 20 == 0 ? numeric_limits<FLOAT_T>::quiet_NaN() :
+                    (FLOAT_T)(rng() % 30) / 10;
+                decoys[i].push_back(boost::make_tuple(
+                    score, targets[j].get<1>(), targets[j].get<2>(), targets[j].get<3>()));
+            }
+            shuffle(decoys[i].begin(), decoys[i].end(), rng);
+        }
+    }
+
+    static void expectSameFdps(const vector<FLOAT_T>& expected, const vector<FLOAT_T>& actual) {
+        ASSERT_EQ(expected.size(), actual.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            EXPECT_NEAR(expected[i], actual[i], 1e-6) << i;
+        }
+    }
+
+    map<string, string> saved_strings_;
+    map<string, bool> saved_bools_;
+    int saved_threads_;
+    string dir_;
+    string score_;
+    string rank_;
+};
+
+TEST_F(AssignConfidenceTest, ColumnarMatchesCollectionTdc) {
+    writeSearchResults(false);
+    QValues expected = run("tdc", false);
+    EXPECT_FALSE(expected.empty());
+    expectSameQValues(expected, run("tdc", true));
+}
+
+TEST_F(AssignConfidenceTest, ColumnarMatchesCollectionMixMax) {
+    writeSearchResults(false);
+    QValues expected = run("mix-max", false);
+    EXPECT_FALSE(expected.empty());
+    expectSameQValues(expected, run("mix-max", true));
+}
+
+TEST_F(AssignConfidenceTest, ColumnarMatchesCollectionPeptideLevel) {
+    writeSearchResults(false);
+    QValues expected = run("peptide-level", false);
+    EXPECT_FALSE(expected.empty());
+    expectSameQValues(expected, run("peptide-level", true));
+}
+
+// The combined p-value has its own rank column for top-match and no xcorr
+// rank to pair on.
+TEST_F(AssignConfidenceTest, ColumnarMatchesCollectionPvalueTdc) {
+    writeSearchResults(true);
+    QValues expected = run("tdc", false);
+    EXPECT_FALSE(expected.empty());
+    expectSameQValues(expected, run("tdc", true));
+}
+
+TEST_F(AssignConfidenceTest, ColumnarMatchesCollectionPvalueMixMax) {
+    writeSearchResults(true);
+    QValues expected = run("mix-max", false);
+    EXPECT_FALSE(expected.empty());
+    expectSameQValues(expected, run("mix-max", true));
+}
+
+TEST_F(AssignConfidenceTest, ColumnarMatchesCollectionPvaluePeptideLevel) {
+    writeSearchResults(true);
+    QValues expected = run("peptide-level", false);
+    EXPECT_FALSE(expected.empty());
+    expectSameQValues(expected, run("peptide-level", true));
+}
+
+// ============================================================
+// AssignConfidenceApplication::AtdcScoreSet
+// ============================================================
+
+TEST_F(AssignConfidenceTest, AtdcMatchesSerialLoop) {
+    mt19937 rng(50);
+    for (size_t num_decoy_sets : {1, 3, 7}) {
+        vector<PsmScore> targets;
+        vector< vector<PsmScore> > decoys;
+        atdcScores(rng, num_decoy_sets, targets, decoys);
+        for (bool old_atdc : {false, true}) {
+            Params::Set("use-old-atdc", old_atdc);
+            for (bool ascending : {false, true}) {
+                mysrandom(7);
+                vector<FLOAT_T> expected = referenceAtdcFdps(targets, decoys, ascending);
+                for (int threads : {1, 4}) {
+                    SCOPED_TRACE(testing::Message() << num_decoy_sets << " decoy sets, "
+                                 << threads << " threads, old " << old_atdc
+                                 << ", ascending " << ascending);
+                    Params::Set("num-threads", threads);
+                    mysrandom(7);
+                    expectSameFdps(expected, atdcFdps(targets, decoys, ascending));
+                }
+            }
+        }
+    }
+}
+
+TEST_F(AssignConfidenceTest, AtdcDuplicateDecoyIsFatal) {
+    mt19937 rng(50);
+    vector<PsmScore> targets;
+    vector< vector<PsmScore> > decoys;
+    atdcScores(rng, 3, targets, decoys);
+    decoys[1].push_back(decoys[1].front());
+    EXPECT_DEATH(atdcFdps(targets, decoys, false), "extra decoy scores");
+}
@@ -1,13 +1,18 @@
 #include <gtest/gtest.h>
 
 #include <cmath>
+#include <cstdio>
+#include <random>
 #include <string>
 #include <vector>
 
+#include <boost/filesystem.hpp>
+
 #include "CQStatistics.h"
 #include "ChromatographicPeak.h"
 #include "IndexedMassSpectralPeak.h"
 #include "LFQPeptide.h"
+#include "Ms1PeakIndex.h"
 #include "PpmTolerance.h"
 #include "ProteinGroup.h"
 #include "Results.h"
@@ -519,23 +524,142 @@ TEST(MedianPolishTest, OverallEffectExtracted) {
 }
 
 // ============================================================
-// binarySearchForIndexedPeak
+// Ms1PeakIndex
 // ============================================================
 
-TEST(BinarySearchTest, FindsCorrectStartIndex) {
-    // Build a sorted list of peaks by zeroBasedMs1ScanIndex
-    std::vector<IndexedMassSpectralPeak> peaks;
-    for (int i = 0; i < 10; ++i) {
-        peaks.emplace_back(500.0 + i * 0.01, 100.0, i, i + 1, static_cast<double>(i));
+namespace {
+// Three scans; bin 50000 (m/z 500.00) has peaks in scans 0 and 2.
+Ms1PeakIndex buildSmallIndex() {
+    const double mzs[][2] = {{500.001, 600.0}, {700.0, 0.0}, {499.998, 500.002}};
+    const int counts[] = {2, 1, 2};
+    Ms1PeakIndex index(BINS_PER_DALTON);
+    for (int scan = 0; scan < 3; ++scan) {
+        index.addScan(scan + 10, scan * 0.5);
+        for (int i = 0; i < counts[scan]; ++i) {
+            index.countPeak(mzs[scan][i]);
+        }
+    }
+    index.reserve();
+    for (int scan = 0; scan < 3; ++scan) {
+        for (int i = 0; i < counts[scan]; ++i) {
+            index.addPeak(mzs[scan][i], 100.0 * (scan + 1), scan);
+        }
     }
+    return index;
+}
+}  // namespace
+
+TEST(Ms1PeakIndexTest, ScanRangeSelectsPeaksOfOneScan) {
+    Ms1PeakIndex index = buildSmallIndex();
+    EXPECT_EQ(index.numPeaks(), 5u);
 
-    int idx = binarySearchForIndexedPeak(&peaks, 5);
-    EXPECT_GE(idx, 0);
-    EXPECT_LT(idx, static_cast<int>(peaks.size()));
+    std::pair<uint32_t, uint32_t> range = index.scanRange(index.bin(500.0), 2);
+    EXPECT_EQ(range.second - range.first, 2u);
+    range = index.scanRange(index.bin(500.0), 1);
+    EXPECT_EQ(range.first, range.second);
+    range = index.scanRange(index.numBins() + 10, 0);
+    EXPECT_EQ(range.first, range.second);
 }
 
-TEST(BinarySearchTest, EmptyVectorReturnsZero) {
-    std::vector<IndexedMassSpectralPeak> peaks;
-    int idx = binarySearchForIndexedPeak(&peaks, 3);
-    EXPECT_EQ(idx, 0);
+TEST(Ms1PeakIndexTest, PeakAtRestoresScanFields) {
+    Ms1PeakIndex index = buildSmallIndex();
+    std::pair<uint32_t, uint32_t> range = index.scanRange(index.bin(700.0), 1);
+    ASSERT_EQ(range.second - range.first, 1u);
+
+    IndexedMassSpectralPeak peak = index.peakAt(range.first);
+    EXPECT_NEAR(peak.mz, 700.0, 1e-4);
+    EXPECT_DOUBLE_EQ(peak.intensity, 200.0);
+    EXPECT_EQ(peak.zeroBasedMs1ScanIndex, 1);
+    EXPECT_EQ(peak.nativeScanNumber, 11);
+    EXPECT_DOUBLE_EQ(peak.retentionTime, 0.5);
+}
+
+TEST(Ms1PeakIndexTest, CacheRoundTripAndStaleCheck) {
+    const std::string path = (boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("ms1-peak-index-%%%%-%%%%.lfqidx")).string();
+    Ms1PeakIndex index = buildSmallIndex();
+    ASSERT_TRUE(index.write(path, 1234, 5678));
+
+    Ms1PeakIndex loaded(BINS_PER_DALTON);
+    ASSERT_TRUE(loaded.read(path, 1234, 5678));
+    EXPECT_EQ(loaded.numPeaks(), index.numPeaks());
+    EXPECT_EQ(loaded.scans().size(), 3u);
+    std::pair<uint32_t, uint32_t> range = loaded.scanRange(loaded.bin(500.0), 2);
+    EXPECT_EQ(range.second - range.first, 2u);
+
+    Ms1PeakIndex stale(BINS_PER_DALTON);
+    EXPECT_FALSE(stale.read(path, 1234, 9999));
+    std::remove(path.c_str());
+}
+
+// ============================================================
+// sweepXics
+// ============================================================
+
+TEST(XicSweepTest, MatchesPeakFind) {
+    // Dense synthetic run: 40 scans, peaks clustered around a few m/z values
+    // so that windows overlap and scans are missed now and then.
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> jitter(-0.004, 0.004);
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    const double centers[] = {400.2, 400.205, 650.31, 650.3105, 812.9};
+    const int numScans = 40;
+
+    vector<vector<double>> scanMzs(numScans);
+    for (int t = 0; t < numScans; ++t) {
+        for (double center : centers) {
+            for (int k = 0; k < 3; ++k) {
+                if (coin(rng) < 0.6) {
+                    scanMzs[t].push_back(center + jitter(rng));
+                }
+            }
+        }
+        std::sort(scanMzs[t].begin(), scanMzs[t].end());
+    }
+
+    Ms1PeakIndex index(BINS_PER_DALTON);
+    for (int t = 0; t < numScans; ++t) {
+        index.addScan(t + 1, t * 0.1);
+        for (double mz : scanMzs[t]) {
+            index.countPeak(mz);
+        }
+    }
+    index.reserve();
+    for (int t = 0; t < numScans; ++t) {
+        for (double mz : scanMzs[t]) {
+            index.addPeak(mz, 1000.0 + mz, t);
+        }
+    }
+    unordered_map<string, vector<Ms1ScanInfo>> ms1Scans;
+    ms1Scans["run"] = index.scans();
+    LFQMetaData metaData(&index, &ms1Scans);
+
+    PpmTolerance tolerance(20.0);
+    vector<XicTarget> targets;
+    vector<double> rts;
+    for (double center : centers) {
+        for (int charge = 1; charge <= 3; ++charge) {
+            for (double rt : {-1.0, 0.0, 1.55, 3.9, 10.0}) {
+                targets.push_back(XicTarget{toMass(center, charge), charge,
+                                            findPrecursorScanIndex(rt, index.scans())});
+                rts.push_back(rt);
+            }
+        }
+    }
+
+    vector<vector<uint32_t>> swept = sweepXics(targets, tolerance, metaData, 3);
+    ASSERT_EQ(swept.size(), targets.size());
+    size_t nonEmpty = 0;
+    for (size_t i = 0; i < targets.size(); ++i) {
+        vector<IndexedMassSpectralPeak> expected = peakFind(
+            rts[i], targets[i].mass, targets[i].charge, "run", tolerance, metaData);
+        ASSERT_EQ(swept[i].size(), expected.size()) << "target " << i;
+        for (size_t j = 0; j < expected.size(); ++j) {
+            IndexedMassSpectralPeak peak = index.peakAt(swept[i][j]);
+            EXPECT_EQ(peak, expected[j]);
+            EXPECT_EQ(peak.zeroBasedMs1ScanIndex, expected[j].zeroBasedMs1ScanIndex);
+        }
+        nonEmpty += expected.empty() ? 0 : 1;
+    }
+    EXPECT_GT(nonEmpty, 0u);
 }
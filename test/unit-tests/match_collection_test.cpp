@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "model/Match.h"
+#include "model/MatchCollection.h"
+
+using namespace std;
+using namespace Crux;
+
+// ============================================================
+// MatchCollection::assignQValues
+// ============================================================
+
+static Match* addScoredMatch(MatchCollection& matches, FLOAT_T score) {
+    Match* match = new Match();
+    match->setScore(XCORR, score);
+    matches.addMatch(match);
+    Match::freeMatch(match);  // the collection holds the remaining reference
+    return match;
+}
+
+TEST(AssignQValuesTest, LooksUpEachScoreExactly) {
+    MatchCollection matches;
+    Match* a = addScoredMatch(matches, 3.5);
+    Match* b = addScoredMatch(matches, 1.25);
+    Match* c = addScoredMatch(matches, 2.0);
+
+    vector<FLOAT_T> scores = {3.5, 2.0, 1.25};
+    vector<FLOAT_T> qvalues = {0.01, 0.02, 0.5};
+    matches.assignQValues(scores, qvalues, XCORR, QVALUE_TDC);
+
+    EXPECT_FLOAT_EQ(0.01, a->getScore(QVALUE_TDC));
+    EXPECT_FLOAT_EQ(0.5, b->getScore(QVALUE_TDC));
+    EXPECT_FLOAT_EQ(0.02, c->getScore(QVALUE_TDC));
+    EXPECT_TRUE(matches.getScoredType(QVALUE_TDC));
+}
+
+TEST(AssignQValuesTest, TiedScoresTakeTheLastQValue) {
+    MatchCollection matches;
+    Match* a = addScoredMatch(matches, 2.0);
+    Match* b = addScoredMatch(matches, 2.0);
+    Match* c = addScoredMatch(matches, 1.0);
+
+    // unsorted input with a repeated score
+    vector<FLOAT_T> scores = {2.0, 1.0, 2.0, 2.0};
+    vector<FLOAT_T> qvalues = {0.1, 0.3, 0.2, 0.25};
+    matches.assignQValues(scores, qvalues, XCORR, QVALUE_TDC);
+
+    EXPECT_FLOAT_EQ(0.25, a->getScore(QVALUE_TDC));
+    EXPECT_FLOAT_EQ(0.25, b->getScore(QVALUE_TDC));
+    EXPECT_FLOAT_EQ(0.3, c->getScore(QVALUE_TDC));
+}
+
+TEST(AssignQValuesTest, NonFiniteScoresGetNaN) {
+    MatchCollection matches;
+    Match* nan = addScoredMatch(matches, numeric_limits<FLOAT_T>::quiet_NaN());
+    Match* inf = addScoredMatch(matches, numeric_limits<FLOAT_T>::infinity());
+    Match* finite = addScoredMatch(matches, 4.0);
+
+    vector<FLOAT_T> scores = {
+        numeric_limits<FLOAT_T>::quiet_NaN(), 4.0, numeric_limits<FLOAT_T>::infinity()};
+    vector<FLOAT_T> qvalues = {0.9, 0.05, 0.8};
+    matches.assignQValues(scores, qvalues, XCORR, QVALUE_TDC);
+
+    EXPECT_TRUE(std::isnan(nan->getScore(QVALUE_TDC)));
+    EXPECT_TRUE(std::isnan(inf->getScore(QVALUE_TDC)));
+    EXPECT_FLOAT_EQ(0.05, finite->getScore(QVALUE_TDC));
+}
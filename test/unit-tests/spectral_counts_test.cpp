@@ -0,0 +1,254 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "app/SpectralCounts.h"
+#include "model/Ion.h"
+#include "model/IonConstraint.h"
+#include "model/IonSeries.h"
+#include "model/Peptide.h"
+#include "model/Protein.h"
+#include "util/modifications.h"
+
+using namespace std;
+using namespace Crux;
+
+// ============================================================
+// SpectralCounts::performParsimonyAnalysis
+// ============================================================
+
+class SpectralCountsTest : public ::testing::Test {
+ protected:
+    typedef SpectralCounts::PeptideSet PeptideSet;
+    typedef SpectralCounts::MetaMapping MetaMapping;
+    // peptide sequences and protein ids of each meta-protein, in map order
+    typedef vector< pair< vector<string>, vector<string> > > Groups;
+
+    // Each peptide gets its own parent protein holding just its sequence.
+    Peptide* addPeptide(const string& sequence) {
+        Protein* parent = new Protein(("parent_" + sequence).c_str(), sequence.c_str(),
+                                      sequence.length(), NULL, 0, 0, NULL);
+        proteins_.push_back(unique_ptr<Protein>(parent));
+        Peptide* peptide = new Peptide(sequence.length(), parent, 1);
+        peptides_.push_back(unique_ptr<Peptide>(peptide));
+        return peptide;
+    }
+
+    Protein* addProtein(const string& id) {
+        Protein* protein = new Protein(id.c_str(), "", 0, NULL, 0, 0, NULL);
+        proteins_.push_back(unique_ptr<Protein>(protein));
+        return protein;
+    }
+
+    void addMetaProtein(const vector<Peptide*>& peptides, const vector<Protein*>& proteins) {
+        PeptideSet peptide_set(Peptide::lessThan);
+        peptide_set.insert(peptides.begin(), peptides.end());
+        MetaProtein meta_protein(protein_id_less_than);
+        meta_protein.insert(proteins.begin(), proteins.end());
+        counts_.meta_mapping_.insert(make_pair(peptide_set, meta_protein));
+    }
+
+    Groups parsimony() {
+        counts_.performParsimonyAnalysis();
+        return groups(counts_.meta_mapping_);
+    }
+
+    // The greedy loop performParsimonyAnalysis used to run, which
+    // re-sorted the remaining meta-proteins every round.  That loop
+    // used std::sort, so its tie order was unspecified; this one uses
+    // stable_sort, whose tie order performParsimonyAnalysis now defines.
+    Groups referenceParsimony() {
+        MetaMapping result(SpectralCounts::comparePeptideSets);
+        vector< pair<PeptideSet, MetaProtein> > peps_vector(
+            counts_.meta_mapping_.begin(), counts_.meta_mapping_.end());
+        while (!peps_vector.empty()) {
+            stable_sort(peps_vector.begin(), peps_vector.end(),
+                        [](const pair<PeptideSet, MetaProtein>& x,
+                           const pair<PeptideSet, MetaProtein>& y) {
+                            return x.first.size() < y.first.size();
+                        });
+            pair<PeptideSet, MetaProtein> node = peps_vector.back();
+            peps_vector.pop_back();
+            if (node.first.size() == 0) { break; }
+            result.insert(node);
+            for (vector< pair<PeptideSet, MetaProtein> >::iterator iter = peps_vector.begin();
+                 iter != peps_vector.end(); ++iter) {
+                PeptideSet difference(Peptide::lessThan);
+                set_difference(iter->first.begin(), iter->first.end(),
+                               node.first.begin(), node.first.end(),
+                               inserter(difference, difference.end()), Peptide::lessThan);
+                iter->first = difference;
+            }
+        }
+        return groups(result);
+    }
+
+    // m/z of the unmodified b and y ions that sumMatchIntensities sums
+    // for a PSM of the given sequence and precursor charge
+    static vector<FLOAT_T> predictByIonMzs(const string& sequence, int charge) {
+        MODIFIED_AA_T* mod_seq = NULL;
+        int length = convert_to_mod_aa_seq(sequence, &mod_seq);
+        IonConstraint* constraint = IonConstraint::newIonConstraintSmart(XCORR, charge);
+        int max_charge = min(constraint->getMaxCharge(), charge);
+        IonConstraint::free(constraint);
+        vector<FLOAT_T> masses;
+        vector<FLOAT_T> mzs;
+        SpectralCounts::predictByIonMzs(mod_seq, length, max_charge, masses, mzs);
+        freeModSeq(mod_seq);
+        return mzs;
+    }
+
+    // The same m/z as SpectralCounts used to take them from IonSeries
+    static vector<FLOAT_T> ionSeriesMzs(const string& sequence, int charge) {
+        MODIFIED_AA_T* mod_seq = NULL;
+        int length = convert_to_mod_aa_seq(sequence, &mod_seq);
+        char* unmodified = modified_aa_to_unmodified_string(mod_seq, length);
+        IonConstraint* constraint = IonConstraint::newIonConstraintSmart(XCORR, charge);
+        IonSeries* ion_series = new IonSeries(constraint, charge);
+        ion_series->update(unmodified, mod_seq);
+        ion_series->predictIons();
+        vector<FLOAT_T> mzs;
+        for (IonIterator i = ion_series->begin(); i != ion_series->end(); ++i) {
+            Ion* ion = *i;
+            if ((ion->getType() == B_ION || ion->getType() == Y_ION) && !ion->isModified()) {
+                mzs.push_back(ion->getMassZ());
+            }
+        }
+        delete ion_series;
+        IonConstraint::free(constraint);
+        free(unmodified);
+        freeModSeq(mod_seq);
+        return mzs;
+    }
+
+    static void expectSameMzs(vector<FLOAT_T> expected, vector<FLOAT_T> actual) {
+        sort(expected.begin(), expected.end());
+        sort(actual.begin(), actual.end());
+        ASSERT_EQ(expected.size(), actual.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            EXPECT_NEAR(expected[i], actual[i], 1e-4) << i;
+        }
+    }
+
+    static FLOAT_T nearestPeakIntensity(const vector< pair<FLOAT_T, FLOAT_T> >& peaks,
+                                        FLOAT_T mz, FLOAT_T tolerance) {
+        return SpectralCounts::nearestPeakIntensity(peaks, mz, tolerance);
+    }
+
+    static Groups groups(const MetaMapping& mapping) {
+        Groups result;
+        for (MetaMapping::const_iterator i = mapping.begin(); i != mapping.end(); ++i) {
+            vector<string> sequences;
+            for (PeptideSet::const_iterator j = i->first.begin(); j != i->first.end(); ++j) {
+                char* sequence = (*j)->getSequence();
+                sequences.push_back(sequence);
+                free(sequence);
+            }
+            vector<string> ids;
+            for (MetaProtein::const_iterator j = i->second.begin(); j != i->second.end(); ++j) {
+                ids.push_back((*j)->getIdPointer());
+            }
+            result.push_back(make_pair(sequences, ids));
+        }
+        return result;
+    }
+
+    SpectralCounts counts_;
+    vector< unique_ptr<Peptide> > peptides_;
+    vector< unique_ptr<Protein> > proteins_;
+};
+
+TEST_F(SpectralCountsTest, ParsimonyBreaksTiesByEarlierSizes) {
+    Peptide* a = addPeptide("AAAK");
+    Peptide* b = addPeptide("BBBK");
+    Peptide* c = addPeptide("CCCK");
+    Peptide* d = addPeptide("DDDK");
+    addMetaProtein({a, b, c}, {addProtein("P1")});
+    addMetaProtein({c, d}, {addProtein("P2"), addProtein("P4")});
+    addMetaProtein({d}, {addProtein("P3")});
+
+    // P2 and P3 both hold only DDDK after P1 is picked; P2 was larger before.
+    Groups expected = {
+        {{"AAAK", "BBBK", "CCCK"}, {"P1"}},
+        {{"DDDK"}, {"P4", "P2"}},
+    };
+    EXPECT_EQ(expected, referenceParsimony());
+    EXPECT_EQ(expected, parsimony());
+}
+
+TEST_F(SpectralCountsTest, ParsimonyMatchesResortingGreedy) {
+    mt19937 rng(48);
+    const int num_peptides = 60;
+    vector<Peptide*> peptides;
+    const string residues = "ACDEFGHIKLMNPQRSTVWY";
+    for (int i = 0; i < num_peptides; i++) {
+        peptides.push_back(addPeptide(
+            string("PEP") + residues[i / 20] + residues[i % 20] + "K"));
+    }
+    for (int i = 0; i < 200; i++) {
+        vector<Peptide*> members;
+        int size = 1 + rng() % 6;
+        for (int j = 0; j < size; j++) {
+            members.push_back(peptides[rng() % num_peptides]);
+        }
+        addMetaProtein(members, {addProtein("prot" + to_string(i))});
+    }
+
+    Groups expected = referenceParsimony();
+    Groups actual = parsimony();
+    EXPECT_EQ(expected, actual);
+    EXPECT_LT(1u, actual.size());
+}
+
+// ============================================================
+// SpectralCounts: SIN ion prediction and peak matching
+// ============================================================
+
+TEST_F(SpectralCountsTest, ByIonMzsMatchIonSeries) {
+    for (int charge = 1; charge <= 3; charge++) {
+        vector<FLOAT_T> expected = ionSeriesMzs("PEPTIDEK", charge);
+        EXPECT_FALSE(expected.empty());
+        expectSameMzs(expected, predictByIonMzs("PEPTIDEK", charge));
+    }
+}
+
+TEST_F(SpectralCountsTest, ByIonMzsMatchIonSeriesModified) {
+    for (int charge = 2; charge <= 3; charge++) {
+        vector<FLOAT_T> expected = ionSeriesMzs("PEPM[15.9949]TIDEK", charge);
+        EXPECT_FALSE(expected.empty());
+        expectSameMzs(expected, predictByIonMzs("PEPM[15.9949]TIDEK", charge));
+    }
+    // the modification shifts the b ions that hold the M
+    EXPECT_NE(predictByIonMzs("PEPMTIDEK", 3), predictByIonMzs("PEPM[15.9949]TIDEK", 3));
+}
+
+TEST_F(SpectralCountsTest, NearestPeakIntensity) {
+    vector< pair<FLOAT_T, FLOAT_T> > peaks = {
+        {100.0, 10.0}, {100.1, 20.0}, {100.15, 5.0}, {200.0, 30.0}, {201.0, 40.0},
+    };
+    // no peaks, or none within tolerance
+    EXPECT_EQ(0, nearestPeakIntensity({}, 100.0, 0.5));
+    EXPECT_EQ(0, nearestPeakIntensity(peaks, 50.0, 0.5));
+    EXPECT_EQ(0, nearestPeakIntensity(peaks, 150.0, 0.5));
+    EXPECT_EQ(0, nearestPeakIntensity(peaks, 300.0, 0.5));
+    // the tolerance is inclusive on either side
+    EXPECT_EQ(30.0, nearestPeakIntensity(peaks, 199.5, 0.5));
+    EXPECT_EQ(0, nearestPeakIntensity(peaks, 199.49, 0.5));
+    EXPECT_EQ(40.0, nearestPeakIntensity(peaks, 201.5, 0.5));
+    EXPECT_EQ(0, nearestPeakIntensity(peaks, 201.51, 0.5));
+    // peaks within 0.2 m/z of each other are each found, not only the
+    // most intense of them
+    EXPECT_EQ(10.0, nearestPeakIntensity(peaks, 100.02, 0.05));
+    EXPECT_EQ(20.0, nearestPeakIntensity(peaks, 100.09, 0.05));
+    EXPECT_EQ(5.0, nearestPeakIntensity(peaks, 100.16, 0.05));
+    // an exact hit, and a tie between two peaks goes to the lower one
+    EXPECT_EQ(20.0, nearestPeakIntensity(peaks, 100.1, 0.5));
+    EXPECT_EQ(30.0, nearestPeakIntensity(peaks, 200.5, 0.5));
+}